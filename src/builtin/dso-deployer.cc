@@ -27,6 +27,7 @@
 #include "fault.hh"
 #include "vlog.hh"
 #include "json-util.hh"
+#include "nox.hh"
 
 using namespace vigil;
 using namespace std;
@@ -104,7 +105,7 @@ DSO_deployer::DSO_deployer(Kernel* kernel, const list<string>& lib_dirs_)
         for(li=componentList->begin(); li!=componentList->end(); ++li) {
             try {
                 Component_context* ctxt = 
-                    new DSO_component_context(kernel, directory, *li);
+                    new DSO_component_context(kernel, this, directory, *li);
                 if (uninstalled_contexts.find(ctxt->get_name()) ==
                     uninstalled_contexts.end()) {
                     uninstalled_contexts[ctxt->get_name()] = ctxt;
@@ -140,7 +141,9 @@ DSO_deployer::DSO_deployer(Kernel* kernel, const list<string>& lib_dirs_)
 }
 
 DSO_deployer::~DSO_deployer() {
-
+    BOOST_FOREACH(container::Component* replica, replicas) {
+        delete replica;
+    }
 }
 
 container::Component*
@@ -165,9 +168,10 @@ DSO_deployer::get_search_paths() const {
 }
 
 DSO_component_context::DSO_component_context(Kernel* kernel,
+                                             DSO_deployer* deployer_,
                                              const string& home_path,
                                              json_object* description)
-    : Component_context(kernel) {
+    : Component_context(kernel), shard_safe(false), deployer(deployer_) {
     using namespace boost;
     using namespace json;
 
@@ -201,6 +205,11 @@ DSO_component_context::DSO_component_context(Kernel* kernel,
     
     this->home_path = home_path;
     
+    attr = json::get_dict_value(description, "shard_safe");
+    if (attr != NULL && attr->type == json_object::JSONT_BOOLEAN) {
+        shard_safe = *(bool*) attr->object;
+    }
+
     attr = json::get_dict_value(description, "dependencies");
     if (attr!=NULL) {
         json_array* depList = (json_array*) attr->object;
@@ -316,6 +325,13 @@ void
 DSO_component_context::install() {
     try {
         component->install();
+        if (shard_safe) {
+            for (unsigned int i = 1; i < nox::get_shard_count(); ++i) {
+                nox::run_in_shard(i, boost::bind(
+                                      &DSO_component_context::install_replica,
+                                      this));
+            }
+        }
         current_state = INSTALLED;
     }
     catch (const std::exception& e) {
@@ -324,3 +340,13 @@ DSO_component_context::install() {
     }
 }
 
+
+/* Creates, configures and installs another instance of the component in the
+ * calling shard, so that its handlers and timers belong to that shard. */
+void
+DSO_component_context::install_replica() {
+    container::Component* replica = factory->instance(this, json_description);
+    deployer->replicas.push_back(replica);
+    replica->configure(configuration);
+    replica->install();
+}
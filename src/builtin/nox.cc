@@ -19,19 +19,28 @@
 #include "nox.hh"
 
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/shared_array.hpp>
+#include <deque>
 #include <errno.h>
+#include <fcntl.h>
 #include <map>
+#include <set>
 #include <signal.h>
 #include "kernel.hh" 
+#include "aggregate-stats-in.hh"
 #include "assert.hh"
 #include "buffer.hh"
+#include "buffer-pool.hh"
 #include "cfg.hh"
 #include "datapath-join.hh"
 #include "datapath-leave.hh"
+#include "desc-stats-in.hh"
 #include "echo-request.hh"
 #include "event-dispatcher.hh"
 #include "flow-mod-event.hh"
+#include "flow-removed.hh"
+#include "flow-stats-in.hh"
 #include "ofmp-config-update.hh"
 #include "ofmp-config-update-ack.hh"
 #include "ofmp-resources-update.hh"
@@ -39,12 +48,20 @@
 #include "openflow/nicira-ext.h"
 #include "openflow/openflow-mgmt.h"
 #include "openflow-event.hh"
+#include "openflow-msg-in.hh"
+#include "packet-in.hh"
+#include "packet-in-limiter.hh"
 #include "poll-loop.hh"
+#include "port-stats-in.hh"
+#include "port-status.hh"
+#include "queue-stats-in.hh"
 #include "shutdown-event.hh"
 #include "string.hh"
 #include "switch-mgr.hh"
 #include "switch-mgr-join.hh"
 #include "switch-mgr-leave.hh"
+#include "table-stats-in.hh"
+#include "threads/native.hh"
 #include "threads/signals.hh"
 #include "timeval.hh"
 #include "vlog.hh"
@@ -63,11 +80,79 @@ static Event_dispatcher event_dispatcher;
 static Timer_dispatcher timer_dispatcher;
 static Switch_Auth *switch_authenticator = NULL; 
 
+class Conn;
+
+/* A shard: a thread group with its own poll loop, event dispatcher and
+ * timers, serving the switch connections created in it.  Shard 0 is the main
+ * loop in co_group_coop. */
+struct Shard {
+    unsigned int index;
+    co_group* group;
+    Poll_loop* loop;
+    Event_dispatcher* dispatcher;
+    Timer_dispatcher* timers;
+
+    /* Connections owned by this shard.  Accessed only from the shard. */
+    std::set<Conn*> conns;
+
+    /* For each event type, whether the events of that type that this shard
+     * produces go to shard 0, as of 'forward_serial'.  Accessed only from the
+     * shard.  See handling_shard(). */
+    std::vector<bool> forward;
+    unsigned int forward_serial;
+
+    /* Callbacks posted from other shards, protected by 'inbox_mutex'.  A byte
+     * written to 'inbox_fds[1]' wakes up run_inbox() when 'inbox' becomes
+     * nonempty. */
+    Native_mutex inbox_mutex;
+    std::deque<Callback> inbox;
+    int inbox_fds[2];
+
+    Shard(unsigned int index, co_group*);
+    void post(const Callback&);
+    void run_inbox();
+};
+
+static unsigned int n_shards = 1;
+static std::vector<Shard*> shards;
+
+/* Number of handlers registered for each event type, by shard, protected by
+ * 'handlers_mutex'.  'handlers_serial' changes whenever any of them do, and
+ * is updated atomically. */
+static Native_mutex handlers_mutex;
+static std::vector<std::vector<unsigned int> > handler_counts;
+static unsigned int handlers_serial = 1;
+
+/* Whether packet-ins are queued in their own class, as set by
+ * set_packet_in_queue(), and how many may wait at once (0 for no limit). */
+static bool queue_packet_ins = true;
+static size_t packet_in_queue_limit;
+
+/* Whether the classifier's Packet_in handler, in shard 0, is counted.  It is
+ * only while the classifier has rules, since only then does it need to see
+ * the packet-ins of every shard. */
+static bool classifier_counted = true;
+
+/* Protects the connection, management and switch manager maps below, which
+ * all shards share, and the packet-in limits. */
+static Native_mutex conn_mutex;
+
+/* Packet-in limits for switches without their own, and for those with.
+ * 'packet_in_limits_serial' changes whenever any of them do, to tell
+ * connections to reload theirs.  Connections check it without the lock, so
+ * it is read and updated atomically. */
+static Packet_in_limits default_packet_in_limits;
+static std::map<datapathid, Packet_in_limits> packet_in_limits;
+static unsigned int packet_in_limits_serial = 1;
+
+static Shard* current_shard();
+
 class Conn
     : public Pollable {
 public:
     boost::shared_ptr<Openflow_connection> oconn;
     Co_sema* disconnected;
+    Shard* shard;
 
     Conn(boost::shared_ptr<Openflow_connection> oconn_,
          Co_sema* disconnected_);
@@ -77,11 +162,19 @@ public:
     void wait();
     
     void close();
+    Packet_in_limiter limiter;
 private:
     bool closing;
     int poll_cnt;
+    unsigned int limits_serial;
+
+    /* Maximum number of messages handled per call to poll(). */
+    static const int RECV_BATCH = 64;
 
     bool do_poll();
+    void handle_message(std::auto_ptr<Buffer>);
+    bool admit_packet_in(const Buffer&);
+    void send_drop_flow(const ofp_packet_in*, size_t len);
 };
 
 // DPID to connection mappings 
@@ -101,10 +194,14 @@ Conn::Conn(boost::shared_ptr<Openflow_connection> oconn_,
            Co_sema* disconnected_)
     : oconn(oconn_),
       disconnected(disconnected_),
+      shard(current_shard()),
+      limiter(Packet_in_limits()),
       closing(false),
-      poll_cnt(0)
+      poll_cnt(0),
+      limits_serial(0)
 {
-    main_loop->add_pollable(this);
+    shard->conns.insert(this);
+    shard->loop->add_pollable(this);
 }
 
 Conn::~Conn()
@@ -112,21 +209,29 @@ Conn::~Conn()
     close();
 }
 
+/* Returns the connection to switch 'dpid', or a null pointer if there is
+ * none.  If 'owner' is nonnull, stores the shard that owns the connection in
+ * '*owner': only that shard may send on it. */
 static boost::shared_ptr<Openflow_connection>
-dpid_to_oconn(datapathid dpid)
+dpid_to_oconn(datapathid dpid, Shard** owner = NULL)
 {
+    Scoped_native_mutex lock(&conn_mutex);
     chashmap::iterator iter = connection_map.find(dpid);
     if (iter == connection_map.end()) {
         lg.err("no datapath with id %s registered at nox",
                dpid.string().c_str());
         return boost::shared_ptr<Openflow_connection>();
     }
+    if (owner) {
+        *owner = iter->second->shard;
+    }
     return iter->second->oconn;
 }
 
 boost::shared_ptr<Switch_mgr>
 mgmtid_to_swm(datapathid mgmt_id)
 {
+    Scoped_native_mutex lock(&conn_mutex);
     swmhashmap::iterator iter = swm_map.find(mgmt_id);
     if (iter == swm_map.end()) {
         // this happens legitimately due to a race between
@@ -143,6 +248,7 @@ mgmtid_to_swm(datapathid mgmt_id)
 datapathid
 dpid_to_mgmtid(datapathid dpid)
 {
+    Scoped_native_mutex lock(&conn_mutex);
     mhashmap::iterator iter = mgmt_map.find(dpid);
     if (iter == mgmt_map.end()) {
         lg.err("no manager found for datapath id %s", dpid.string().c_str());
@@ -154,6 +260,7 @@ dpid_to_mgmtid(datapathid dpid)
 bool
 active_mgmt(const datapathid& mgmtid)
 {
+    Scoped_native_mutex lock(&conn_mutex);
     for (mhashmap::const_iterator it = mgmt_map.begin();
          it != mgmt_map.end(); ++it)
     {
@@ -233,57 +340,286 @@ Conn::close()
         datapathid mgmt_id = oconn->get_mgmt_id();
         if (dp_id == mgmt_id) {
             Switch_mgr_leave_event* swmle = new Switch_mgr_leave_event(mgmt_id);
-            swm_map.erase(mgmt_id);
+            {
+                Scoped_native_mutex lock(&conn_mutex);
+                swm_map.erase(mgmt_id);
+            }
             post_event(swmle);
         } else {
             Datapath_leave_event* dple = new Datapath_leave_event(dp_id);
             post_event(dple);
         }
-        connection_map.erase(dp_id);
-        mgmt_map.erase(dp_id);
-        main_loop->remove_pollable(this);
+        const Packet_in_stats& pis = limiter.get_stats();
+        if (pis.sampled || pis.dropped) {
+            lg.dbg("%s: %"PRIu64" packet-ins admitted, %"PRIu64" sampled, "
+                   "%"PRIu64" dropped, %"PRIu64" drop flows",
+                   dp_id.string().c_str(), pis.admitted, pis.sampled,
+                   pis.dropped, pis.drop_flows);
+        }
+        if (const Buffer_pool* pool = oconn->get_buffer_pool()) {
+            const Buffer_pool::Stats& s = pool->get_stats();
+            lg.dbg("%s: buffer pool hit rate %.1f%% (%"PRIu64" hits, "
+                   "%"PRIu64" misses, %"PRIu64" oversize, %"PRIu64" discarded)",
+                   dp_id.string().c_str(), pool->hit_rate() * 100.0,
+                   s.hits, s.misses, s.oversize, s.discarded);
+        }
+        {
+            /* A newer connection from the same switch may already have taken
+             * our place, possibly in another shard. */
+            Scoped_native_mutex lock(&conn_mutex);
+            chashmap::iterator i = connection_map.find(dp_id);
+            if (i != connection_map.end() && i->second == this) {
+                connection_map.erase(i);
+                mgmt_map.erase(dp_id);
+            }
+        }
+        shard->conns.erase(this);
+        shard->loop->remove_pollable(this);
         if (!poll_cnt) {
             delete this;
         }
     }
 }
 
+/* Adds 'delta' to the number of handlers for 'type' in shard 'index'. */
+static void
+count_handler(unsigned int index, Event_type_id type, int delta)
+{
+    Scoped_native_mutex lock(&handlers_mutex);
+    std::vector<unsigned int>& counts = handler_counts[index];
+    if (type >= counts.size()) {
+        counts.resize(type + 1);
+    }
+    counts[type] += delta;
+    __sync_fetch_and_add(&handlers_serial, 1);
+}
+
+/* Counts the classifier's Packet_in handler if, and only if, the classifier
+ * has rules, so that workers keep their packet-ins unless a rule wants
+ * them.  Called in shard 0 after every change to the rules. */
+static void
+count_classifier()
+{
+    bool counted = classifier.n_rules() != 0;
+    if (counted != classifier_counted) {
+        classifier_counted = counted;
+        Event_type_id type
+            = Event::get_type_id(Packet_in_event::static_get_name());
+        count_handler(0, type, counted ? 1 : -1);
+    }
+}
+
+/* Returns the shard that should handle the events of the given 'type' that
+ * 'shard' produces.
+ *
+ * Every handler in a shard other than 0 belongs to a replica of a shard-safe
+ * component whose original is in shard 0.  If shard 0 has more handlers for
+ * 'type' than 'shard', then some component that is not shard-safe also wants
+ * these events.  Shard 0 then gets them, where all of the handlers see them,
+ * instead of 'shard', where only some would. */
+static Shard*
+handling_shard(Shard* shard, Event_type_id type)
+{
+    if (!shard->index) {
+        return shard;
+    }
+
+    if (shard->forward_serial != __sync_fetch_and_add(&handlers_serial, 0)) {
+        Scoped_native_mutex lock(&handlers_mutex);
+        const std::vector<unsigned int>& main = handler_counts[0];
+        const std::vector<unsigned int>& own = handler_counts[shard->index];
+        shard->forward.assign(main.size(), false);
+        for (size_t i = 0; i < main.size(); ++i) {
+            shard->forward[i] = main[i] > (i < own.size() ? own[i] : 0);
+        }
+        shard->forward_serial = handlers_serial;
+    }
+    return (type < shard->forward.size() && shard->forward[type]
+            ? shards[0] : shard);
+}
+
+/* Dispatches 'event' in 'shard', or posts it to shard 0 if handling_shard()
+ * says so.  Statistics replies and, unless set_packet_in_queue() says
+ * otherwise, packet-ins are queued instead of dispatched, so that they wait
+ * behind echo replies and topology changes instead of delaying them.  They
+ * are thus handled after port-status messages that follow them, and
+ * packet-ins and flow-removed messages may swap places too. */
+static void
+dispatch_event(Shard* shard, std::auto_ptr<Event> event)
+{
+    Event_type_id type = event->get_type_id();
+    Shard* handler = handling_shard(shard, type);
+    if (handler != shard) {
+        handler->dispatcher->post(event.release());
+        return;
+    }
+
+    switch (shard->dispatcher->get_event_class(type)) {
+    case Event_dispatcher::PACKET_IN:
+        if (!queue_packet_ins) {
+            shard->dispatcher->dispatch(*event);
+            break;
+        }
+        /* Fall through. */
+    case Event_dispatcher::STATS:
+        shard->dispatcher->post(event.release());
+        break;
+    default:
+        shard->dispatcher->dispatch(*event);
+        break;
+    }
+}
+
+/* Returns the packet-in limits for switch 'dpid'.  Must be called with
+ * 'conn_mutex' held. */
+static const Packet_in_limits&
+lookup_packet_in_limits(const datapathid& dpid)
+{
+    std::map<datapathid, Packet_in_limits>::const_iterator i
+        = packet_in_limits.find(dpid);
+    return i != packet_in_limits.end() ? i->second : default_packet_in_limits;
+}
+
+/* Returns true if packet-in 'b' is within the switch's limits, or is sampled,
+ * false if it should be dropped. */
 bool
-Conn::do_poll()
+Conn::admit_packet_in(const Buffer& b)
 {
-    int error;
-    std::auto_ptr<Buffer> b(oconn->recv_openflow(error, false));
-    switch (error) {
-    case 0: {
-        std::auto_ptr<Buffer> msgB(new Array_buffer(b.get()->size()));
-        memcpy(msgB.get()->data(), b.get()->data(), b.get()->size());
+    if (limits_serial != __sync_fetch_and_add(&packet_in_limits_serial, 0)) {
+        Scoped_native_mutex lock(&conn_mutex);
+        limits_serial = packet_in_limits_serial;
+        limiter.set_limits(lookup_packet_in_limits(oconn->get_datapath_id()));
+    }
+
+    const size_t min_size = offsetof(ofp_packet_in, data);
+    if (b.size() < min_size) {
+        /* Let the parser complain about it. */
+        return true;
+    }
+
+    const ofp_packet_in* opi = reinterpret_cast<const ofp_packet_in*>(b.data());
+    switch (limiter.admit(ntohs(opi->in_port), time_msec())) {
+    case Packet_in_limiter::ADMIT:
+    case Packet_in_limiter::SAMPLE:
+        return true;
+    case Packet_in_limiter::DROP_AND_BLOCK:
+        send_drop_flow(opi, b.size());
+        return false;
+    case Packet_in_limiter::DROP:
+    default:
+        return false;
+    }
+}
+
+/* Asks the switch to drop, for a while, the packets from the source of
+ * packet-in 'opi', which is 'len' bytes long, on the port it came in on. */
+void
+Conn::send_drop_flow(const ofp_packet_in* opi, size_t len)
+{
+    const size_t eth_src_end = offsetof(ofp_packet_in, data) + 12;
+    if (len < eth_src_end) {
+        return;
+    }
+
+    ofp_flow_mod ofm;
+    memset(&ofm, 0, sizeof ofm);
+    ofm.header.version = OFP_VERSION;
+    ofm.header.type = OFPT_FLOW_MOD;
+    ofm.header.length = htons(sizeof ofm);
+    ofm.header.xid = htonl(allocate_openflow_xid());
+    ofm.match.wildcards = htonl(OFPFW_ALL & ~(OFPFW_IN_PORT | OFPFW_DL_SRC));
+    ofm.match.in_port = opi->in_port;
+    memcpy(ofm.match.dl_src, opi->data + 6, sizeof ofm.match.dl_src);
+    ofm.command = htons(OFPFC_ADD);
+    ofm.hard_timeout = htons(limiter.get_limits().drop_flow_secs);
+    ofm.priority = htons(UINT16_MAX);
+    ofm.buffer_id = htonl(UINT32_MAX);
+    ofm.out_port = htons(OFPP_NONE);
+    if (oconn->send_openflow(&ofm.header, false)) {
+        lg.dbg("%s: could not install packet-in drop flow",
+               oconn->to_string().c_str());
+    }
+}
+
+/* Dispatches the events for received OpenFlow message 'b'. */
+void
+Conn::handle_message(std::auto_ptr<Buffer> b)
+{
+    const ofp_header* oh = reinterpret_cast<const ofp_header*>(b->data());
+    if (oh->type == OFPT_PACKET_IN && !admit_packet_in(*b)) {
+        return;
+    }
 
+    /* Only build the raw Openflow_msg_event if someone listens for it.  When
+     * someone does, the typed event and the raw event share the received
+     * bytes instead of each owning a copy.  The raw event is dispatched at
+     * once, so it is handled before a typed event that dispatch_event()
+     * queues. */
+    static const Event_type_id openflow_msg_type
+        = Event::get_type_id(Openflow_msg_event::static_get_name());
+    Shard* msg_shard = handling_shard(shard, openflow_msg_type);
+    if (msg_shard == shard
+        && !shard->dispatcher->has_handlers(openflow_msg_type)) {
         std::auto_ptr<Event> event(openflow_packet_to_event(oconn, b));
         if (event.get()) {
-            event_dispatcher.dispatch(*event);
+            dispatch_event(shard, event);
         }
+        return;
+    }
 
-        event.reset(openflow_msg_to_event(oconn, msgB));
-	if (event.get())
-	    event_dispatcher.dispatch(*event);
+    boost::shared_ptr<Buffer> msg(b.release());
+    std::auto_ptr<Event> event(
+        openflow_packet_to_event(oconn, std::auto_ptr<Buffer>(
+                                     new Shared_buffer(msg))));
+    if (event.get()) {
+        dispatch_event(shard, event);
+    }
 
-        return true;
+    event.reset(openflow_msg_to_event(oconn, msg));
+    if (event.get()) {
+        if (msg_shard == shard) {
+            shard->dispatcher->dispatch(*event);
+        } else {
+            msg_shard->dispatcher->post(event.release());
+        }
     }
+}
 
-    case EAGAIN:
-        return false;
+bool
+Conn::do_poll()
+{
+    /* Stream connections read everything the socket has available at once,
+     * so the messages after the first are normally already buffered and cost
+     * no system call to receive.  Handle up to a batch of them before giving
+     * other Pollables a turn. */
+    for (int i = 0; i < RECV_BATCH; ++i) {
+        int error;
+        std::auto_ptr<Buffer> b(oconn->recv_openflow(error, false));
+        switch (error) {
+        case 0:
+            handle_message(b);
+            if (closing) {
+                return true;
+            }
+            break;
 
-    case EOF:
-        lg.warn("%s: connection closed by peer", oconn->to_string().c_str());
-        close();
-        return true;
- 
-    default:
-        lg.warn("%s: disconnected (%s)",
-                oconn->to_string().c_str(), strerror(error));
-        close();
-        return true;
-   }
+        case EAGAIN:
+            return i > 0;
+
+        case EOF:
+            lg.warn("%s: connection closed by peer",
+                    oconn->to_string().c_str());
+            close();
+            return true;
+
+        default:
+            lg.warn("%s: disconnected (%s)",
+                    oconn->to_string().c_str(), strerror(error));
+            close();
+            return true;
+        }
+    }
+    return true;
 }
 
 void
@@ -346,34 +682,229 @@ handle_echo_request(const Event& e)
     return CONTINUE;
 }
 
+Shard::Shard(unsigned int index_, co_group* group_)
+    : index(index_), group(group_), forward_serial(0)
+{
+    if (pipe(inbox_fds) < 0) {
+        throw std::runtime_error("Unable to create a pipe for a shard.");
+    }
+    for (int i = 0; i < 2; ++i) {
+        int flags = fcntl(inbox_fds[i], F_GETFL, 0);
+        if (fcntl(inbox_fds[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+            throw std::runtime_error("Unable to set a pipe non-blocking.");
+        }
+    }
+}
+
 void
-init()
+Shard::post(const Callback& callback)
 {
-    classifier.register_packet_in();
+    Scoped_native_mutex lock(&inbox_mutex);
+    bool wake = inbox.empty();
+    inbox.push_back(callback);
+    if (wake) {
+        /* If the pipe is full, run_inbox() has bytes to read already. */
+        static const char c = '\0';
+        ssize_t retval;
+        do {
+            retval = write(inbox_fds[1], &c, 1);
+        } while (retval < 0 && errno == EINTR);
+        if (retval < 0 && errno != EAGAIN) {
+            lg.err("could not wake up shard %u: %s", index, strerror(errno));
+        }
+    }
+}
+
+/* Runs the callbacks posted to the shard from elsewhere, forever. */
+void
+Shard::run_inbox()
+{
+    for (;;) {
+        co_fd_read_wait(inbox_fds[0], NULL);
+        co_block();
+
+        char buf[64];
+        while (read(inbox_fds[0], buf, sizeof buf) > 0) {
+            continue;
+        }
+
+        std::deque<Callback> callbacks;
+        {
+            Scoped_native_mutex lock(&inbox_mutex);
+            callbacks.swap(inbox);
+        }
+        BOOST_FOREACH (Callback& callback, callbacks) {
+            callback();
+        }
+    }
+}
+
+/* Returns the shard that the calling thread runs in. */
+static Shard*
+current_shard()
+{
+    if (shards.size() > 1) {
+        co_group* group = co_group_self();
+        for (size_t i = 1; i < shards.size(); ++i) {
+            if (shards[i]->group == group) {
+                return shards[i];
+            }
+        }
+    }
+    return shards[0];
+}
+
+/* Returns the shard that should own the next switch connection. */
+static Shard*
+next_shard()
+{
+    static unsigned int next;
+    return shards[__sync_fetch_and_add(&next, 1) % shards.size()];
+}
+
+/* Assigns the events that switches generate to their classes in
+ * 'dispatcher'.  Everything else stays in Event_dispatcher::CONTROL. */
+static void
+set_event_classes(Event_dispatcher* dispatcher)
+{
+    static const Event_name topology[] = {
+        Datapath_join_event::static_get_name(),
+        Datapath_leave_event::static_get_name(),
+        Port_status_event::static_get_name(),
+    };
+    static const Event_name stats[] = {
+        Aggregate_stats_in_event::static_get_name(),
+        Desc_stats_in_event::static_get_name(),
+        Flow_removed_event::static_get_name(),
+        Flow_stats_in_event::static_get_name(),
+        Port_stats_in_event::static_get_name(),
+        Queue_stats_in_event::static_get_name(),
+        Table_stats_in_event::static_get_name(),
+    };
+    BOOST_FOREACH (const Event_name& name, topology) {
+        dispatcher->set_event_class(name, Event_dispatcher::TOPOLOGY);
+    }
+    BOOST_FOREACH (const Event_name& name, stats) {
+        dispatcher->set_event_class(name, Event_dispatcher::STATS);
+    }
+    dispatcher->set_event_class(Packet_in_event::static_get_name(),
+                                Event_dispatcher::PACKET_IN);
+    dispatcher->set_class_max_queued(Event_dispatcher::PACKET_IN,
+                                     packet_in_queue_limit);
+}
+
+/* Sets up the state of 'shard', from within its thread group. */
+static void
+init_shard(Shard* shard)
+{
+    if (shard->index) {
+        shard->loop = new Poll_loop(N_THREADS);
+        shard->dispatcher = new Event_dispatcher;
+        shard->timers = new Timer_dispatcher;
+        shard->loop->add_pollable(shard->dispatcher);
+        shard->loop->add_pollable(shard->timers);
+        co_thread_create(shard->group,
+                         boost::bind(&Poll_loop::run, shard->loop));
+    }
+    set_event_classes(shard->dispatcher);
+    co_thread_create(shard->group, boost::bind(&Shard::run_inbox, shard));
+
     register_handler(Echo_request_event::static_get_name(),
                      handle_echo_request, 100);
+}
+
+void
+set_shard_count(unsigned int n)
+{
+    assert(shards.empty());
+    n_shards = std::max(n, 1U);
+}
+
+unsigned int
+get_shard_count()
+{
+    return n_shards;
+}
+
+unsigned int
+get_current_shard()
+{
+    return current_shard()->index;
+}
+
+void
+post_to_shard(unsigned int shard, const Callback& callback)
+{
+    shards.at(shard)->post(callback);
+}
+
+void
+post_event(unsigned int shard, Event* event)
+{
+    shards.at(shard)->dispatcher->post(event);
+}
+
+void
+run_in_shard(unsigned int shard, const Callback& callback)
+{
+    co_group* old_group = co_migrate(shards.at(shard)->group);
+    try {
+        callback();
+    } catch (...) {
+        co_migrate(old_group);
+        throw;
+    }
+    co_migrate(old_group);
+}
+
+void
+init()
+{
+    main_loop = new Poll_loop(N_THREADS);
+    main_loop->add_pollable(&event_dispatcher);
+    main_loop->add_pollable(&timer_dispatcher);
+
+    Shard* main_shard = new Shard(0, &co_group_coop);
+    main_shard->loop = main_loop;
+    main_shard->dispatcher = &event_dispatcher;
+    main_shard->timers = &timer_dispatcher;
+    shards.push_back(main_shard);
+    for (unsigned int i = 1; i < n_shards; ++i) {
+        co_group* group;
+        co_group_create(&group);
+        shards.push_back(new Shard(i, group));
+    }
+    handler_counts.resize(n_shards);
+    for (unsigned int i = 0; i < n_shards; ++i) {
+        run_in_shard(i, boost::bind(init_shard, shards[i]));
+    }
+    if (n_shards > 1) {
+        lg.info("spreading switch connections over %u shards", n_shards);
+    }
+
+    classifier.register_packet_in();
+    count_classifier();
     register_handler(Ofmp_config_update_event::static_get_name(),
                      handle_ofmp_config, 100);
     register_handler(Ofmp_config_update_ack_event::static_get_name(),
                      handle_ofmp_config_ack, 100);
     register_handler(Ofmp_resources_update_event::static_get_name(),
                      handle_ofmp_resources_update, 100);
-    main_loop = new Poll_loop(N_THREADS);
-    main_loop->add_pollable(&event_dispatcher);
-    main_loop->add_pollable(&timer_dispatcher);
     new Signal_handler;
 }
 
 Poll_loop*
 get_poll_loop() {
-    return main_loop;
+    return current_shard()->loop;
 }
 
 void
 register_handler(const Event_name& name,
                  boost::function<Disposition(const Event&)> handler, int order)
 {
-    event_dispatcher.add_handler(name, handler, order);
+    Shard* shard = current_shard();
+    shard->dispatcher->add_handler(name, handler, order);
+    count_handler(shard->index, Event::get_type_id(name), 1);
 }
 
 /* Returns a nonzero OpenFlow transaction ID that has not been used for some
@@ -384,34 +915,130 @@ uint32_t
 allocate_openflow_xid()
 {
     static uint32_t xid;
-    if (!xid) {
-        xid = 1;
+    uint32_t x;
+    do {
+        x = __sync_fetch_and_add(&xid, 1);
+    } while (!x);
+    return x;
+}
+
+/* Forwarding of requests for switches owned by other shards.  The request is
+ * re-issued in the owning shard, with copies of any data that the caller
+ * retains ownership of.  The caller has long since been told that the
+ * request succeeded, so a failure can only be logged. */
+
+static void
+log_forwarded_error(const datapathid& dpid, const char* what, int error)
+{
+    if (error) {
+        lg.warn("%s: forwarded %s failed: %s", dpid.string().c_str(), what,
+                strerror(error));
     }
-    return xid++;
+}
+
+static boost::shared_array<uint8_t>
+copy_bytes(const void* data, size_t size)
+{
+    boost::shared_array<uint8_t> copy(new uint8_t[size]);
+    memcpy(copy.get(), data, size);
+    return copy;
+}
+
+static boost::shared_ptr<Buffer>
+copy_buffer(const Buffer& buffer)
+{
+    boost::shared_ptr<Buffer> copy(new Array_buffer(buffer.size()));
+    memcpy(copy->data(), buffer.data(), buffer.size());
+    return copy;
+}
+
+static void
+forward_openflow_command(datapathid dpid, boost::shared_array<uint8_t> oh)
+{
+    int error = send_openflow_command(
+        dpid, reinterpret_cast<ofp_header*>(oh.get()), true);
+    log_forwarded_error(dpid, "command", error);
+}
+
+static void
+forward_packet_out(datapathid dpid, boost::shared_ptr<Buffer> packet,
+                   uint16_t out_port, uint16_t in_port)
+{
+    int error = send_openflow_packet_out(dpid, *packet, out_port, in_port,
+                                         true);
+    log_forwarded_error(dpid, "packet-out", error);
+}
+
+static void
+forward_packet_out_actions(datapathid dpid, boost::shared_ptr<Buffer> packet,
+                           boost::shared_array<uint8_t> actions,
+                           uint16_t actions_len, uint16_t in_port)
+{
+    int error = send_openflow_packet_out(
+        dpid, *packet, reinterpret_cast<ofp_action_header*>(actions.get()),
+        actions_len, in_port, true);
+    log_forwarded_error(dpid, "packet-out", error);
+}
+
+static void
+forward_buffered_packet_out_actions(datapathid dpid, uint32_t buffer_id,
+                                    boost::shared_array<uint8_t> actions,
+                                    uint16_t actions_len, uint16_t in_port)
+{
+    int error = send_openflow_packet_out(
+        dpid, buffer_id, reinterpret_cast<ofp_action_header*>(actions.get()),
+        actions_len, in_port, true);
+    log_forwarded_error(dpid, "packet-out", error);
 }
 
 /* Attempts to send OpenFlow command 'oh' to switch 'datapath_id'.
  *
  * Returns 0 if successful or a positive errno value.  Returns ESRCH if switch
  * 'datapath_id' is unknown.  If 'block' is true, blocks as necessary;
- * otherwise, returns EAGAIN if blocking is needed.  */
+ * otherwise, returns EAGAIN if blocking is needed.
+ *
+ * If another shard owns the switch, 'oh' is copied and sent from that shard,
+ * which blocks as necessary, and 0 is returned once the copy is queued.  The
+ * result of the send, including EAGAIN, then does not reach the caller: it
+ * is only logged if it is an error.  The other send functions do the
+ * same.  */
 int send_openflow_command(const datapathid& datapath_id, const ofp_header* oh,
                           bool block)
 {
     co_might_yield_if(block);
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        owner->post(boost::bind(forward_openflow_command, datapath_id,
+                                copy_bytes(oh, ntohs(oh->length))));
+        return 0;
     }
 
     int error = oconn->send_openflow(oh, block);
     if (!error && oh->type == OFPT_FLOW_MOD) {
-        /* Notify flowtracker than we're modifying the switch's flow table. */
-        /* NOTE: only okay to pass in NULL because synchronously dispatching */
-        Flow_mod_event fme(datapath_id,
-                           reinterpret_cast<const ofp_flow_mod*>(oh),
-                           std::auto_ptr<Buffer>(NULL));
-        event_dispatcher.dispatch(fme);
+        /* Notify flowtracker than we're modifying the switch's flow table,
+         * in shard 0 if handlers that are not shard-safe want to know. */
+        Event_type_id type
+            = Event::get_type_id(Flow_mod_event::static_get_name());
+        Shard* handler = handling_shard(owner, type);
+        if (handler == owner) {
+            /* Only okay to pass in NULL because synchronously dispatching. */
+            Flow_mod_event fme(datapath_id,
+                               reinterpret_cast<const ofp_flow_mod*>(oh),
+                               std::auto_ptr<Buffer>(NULL));
+            owner->dispatcher->dispatch(fme);
+        } else {
+            size_t size = ntohs(oh->length);
+            std::auto_ptr<Buffer> copy(new Array_buffer(size));
+            memcpy(copy->data(), oh, size);
+            const ofp_flow_mod* ofm
+                = reinterpret_cast<const ofp_flow_mod*>(copy->data());
+            handler->dispatcher->post(new Flow_mod_event(datapath_id, ofm,
+                                                         copy));
+        }
     }
     return error;
 }
@@ -427,26 +1054,100 @@ int send_openflow_packet_out(const datapathid& datapath_id,
                              uint16_t in_port, bool block)
 {
     co_might_yield_if(block);
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        owner->post(boost::bind(forward_packet_out, datapath_id,
+                                copy_buffer(packet), out_port, in_port));
+        return 0;
     }
 
     return oconn->send_packet(packet, out_port, in_port, block);
 }
 
+/* From a shard other than the switch's own, the result is only a snapshot. */
+size_t get_openflow_send_backlog(const datapathid& datapath_id)
+{
+    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    return oconn ? oconn->get_tx_backlog() : 0;
+}
+
+void
+set_packet_in_queue(bool queued, size_t max_queued)
+{
+    queue_packet_ins = queued;
+    packet_in_queue_limit = max_queued;
+}
+
+void
+set_packet_in_limits(const Packet_in_limits& limits)
+{
+    Scoped_native_mutex lock(&conn_mutex);
+    default_packet_in_limits = limits;
+    __sync_fetch_and_add(&packet_in_limits_serial, 1);
+}
+
+void
+set_packet_in_limits(const datapathid& dpid, const Packet_in_limits& limits)
+{
+    Scoped_native_mutex lock(&conn_mutex);
+    packet_in_limits[dpid] = limits;
+    __sync_fetch_and_add(&packet_in_limits_serial, 1);
+}
+
+bool
+get_packet_in_stats(const datapathid& dpid, Packet_in_stats* stats)
+{
+    Scoped_native_mutex lock(&conn_mutex);
+    chashmap::iterator i = connection_map.find(dpid);
+    if (i == connection_map.end()) {
+        return false;
+    }
+    /* The owning shard may be counting at the same time, but the counters
+     * are updated atomically. */
+    *stats = i->second->limiter.get_stats();
+    return true;
+}
+
 int close_openflow_connection(const datapathid& dpid)
 {
-    chashmap::iterator iter = connection_map.find(dpid);
-    if (iter == connection_map.end()) {
-        lg.err("request to close connection to unknown dpid '%s'\n",
-               dpid.string().c_str());
-        return ESRCH;
+    Conn* conn;
+    {
+        /* Another shard may delete its connection as soon as the lock is
+         * released, so only a connection of our own shard may be used after
+         * that. */
+        Scoped_native_mutex lock(&conn_mutex);
+        chashmap::iterator iter = connection_map.find(dpid);
+        if (iter == connection_map.end()) {
+            lg.err("request to close connection to unknown dpid '%s'\n",
+                   dpid.string().c_str());
+            return ESRCH;
+        }
+        conn = iter->second;
+        if (conn->shard != current_shard()) {
+            conn->shard->post(boost::bind(close_openflow_connection, dpid));
+            return 0;
+        }
     }
-    iter->second->close();
+    conn->close();
     return 0; // success
 }
 
+static void
+forward_add_snat(datapathid dpid, uint16_t port,
+                 std::pair<uint32_t, uint32_t> ip_range,
+                 std::pair<uint16_t, uint16_t> tcp_range,
+                 std::pair<uint16_t, uint16_t> udp_range,
+                 ethernetaddr mac_addr, uint16_t mac_timeout)
+{
+    send_add_snat(dpid, port, ip_range.first, ip_range.second,
+                  tcp_range.first, tcp_range.second,
+                  udp_range.first, udp_range.second, mac_addr, mac_timeout);
+}
+
 /* Attempts to send set nat parameters for switch port 'datapath_id':'port num'
  *
  * Returns 0 if successful or a positive errno value.  Returns ESRCH if switch
@@ -457,18 +1158,34 @@ int send_add_snat(const datapathid &datapath_id, uint16_t port,
                     uint16_t udp_start, uint16_t udp_end,
                     ethernetaddr mac_addr, 
                     uint16_t mac_timeout) {
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        /* Too many arguments for boost::bind. */
+        owner->post(boost::bind(
+                        forward_add_snat, datapath_id, port,
+                        std::make_pair(ip_addr_start, ip_addr_end),
+                        std::make_pair(tcp_start, tcp_end),
+                        std::make_pair(udp_start, udp_end),
+                        mac_addr, mac_timeout));
+        return 0;
     }
     return oconn->send_add_snat(port,ip_addr_start,ip_addr_end, 
                   tcp_start,tcp_end,udp_start,udp_end, mac_addr, mac_timeout); 
 }
 
 int send_del_snat(const datapathid &datapath_id, uint16_t port){
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        owner->post(boost::bind(send_del_snat, datapath_id, port));
+        return 0;
     }
     return oconn->send_del_snat(port);
 }
@@ -613,9 +1330,8 @@ fetch_switch_logs(datapathid dpid, const std::string& output_file,
     std::vector<std::string> args;
     args.push_back(ip.string());
     args.push_back(string_format("%"PRIu16, port));
-    error = oconn->send_remote_command("get-logs", args);
+    error = send_switch_command(dpid, "get-logs", args);
     if (error) {
-        lg.warn("could not send remote command: %s", strerror(error));
         return error;
     }
     /* XXX we should register a callback to be fired when we receive a reply
@@ -630,9 +1346,13 @@ fetch_switch_logs(datapathid dpid, const std::string& output_file,
 int
 send_switch_command(datapathid dpid, const std::string& command, const std::vector<std::string> args)
 {
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(dpid);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(dpid, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        owner->post(boost::bind(send_switch_command, dpid, command, args));
+        return 0;
     }
 
     int error = oconn->send_remote_command(command, args);
@@ -675,9 +1395,17 @@ int send_openflow_packet_out(const datapathid& datapath_id,
                              uint16_t in_port, bool block)
 {
     co_might_yield_if(block);
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        owner->post(boost::bind(forward_packet_out_actions, datapath_id,
+                                copy_buffer(packet),
+                                copy_bytes(actions, actions_len),
+                                actions_len, in_port));
+        return 0;
     }
 
     return oconn->send_packet(packet, actions, actions_len, in_port, block);
@@ -696,9 +1424,17 @@ send_openflow_packet_out(const datapathid& datapath_id,
                          uint16_t in_port, bool block)
 {
     co_might_yield_if(block);
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        int (*send)(const datapathid&, uint32_t, uint16_t, uint16_t, bool)
+            = send_openflow_packet_out;
+        owner->post(boost::bind(send, datapath_id, buffer_id, out_port,
+                                in_port, true));
+        return 0;
     }
 
     return oconn->send_packet(buffer_id, out_port, in_port, block);
@@ -717,9 +1453,17 @@ send_openflow_packet_out(const datapathid& datapath_id,
                          uint16_t in_port, bool block)
 {
     co_might_yield_if(block);
-    boost::shared_ptr<Openflow_connection> oconn = dpid_to_oconn(datapath_id);
+    Shard* owner;
+    boost::shared_ptr<Openflow_connection> oconn
+        = dpid_to_oconn(datapath_id, &owner);
     if (!oconn) {
         return ESRCH;
+    } else if (owner != current_shard()) {
+        owner->post(boost::bind(forward_buffered_packet_out_actions,
+                                datapath_id, buffer_id,
+                                copy_bytes(actions, actions_len),
+                                actions_len, in_port));
+        return 0;
     }
 
     return oconn->send_packet(buffer_id, actions, actions_len, in_port, block);
@@ -728,24 +1472,25 @@ send_openflow_packet_out(const datapathid& datapath_id,
 void
 post_event(Event* event)
 {
-    event_dispatcher.post(event);
+    Shard* shard = current_shard();
+    handling_shard(shard, event->get_type_id())->dispatcher->post(event);
 }
 
 Timer
 post_timer(const Callback& callback, const timeval& duration)
 {
-    return timer_dispatcher.post(callback, duration);
+    return current_shard()->timers->post(callback, duration);
 }
 
 Timer
 post_timer(const Callback& callback)
 {
-    return timer_dispatcher.post(callback);
+    return current_shard()->timers->post(callback);
 }
 
 void
 timer_debug() {
-    timer_dispatcher.debug();
+    current_shard()->timers->debug();
 }
 
 //-----------------------------------------------------------------------------
@@ -754,13 +1499,46 @@ uint32_t
 register_handler_on_match(uint32_t priority, const Packet_expr &expr,
                           Pexpr_action callback)
 {
-    return classifier.add_rule(priority, expr, callback);
+    uint32_t rule_id = classifier.add_rule(priority, expr, callback);
+    count_classifier();
+    return rule_id;
 }
 
 bool 
 unregister_handler(uint32_t rule_id)
 {
-    return classifier.delete_rule(rule_id);
+    bool deleted = classifier.delete_rule(rule_id);
+    count_classifier();
+    return deleted;
+}
+
+void
+register_handlers_on_match(
+    const std::vector<Packet_classifier::Rule_spec>& rules,
+    std::vector<uint32_t>& rule_ids)
+{
+    classifier.add_rules(rules, rule_ids);
+    count_classifier();
+}
+
+uint32_t
+unregister_handlers(const std::vector<uint32_t>& rule_ids)
+{
+    uint32_t n_deleted = classifier.delete_rules(rule_ids);
+    count_classifier();
+    return n_deleted;
+}
+
+void
+set_flow_cache_size(size_t n)
+{
+    classifier.set_flow_cache_size(n);
+}
+
+Flow_cache_stats
+get_flow_cache_stats()
+{
+    return classifier.get_flow_cache_stats();
 }
 
 void register_switch_auth(Switch_Auth* auth) { 
@@ -1208,15 +1986,18 @@ void Handshake_fsm::register_mgmt() {
     swm->set_config(swm_config);
     assert(resources_event); 
     swm->resources_update_handler(*resources_event);
-    swm_map.insert(swmhashmap::value_type(mgmt_id, 
-                boost::shared_ptr<Switch_mgr>(swm)));
+    {
+        Scoped_native_mutex lock(&conn_mutex);
+        swm_map.insert(swmhashmap::value_type(mgmt_id, 
+                    boost::shared_ptr<Switch_mgr>(swm)));
+    }
 
     lg.dbg("Registering mgmt channel with id = %"PRIx64"\n",mgmt_id.as_host()); 
     /* Really we want to just dispatch this event immediately, but that would
      * prevent any handlers for it from blocking, since we're running inside
      * an FSM. */
     // NOTE: event steals auto_ptr to feature
-    event_dispatcher.post(new Switch_mgr_join_event(mgmt_id));
+    post_event(new Switch_mgr_join_event(mgmt_id));
     disconnected = NULL;
 
     do_exit(0);
@@ -1239,7 +2020,10 @@ void Handshake_fsm::register_switch() {
     oconn->set_datapath_id(dpid);
     oconn->set_mgmt_id(mgmt_id);
     register_conn(oconn.release(), disconnected);
-    mgmt_map.insert(mhashmap::value_type(dpid, mgmt_id));
+    {
+        Scoped_native_mutex lock(&conn_mutex);
+        mgmt_map.insert(mhashmap::value_type(dpid, mgmt_id));
+    }
 
     /* delete all flows on this switch */
     {
@@ -1271,7 +2055,7 @@ void Handshake_fsm::register_switch() {
      * prevent any handlers for it from blocking, since we're running inside
      * an FSM. */
     // NOTE: event steals auto_ptr to features
-    event_dispatcher.post(new Datapath_join_event(features_reply, features_reply_buf));
+    post_event(new Datapath_join_event(features_reply, features_reply_buf));
     disconnected = NULL;
 
     do_exit(0);
@@ -1388,10 +2172,23 @@ void unreliable_connector_thread(Connector_aux* aux)
 void passive_connector_thread(Connector_aux* aux)
 {
     for (;;) {
+        /* Accept each connection in the shard that will own it, so that the
+         * connection and its FSMs belong to that shard's thread group.  The
+         * datapath id is not known until after the handshake, so connections
+         * are simply dealt out in turn. */
+        co_migrate(next_shard()->group);
         do_connect(aux, 5, NULL, NULL);
     }
 }
 
+static void
+start_reliable_connection(Openflow_connection_factory* factory)
+{
+    std::auto_ptr<Openflow_connection_factory> f(factory);
+    std::auto_ptr<Openflow_connection> c(new Reliable_openflow_connection(f));
+    new Handshake_fsm(c, NULL, NULL, 4);
+}
+
 void
 connect(Openflow_connection_factory* factory, bool reliable)
 {
@@ -1399,18 +2196,41 @@ connect(Openflow_connection_factory* factory, bool reliable)
     aux->factory = factory;
 
     if (reliable && !factory->passive()) {
-        std::auto_ptr<Openflow_connection_factory> f(factory);
-        std::auto_ptr<Openflow_connection> c(
-            new Reliable_openflow_connection(f));
-        new Handshake_fsm(c, NULL, NULL, 4);
+        run_in_shard(next_shard()->index,
+                     boost::bind(start_reliable_connection, factory));
     } else {
         void (*thread_func)(Connector_aux*);
+        co_group* group;
         if (factory->passive()) {
             thread_func = passive_connector_thread; 
+            group = &co_group_coop;
         } else {
             thread_func = unreliable_connector_thread;
+            group = next_shard()->group;
         }
-        co_thread_create(&co_group_coop, boost::bind(thread_func, aux)); 
+        co_thread_create(group, boost::bind(thread_func, aux)); 
+    }
+}
+
+/* Closes the calling shard's connections to switch 'dpid', other than the
+ * one registered for it. */
+static void
+close_stale_conns(datapathid dpid)
+{
+    Shard* shard = current_shard();
+    std::vector<Conn*> stale;
+    {
+        Scoped_native_mutex lock(&conn_mutex);
+        chashmap::iterator i = connection_map.find(dpid);
+        Conn* current = i != connection_map.end() ? i->second : NULL;
+        BOOST_FOREACH (Conn* conn, shard->conns) {
+            if (conn != current && conn->oconn->get_datapath_id() == dpid) {
+                stale.push_back(conn);
+            }
+        }
+    }
+    BOOST_FOREACH (Conn* conn, stale) {
+        conn->close();
     }
 }
 
@@ -1419,16 +2239,26 @@ register_conn(Openflow_connection* oconn, Co_sema* disconnected)
 {
     datapathid dp_id = oconn->get_datapath_id();
 
-    chashmap::iterator i;
     Conn* conn = new Conn(boost::shared_ptr<Openflow_connection>(oconn),
                           disconnected);
-    std::pair<chashmap::iterator, bool> pair
-        = connection_map.insert(chashmap::value_type(dp_id, conn));
-    if (!pair.second) {
-        pair.first->second->close();
-        // Conn->close() removes the entry from connection_map, so reinsert
-        pair = connection_map.insert(chashmap::value_type(dp_id, conn));
-        assert(pair.second); 
+    Shard* old_shard = NULL;
+    {
+        Scoped_native_mutex lock(&conn_mutex);
+        std::pair<chashmap::iterator, bool> pair
+            = connection_map.insert(chashmap::value_type(dp_id, conn));
+        if (!pair.second) {
+            /* The switch reconnected before we noticed that its old
+             * connection was gone.  The old connection may belong to another
+             * shard, which may delete it once the lock is released. */
+            old_shard = pair.first->second->shard;
+            pair.first->second = conn;
+            if (old_shard != conn->shard) {
+                old_shard->post(boost::bind(close_stale_conns, dp_id));
+            }
+        }
+    }
+    if (old_shard == conn->shard) {
+        close_stale_conns(dp_id);
     }
 }
 
@@ -16,6 +16,7 @@
  * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "packet-classifier.hh"
+#include <algorithm>
 #include <boost/bind.hpp>
 #include "assert.hh"
 #include "nox.hh"
@@ -24,6 +25,9 @@
 
 namespace vigil {
 
+/* Number of matching rules that handle_packet_in() copies to the stack. */
+static const size_t MAX_LOCAL_MATCHES = 8;
+
 void
 Packet_classifier::register_packet_in()
 {
@@ -32,28 +36,142 @@ Packet_classifier::register_packet_in()
                                         this, _1), 100);
 }
 
+/* Appends the highest-priority rules in 'result' to 'set', then clears
+ * 'result'. */
+template<class Result, class Set>
+static void
+get_top_rules(Result& result, Set& set)
+{
+    const Rule<Packet_expr, Pexpr_action> *match = result.next();
+    if (match != NULL) {
+        uint32_t top_priority = match->priority;
+        do {
+            set.push_back(match);
+            match = result.next();
+        } while (match != NULL && match->priority == top_priority);
+    }
+    result.clear();
+}
+
+/* Stores in 'set' the highest-priority rules that match 'flow'. */
+void
+Packet_classifier::lookup(const Flow& flow, Match_set& set)
+{
+    if (get_backend() == TUPLE_SPACE) {
+        tuple_result.set_data(&flow);
+        get_rules(tuple_result);
+        get_top_rules(tuple_result, set);
+    } else if (use_compiled) {
+        compiled_result.set_data(&flow);
+        compiled.get_rules(compiled_result);
+        get_top_rules(compiled_result, set);
+    } else {
+        result.set_data(&flow);
+        get_rules(result);
+        get_top_rules(result, set);
+    }
+}
+
+/* Brings the compiled snapshot, if it is in use, up to date with the rules.
+ * Building bumps the generation, so this must precede using the cache. */
+void
+Packet_classifier::make_current()
+{
+    if (get_backend() == CNODE_TREE && use_compiled
+        && !compiled.is_current(*this)) {
+        build();
+        compiled.compile(*this);
+    }
+}
+
 Disposition
 Packet_classifier::handle_packet_in(const Event& e)
 {
     const Packet_in_event& pi = assert_cast<const Packet_in_event&>(e);
-    const Rule<Packet_expr, Pexpr_action> *match;
-    Flow flow(pi.in_port, *(pi.get_buffer()));
-
-    result.set_data(&flow);
-    get_rules(result);
-    match = result.next();
-    if (match == NULL) {
-        result.clear();
-        return CONTINUE;
-    }
-    int top_priority = match->priority;
-    do {
-        match->action(pi);
-        match = result.next();
-    } while (match != NULL && (match->priority == top_priority));
+    const Flow& flow = pi.flow;
 
-    result.clear();
+    make_current();
+
+    const Match_set *set = flow_cache.lookup(flow, get_generation());
+    if (set == NULL) {
+        Match_set *entry = flow_cache.insert(flow, get_generation());
+        if (entry == NULL) {
+            entry = &matches;
+            matches.clear();
+        }
+        lookup(flow, *entry);
+        set = entry;
+    }
+
+    /* Actions may block or dispatch other packet-ins, which may overwrite
+     * 'set' in the meantime, so run them from a copy.  Small sets are copied
+     * to the stack, to keep cache hits free of allocation. */
+    const Rule_type* local[MAX_LOCAL_MATCHES];
+    Match_set copy;
+    const Rule_type* const* rules = local;
+    size_t n = set->size();
+    if (n <= MAX_LOCAL_MATCHES) {
+        std::copy(set->begin(), set->end(), local);
+    } else {
+        copy = *set;
+        rules = &copy[0];
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        rules[i]->action(pi);
+    }
     return CONTINUE;
 }
 
+/* Stores in each of the 'n' 'sets' the highest-priority rules that match the
+ * corresponding one of 'flows', as handle_packet_in() would find them. */
+void
+Packet_classifier::classify(const Flow* const flows[],
+                            Match_set* const sets[], size_t n)
+{
+    make_current();
+
+    uint32_t generation = get_generation();
+    batch_misses.clear();
+    for (size_t i = 0; i < n; i++) {
+        const Match_set *set = flow_cache.lookup(*flows[i], generation);
+        if (set != NULL) {
+            sets[i]->assign(set->begin(), set->end());
+        } else {
+            sets[i]->clear();
+            batch_misses.push_back(i);
+        }
+    }
+    if (batch_misses.empty()) {
+        return;
+    }
+
+    if (get_backend() == CNODE_TREE && use_compiled) {
+        while (batch_results.size() < batch_misses.size()) {
+            batch_results.push_back(new Batch_result(NULL));
+        }
+        batch_ptrs.clear();
+        for (size_t i = 0; i < batch_misses.size(); i++) {
+            batch_results[i].set_data(flows[batch_misses[i]]);
+            batch_ptrs.push_back(&batch_results[i]);
+        }
+        compiled.get_rules_batch(&batch_ptrs[0], batch_ptrs.size());
+        for (size_t i = 0; i < batch_misses.size(); i++) {
+            get_top_rules(batch_results[i], *sets[batch_misses[i]]);
+        }
+    } else {
+        for (size_t i = 0; i < batch_misses.size(); i++) {
+            lookup(*flows[batch_misses[i]], *sets[batch_misses[i]]);
+        }
+    }
+
+    for (size_t i = 0; i < batch_misses.size(); i++) {
+        size_t j = batch_misses[i];
+        Match_set *entry = flow_cache.insert(*flows[j], generation);
+        if (entry != NULL) {
+            *entry = *sets[j];
+        }
+    }
+}
+
 }
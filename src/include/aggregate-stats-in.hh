@@ -39,7 +39,7 @@ struct Aggregate_stats_in_event
                              std::auto_ptr<Buffer> buf);
 
     // -- only for use within python
-    Aggregate_stats_in_event() : Event(static_get_name()) { }
+    Aggregate_stats_in_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Aggregate_stats_in_event";
@@ -60,7 +60,7 @@ inline
 Aggregate_stats_in_event::Aggregate_stats_in_event(const datapathid& dpid,
                                                    const ofp_stats_reply *osr,
                                                    std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()), Ofp_msg_event(&osr->header, buf)
+    : Event(static_get_name(), this), Ofp_msg_event(&osr->header, buf)
 {
     datapath_id  = dpid;
 
@@ -37,7 +37,7 @@ struct Barrier_reply_event
 {
     Barrier_reply_event(datapathid datapath_id_,
                        const ofp_header *oh, std::auto_ptr<Buffer> buf_)
-        : Event(static_get_name()), Ofp_msg_event(oh, buf_),
+        : Event(static_get_name(), this), Ofp_msg_event(oh, buf_),
           datapath_id(datapath_id_)
         {}
 
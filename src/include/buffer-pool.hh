@@ -0,0 +1,126 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BUFFER_POOL_HH
+#define BUFFER_POOL_HH 1
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include "buffer.hh"
+
+namespace vigil {
+
+struct co_group;
+
+/* A pool of reusable storage blocks for OpenFlow message buffers.
+ *
+ * Requests are rounded up to one of a small number of size classes chosen to
+ * fit the common messages: echoes, port status and flow removed messages fit
+ * the smallest class, packet-ins carrying the default miss_send_len fit the
+ * second, full-sized packet-ins fit the third, and the last class holds any
+ * OpenFlow message at all (e.g. large stats replies).
+ *
+ * Buffers handed out by allocate() keep the pool alive and return their block
+ * to it when they are destroyed, so a block is recycled only once the last
+ * event referencing it is gone.  Each size class keeps a bounded free list;
+ * blocks beyond that bound are released with delete[].
+ *
+ * A Buffer_pool is not thread-safe and must be used only from the
+ * (cooperative) thread group that created it.  Buffers allocated from it may
+ * be destroyed in another group, e.g. when an event is forwarded between
+ * shards, in which case their blocks are freed instead of recycled. */
+class Buffer_pool
+    : public boost::enable_shared_from_this<Buffer_pool>,
+      boost::noncopyable
+{
+public:
+    /* Allocation and recycling counters. */
+    struct Stats
+    {
+        Stats();
+
+        uint64_t hits;          /* Allocations served from a free list. */
+        uint64_t misses;        /* Allocations that needed a new block. */
+        uint64_t oversize;      /* Allocations too big for any size class. */
+        uint64_t recycled;      /* Blocks returned to a free list. */
+        uint64_t discarded;     /* Blocks freed because a free list was full. */
+    };
+
+    static const int N_CLASSES = 4;
+
+    static boost::shared_ptr<Buffer_pool> create();
+    ~Buffer_pool();
+
+    /* Returns a buffer of exactly 'size' bytes whose storage comes from the
+     * pool whenever 'size' fits in one of the size classes. */
+    std::auto_ptr<Buffer> allocate(size_t size);
+
+    const Stats& get_stats() const { return stats; }
+
+    /* Fraction of allocations served without calling the allocator, in the
+     * range [0, 1].  Returns 0 if nothing has been allocated yet. */
+    double hit_rate() const;
+
+    /* Number of blocks currently waiting in free lists. */
+    size_t n_free() const;
+
+private:
+    friend class Pooled_buffer;
+
+    std::vector<uint8_t*> free_list[N_CLASSES];
+    Stats stats;
+    co_group* group;            /* Group that created the pool. */
+
+    Buffer_pool();
+
+    static int size_class(size_t size);
+    uint8_t* get_block(int size_class);
+    void put_block(uint8_t* block, int size_class);
+};
+
+/* Buffer whose storage was obtained from a Buffer_pool.  Behaves like an
+ * Array_buffer; if it is extended beyond its block, its content moves to
+ * ordinary heap storage and the block goes back to the pool. */
+class Pooled_buffer
+    : public Buffer
+{
+public:
+    Pooled_buffer(const boost::shared_ptr<Buffer_pool>&, size_t size);
+    ~Pooled_buffer();
+
+    uint8_t* push(size_t n);
+    uint8_t* put(size_t n);
+
+private:
+    boost::shared_ptr<Buffer_pool> pool;
+    uint8_t* base;
+    size_t capacity;
+    int size_class;             /* -1 if 'base' is not a pool block. */
+
+    void reallocate(size_t new_capacity, size_t headroom);
+
+    Pooled_buffer(const Pooled_buffer&);
+    Pooled_buffer& operator=(const Pooled_buffer&);
+};
+
+} // namespace vigil
+
+#endif /* buffer-pool.hh */
@@ -22,6 +22,7 @@
 #include <cstdlib>
 #include <stdint.h>
 #include <stdexcept>
+#include <boost/shared_ptr.hpp>
 
 namespace vigil {
 
@@ -299,6 +300,41 @@ inline void Nonowning_buffer::reinit(uint8_t* data_, size_t size_)
     m_size = size_;
 }
 
+/* A buffer that views the content of another, reference-counted buffer.  The
+ * underlying storage stays alive for as long as any Shared_buffer (or any
+ * other holder of the boost::shared_ptr) refers to it, so several consumers
+ * may each have their own Buffer, with its own independent pull() and trim()
+ * window, without copying the bytes.
+ *
+ * The shared content is treated as read-only by convention, and a
+ * Shared_buffer may not be extended. */
+class Shared_buffer
+    : public Buffer
+{
+public:
+    Shared_buffer(const boost::shared_ptr<Buffer>&);
+    ~Shared_buffer() { }
+
+    /* The buffer whose storage is being shared. */
+    const boost::shared_ptr<Buffer>& get_owner() const { return owner; }
+
+    /* A Shared_buffer cannot be extended. */
+    uint8_t* push(size_t n) { ::abort(); }
+    uint8_t* put(size_t n) { ::abort(); }
+
+private:
+    boost::shared_ptr<Buffer> owner;
+
+    Shared_buffer(const Shared_buffer&);
+    Shared_buffer& operator=(const Shared_buffer&);
+};
+
+/* Constructs a Shared_buffer whose contents are the same as 'owner_''s, and
+ * which keeps 'owner_' alive until it is destroyed. */
+inline Shared_buffer::Shared_buffer(const boost::shared_ptr<Buffer>& owner_)
+    : Buffer(owner_->data(), owner_->size()), owner(owner_)
+{}
+
 } // namespace vigil
 
 #endif /* buffer.hh */
@@ -18,6 +18,7 @@
 #ifndef  CLASSIFIER_HH
 #define  CLASSIFIER_HH
 
+#include <algorithm>
 #include <errno.h>
 #include <stdint.h>
 #include <boost/scoped_ptr.hpp>
@@ -27,6 +28,7 @@
 #include "errno_exception.hh"
 #include "hash_map.hh"
 #include "rule.hh"
+#include "tuple-space.hh"
 
 /*
  * General packet classifier.
@@ -39,19 +41,45 @@
  * with it a map of rule pointers allowing for easy removal of rules by ID
  * (instead of requiring a search of the entire tree).
  *
+ * Rules can instead be kept in a Tuple_space, selected per classifier with
+ * set_backend(TUPLE_SPACE), which holds up better when rules wildcard many
+ * different subsets of fields.  Lookups and rule updates work the same with
+ * either backend; build(), unbuild() and clean() only affect the tree.
+ *
  * Expr should follow the model described by the example in "expr.hh".
  */
 
 namespace vigil {
 
+template<class Expr, typename Action>
+class Compiled_classifier;
+
 template<class Expr, typename Action>
 class Classifier {
 
 public:
+    friend class Compiled_classifier<Expr, Action>;
+
     typedef Expr Expr_type;
     typedef Rule<Expr, Action>* Rule_ptr;
     typedef hash_map<uint32_t, Rule_ptr> Id_map;
 
+    enum Backend {
+        CNODE_TREE,
+        TUPLE_SPACE
+    };
+
+    /* A rule to add with add_rules(). */
+    struct Rule_spec {
+        Rule_spec(uint32_t priority_, const Expr& expr_,
+                  const Action& action_)
+            : priority(priority_), expr(expr_), action(action_) { }
+
+        uint32_t priority;
+        Expr expr;
+        Action action;
+    };
+
     Classifier(uint32_t, int);
     Classifier();
     void reset(uint32_t, int);
@@ -64,19 +92,43 @@ public:
     bool delete_rule(uint32_t);
     template<typename Data>
     uint32_t delete_rules(const Data*);
+    void add_rules(const std::vector<Rule_spec>&, std::vector<uint32_t>&);
+    uint32_t delete_rules(const std::vector<uint32_t>&);
     void build();
     void unbuild();
-    void clean() { root->clean(); } /* deletes empty subtrees */
+    void clean() { root->clean(); ++generation; } /* deletes empty subtrees */
+
+    /* Changes whenever the rules or the tree's structure do. */
+    uint32_t get_generation() const { return generation; }
+    size_t n_rules() const { return rules.size(); }
+
+    void set_backend(Backend);
+    Backend get_backend() const { return tuples ? TUPLE_SPACE : CNODE_TREE; }
 
     template<typename Data>
     void get_rules(Cnode_result<Expr, Action, Data>&);
+    template<typename Data>
+    void get_rules(Tuple_result<Expr, Action, Data>&);
+    template<typename Data>
+    void get_rules_batch(Cnode_result<Expr, Action, Data>* const[], size_t);
     void print() const;
 
 private:
     boost::scoped_ptr<Cnode<Expr, Action> > root;
+    boost::scoped_ptr<Tuple_space<Expr, Action> > tuples; /* If TUPLE_SPACE. */
     std::vector<Cnode<Expr, Action>*> to_traverse;
+
+    /* A lookup in progress in get_rules_batch(). */
+    struct Lane {
+        Lane() : next(NULL) { }
+
+        const Cnode<Expr, Action> *next; /* Node to traverse next, if any. */
+        std::vector<Cnode<Expr, Action>*> to_traverse;
+    };
+    std::vector<Lane> lanes;
     Id_map rules;
     uint32_t id_counter;
+    uint32_t generation;
 
     uint32_t get_id();
 
@@ -92,7 +144,7 @@ private:
 
 template<class Expr, typename Action>
 Classifier<Expr, Action>::Classifier(uint32_t split_field, int n_buckets)
-    : id_counter(1)
+    : id_counter(1), generation(0)
 {
     root.reset(new Cnode<Expr, Action>(split_field, n_buckets));
 }
@@ -104,7 +156,7 @@ Classifier<Expr, Action>::Classifier(uint32_t split_field, int n_buckets)
 
 template<class Expr, typename Action>
 Classifier<Expr, Action>::Classifier()
-    : id_counter(1)
+    : id_counter(1), generation(0)
 {
     root.reset(new Cnode<Expr, Action>());
 }
@@ -117,6 +169,7 @@ template<class Expr, typename Action>
 Classifier<Expr, Action>::~Classifier()
 {
     root.reset();
+    tuples.reset();
     for (typename Id_map::const_iterator id = rules.begin();
          id != rules.end(); ++id)
     {
@@ -138,8 +191,12 @@ Classifier<Expr, Action>::reset(uint32_t split_field, int n_buckets)
     {
         delete id->second;
     }
+    if (tuples) {
+        tuples->clear();
+    }
     rules.clear();
     id_counter = 1;
+    ++generation;
 }
 
 
@@ -157,8 +214,12 @@ Classifier<Expr, Action>::reset()
     {
         delete id->second;
     }
+    if (tuples) {
+        tuples->clear();
+    }
     rules.clear();
     id_counter = 1;
+    ++generation;
 }
 
 
@@ -212,7 +273,11 @@ Classifier<Expr, Action>::add_rule(uint32_t priority, const Expr& expr,
     inserted = rules.insert(entry);
     if (inserted.second == true) {
         try {
-            root->add_rule(entry.second, 0);
+            if (tuples) {
+                tuples->add_rule(entry.second);
+            } else {
+                root->add_rule(entry.second, 0);
+            }
         } catch (...) {
             rules.erase(inserted.first);
             delete entry.second;
@@ -223,6 +288,7 @@ Classifier<Expr, Action>::add_rule(uint32_t priority, const Expr& expr,
         throw errno_exception(ENOMEM, "classifier::add_rule");
     }
 
+    ++generation;
     return new_id;
 }
 
@@ -237,12 +303,19 @@ Classifier<Expr, Action>::change_rule_priority(uint32_t id, uint32_t priority)
         return false;
     }
 
+    if (tuples) {
+        tuples->change_rule_priority(entry->second, priority);
+        ++generation;
+        return true;
+    }
+
     Cnode<Expr, Action> *node = entry->second->get_node();
     if (node == NULL) {
         return false;
     }
 
-    return node->change_rule_priority(id, priority);
+    ++generation;
+    return node->change_rule_priority(entry->second, priority);
 }
 
 template<class Expr, typename Action>
@@ -276,13 +349,18 @@ Classifier<Expr, Action>::delete_rule(uint32_t id)
         return false;
     }
 
-    Cnode<Expr, Action> *node = entry->second->get_node();
-    if (node != NULL) {
-        node->remove_rule(entry->first);
+    if (tuples) {
+        tuples->remove_rule(entry->second);
+    } else {
+        Cnode<Expr, Action> *node = entry->second->get_node();
+        if (node != NULL) {
+            node->remove_rule(entry->second);
+        }
     }
 
     delete entry->second;
     rules.erase(entry);
+    ++generation;
     return true;
 }
 
@@ -316,6 +394,71 @@ Classifier<Expr, Action>::delete_rules(const Data *data)
     return n_del;
 }
 
+/*
+ * Adds each of 'specs' as add_rule() does and appends the new rules' IDs to
+ * 'ids', in the same order.  If an exception is thrown, none of the rules
+ * are left in the classifier.
+ *
+ * Adding a rule only hangs it in the tree where it belongs; splitting the
+ * nodes it lands in waits for the next build(), which then only revisits the
+ * parts of the tree that changed.  So a batch of changes followed by one
+ * build() costs about as much as the nodes the changes touch, however large
+ * the classifier is.  The rules are added in priority order, which is the
+ * order in which a node's rule list grows cheaply.
+ */
+
+template<class Expr, typename Action>
+void
+Classifier<Expr, Action>::add_rules(const std::vector<Rule_spec>& specs,
+                                    std::vector<uint32_t>& ids)
+{
+    std::vector<std::pair<uint32_t, size_t> > order;
+    order.reserve(specs.size());
+    for (size_t i = 0; i < specs.size(); i++) {
+        order.push_back(std::make_pair(specs[i].priority, i));
+    }
+    std::sort(order.begin(), order.end());
+
+    size_t n_ids = ids.size();
+    ids.resize(n_ids + specs.size());
+
+    size_t n_added = 0;
+    try {
+        for (; n_added < order.size(); n_added++) {
+            const Rule_spec& spec = specs[order[n_added].second];
+            ids[n_ids + order[n_added].second]
+                = add_rule(spec.priority, spec.expr, spec.action);
+        }
+    } catch (...) {
+        while (n_added > 0) {
+            delete_rule(ids[n_ids + order[--n_added].second]);
+        }
+        ids.resize(n_ids);
+        throw;
+    }
+}
+
+
+/*
+ * Deletes each of the rules with IDs in 'ids' as delete_rule() does.
+ * Returns the number of rules deleted.
+ */
+
+template<class Expr, typename Action>
+uint32_t
+Classifier<Expr, Action>::delete_rules(const std::vector<uint32_t>& ids)
+{
+    uint32_t n_del = 0;
+
+    for (std::vector<uint32_t>::const_iterator id = ids.begin();
+         id != ids.end(); ++id)
+    {
+        n_del += delete_rule(*id);
+    }
+
+    return n_del;
+}
+
 /*
  * Builds the tree.
  */
@@ -328,6 +471,7 @@ Classifier<Expr, Action>::build()
     if (tmp != root.get()) {
         root.reset(tmp);
     }
+    ++generation;
 }
 
 
@@ -339,6 +483,7 @@ Classifier<Expr, Action>::unbuild()
     if (tmp != root.get()) {
         root.reset(tmp);
     }
+    ++generation;
 }
 
 /*
@@ -355,6 +500,11 @@ template<typename Data>
 void
 Classifier<Expr, Action>::get_rules(Cnode_result<Expr, Action, Data>& result)
 {
+    if (tuples) {
+        tuples->get_rules(result);
+        return;
+    }
+
     root->traverse(result, to_traverse);
     while (!to_traverse.empty()) {
         Cnode<Expr, Action> *node = to_traverse.back();
@@ -363,6 +513,115 @@ Classifier<Expr, Action>::get_rules(Cnode_result<Expr, Action, Data>& result)
     }
 }
 
+/*
+ * Does get_rules() for each of the 'n' 'results' at once.  The lookups take
+ * turns a node at a time, and each prefetches the node that it will visit
+ * after its next one before handing over, so that one lookup's cache misses
+ * are served while the others work.  A batch of one is a plain get_rules().
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Classifier<Expr, Action>::get_rules_batch(
+    Cnode_result<Expr, Action, Data>* const results[], size_t n)
+{
+    if (tuples || n == 1) {
+        for (size_t i = 0; i < n; i++) {
+            get_rules(*results[i]);
+        }
+        return;
+    }
+
+    if (lanes.size() < n) {
+        lanes.resize(n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        lanes[i].next = root.get();
+    }
+
+    size_t n_busy = n;
+    while (n_busy > 0) {
+        n_busy = 0;
+        for (size_t i = 0; i < n; i++) {
+            Lane& lane = lanes[i];
+            if (lane.next == NULL) {
+                continue;
+            }
+
+            lane.next->traverse(*results[i], lane.to_traverse);
+            if (lane.to_traverse.empty()) {
+                lane.next = NULL;
+                continue;
+            }
+            lane.next = lane.to_traverse.back();
+            lane.to_traverse.pop_back();
+            if (!lane.to_traverse.empty()) {
+                __builtin_prefetch(lane.to_traverse.back());
+            }
+            n_busy++;
+        }
+    }
+}
+
+/*
+ * Readies 'result' to find the rules that match its data, as with a
+ * Cnode_result, but probing only as much of the classifier as is needed to
+ * return each match from next() in turn.  Only supported by the TUPLE_SPACE
+ * backend.  'result' must not be used once the rules change.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Classifier<Expr, Action>::get_rules(Tuple_result<Expr, Action, Data>& result)
+{
+    assert(tuples);
+    tuples->get_rules(result);
+}
+
+/*
+ * Moves all of the rules to 'backend'.  A tree that the rules leave keeps
+ * any structure it was constructed with.
+ */
+
+template<class Expr, typename Action>
+void
+Classifier<Expr, Action>::set_backend(Backend backend)
+{
+    if (backend == get_backend()) {
+        return;
+    }
+
+    if (backend == TUPLE_SPACE) {
+        boost::scoped_ptr<Tuple_space<Expr, Action> > space(
+            new Tuple_space<Expr, Action>);
+        for (typename Id_map::const_iterator id = rules.begin();
+             id != rules.end(); ++id)
+        {
+            space->add_rule(id->second);
+        }
+        for (typename Id_map::const_iterator id = rules.begin();
+             id != rules.end(); ++id)
+        {
+            Cnode<Expr, Action> *node = id->second->get_node();
+            if (node != NULL) {
+                node->remove_rule(id->second);
+            }
+        }
+        root->clean();
+        tuples.swap(space);
+    } else {
+        for (typename Id_map::const_iterator id = rules.begin();
+             id != rules.end(); ++id)
+        {
+            root->add_rule(id->second, 0);
+        }
+        tuples.reset();
+    }
+    ++generation;
+}
+
 template<class Expr, typename Action>
 void
 Classifier<Expr, Action>::print() const
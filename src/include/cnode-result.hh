@@ -39,17 +39,21 @@
 
 namespace vigil {
 
+template<class Expr, typename Action>
+class Tuple_space;
+
 template<class Expr, typename Action, typename Data>
 class Cnode_result {
 
 public:
     friend class Cnode<Expr, Action>;
+    friend class Tuple_space<Expr, Action>;
 
     typedef Rule<Expr, Action>* Rule_ptr;
     typedef std::list<Rule_ptr> Rule_list;
 
     Cnode_result(const Data *data_)
-        : data(data_), num_lists(0) {}
+        : data(data_), num_lists(0) { traversed.reserve(DEFAULT_VEC_SIZE); }
 
     void push(const Rule_list&);
     const Rule<Expr, Action>* next();
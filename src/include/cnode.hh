@@ -18,6 +18,7 @@
 #ifndef  CNODE_HH
 #define  CNODE_HH
 
+#include <algorithm>
 #include <list>
 #include <string>
 #include <vector>
@@ -36,10 +37,15 @@
 
 namespace vigil {
 
+template<class Expr, typename Action>
+class Compiled_classifier;
+
 template<class Expr, typename Action>
 class Cnode {
 
 public:
+    friend class Compiled_classifier<Expr, Action>;
+
     typedef Rule<Expr, Action>* Rule_ptr;
     typedef std::list<Rule_ptr> Rule_list;
 
@@ -49,8 +55,8 @@ public:
     ~Cnode();
 
     void add_rule(const Rule_ptr&, uint32_t, bool = true);
-    bool change_rule_priority(uint32_t, uint32_t);
-    bool remove_rule(uint32_t);
+    bool change_rule_priority(const Rule_ptr&, uint32_t);
+    bool remove_rule(const Rule_ptr&);
     Cnode<Expr, Action> *build(uint32_t, bool);
     Cnode<Expr, Action> *unbuild();
     bool clean();
@@ -73,18 +79,28 @@ private:
 
     Cnode<Expr, Action> *next;      // for chaining
 
-    void add_rule_to_list(const Rule_ptr&);
+    bool dirty;                     // subtree changed since last build()
+    uint32_t n_unsplit;             // leaf size when last not worth splitting
+    std::vector<Cnode<Expr, Action>*> dirty_children;
+
+    typename Rule_list::iterator add_rule_to_list(const Rule_ptr&);
     void build_children(uint32_t, bool);
     Cnode<Expr, Action>* split(uint32_t, bool);
     void split_node(uint32_t, uint32_t, int);
     void set_node_pointers();
     void add_node_rules(Cnode<Expr, Action> *);
+    void forget_dirty_child(Cnode<Expr, Action> *);
+    Cnode<Expr, Action> *find_child(uint32_t) const;
     uint32_t best_split(uint32_t, uint32_t&, int&) const;
     uint32_t exp_rules_with_split(uint32_t, std::vector<bool>&,
                                   int, int&) const;
 
     static int get_bucket(uint32_t, int);
 
+    /* How many values ahead traverse() prefetches buckets for when it looks
+     * up a set of values. */
+    static const int SET_PREFETCH = 4;
+
     Cnode(const Cnode&);
     Cnode& operator=(const Cnode&);
 };
@@ -113,7 +129,7 @@ const uint32_t Cnode<Expr, Action>::MASKS[] = {
 template<class Expr, typename Action>
 Cnode<Expr, Action>::Cnode(uint32_t field, int n_buckets, uint32_t value_)
     : value(value_), bucket_mask(n_buckets - 1), split_field(field),
-      any_node(NULL), next(NULL)
+      any_node(NULL), next(NULL), dirty(true), n_unsplit(0)
 {
     assert(split_field < 32);
     assert(n_buckets > 0 && ((n_buckets & (n_buckets - 1)) == 0));
@@ -131,7 +147,8 @@ Cnode<Expr, Action>::Cnode(uint32_t field, int n_buckets, uint32_t value_)
 
 template<class Expr, typename Action>
 Cnode<Expr, Action>::Cnode(uint32_t value_)
-    : value(value_), bucket_mask(-1), buckets(NULL), any_node(NULL), next(NULL)
+    : value(value_), bucket_mask(-1), buckets(NULL), any_node(NULL), next(NULL),
+      dirty(true), n_unsplit(0)
 { }
 
 
@@ -141,7 +158,8 @@ Cnode<Expr, Action>::Cnode(uint32_t value_)
 
 template<class Expr, typename Action>
 Cnode<Expr, Action>::Cnode()
-    : value(0), bucket_mask(-1), buckets(NULL), any_node(NULL), next(NULL)
+    : value(0), bucket_mask(-1), buckets(NULL), any_node(NULL), next(NULL),
+      dirty(true), n_unsplit(0)
 { }
 
 
@@ -182,19 +200,26 @@ Cnode<Expr, Action>::~Cnode()
     }
 }
 
+/*
+ * Inserts 'rule' into the node's 'rules' list after any rules with the same
+ * or a lower priority value, and returns its position.  Searches from the back, so
+ * that adding rules in priority order, as split() and unbuild() do, takes
+ * constant time per rule.
+ */
+
 template<class Expr, typename Action>
-void
+typename Cnode<Expr, Action>::Rule_list::iterator
 Cnode<Expr, Action>::add_rule_to_list(const Rule_ptr& rule)
 {
-    for (typename Rule_list::iterator iter = rules.begin();
-         iter != rules.end(); ++iter)
-    {
-        if (rule->priority <= (*iter)->priority) {
-            rules.insert(iter, rule);
-            return;
+    typename Rule_list::iterator pos = rules.end();
+    while (pos != rules.begin()) {
+        typename Rule_list::iterator prev = pos;
+        if ((*--prev)->priority <= rule->priority) {
+            break;
         }
+        pos = prev;
     }
-    rules.push_back(rule);
+    return rules.insert(pos, rule);
 }
 
 
@@ -209,6 +234,8 @@ Cnode<Expr, Action>::add_rule_to_list(const Rule_ptr& rule)
  * rule this should be true, however when a duplicate copy of the tree is being
  * made, 'set_pointer' should be set to false because the master tree shouldn't
  * be undergoing any changes.  Currently 'set_pointer' defaults to true.
+ * Marks every node on the way as needing to be built again, and records each
+ * child that becomes so in its parent's 'dirty_children'.
  * If an exception is thrown, the caller can assume that 'rule' has not been
  * added to the node.
  */
@@ -220,10 +247,12 @@ Cnode<Expr, Action>::add_rule(const Rule_ptr& rule, uint32_t path,
 {
     const Expr& expr = rule->expr;
 
+    dirty = true;
     if (bucket_mask < 0 || !expr.splittable(path)) {
-        add_rule_to_list(rule);
+        typename Rule_list::iterator pos = add_rule_to_list(rule);
         if (set_pointer) {
             rule->node = this;
+            rule->pos = pos;
         }
         return;
     }
@@ -241,12 +270,29 @@ Cnode<Expr, Action>::add_rule(const Rule_ptr& rule, uint32_t path,
 
         if (child == NULL) {
             child = new Cnode(rule_value);
+            try {
+                dirty_children.push_back(child);
+            } catch (...) {
+                delete child;
+                throw;
+            }
             child->next = buckets[bucket];
             buckets[bucket] = child;
+        } else if (!child->dirty) {
+            dirty_children.push_back(child);
         }
     } else {
         if (any_node == NULL) {
-            any_node = new Cnode();
+            child = new Cnode();
+            try {
+                dirty_children.push_back(child);
+            } catch (...) {
+                delete child;
+                throw;
+            }
+            any_node = child;
+        } else if (!any_node->dirty) {
+            dirty_children.push_back(any_node);
         }
         child = any_node;
     }
@@ -256,53 +302,44 @@ Cnode<Expr, Action>::add_rule(const Rule_ptr& rule, uint32_t path,
 
 
 /*
- * Change priority of rule with 'id' in this node to 'priority' and reorder in
- * rule list as appropriate.
+ * Change priority of 'rule', which must be in this node, to 'priority' and
+ * reorder in rule list as appropriate.  Returns 'false' if 'rule' is not in
+ * the node.
  */
 
 template<class Expr, typename Action>
 bool
-Cnode<Expr, Action>::change_rule_priority(uint32_t id, uint32_t priority)
+Cnode<Expr, Action>::change_rule_priority(const Rule_ptr& rule,
+                                          uint32_t priority)
 {
-    for (typename Rule_list::iterator iter = rules.begin();
-         iter != rules.end(); ++iter)
-    {
-        if ((*iter)->id == id) {
-            Rule_ptr r = *iter;
-            rules.erase(iter);
-            r->priority = priority;
-            add_rule_to_list(r);
-            return true;
-        }
+    if (rule->node != this) {
+        return false;
     }
 
-    return false;
+    rules.erase(rule->pos);
+    rule->priority = priority;
+    rule->pos = add_rule_to_list(rule);
+    return true;
 }
 
 
 /*
- * Removes rule with 'id' from the node's 'rules' lists and sets its Cnode
- * pointer to NULL if it is pointing to the current node.  Returns 'true' if
- * the rule was found and thus removed from the list, else returns 'false'.
+ * Removes 'rule' from the node's 'rules' list and sets its Cnode pointer to
+ * NULL.  Returns 'true' if the rule was in the node and thus removed from the
+ * list, else returns 'false'.
  */
 
 template<class Expr, typename Action>
 bool
-Cnode<Expr, Action>::remove_rule(uint32_t id)
+Cnode<Expr, Action>::remove_rule(const Rule_ptr& rule)
 {
-    for (typename Rule_list::iterator iter = rules.begin();
-         iter != rules.end(); ++iter)
-    {
-        if ((*iter)->id == id) {
-            if ((*iter)->node == this) {
-                (*iter)->node = NULL;
-            }
-            rules.erase(iter);
-            return true;
-        }
+    if (rule->node != this) {
+        return false;
     }
 
-    return false;
+    rules.erase(rule->pos);
+    rule->node = NULL;
+    return true;
 }
 
 
@@ -328,6 +365,12 @@ Cnode<Expr, Action>::remove_rule(uint32_t id)
  *
  * If an exception is thrown, guarantees that the master tree is still
  * consistent, and frees any copies that were created in the build attempt.
+ *
+ * Sub-trees that no rule has been added to since they were last built are
+ * skipped, so that building after a few updates only costs as much as the
+ * paths those updates took.  A leaf that was not worth splitting is not
+ * considered again until it has half again as many rules, since weighing a
+ * split costs time in proportion to the leaf's size.
  */
 
 template<class Expr, typename Action>
@@ -336,12 +379,20 @@ Cnode<Expr, Action>::build(uint32_t path, bool is_copy)
 {
     Cnode<Expr, Action> *new_this = this;
 
+    if (!dirty) {
+        return this;
+    }
+
     if (bucket_mask < 0) {
-        if (rules.size() <= Expr::LEAF_THRESHOLD) {
+        if (rules.size() <= Expr::LEAF_THRESHOLD
+            || rules.size() < n_unsplit + n_unsplit / 2) {
+            dirty = false;
             return this;
         }
         new_this = split(path, is_copy);
         if (new_this->bucket_mask < 0) {
+            new_this->n_unsplit = rules.size();
+            new_this->dirty = false;
             return new_this;
         }
     }
@@ -366,6 +417,8 @@ Cnode<Expr, Action>::build(uint32_t path, bool is_copy)
         new_this->set_node_pointers();
     }
 
+    new_this->dirty_children.clear();
+    new_this->dirty = false;
     return new_this;
 }
 
@@ -374,7 +427,9 @@ Cnode<Expr, Action>::build(uint32_t path, bool is_copy)
  * Builds the children of a node.  If the node is a copy, the children can be
  * built knowing that copies will not be made of them.  If however the node is
  * not a copy, each built child may be a new sub-tree, in which case the old
- * one should be freed.
+ * one should be freed.  Only the children in 'dirty_children' can need it,
+ * so the others are not visited.  Each is dropped from the list once built,
+ * so that after an exception the list still names every unbuilt child.
  */
 
 template<class Expr, typename Action>
@@ -396,26 +451,22 @@ Cnode<Expr, Action>::build_children(uint32_t path, bool is_copy)
         return;
     }
 
-    for (int i = 0; i <= bucket_mask; i++) {
-        Cnode<Expr, Action> *child = buckets[i];
-        Cnode<Expr, Action> **prev = &buckets[i];
-        while (child != NULL) {
-            child = child->build(path, is_copy);
-            if (child != *prev) {
-                delete *prev;
-                *prev = child;
+    while (!dirty_children.empty()) {
+        Cnode<Expr, Action> *child = dirty_children.back();
+        Cnode<Expr, Action> **prev = &any_node;
+        if (child != any_node) {
+            prev = &buckets[get_bucket(child->value, bucket_mask)];
+            while (*prev != child) {
+                prev = &(*prev)->next;
             }
-            prev = &((*prev)->next);
-            child = *prev;
         }
-    }
 
-    if (any_node) {
-        Cnode<Expr, Action> *new_node = any_node->build(path, is_copy);
-        if (new_node != any_node) {
-            delete any_node;
-            any_node = new_node;
+        Cnode<Expr, Action> *new_child = child->build(path, is_copy);
+        if (new_child != child) {
+            delete child;
+            *prev = new_child;
         }
+        dirty_children.pop_back();
     }
 }
 
@@ -550,6 +601,7 @@ Cnode<Expr, Action>::set_node_pointers()
          iter != rules.end(); ++iter)
     {
         (*iter)->node = this;
+        (*iter)->pos = iter;
     }
 
     if (bucket_mask < 0) {
@@ -710,6 +762,42 @@ Cnode<Expr, Action>::get_bucket(uint32_t value, int mask)
 template<class Expr, typename Data>
 bool get_field(uint32_t, const Data&, uint32_t, uint32_t&);
 
+/*
+ * Data types whose value for some field is a set (e.g. the groups a host
+ * belongs to) may specialize this to point 'begin' and 'end' at the values
+ * of 'field' in 'data', sorted in ascending order, and return 'true'.  An
+ * empty set means that 'data' has no value for the field, so only rules
+ * wildcarding it apply.  Traversal then looks all of the values up in one
+ * pass over the array, prefetching ahead, instead of calling get_field()
+ * for each.  Returning 'false', as the default does, has the values read
+ * one at a time with get_field().
+ */
+
+template<class Expr, typename Data>
+bool
+get_field_set(uint32_t, const Data&, const uint32_t*&, const uint32_t*&)
+{
+    return false;
+}
+
+/*
+ * Returns the child for 'value_', or NULL if there is none.
+ */
+
+template<class Expr, typename Action>
+Cnode<Expr, Action>*
+Cnode<Expr, Action>::find_child(uint32_t value_) const
+{
+    for (Cnode<Expr, Action> *child = buckets[get_bucket(value_, bucket_mask)];
+         child != NULL; child = child->next)
+    {
+        if (child->value == value_) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
 template<class Expr, typename Action>
 template<typename Data>
 void
@@ -728,17 +816,28 @@ Cnode<Expr, Action>::traverse(Cnode_result<Expr, Action, Data>& result,
         to_traverse.push_back(any_node);
     }
 
+    const uint32_t *values, *values_end;
+    if (get_field_set<Expr, Data>(split_field, *(result.data),
+                                  values, values_end)) {
+        for (const uint32_t *value = values; value != values_end; value++) {
+            if (values_end - value > SET_PREFETCH) {
+                __builtin_prefetch(&buckets[get_bucket(value[SET_PREFETCH],
+                                                       bucket_mask)]);
+            }
+            Cnode<Expr, Action> *child = find_child(*value);
+            if (child != NULL && (value == values || value[-1] != *value)) {
+                to_traverse.push_back(child);
+            }
+        }
+        return;
+    }
+
     uint32_t idx = 0;
 
     while (get_field<Expr, Data>(split_field, *(result.data), idx, rule_value)) {
-        int bucket = get_bucket(rule_value, bucket_mask);
-        for (Cnode<Expr, Action> *child = buckets[bucket]; child != NULL;
-             child = child->next)
-        {
-            if (child->value == rule_value) {
-                to_traverse.push_back(child);
-                break;
-            }
+        Cnode<Expr, Action> *child = find_child(rule_value);
+        if (child != NULL) {
+            to_traverse.push_back(child);
         }
         idx++;
     }
@@ -755,6 +854,24 @@ Cnode<Expr, Action>::traverse(Cnode_result<Expr, Action, Data>& result,
 }
 
 
+/*
+ * Drops 'child', which is about to be deleted, from 'dirty_children'.
+ */
+
+template<class Expr, typename Action>
+void
+Cnode<Expr, Action>::forget_dirty_child(Cnode<Expr, Action> *child)
+{
+    if (child->dirty) {
+        typename std::vector<Cnode<Expr, Action>*>::iterator iter
+            = std::find(dirty_children.begin(), dirty_children.end(), child);
+        if (iter != dirty_children.end()) {
+            dirty_children.erase(iter);
+        }
+    }
+}
+
+
 /*
  * Deletes any empty subtrees by recursively calling clean() on child nodes.
  * Returns 'true' if the node contains no subtrees and no rules (and thus the
@@ -777,6 +894,7 @@ Cnode<Expr, Action>::clean()
         while (child != NULL) {
             if (child->clean()) {
                 *prev = child->next;
+                forget_dirty_child(child);
                 delete child;
                 child = *prev;
             } else {
@@ -789,6 +907,7 @@ Cnode<Expr, Action>::clean()
 
     if (any_node != NULL) {
         if (any_node->clean()) {
+            forget_dirty_child(any_node);
             delete any_node;
             any_node = NULL;
         } else {
@@ -0,0 +1,503 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef  COMPILED_CLASSIFIER_HH
+#define  COMPILED_CLASSIFIER_HH
+
+#include <vector>
+#include <stdint.h>
+
+#include "classifier.hh"
+#include "cnode.hh"
+#include "cnode-result.hh"
+#include "rule.hh"
+
+/*
+ * Compiled classifier snapshot.
+ *
+ * A read-only copy of a Classifier's Cnode tree laid out in three contiguous
+ * arrays: a node table, open-addressed child tables indexed by the split
+ * field's value, and each node's rules in priority order.  Lookups walk array
+ * indexes instead of chasing bucket chains and list nodes, and touch far
+ * fewer cache lines once a classifier holds thousands of rules.
+ *
+ * The snapshot does not track changes to the classifier.  Callers should
+ * compare it against the classifier with is_current() and compile() it again
+ * if it is stale before each lookup, so that it is rebuilt lazily, at most
+ * once per batch of rule changes.
+ *
+ * Lookups fill in a Compiled_result, which is used exactly like a
+ * Cnode_result.
+ */
+
+namespace vigil {
+
+/* A rule and a copy of its priority, so that comparing priorities does not
+ * need to dereference the rule. */
+template<class Expr, typename Action>
+struct Compiled_rule {
+    uint32_t priority;
+    const Rule<Expr, Action>* rule;
+};
+
+template<class Expr, typename Action>
+class Compiled_classifier;
+
+template<class Expr, typename Action, typename Data>
+class Compiled_result {
+
+public:
+    typedef Compiled_rule<Expr, Action> Rule_ref;
+
+    Compiled_result(const Data *data_)
+        : data(data_), num_lists(0) { traversed.reserve(DEFAULT_VEC_SIZE); }
+
+    void push(const Rule_ref *begin, const Rule_ref *end);
+    const Rule<Expr, Action>* next();
+    void set_data(const Data *data_) { data = data_; }
+    void clear() { num_lists = 0; }
+
+private:
+    struct current_rule {
+        const Rule_ref *rule;
+        const Rule_ref *end;
+        bool ismatch;
+    };
+
+    const Data *data;
+    uint32_t num_lists;
+    std::vector<current_rule> traversed;
+
+    friend class Compiled_classifier<Expr, Action>;
+
+    Compiled_result();
+    Compiled_result(const Compiled_result&);
+    Compiled_result& operator=(const Compiled_result&);
+};
+
+template<class Expr, typename Action, typename Data>
+void
+Compiled_result<Expr, Action, Data>::push(const Rule_ref *begin,
+                                          const Rule_ref *end)
+{
+    if (begin != end) {
+        current_rule r;
+        r.rule = begin;
+        r.end = end;
+        r.ismatch = false;
+        if (num_lists == traversed.size()) {
+            traversed.push_back(r);
+        } else {
+            traversed[num_lists] = r;
+        }
+        ++num_lists;
+    }
+}
+
+/*
+ * Returns the highest priority rule that remains and matches 'data', or NULL
+ * if there is none.  Same as Cnode_result::next().
+ */
+
+template<class Expr, typename Action, typename Data>
+const Rule<Expr, Action>*
+Compiled_result<Expr, Action, Data>::next()
+{
+    const Rule<Expr, Action>* match = NULL;
+    uint32_t min_pri = 0;
+    uint32_t min_idx = 0;
+
+    for (uint32_t i = 0; i < num_lists;) {
+        current_rule& current = traversed[i];
+        const Rule_ref& ref = *current.rule;
+        if (match == NULL || ref.priority < min_pri) {
+            if (current.ismatch
+                || matches(ref.rule->id, ref.rule->expr, *data)) {
+                match = ref.rule;
+                min_pri = ref.priority;
+                min_idx = i;
+                current.ismatch = true;
+                ++i;
+            } else if (++current.rule == current.end) {
+                current = traversed[--num_lists];
+            }
+        } else {
+            ++i;
+        }
+    }
+
+    if (match != NULL) {
+        current_rule& current = traversed[min_idx];
+        if (++current.rule == current.end) {
+            current = traversed[--num_lists];
+        } else {
+            current.ismatch = false;
+        }
+    }
+
+    return match;
+}
+
+template<class Expr, typename Action>
+class Compiled_classifier {
+
+public:
+    Compiled_classifier() : compiled(false), generation(0), n_rule_nodes(0) { }
+
+    /* Returns true if the snapshot reflects 'classifier' as it is now. */
+    bool is_current(const Classifier<Expr, Action>& classifier) const {
+        return compiled && generation == classifier.get_generation();
+    }
+
+    void compile(const Classifier<Expr, Action>&);
+
+    template<typename Data>
+    void get_rules(Compiled_result<Expr, Action, Data>&);
+    template<typename Data>
+    void get_rules_batch(Compiled_result<Expr, Action, Data>* const[], size_t);
+
+    size_t n_nodes() const { return nodes.size(); }
+
+private:
+    typedef Cnode<Expr, Action> Node_type;
+    typedef Compiled_rule<Expr, Action> Rule_ref;
+
+    static const uint32_t LEAF = ~(uint32_t) 0;
+
+    /* As in Cnode::traverse(). */
+    static const int SET_PREFETCH = 4;
+
+    struct Node {
+        uint32_t split_field;   /* LEAF if the node has no children. */
+        uint32_t shift;         /* 32 - log2(child table size). */
+        uint32_t child_begin;   /* Index of first child slot. */
+        uint32_t child_mask;    /* Child table size - 1. */
+        int32_t any_child;      /* Index of "any" child, or -1. */
+        uint32_t rule_begin;    /* Range of the node's rules in 'rules'. */
+        uint32_t rule_end;
+    };
+
+    struct Child_slot {
+        uint32_t value;
+        int32_t node;           /* Index in 'nodes', or -1 if slot is empty. */
+    };
+
+    bool compiled;
+    uint32_t generation;
+    std::vector<Node> nodes;
+    std::vector<Child_slot> slots;
+    std::vector<Rule_ref> rules;
+    std::vector<uint32_t> to_traverse;
+    uint32_t n_rule_nodes;      /* Number of nodes with rules. */
+
+    /* A lookup in progress in get_rules_batch(). */
+    struct Lane {
+        int32_t next;           /* Node to visit next, or -1 if done. */
+        std::vector<uint32_t> to_traverse;
+    };
+    std::vector<Lane> lanes;
+
+    uint32_t add_node(const Node_type *);
+    template<typename Data>
+    void visit(const Node&, Compiled_result<Expr, Action, Data>&,
+               std::vector<uint32_t>&) const;
+    void prefetch(uint32_t node) const;
+
+    static uint32_t hash(uint32_t value, uint32_t shift) {
+        return (value * HASH_MULTIPLIER) >> shift;
+    }
+
+    /* Returns the index of the child of 'node', whose child table is
+     * 'table', for 'value', or -1 if there is none. */
+    static int32_t find_child(const Node& node, const Child_slot *table,
+                              uint32_t value) {
+        for (uint32_t slot = hash(value, node.shift); table[slot].node >= 0;
+             slot = (slot + 1) & node.child_mask)
+        {
+            if (table[slot].value == value) {
+                return table[slot].node;
+            }
+        }
+        return -1;
+    }
+
+    Compiled_classifier(const Compiled_classifier&);
+    Compiled_classifier& operator=(const Compiled_classifier&);
+};
+
+/*
+ * Replaces the snapshot by one of 'classifier''s tree as it is now.
+ */
+
+template<class Expr, typename Action>
+void
+Compiled_classifier<Expr, Action>::compile(
+    const Classifier<Expr, Action>& classifier)
+{
+    nodes.clear();
+    slots.clear();
+    rules.clear();
+    n_rule_nodes = 0;
+    add_node(classifier.root.get());
+
+    /* A lookup visits each node at most once, so this is as much room as
+     * get_rules() can need. */
+    to_traverse.reserve(nodes.size());
+    for (size_t i = 0; i < lanes.size(); i++) {
+        lanes[i].to_traverse.reserve(nodes.size());
+    }
+
+    generation = classifier.get_generation();
+    compiled = true;
+}
+
+/*
+ * Appends 'cnode' and its descendents to the snapshot and returns the index of
+ * 'cnode''s entry in 'nodes'.
+ */
+
+template<class Expr, typename Action>
+uint32_t
+Compiled_classifier<Expr, Action>::add_node(const Node_type *cnode)
+{
+    uint32_t index = nodes.size();
+    nodes.push_back(Node());
+
+    Node node;
+    node.rule_begin = rules.size();
+    for (typename Node_type::Rule_list::const_iterator iter
+             = cnode->rules.begin(); iter != cnode->rules.end(); ++iter)
+    {
+        Rule_ref ref;
+        ref.priority = (*iter)->priority;
+        ref.rule = *iter;
+        rules.push_back(ref);
+    }
+    node.rule_end = rules.size();
+    if (node.rule_end != node.rule_begin) {
+        n_rule_nodes++;
+    }
+    node.any_child = -1;
+
+    if (cnode->bucket_mask < 0) {
+        node.split_field = LEAF;
+        node.shift = 0;
+        node.child_begin = node.child_mask = 0;
+        nodes[index] = node;
+        return index;
+    }
+
+    /* Size the child table for a load factor of at most 1/2. */
+    uint32_t n_children = 0;
+    for (int i = 0; i <= cnode->bucket_mask; i++) {
+        for (const Node_type *child = cnode->buckets[i]; child != NULL;
+             child = child->next)
+        {
+            n_children++;
+        }
+    }
+    uint32_t n_slots = 2;
+    node.shift = 31;
+    while (n_slots < n_children * 2) {
+        n_slots <<= 1;
+        node.shift--;
+    }
+
+    node.split_field = cnode->split_field;
+    node.child_begin = slots.size();
+    node.child_mask = n_slots - 1;
+    Child_slot empty;
+    empty.value = 0;
+    empty.node = -1;
+    slots.resize(slots.size() + n_slots, empty);
+
+    for (int i = 0; i <= cnode->bucket_mask; i++) {
+        for (const Node_type *child = cnode->buckets[i]; child != NULL;
+             child = child->next)
+        {
+            int32_t child_index = add_node(child);
+            uint32_t slot = hash(child->value, node.shift);
+            while (slots[node.child_begin + slot].node >= 0) {
+                slot = (slot + 1) & node.child_mask;
+            }
+            slots[node.child_begin + slot].value = child->value;
+            slots[node.child_begin + slot].node = child_index;
+        }
+    }
+    if (cnode->any_node != NULL) {
+        node.any_child = add_node(cnode->any_node);
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+/*
+ * Populates 'result' with the rules that may match its data, like
+ * Classifier::get_rules().  Does not allocate memory once 'result' has been
+ * used with this snapshot.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Compiled_classifier<Expr, Action>::get_rules(
+    Compiled_result<Expr, Action, Data>& result)
+{
+    result.traversed.reserve(n_rule_nodes);
+    to_traverse.push_back(0);
+    while (!to_traverse.empty()) {
+        const Node& node = nodes[to_traverse.back()];
+        to_traverse.pop_back();
+        visit(node, result, to_traverse);
+    }
+}
+
+/*
+ * Does get_rules() for each of the 'n' 'results' at once, in the manner of
+ * Classifier::get_rules_batch(): the lookups take turns a node at a time, and
+ * each prefetches the rules of the node it visits next, and the node after
+ * that, before handing over.  Does not allocate memory once as many results
+ * have been looked up in a batch with this snapshot.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Compiled_classifier<Expr, Action>::get_rules_batch(
+    Compiled_result<Expr, Action, Data>* const results[], size_t n)
+{
+    if (n == 1) {
+        get_rules(*results[0]);
+        return;
+    }
+
+    if (lanes.size() < n) {
+        lanes.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            lanes[i].to_traverse.reserve(nodes.size());
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        results[i]->traversed.reserve(n_rule_nodes);
+        lanes[i].next = 0;
+    }
+
+    size_t n_busy = n;
+    while (n_busy > 0) {
+        n_busy = 0;
+        for (size_t i = 0; i < n; i++) {
+            Lane& lane = lanes[i];
+            if (lane.next < 0) {
+                continue;
+            }
+
+            visit(nodes[lane.next], *results[i], lane.to_traverse);
+            if (lane.to_traverse.empty()) {
+                lane.next = -1;
+                continue;
+            }
+            lane.next = lane.to_traverse.back();
+            lane.to_traverse.pop_back();
+            prefetch(lane.next);
+            if (!lane.to_traverse.empty()) {
+                __builtin_prefetch(&nodes[lane.to_traverse.back()]);
+            }
+            n_busy++;
+        }
+    }
+}
+
+/*
+ * Adds 'node''s rules to 'result' and pushes the children of 'node' that
+ * 'result''s data leads to onto 'to_visit'.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Compiled_classifier<Expr, Action>::visit(
+    const Node& node, Compiled_result<Expr, Action, Data>& result,
+    std::vector<uint32_t>& to_visit) const
+{
+    const Data& data = *result.data;
+
+    if (node.rule_begin != node.rule_end) {
+        const Rule_ref *first = &rules[node.rule_begin];
+        result.push(first, first + (node.rule_end - node.rule_begin));
+    }
+    if (node.split_field == LEAF) {
+        return;
+    }
+
+    if (node.any_child >= 0) {
+        to_visit.push_back(node.any_child);
+    }
+
+    const Child_slot *table = &slots[node.child_begin];
+    const uint32_t *values, *values_end;
+    if (get_field_set<Expr, Data>(node.split_field, data, values,
+                                  values_end)) {
+        for (const uint32_t *value = values; value != values_end; value++) {
+            if (values_end - value > SET_PREFETCH) {
+                __builtin_prefetch(&table[hash(value[SET_PREFETCH],
+                                               node.shift)]);
+            }
+            int32_t child = find_child(node, table, *value);
+            if (child >= 0 && (value == values || value[-1] != *value)) {
+                to_visit.push_back(child);
+            }
+        }
+        return;
+    }
+
+    uint32_t idx = 0;
+    uint32_t value;
+    while (get_field<Expr, Data>(node.split_field, data, idx, value)) {
+        int32_t child = find_child(node, table, value);
+        if (child >= 0) {
+            to_visit.push_back(child);
+        }
+        idx++;
+    }
+
+    if (idx == 0) {
+        for (uint32_t slot = 0; slot <= node.child_mask; slot++) {
+            if (table[slot].node >= 0) {
+                to_visit.push_back(table[slot].node);
+            }
+        }
+    }
+}
+
+/*
+ * Asks the CPU to start loading the rules of node 'index'.
+ */
+
+template<class Expr, typename Action>
+void
+Compiled_classifier<Expr, Action>::prefetch(uint32_t index) const
+{
+    const Node& node = nodes[index];
+    if (node.rule_begin != node.rule_end) {
+        __builtin_prefetch(&rules[node.rule_begin]);
+    }
+}
+
+} // namespace vigil
+
+#endif
@@ -43,7 +43,7 @@ struct Datapath_join_event
                         datapathid mgmt_id_ = datapathid::from_net(0));
 
     // -- only for use within python
-    Datapath_join_event() : Event(static_get_name()) { }
+    Datapath_join_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Datapath_join_event";
@@ -77,7 +77,7 @@ struct Datapath_join_event
 
 inline
 Datapath_join_event::Datapath_join_event(const Datapath_join_event& dje)
-  : Event(static_get_name()), Ofp_msg_event(dje.get_ofp_msg(), dje.buf),
+  : Event(static_get_name(), this), Ofp_msg_event(dje.get_ofp_msg(), dje.buf),
     n_buffers(dje.n_buffers), n_tables(dje.n_tables),
     capabilities(dje.capabilities), actions(dje.actions),
     mgmt_id(dje.mgmt_id)
@@ -95,7 +95,7 @@ inline
 Datapath_join_event::Datapath_join_event(const ofp_switch_features *osf,
                                          std::auto_ptr<Buffer> buf,
                                          datapathid mgmt_id_)
-    : Event(static_get_name()), Ofp_msg_event(&osf->header, buf)
+    : Event(static_get_name(), this), Ofp_msg_event(&osf->header, buf)
 {
     datapath_id  = datapathid::from_net(osf->datapath_id); 
     n_buffers    = ntohl(osf->n_buffers);
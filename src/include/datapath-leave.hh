@@ -34,10 +34,10 @@ struct Datapath_leave_event
     : public Event
 {
     Datapath_leave_event(datapathid datapath_id_)
-        : Event(static_get_name()), datapath_id(datapath_id_) { }
+        : Event(static_get_name(), this), datapath_id(datapath_id_) { }
 
     // -- only for use within python
-    Datapath_leave_event() : Event(static_get_name()) { }
+    Datapath_leave_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Datapath_leave_event";
@@ -38,7 +38,7 @@ struct Desc_stats_in_event
                         std::auto_ptr<Buffer> buf);
 
     // -- only for use within python
-    Desc_stats_in_event() : Event(static_get_name()) { }
+    Desc_stats_in_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Desc_stats_in_event";
@@ -61,7 +61,7 @@ inline
 Desc_stats_in_event::Desc_stats_in_event(const datapathid& dpid,
                                          const ofp_stats_reply *osr,
                                          std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()), Ofp_msg_event(&osr->header, buf)
+    : Event(static_get_name(), this), Ofp_msg_event(&osr->header, buf)
 {
     datapath_id  = dpid;
 
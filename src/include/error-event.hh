@@ -37,7 +37,7 @@ struct Error_event
 {
     Error_event(datapathid datapath_id_,
                 const ofp_error_msg *oem, std::auto_ptr<Buffer> buffer)
-        : Event(static_get_name()),
+        : Event(static_get_name(), this),
           Ofp_msg_event(&oem->header, buffer),
           datapath_id(datapath_id_),
           type(ntohs(oem->type)),
@@ -19,6 +19,7 @@
 #define EVENT_DISPATCHER_HH 1
 
 #include <boost/function.hpp>
+#include <stdint.h>
 #include "event.hh"
 #include "poll-loop.hh"
 
@@ -42,6 +43,14 @@ struct Event_dispatcher_impl;
  * One convenient feature of this event dispatcher is that event handlers may
  * block without holding up processing of further events: they will be
  * dispatched by the Poll_loop in another thread.
+ *
+ * Queued events are divided into classes, each with its own queue.  Each
+ * poll dispatches up to a class's weight in events from each class, highest
+ * priority first, so that a flood of low-priority events cannot delay the
+ * others by more than one round.  A class may also limit the number of
+ * events it queues, beyond which newly posted events are dropped.  An event
+ * that waits in a queue may thus be handled after events that were produced
+ * after it but dispatched immediately or queued in a higher class.
  */
 class Event_dispatcher
     : public Pollable
@@ -57,16 +66,63 @@ public:
     typedef boost::function<Handler_signature> Handler;
     void add_handler(const Event_name&, const Handler&, int order);
 
-    /* Appends 'event' to the list of events to be handled in the main loop. */
+    /* Returns true if at least one handler is registered for events of the
+     * given 'type'.  Lets producers skip building events nobody consumes. */
+    bool has_handlers(const Event_name&) const;
+    bool has_handlers(Event_type_id) const;
+
+    /* Appends 'event' to the list of events to be handled in the main loop.
+     *
+     * Unlike the other member functions, may be called from any thread
+     * created by co_thread_create() or assimilated, including native threads
+     * and threads in other groups than the one that polls the dispatcher. */
     void post(Event* event);
 
-    /* Dispatches 'event' immediately, bypassing the event queue. */
+    /* Event classes, in decreasing order of priority.  Events are in class
+     * CONTROL unless set_event_class() says otherwise. */
+    enum Event_class {
+        CONTROL,                /* Switch and controller housekeeping. */
+        TOPOLOGY,               /* Datapath and port changes. */
+        STATS,                  /* Statistics replies. */
+        PACKET_IN,              /* Packets sent up by switches. */
+        N_EVENT_CLASSES
+    };
+
+    /* Puts events of the given type in class 'c'. */
+    void set_event_class(const Event_name&, Event_class c);
+    Event_class get_event_class(Event_type_id) const;
+
+    /* Sets the number of class 'c' events dispatched per poll to 'weight'
+     * (at least 1) and the number that may be queued at once to 'max_queued'
+     * (0 for no limit).  set_class_max_queued() sets only the latter. */
+    void set_class_limits(Event_class c, unsigned int weight,
+                          size_t max_queued);
+    void set_class_max_queued(Event_class c, size_t max_queued);
+
+    /* Dispatches 'event' immediately, bypassing the event queue.  Looks up
+     * handlers by the event's type id, which indexes a table of handlers
+     * sorted by 'order', so no name hashing happens per event. */
     void dispatch(const Event& event);
 
     /* Pollable implementation.  Processes pending events when polled.  */
     bool poll();
     void wait();
 
+    /* Queue statistics. */
+    struct Stats {
+        uint64_t n_posted;      /* Events posted. */
+        uint64_t n_remote;      /* Of those, posted from other groups. */
+        uint64_t n_dispatched;  /* Events dispatched from the queue. */
+        size_t depth;           /* Events currently queued. */
+        size_t max_depth;       /* Largest number of events queued at once. */
+        size_t max_batch;       /* Most posted events collected by one poll. */
+        struct {
+            size_t depth;       /* Events of the class currently queued. */
+            uint64_t n_dropped; /* Events dropped because of the limit. */
+        } classes[N_EVENT_CLASSES];
+    };
+    Stats get_stats() const;
+
 private:
     Event_dispatcher_impl* p;
 };
@@ -28,6 +28,10 @@ enum Disposition { CONTINUE, STOP };
 
 typedef std::string Event_name;
 
+/* A small integer that stands for an Event_name within this process.  Ids are
+ * assigned densely, starting from 0, the first time each name is seen. */
+typedef unsigned int Event_type_id;
+
 /** @defgroup noxevents NOX Events
  *
  * An Event represents a low-level or high-level event in the network.  The
@@ -57,16 +61,39 @@ public:
     /* Get event name */
     Event_name get_name() const;
 
+    /* Get the type id for the event's name.  Cheaper to compare and to look
+     * up handlers by than the name itself. */
+    Event_type_id get_type_id() const { return type_id; }
+
+    /* Returns the type id for 'name', assigning one if 'name' has not been
+     * seen before.  May be called from any thread. */
+    static Event_type_id get_type_id(const Event_name& name);
+
     /* For debugging purposes only. */
     std::string get_class_name() const; 
 
 protected:
     Event(const Event_name&);
 
+    /* For event classes T that have a static_get_name() function, whose
+     * constructors call Event(static_get_name(), this).  Looks up the type id
+     * once per class instead of once per event. */
+    template <class T>
+    Event(const Event_name& name_, const T*)
+        : name(name_), type_id(class_type_id<T>(name_)) { }
+
     void set_name(const Event_name&);
 
 private:
     Event_name name;
+    Event_type_id type_id;
+
+    template <class T>
+    static Event_type_id class_type_id(const Event_name& name_)
+    {
+        static const Event_type_id id = get_type_id(name_);
+        return id;
+    }
 };
 
 } // namespace vigil
@@ -19,6 +19,7 @@
 #define  PACKET_EXPR_HH
 
 #include <string>
+#include <vector>
 
 #include <stdint.h>
 
@@ -146,6 +147,23 @@ public:
     uint8_t nw_proto;
 };
 
+/*
+ * A Flow along with the groups its source and destination belong to, so that
+ * it can be classified on GROUP_SRC and GROUP_DST as well.  Both group lists
+ * must be kept sorted in ascending order.  An empty list stands for the group
+ * 0, "no group", as in NAT_enforcer, so 0 should not name a real group.
+ * Since a host may belong to hundreds of groups, the classifier looks the
+ * lists up with get_field_set() rather than a value at a time.
+ */
+
+struct Grouped_flow {
+    Grouped_flow(const Flow *flow_) : flow(flow_) { }
+
+    const Flow *flow;
+    std::vector<uint32_t> src_groups;
+    std::vector<uint32_t> dst_groups;
+};
+
 
 /*
  * This function should be defined for every Data type that
@@ -166,6 +184,22 @@ template <>
 bool
 get_field<Packet_expr, Packet_expr>(uint32_t field, const Packet_expr& expr,
                                     uint32_t idx, uint32_t& value);
+template <>
+bool
+get_field<Packet_expr, Grouped_flow>(uint32_t field, const Grouped_flow& flow,
+                                     uint32_t idx, uint32_t& value);
+
+/*
+ * Points 'begin' and 'end' at the groups of a Grouped_flow for GROUP_SRC and
+ * GROUP_DST.  See get_field_set() in cnode.hh.
+ */
+
+template <>
+bool
+get_field_set<Packet_expr, Grouped_flow>(uint32_t field,
+                                         const Grouped_flow& flow,
+                                         const uint32_t*& begin,
+                                         const uint32_t*& end);
 
 /*
  * This function should be defined for every Data type that
@@ -183,6 +217,9 @@ bool matches(uint32_t rule_id, const Packet_expr&, const Flow&);
 template <>
 bool matches(uint32_t rule_id, const Packet_expr&, const Packet_expr&);
 
+template <>
+bool matches(uint32_t rule_id, const Packet_expr&, const Grouped_flow&);
+
 } // namespace vigil
 
 
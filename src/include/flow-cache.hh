@@ -0,0 +1,240 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FLOW_CACHE_HH
+#define FLOW_CACHE_HH 1
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include "flow.hh"
+
+/*
+ * Exact-match flow cache.
+ *
+ * Remembers a set of values (in Packet_classifier, the highest-priority
+ * rules that match) for each of the most recently seen Flows, so that
+ * looking a Flow up again costs one hash probe and one comparison of
+ * Flow_keys.
+ * Each entry records the generation of whatever its set was computed from,
+ * and is ignored once the caller passes a different generation, so the
+ * caller invalidates the whole cache by bumping a counter.
+ *
+ * The cache holds a fixed number of entries, allocated when it is sized, and
+ * evicts with the CLOCK algorithm: a hand sweeps the entries, clearing their
+ * reference bits, and takes the first one that was not used since the last
+ * sweep.  Lookups and insertions do not allocate memory once each entry's
+ * vector has grown to the size of the sets stored in it.
+ */
+
+namespace vigil {
+
+struct Flow_cache_stats {
+    Flow_cache_stats() : hits(0), misses(0), stale(0), evictions(0) { }
+
+    uint64_t hits;
+    uint64_t misses;        /* Includes 'stale'. */
+    uint64_t stale;         /* Misses on an entry from an older generation. */
+    uint64_t evictions;
+
+    double hit_rate() const {
+        return hits + misses ? (double) hits / (hits + misses) : 0.0;
+    }
+};
+
+template<typename T>
+class Flow_cache {
+
+public:
+    typedef std::vector<const T*> Value;
+
+    Flow_cache(size_t n_entries = 0) { resize(n_entries); }
+
+    void resize(size_t n_entries);
+    size_t size() const { return entries.size(); }
+    void clear();
+
+    const Value* lookup(const Flow&, uint32_t generation);
+    Value* insert(const Flow&, uint32_t generation);
+
+    const Flow_cache_stats& get_stats() const { return stats; }
+
+private:
+    struct Entry {
+        Flow_key key;
+        uint32_t hash;
+        uint32_t generation;
+        int32_t next;           /* Next entry in the same bucket, or -1. */
+        bool referenced;        /* Used since the hand last passed? */
+        Value value;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<int32_t> buckets;   /* Heads of chains, or -1. */
+    uint32_t bucket_mask;
+    uint32_t n_used;                /* Entries in use are [0, n_used). */
+    uint32_t hand;
+    Flow_cache_stats stats;
+
+    int32_t find(const Flow_key&, uint32_t hash) const;
+    void unlink(uint32_t);
+
+    Flow_cache(const Flow_cache&);
+    Flow_cache& operator=(const Flow_cache&);
+};
+
+/*
+ * Makes room for 'n_entries' entries, 0 to disable the cache, dropping all of
+ * the current ones.
+ */
+
+template<typename T>
+void
+Flow_cache<T>::resize(size_t n_entries)
+{
+    size_t n_buckets = 1;
+    while (n_buckets < n_entries) {
+        n_buckets *= 2;
+    }
+    std::vector<Entry>(n_entries).swap(entries);
+    std::vector<int32_t>(n_buckets, -1).swap(buckets);
+    bucket_mask = n_buckets - 1;
+    n_used = 0;
+    hand = 0;
+}
+
+/*
+ * Drops all of the entries, keeping the memory allocated for them.
+ */
+
+template<typename T>
+void
+Flow_cache<T>::clear()
+{
+    std::fill(buckets.begin(), buckets.end(), -1);
+    n_used = 0;
+    hand = 0;
+}
+
+template<typename T>
+int32_t
+Flow_cache<T>::find(const Flow_key& key, uint32_t hash) const
+{
+    for (int32_t i = buckets[hash & bucket_mask]; i >= 0;
+         i = entries[i].next) {
+        const Entry& e = entries[i];
+        if (e.hash == hash && e.key == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Removes entry 'idx' from its bucket's chain.
+ */
+
+template<typename T>
+void
+Flow_cache<T>::unlink(uint32_t idx)
+{
+    int32_t *p = &buckets[entries[idx].hash & bucket_mask];
+    while (*p != (int32_t) idx) {
+        p = &entries[*p].next;
+    }
+    *p = entries[idx].next;
+}
+
+/*
+ * Returns the set cached for 'flow' as of 'generation', or NULL if there is
+ * none.
+ */
+
+template<typename T>
+const typename Flow_cache<T>::Value*
+Flow_cache<T>::lookup(const Flow& flow, uint32_t generation)
+{
+    if (entries.empty()) {
+        return NULL;
+    }
+
+    Flow_key key(flow);
+    int32_t idx = find(key, key.hash());
+    if (idx >= 0) {
+        Entry& e = entries[idx];
+        if (e.generation == generation) {
+            e.referenced = true;
+            stats.hits++;
+            return &e.value;
+        }
+        stats.stale++;
+    }
+    stats.misses++;
+    return NULL;
+}
+
+/*
+ * Returns an empty set for the caller to fill in for 'flow' as of
+ * 'generation', replacing any that is cached for 'flow' and evicting
+ * another flow's if the cache is full.  Returns NULL if the cache is
+ * disabled.
+ */
+
+template<typename T>
+typename Flow_cache<T>::Value*
+Flow_cache<T>::insert(const Flow& flow, uint32_t generation)
+{
+    if (entries.empty()) {
+        return NULL;
+    }
+
+    Flow_key key(flow);
+    uint32_t hash = key.hash();
+    int32_t idx = find(key, hash);
+    if (idx < 0) {
+        if (n_used < entries.size()) {
+            idx = n_used++;
+        } else {
+            while (entries[hand].referenced) {
+                entries[hand].referenced = false;
+                hand = (hand + 1) % entries.size();
+            }
+            idx = hand;
+            hand = (hand + 1) % entries.size();
+            unlink(idx);
+            stats.evictions++;
+        }
+
+        Entry& e = entries[idx];
+        e.key = key;
+        e.hash = hash;
+        e.next = buckets[hash & bucket_mask];
+        buckets[hash & bucket_mask] = idx;
+    }
+
+    Entry& e = entries[idx];
+    e.generation = generation;
+    e.referenced = true;
+    e.value.clear();
+    return &e.value;
+}
+
+} // namespace vigil
+
+#endif /* flow-cache.hh */
@@ -87,6 +87,8 @@ struct Flow {
    */
   Flow(const Flow& flow_, uint64_t cookie_=0, bool invalid_=false);
   /** Constructor from packet
+   *
+   * Tries parse_fast() first and falls back to parse().
    */
   Flow(uint16_t in_port_, const Buffer&, uint64_t cookie_=0);
   /** Constructor from ofp_match
@@ -124,19 +126,109 @@ struct Flow {
   /** \brief Return hash code
    */
   uint64_t hash_code() const;
+  /** \brief Parse the headers of an Ethernet frame
+   *
+   * Sets every field except in_port and cookie from the frame in
+   * 'buffer', which may be anything: 802.2, VLAN-tagged, ARP, IPv4 with
+   * truncated headers and so on.
+   */
+  void parse(const Buffer&);
+  /** \brief Parse a common Ethernet frame quickly
+   *
+   * Like parse(), but only for Ethernet II frames, with at most one VLAN
+   * tag, carrying IPv4 with complete TCP, UDP or ICMP headers (or an IPv4
+   * fragment or another protocol).  Reads every header at a fixed offset
+   * with one bounds check per layer.
+   *
+   * @return false, possibly with some fields changed, for any other frame
+   */
+  bool parse_fast(const Buffer&);
   
 };
 bool operator==(const Flow& lhs, const Flow& rhs);
 bool operator!=(const Flow& lhs, const Flow& rhs);
 std::ostream& operator<<(std::ostream&, const Flow&);
 
+/** \brief Packed, canonical form of a Flow
+ *
+ * The fields that operator==(const Flow&, const Flow&) compares, at fixed
+ * byte offsets, in network byte order, with the padding zeroed.  Two Flows
+ * are equal exactly when their keys are equal byte for byte, so keys
+ * compare with memcmp() and hash as five words.  The 33 bytes of fields
+ * need 40 bytes of key.
+ */
+struct Flow_key {
+  /** Packed fields
+   */
+  uint64_t words[5];
+
+  /** Key of the all-zero Flow
+   */
+  Flow_key() { memset(words, 0, sizeof words); }
+  /** Packs 'flow'
+   */
+  explicit Flow_key(const Flow& flow) {
+    uint8_t* p = reinterpret_cast<uint8_t*>(words);
+    memset(words, 0, sizeof words);
+    memcpy(p, &flow.in_port, 2);
+    memcpy(p + 2, &flow.dl_vlan, 2);
+    memcpy(p + 4, &flow.dl_type, 2);
+    p[6] = flow.dl_vlan_pcp;
+    p[7] = flow.nw_proto;
+    memcpy(p + 8, &flow.nw_src, 4);
+    memcpy(p + 12, &flow.nw_dst, 4);
+    memcpy(p + 16, &flow.tp_src, 2);
+    memcpy(p + 18, &flow.tp_dst, 2);
+    p[20] = flow.nw_tos;
+    memcpy(p + 24, flow.dl_src.octet, ethernetaddr::LEN);
+    memcpy(p + 32, flow.dl_dst.octet, ethernetaddr::LEN);
+  }
+
+  /** \brief Return hash code
+   *
+   * A fast, non-cryptographic hash in the style of xxHash64.  Unlike
+   * Flow::hash_code(), which is an MD5 digest, it is not meant to be
+   * stable across hosts or releases.
+   */
+  uint64_t hash() const {
+    static const uint64_t P1 = 0x9e3779b185ebca87ULL;
+    static const uint64_t P2 = 0xc2b2ae3d27d4eb4fULL;
+    static const uint64_t P3 = 0x165667b19e3779f9ULL;
+    uint64_t h = P3 + sizeof words;
+    for (int i = 0; i < 5; i++) {
+      uint64_t k = words[i] * P2;
+      k = (k << 31 | k >> 33) * P1;
+      h ^= k;
+      h = (h << 27 | h >> 37) * P1 + P3;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+  }
+
+  bool operator==(const Flow_key& that) const {
+    return !memcmp(words, that.words, sizeof words);
+  }
+  bool operator!=(const Flow_key& that) const {
+    return !(*this == that);
+  }
+};
+
 } // namespace vigil
 
 ENTER_HASH_NAMESPACE
 template <>
 struct hash<vigil::Flow> {
   std::size_t operator() (const vigil::Flow& flow) const {
-    return HASH_NAMESPACE::hash<uint64_t>()(flow.hash_code());
+    return vigil::Flow_key(flow).hash();
+  }
+};
+template <>
+struct hash<vigil::Flow_key> {
+  std::size_t operator() (const vigil::Flow_key& key) const {
+    return key.hash();
   }
 };
 EXIT_HASH_NAMESPACE
@@ -0,0 +1,74 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LINK_WEIGHER_HH
+#define LINK_WEIGHER_HH 1
+
+#include <vector>
+#include <stdint.h>
+
+/*
+ * Turns samples of the load on a link, as a fraction of its capacity, into a
+ * weight for Route_table, so that shortest paths steer around busy links.
+ *
+ * Samples are smoothed by an exponentially weighted moving average, which
+ * moves 'alpha' of the way from the old average to each new sample.  The
+ * smoothed load is then put in one of a few levels split by thresholds, and
+ * a link at level i weighs 2^i: with the default thresholds of 0.5, 0.75
+ * and 0.9, a link weighs 1, 2, 4 or 8.  Weights change only when the level
+ * does, so routes are searched again only when a load crosses a threshold,
+ * not on every sample.  To keep a load that hovers around a threshold from
+ * moving a link back and forth, a link drops to a lower level only once its
+ * load is 'hysteresis' below the threshold it crossed going up.
+ */
+
+namespace vigil {
+
+class Link_weigher {
+
+public:
+    /* The smoothed load on one link. */
+    struct Load {
+        Load() : value(0), level(0), sampled(false) { }
+
+        double value;
+        unsigned int level;
+        bool sampled;           /* False until the first sample. */
+    };
+
+    Link_weigher();
+
+    void set_alpha(double alpha) { this->alpha = alpha; }
+    void set_hysteresis(double hysteresis) { this->hysteresis = hysteresis; }
+    bool set_thresholds(const std::vector<double>&);
+
+    bool sample(Load&, double load) const;
+
+    /* Returns the weight of a link with 'load'. */
+    uint16_t weight(const Load& load) const { return 1 << load.level; }
+
+    static const unsigned int MAX_LEVELS = 8;
+
+private:
+    double alpha;
+    double hysteresis;
+    std::vector<double> thresholds;
+};
+
+} // namespace vigil
+
+#endif /* link-weigher.hh */
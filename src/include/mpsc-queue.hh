@@ -0,0 +1,114 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MPSC_QUEUE_HH
+#define MPSC_QUEUE_HH 1
+
+#include <boost/noncopyable.hpp>
+
+namespace vigil {
+
+/* A lock-free FIFO queue with any number of producers and a single consumer.
+ *
+ * push() may be called concurrently from any number of threads, native or
+ * cooperative, in any thread group.  pop() must only be called by one thread
+ * at a time, normally always the same one.
+ *
+ * This is Dmitry Vyukov's non-intrusive MPSC queue: a producer swings 'head'
+ * to its node with one atomic exchange and then links the previous node to
+ * it.  Between those two steps the queue looks shorter to the consumer than
+ * it is, so pop() may report empty while a push() is still completing; the
+ * producer is then responsible for waking the consumer afterward. */
+template <typename T>
+class Mpsc_queue
+    : boost::noncopyable
+{
+public:
+    Mpsc_queue();
+    ~Mpsc_queue();
+
+    void push(const T&);
+    bool pop(T&);
+
+private:
+    struct Node {
+        Node* volatile next;
+        T value;
+
+        Node() : next(0), value() { }
+        Node(const T& value_) : next(0), value(value_) { }
+    };
+
+    Node* volatile head;        /* Most recently pushed node. */
+    Node* tail;                 /* Consumer only: node before the next one. */
+};
+
+template <typename T>
+Mpsc_queue<T>::Mpsc_queue()
+{
+    head = tail = new Node;
+}
+
+/* Destroys the queue.  Values still queued are destroyed without being
+ * popped. */
+template <typename T>
+Mpsc_queue<T>::~Mpsc_queue()
+{
+    while (tail) {
+        Node* next = tail->next;
+        delete tail;
+        tail = next;
+    }
+}
+
+/* Appends 'value' to the queue. */
+template <typename T>
+void
+Mpsc_queue<T>::push(const T& value)
+{
+    Node* node = new Node(value);
+
+    /* __sync_lock_test_and_set() is only an acquire barrier, but 'node' must
+     * be fully written before it becomes reachable. */
+    __sync_synchronize();
+    Node* prev = __sync_lock_test_and_set(&head, node);
+    prev->next = node;
+}
+
+/* Removes the value at the front of the queue into 'value' and returns true,
+ * or returns false if the queue is empty. */
+template <typename T>
+bool
+Mpsc_queue<T>::pop(T& value)
+{
+    Node* next = tail->next;
+    if (!next) {
+        return false;
+    }
+    __sync_synchronize();
+
+    /* 'next' becomes the new dummy node. */
+    value = next->value;
+    next->value = T();
+    delete tail;
+    tail = next;
+    return true;
+}
+
+} // namespace vigil
+
+#endif /* mpsc-queue.hh */
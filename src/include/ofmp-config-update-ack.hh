@@ -57,7 +57,7 @@ private:
 inline
 Ofmp_config_update_ack_event::Ofmp_config_update_ack_event(datapathid id_,
         const ofmp_config_update_ack *ocua, int msg_len)
-    : Event(static_get_name()), mgmt_id(id_)
+    : Event(static_get_name(), this), mgmt_id(id_)
 {
     format = ntohl(ocua->format);
     flags = ntohl(ocua->flags);
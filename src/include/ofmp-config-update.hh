@@ -55,7 +55,7 @@ private:
 inline
 Ofmp_config_update_event::Ofmp_config_update_event(datapathid id_,
         const ofmp_config_update *ocu, int msg_len)
-    : Event(static_get_name()), mgmt_id(id_)
+    : Event(static_get_name(), this), mgmt_id(id_)
 {
     int data_len;
 
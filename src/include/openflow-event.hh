@@ -36,13 +36,16 @@ Event* openflow_packet_to_event(boost::shared_ptr<Openflow_connection>
         oconn, std::auto_ptr<Buffer> p);
 
 /** \brief Convert OpenFlow packets into Openflow_msg_event.
+ *
+ * The message buffer is shared rather than copied, so the same bytes may
+ * also back the event built by openflow_packet_to_event().
  *
  * @param oconn OpenFlow connection
  * @param p buffer with message
  * @return Openflow_msg_event
  */
 Event* openflow_msg_to_event(boost::shared_ptr<Openflow_connection>
-        oconn, std::auto_ptr<Buffer> p);
+        oconn, boost::shared_ptr<Buffer> p);
 
 } // namespace vigil
 
@@ -34,6 +34,10 @@ namespace vigil
    * Allows all OpenFlow messages to be exposed to components
    * as events.  This is useful for vendor extensions and so on.
    *
+   * This event is dispatched as soon as the message arrives.  The typed
+   * events for packet-ins and statistics replies are queued instead, so
+   * for those messages this event is handled first.
+   *
    * @author ykk
    * @date 2008
    */
@@ -50,11 +54,20 @@ namespace vigil
     Openflow_msg_event(const datapathid& dpid, const ofp_header* ofp_msg_,
 		       std::auto_ptr<Buffer> buf);
 
+    /** \brief Constructor sharing the message buffer
+     * 
+     * @param dpid datapath associated with message
+     * @param of_msg_ header pointer to message
+     * @param buf shared buffer containing message
+     */
+    Openflow_msg_event(const datapathid& dpid, const ofp_header* ofp_msg_,
+		       boost::shared_ptr<Buffer> buf);
+
     /** \brief Empty constructor.
      *
      *  Only for use within python
      */
-    Openflow_msg_event() : Event(static_get_name()) { }
+    Openflow_msg_event() : Event(static_get_name(), this) { }
 
     /** \brief Return static name for event.
      *
@@ -72,7 +85,15 @@ namespace vigil
 inline
 Openflow_msg_event::Openflow_msg_event(const datapathid& dpid, const ofp_header* ofp_msg_,
 				       std::auto_ptr<Buffer> buf)
-  : Event(static_get_name()), Ofp_msg_event(ofp_msg_, buf)
+  : Event(static_get_name(), this), Ofp_msg_event(ofp_msg_, buf)
+{
+    datapath_id = dpid;
+}
+
+inline
+Openflow_msg_event::Openflow_msg_event(const datapathid& dpid, const ofp_header* ofp_msg_,
+				       boost::shared_ptr<Buffer> buf)
+  : Event(static_get_name(), this), Ofp_msg_event(ofp_msg_, buf)
 {
     datapath_id = dpid;
 }
@@ -39,6 +39,7 @@
 namespace vigil {
 
 class Buffer;
+class Buffer_pool;
 class Async_stream;
 class Async_datagram;
 class Openflow_connection_factory;
@@ -67,6 +68,12 @@ public:
     virtual uint32_t get_remote_ip() { 
         return 0; // 0.0.0.0 indicates failure
     }
+    /* Pool that message buffers are allocated from, or null if this kind of
+     * connection does not pool its buffers. */
+    virtual const Buffer_pool* get_buffer_pool() const { return NULL; }
+    /* Number of bytes accepted by send_openflow() but not yet written to the
+     * underlying transport. */
+    virtual size_t get_tx_backlog() const { return 0; }
     /* Core functionality. */
     int connect(bool block);
     int send_openflow(const ofp_header*, bool block);
@@ -184,6 +191,21 @@ public:
     std::string get_ssl_fingerprint();
     uint32_t get_local_ip();  
     uint32_t get_remote_ip();  
+    const Buffer_pool* get_buffer_pool() const { return pool.get(); }
+    size_t get_tx_backlog() const { return tx_queue.size() - tx_start; }
+
+    /* Transmit coalescing.  Outgoing messages are appended to a per-connection
+     * queue and written together, so a burst of messages (e.g. a flow_mod
+     * followed by a packet_out) costs a single write.  The queue is flushed
+     * once 'flush_delay' has passed since the first message was queued, or as
+     * soon as the sending thread yields if 'flush_delay' is zero, or at once
+     * when it holds more than tx_flush_bytes.  Once the queue holds
+     * 'high_water' bytes that could not be written, sends fail with EAGAIN
+     * until the transport drains it.
+     *
+     * Applies to connections created afterward. */
+    static void set_tx_coalescing(const timeval& flush_delay,
+                                  size_t high_water);
 private:
     virtual int do_connect();
     virtual int do_send_openflow(const ofp_header*);
@@ -194,17 +216,41 @@ private:
 
     Auto_fsm tx_fsm;
     void tx_run();
-    int send_tx_buf();
+    int flush_tx();
 
-    int do_read(void *, size_t);
+    int fill_rx_ring();
+    const ofp_header* rx_ring_message() const;
 
     std::auto_ptr<Async_stream> stream;
 
-    size_t rx_bytes;
-    ofp_header rx_header;
-    std::auto_ptr<Buffer> rx_buf;
+    /* Storage for received messages. */
+    boost::shared_ptr<Buffer_pool> pool;
+
+    /* Bytes read from 'stream' that have not yet been returned as messages
+     * occupy rx_ring[rx_start, rx_end).  Each read pulls in as much as the
+     * socket has available, so a busy switch delivers many messages per
+     * system call. */
+    std::auto_ptr<Buffer> rx_ring;
+    size_t rx_start;
+    size_t rx_end;
+
+    /* Large enough for any OpenFlow message. */
+    static const size_t rx_ring_size;
+
+    /* Queued outgoing bytes that have not yet been written occupy
+     * tx_queue[tx_start, tx_queue.size()).  Written bytes are dropped from
+     * the front once they are half of the queue.  The vector keeps its
+     * capacity between bursts, so queueing normally does not allocate. */
+    std::vector<uint8_t> tx_queue;
+    size_t tx_start;
+    timeval tx_flush_time;
+    timeval tx_flush_delay;
+    size_t tx_high_water;
+
+    static timeval default_tx_flush_delay;
+    static size_t default_tx_high_water;
+    static const size_t tx_flush_bytes;
 
-    std::auto_ptr<Buffer> tx_buf;
     Connection_type conn_type; 
 };
 
@@ -224,6 +270,12 @@ public:
     int close();
     std::string to_string();
     Connection_type get_conn_type(); 
+    const Buffer_pool* get_buffer_pool() const {
+        return c.get() ? c->get_buffer_pool() : NULL;
+    }
+    size_t get_tx_backlog() const {
+        return c.get() ? c->get_tx_backlog() : 0;
+    }
 private:
     std::auto_ptr<Openflow_connection_factory> f;
     std::auto_ptr<Openflow_connection> c;
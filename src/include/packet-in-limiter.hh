@@ -0,0 +1,131 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PACKET_IN_LIMITER_HH
+#define PACKET_IN_LIMITER_HH 1
+
+#include <stdint.h>
+#include "hash_map.hh"
+
+namespace vigil {
+
+/* A token bucket that admits 'rate' events per second on average and up to
+ * 'burst' events at once.  Times are in milliseconds, as from time_msec(). */
+class Token_bucket
+{
+public:
+    Token_bucket(unsigned int rate = 0, unsigned int burst = 0);
+
+    /* Returns true and takes a token if one is available at time 'now'.
+     * Always returns true if the rate is 0. */
+    bool consume(long long int now);
+
+    /* Returns true if a token is available at time 'now', without taking it.
+     * Always returns true if the rate is 0. */
+    bool available(long long int now);
+
+    /* Takes the token that available() just reported. */
+    void take();
+
+private:
+    unsigned int rate;
+    uint64_t capacity;          /* 'burst' in thousandths of a token. */
+    uint64_t tokens;            /* Thousandths of a token. */
+    long long int last_fill;
+};
+
+/* Packet-in admission settings for a datapath. */
+struct Packet_in_limits
+{
+    Packet_in_limits();         /* No limits. */
+
+    /* Packet-ins per second and burst size for the datapath as a whole and
+     * for each of its ports.  A rate of 0 means no limit.  A burst of 0
+     * defaults to one second's worth. */
+    unsigned int rate, burst;
+    unsigned int port_rate, port_burst;
+
+    /* If nonzero, 1 of every 'sample' packet-ins over the limits is admitted
+     * anyway, instead of all of them being dropped. */
+    unsigned int sample;
+
+    /* If nonzero, when a port goes over its limit, a flow that drops packets
+     * from the offending source on that port is installed for this many
+     * seconds. */
+    unsigned int drop_flow_secs;
+
+    bool is_limited() const { return rate || port_rate; }
+};
+
+/* Packet-in admission counters for a datapath. */
+struct Packet_in_stats
+{
+    Packet_in_stats();
+
+    uint64_t admitted;          /* Within the limits. */
+    uint64_t sampled;           /* Over the limits, but admitted as samples. */
+    uint64_t dropped;           /* Over the limits and dropped. */
+    uint64_t drop_flows;        /* Drop flows requested. */
+};
+
+/* Decides which packet-ins from one datapath to pass on to the controller,
+ * according to a Packet_in_limits.  Not thread-safe. */
+class Packet_in_limiter
+{
+public:
+    enum Verdict {
+        ADMIT,                  /* Within the limits. */
+        SAMPLE,                 /* Over the limits, but admitted as a sample. */
+        DROP,                   /* Over the limits. */
+        DROP_AND_BLOCK          /* Over the port's limit: also install a drop
+                                 * flow for the packet's source. */
+    };
+
+    Packet_in_limiter(const Packet_in_limits&);
+
+    /* Decides the fate of a packet-in received on 'in_port' at time 'now', in
+     * milliseconds, and counts it. */
+    Verdict admit(uint16_t in_port, long long int now);
+
+    const Packet_in_limits& get_limits() const { return limits; }
+
+    /* Returns a copy of the counters.  Unlike the other member functions, may
+     * be called from any thread, because the counters are updated
+     * atomically. */
+    Packet_in_stats get_stats() const;
+
+    /* Changes the limits, keeping the counters. */
+    void set_limits(const Packet_in_limits&);
+
+private:
+    struct Port {
+        Token_bucket bucket;
+        long long int drop_flow_expires;
+    };
+
+    Packet_in_limits limits;
+    Packet_in_stats stats;
+    Token_bucket bucket;
+    hash_map<uint16_t, Port> ports;
+    unsigned int n_excess;
+
+    Verdict excess(Port*, long long int now);
+};
+
+} // namespace vigil
+
+#endif /* packet-in-limiter.hh */
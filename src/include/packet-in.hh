@@ -51,7 +51,8 @@ struct Packet_in_event
     Packet_in_event(datapathid datapath_id_, uint16_t in_port_,
                     std::auto_ptr<Buffer> buf_, size_t total_len_,
                     uint32_t buffer_id_, uint8_t reason_)
-        : Event(static_get_name()), Ofp_msg_event((ofp_header*) NULL, buf_),
+        : Event(static_get_name(), this),
+          Ofp_msg_event((ofp_header*) NULL, buf_),
           datapath_id(datapath_id_), in_port(in_port_), total_len(total_len_),
           buffer_id(buffer_id_), reason(reason_), flow(htons(in_port), *buf)
         { }
@@ -59,14 +60,15 @@ struct Packet_in_event
     Packet_in_event(datapathid datapath_id_, uint16_t in_port_,
                     boost::shared_ptr<Buffer> buf_, size_t total_len_,
                     uint32_t buffer_id_, uint8_t reason_)
-        : Event(static_get_name()), Ofp_msg_event((ofp_header*) NULL, buf_),
+        : Event(static_get_name(), this),
+          Ofp_msg_event((ofp_header*) NULL, buf_),
           datapath_id(datapath_id_), in_port(in_port_), total_len(total_len_),
           buffer_id(buffer_id_), reason(reason_), flow(htons(in_port), *buf)
         { }
 
     Packet_in_event(datapathid datapath_id_,
                     const ofp_packet_in *opi, std::auto_ptr<Buffer> buf_)
-        : Event(static_get_name()), Ofp_msg_event(&opi->header, buf_),
+        : Event(static_get_name(), this), Ofp_msg_event(&opi->header, buf_),
           datapath_id(datapath_id_),
           in_port(ntohs(opi->in_port)),
           total_len(ntohs(opi->total_len)),
@@ -101,6 +103,10 @@ struct Packet_in_event
     uint8_t  reason;
 
     /** \brief Flow interpretation
+     *
+     * The packet is parsed once, when the event is built, with in_port in
+     * network byte order.  Handlers should use this instead of parsing
+     * the buffer again.  Python handlers get it as the "flow" attribute.
      */
     Flow flow;
 
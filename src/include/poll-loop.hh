@@ -75,6 +75,9 @@ private:
 class Poll_loop
 {
 public:
+    /* Creates a loop served by 'n_threads' cooperative threads, which run in
+     * the thread group of the caller.  run() must be called from that same
+     * group. */
     Poll_loop(unsigned int n_threads);
     ~Poll_loop();
 
@@ -122,7 +122,7 @@ struct Port_stats_in_event
                         std::auto_ptr<Buffer> buf);
 
     // -- only for use within python
-    Port_stats_in_event() : Event(static_get_name()) { }
+    Port_stats_in_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Port_stats_in_event";
@@ -145,7 +145,7 @@ inline
 Port_stats_in_event::Port_stats_in_event(const datapathid& dpid,
                                          const ofp_stats_reply *osr,
                                          std::auto_ptr<Buffer> buf)
-    : Event(static_get_name()), Ofp_msg_event(&osr->header, buf)
+    : Event(static_get_name(), this), Ofp_msg_event(&osr->header, buf)
 {
     datapath_id  = dpid;
 }
@@ -23,6 +23,9 @@
 #include <pthread.h>
 #include <signal.h>
 #include <vector>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 
 namespace vigil {
 
@@ -59,6 +62,13 @@ public:
      * On systems that lack ppoll(), the contents of 'pollfds' are modified
      * temporarily for the duration of the call. */
     int poll(std::vector<pollfd>& pollfds, const struct timespec *timeout);
+
+#if defined(HAVE_PPOLL) && defined(HAVE_EPOLL_CREATE)
+    /* Invokes epoll_wait() on 'epfd', with the same interruption semantics as
+     * poll(), storing up to 'max_events' ready descriptors in 'events'. */
+    int epoll_wait(int epfd, epoll_event* events, int max_events,
+                   const struct timespec *timeout);
+#endif
 private:
 #ifdef HAVE_PPOLL
     int sig_nr;
@@ -0,0 +1,189 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROUTE_TABLE_HH
+#define ROUTE_TABLE_HH 1
+
+#include <vector>
+#include <stdint.h>
+
+#include "hash_map.hh"
+#include "netinet++/datapathid.hh"
+
+/*
+ * All-pairs shortest paths over a topology of switches, kept compact enough
+ * for fabrics of thousands of switches.
+ *
+ * Switches are numbered densely in the order they are first seen.  Links are
+ * kept in an adjacency array (compressed sparse rows: each switch's outgoing
+ * links are contiguous, sorted by destination).  For each source, the table
+ * holds the previous switch and cost of the shortest path to every
+ * destination, two flat arrays of 'capacity' x 'capacity' entries, so a path
+ * is read off by walking back from its destination, and no path is ever
+ * stored whole.
+ *
+ * A path's cost is the sum of the weights of its links.  Every link weighs 1
+ * until set_weight() says otherwise, so by default paths are shortest by hop
+ * count and are found by breadth-first search.  Once any link weighs more,
+ * the search becomes Dijkstra's, with a list of switches per cost, since
+ * weights are small integers.  Path costs must stay below 65535.
+ *
+ * Link changes are recorded with add_link(), remove_link() and set_weight()
+ * and take effect on the next update(), which rebuilds the adjacency array
+ * and then searches again from only the sources whose shortest paths the
+ * changes can alter, once each however many changes there were.
+ *
+ * update() may instead be done in steps: prepare_update() applies the
+ * changes and lists the sources to search again, search() searches from one
+ * of them, and finish_update() makes the new paths visible to get_route().
+ * Between prepare_update() and finish_update(), search() may be called from
+ * several threads at once for different sources, each with its own queue,
+ * as long as nothing else touches the table.  To keep answering get_route()
+ * while an update is under way, update a copy of the table and then replace
+ * the original with it.
+ *
+ * Often there are several shortest paths between two switches, such as the
+ * paths up through each of the spines of a fabric.  They take no more room:
+ * with every source's path costs at hand, the links that lead on along some
+ * shortest path to a destination are just those to a switch that much
+ * closer to it.  get_routes() collects all of the paths as a DAG, and get_route()
+ * with a hash picks one of them, choosing among such links at each switch.
+ *
+ * All port numbers are in host byte order.
+ */
+
+namespace vigil {
+
+class Route_table {
+
+public:
+    /* A link on a path, as seen from the switch it leaves. */
+    struct Hop {
+        datapathid dst;         /* Switch the link leads to. */
+        uint16_t outport;       /* Port it leaves from. */
+        uint16_t inport;        /* Port it arrives on at 'dst'. */
+    };
+
+    /* All the shortest paths from one switch to another. */
+    struct Dag {
+        struct Link {
+            Hop hop;
+            uint32_t next;      /* Index in 'dps' of 'hop.dst'. */
+        };
+
+        /* The switches on any of the paths, in order of cost from the first,
+         * the source, so the last is the destination. */
+        std::vector<datapathid> dps;
+
+        /* The links of dps[i] that lead on along a path are links[j] for
+         * offsets[i] <= j < offsets[i + 1]. */
+        std::vector<uint32_t> offsets;
+        std::vector<Link> links;
+    };
+
+    Route_table();
+
+    void add_link(const datapathid& src, uint16_t outport,
+                  const datapathid& dst, uint16_t inport);
+    void remove_link(const datapathid& src, uint16_t outport,
+                     const datapathid& dst, uint16_t inport);
+    void set_weight(const datapathid& src, uint16_t outport,
+                    const datapathid& dst, uint16_t inport, uint16_t weight);
+    void update();
+
+    void prepare_update(std::vector<uint32_t>& sources);
+    void search(uint32_t source, std::vector<uint32_t>& queue);
+    void finish_update();
+
+    /* Returns true if there are link or weight changes not yet applied by
+     * update(). */
+    bool is_pending() const { return !changes.empty(); }
+
+    bool get_route(const datapathid& src, const datapathid& dst,
+                   std::vector<Hop>& path) const;
+    bool get_route(const datapathid& src, const datapathid& dst,
+                   uint64_t hash, std::vector<Hop>& path) const;
+    bool get_routes(const datapathid& src, const datapathid& dst,
+                    Dag& dag) const;
+
+    size_t n_switches() const { return dps.size(); }
+    size_t n_links() const { return links.size(); }
+    size_t memory_usage() const;
+
+private:
+    static const uint32_t NONE = ~(uint32_t) 0;
+    static const uint16_t UNREACHABLE = 0xffff;
+
+    /* Ordered and compared by everything but 'weight'. */
+    struct Link {
+        uint32_t src;
+        uint32_t dst;
+        uint16_t outport;
+        uint16_t inport;
+        uint16_t weight;
+
+        bool operator<(const Link&) const;
+        bool operator==(const Link&) const;
+    };
+
+    struct Edge {
+        uint32_t dst;
+        uint16_t outport;
+        uint16_t inport;
+    };
+
+    /* A link added or removed, or given a new weight, since the last
+     * update(). */
+    struct Change {
+        enum Type { ADD, REMOVE, WEIGH };
+
+        Link link;
+        Type type;
+    };
+
+    hash_map<datapathid, uint32_t> indexes;
+    std::vector<datapathid> dps;
+
+    std::vector<Link> links;    /* Sorted, as of the last update(). */
+    std::vector<Change> changes;
+
+    std::vector<uint32_t> offsets; /* Switch i's edges start at offsets[i]. */
+    std::vector<Edge> edges;
+    std::vector<uint16_t> weights; /* Weight of each edge. */
+    uint16_t max_weight;        /* Heaviest edge, 1 if there are none. */
+
+    uint32_t capacity;          /* Row length of 'preds' and 'costs'. */
+    uint32_t n_searched;        /* Switches that have rows. */
+    std::vector<uint32_t> preds; /* Previous switch on each path, or NONE. */
+    std::vector<uint16_t> costs; /* Cost of each path, or UNREACHABLE. */
+    std::vector<uint32_t> queue;
+
+    uint32_t get_index(const datapathid&);
+    uint32_t find_index(const datapathid&) const;
+    uint32_t find_edge(uint32_t src, uint32_t dst) const;
+    bool leads_to(uint32_t src, uint32_t edge, uint32_t dst) const;
+    uint32_t min_weight(uint32_t src, uint32_t dst) const;
+    void build_edges();
+    void search_by_weight(uint32_t source, std::vector<uint32_t>& queue);
+    static void sort_dag(const uint16_t *costs,
+                         const std::vector<uint32_t>& nodes, Dag&);
+    void grow(uint32_t n);
+};
+
+} // namespace vigil
+
+#endif /* route-table.hh */
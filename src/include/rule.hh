@@ -18,6 +18,7 @@
 #ifndef  RULE_HH
 #define  RULE_HH
 
+#include <list>
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -58,6 +59,7 @@ public:
 
 private:
     Cnode<Expr, Action> *node;
+    typename std::list<Rule_ptr>::iterator pos;   /* In node's list. */
 
     Rule();
     Rule& operator=(const Rule&);
@@ -34,7 +34,7 @@ struct Switch_mgr_leave_event
     : public Event
 {
     Switch_mgr_leave_event(datapathid id_)
-        : Event(static_get_name()), mgmt_id(id_) { }
+        : Event(static_get_name(), this), mgmt_id(id_) { }
 
     static const Event_name static_get_name() {
         return "Switch_mgr_leave_event";
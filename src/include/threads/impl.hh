@@ -190,6 +190,24 @@ void co_fd_read_wait(int fd, int *revents);
 void co_fd_write_wait(int fd, int *revents);
 void co_fd_closed(int fd);
 
+/* File descriptor waiting backends.
+ *
+ * CO_FD_BACKEND_POLL, the default, hands poll() every file descriptor that
+ * some thread waits on and scans all of them after each wakeup, so the cost
+ * of a wakeup grows with the number of descriptors, even idle ones.
+ * CO_FD_BACKEND_EPOLL keeps the descriptors registered with epoll so that a
+ * wakeup costs time proportional to the number of ready descriptors only.
+ *
+ * The backend must be selected before any thread waits on a file descriptor,
+ * normally right after co_init().  co_set_fd_backend() returns false, leaving
+ * the poll backend in use, if the requested backend is not supported. */
+enum co_fd_backend {
+    CO_FD_BACKEND_POLL,
+    CO_FD_BACKEND_EPOLL
+};
+bool co_set_fd_backend(enum co_fd_backend);
+enum co_fd_backend co_get_fd_backend(void);
+
 /* Timers. */
 void co_timer_wait(timeval abs_time, int *expired);
 void co_sleep(timeval duration);
@@ -0,0 +1,652 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TUPLE_SPACE_HH
+#define TUPLE_SPACE_HH 1
+
+#include <algorithm>
+#include <list>
+#include <vector>
+#include <stdint.h>
+
+#include "cnode.hh"
+#include "hash_map.hh"
+#include "rule.hh"
+
+/*
+ * Tuple space search classifier backend.
+ *
+ * Groups rules by the set of splittable fields they do not wildcard (their
+ * "tuple") and keeps, per tuple, a hash table from the rules' values for
+ * those fields to the rules themselves, in priority order.  A lookup costs
+ * one hash probe per tuple however the rules' wildcards overlap, where a
+ * Cnode tree must descend into every "any" child and, for data that lacks a
+ * value for a split field, into every bucket.
+ *
+ * Tuples are kept sorted by the highest priority among their rules, so a
+ * Tuple_result, which probes them lazily, can stop probing once no remaining
+ * tuple can hold a better match than the ones it has already found.  A
+ * Cnode_result can be filled in too, in which case every tuple is probed.
+ *
+ * Used through Classifier::set_backend() rather than on its own.  Like Cnode,
+ * only narrows down the candidate rules: results still check each one with
+ * matches().
+ */
+
+namespace vigil {
+
+template<class Expr, typename Action>
+class Tuple_space;
+
+template<class Expr, typename Action, typename Data>
+class Tuple_result {
+
+public:
+    typedef Rule<Expr, Action>* Rule_ptr;
+    typedef std::list<Rule_ptr> Rule_list;
+
+    Tuple_result(const Data *data_)
+        : data(data_), space(NULL), next_tuple(0), num_lists(0)
+        { traversed.reserve(DEFAULT_VEC_SIZE); }
+
+    void push(const Rule_list&);
+    const Rule<Expr, Action>* next();
+    void set_data(const Data *data_) { data = data_; }
+    void clear() { space = NULL; next_tuple = 0; num_lists = 0; }
+
+private:
+    struct current_rule {
+        typename Rule_list::const_iterator rule;
+        typename Rule_list::const_iterator end;
+        bool ismatch;
+    };
+
+    const Data *data;
+    Tuple_space<Expr, Action> *space;
+    uint32_t next_tuple;
+    uint32_t num_lists;
+    std::vector<current_rule> traversed;
+
+    friend class Tuple_space<Expr, Action>;
+
+    Tuple_result();
+    Tuple_result(const Tuple_result&);
+    Tuple_result& operator=(const Tuple_result&);
+};
+
+template<class Expr, typename Action>
+class Tuple_space {
+
+public:
+    typedef Rule<Expr, Action>* Rule_ptr;
+    typedef std::list<Rule_ptr> Rule_list;
+
+    Tuple_space() : sorted(true) { }
+    ~Tuple_space() { clear(); }
+
+    void add_rule(const Rule_ptr&);
+    bool remove_rule(const Rule_ptr&);
+    void change_rule_priority(const Rule_ptr&, uint32_t);
+    void clear();
+
+    template<typename Data>
+    void get_rules(Cnode_result<Expr, Action, Data>&);
+    template<typename Data>
+    void get_rules(Tuple_result<Expr, Action, Data>&);
+
+    size_t n_tuples() const { return tuples.size(); }
+
+private:
+    typedef hash_map<uint32_t, Rule_list> Bucket_map;
+
+    /* Entry in a tuple's open-addressed, linearly probed index of its
+     * buckets, which lookups use instead of the Bucket_map. */
+    struct Slot {
+        uint32_t key;
+        const Rule_list *rules;     /* NULL if the slot is empty. */
+    };
+
+    struct Tuple {
+        uint32_t mask;              /* Cnode::MASKS bits of 'fields'. */
+        uint32_t n_fields;
+        uint32_t fields[Expr::NUM_FIELDS];
+        uint32_t n_rules;
+        uint32_t best_priority;     /* Lowest priority value of any rule. */
+        std::vector<Slot> slots;    /* Power of 2 in size, at most half full. */
+        Bucket_map buckets;         /* Keyed by hash of rules' values. */
+    };
+
+    typedef hash_map<uint32_t, Tuple*> Tuple_map;
+
+    Tuple_map tuple_map;
+    std::vector<Tuple*> tuples;     /* Sorted by 'best_priority'... */
+    bool sorted;                    /* ...if this is true. */
+    std::vector<const Rule_list*> probed;
+
+    template<class E, typename A, typename D>
+    friend class Tuple_result;
+
+    static uint32_t get_mask(const Expr&);
+    static uint32_t hash_value(uint32_t hash, uint32_t value) {
+        hash = (hash ^ value) * 0x9e3779b1;
+        return hash ^ (hash >> 16);
+    }
+    static uint32_t rule_key(const Tuple&, const Expr&);
+    static const Rule_list *find_bucket(const Tuple&, uint32_t key);
+    static Rule_list& insert_bucket(Tuple&, uint32_t key);
+    static void erase_bucket(Tuple&, typename Bucket_map::iterator);
+    static void resize_slots(Tuple&, size_t);
+    static bool priority_less(const Tuple *a, const Tuple *b) {
+        return a->best_priority < b->best_priority;
+    }
+
+    void sort();
+    template<typename Data, class Result>
+    void probe(const Tuple&, const Data&, Result&);
+    template<class Result>
+    void push_all(const Tuple&, Result&);
+    template<typename Data, class Result>
+    void probe_fields(const Tuple&, const Data&, uint32_t, uint32_t,
+                      bool, Result&);
+
+    Tuple_space(const Tuple_space&);
+    Tuple_space& operator=(const Tuple_space&);
+};
+
+template<class Expr, typename Action, typename Data>
+void
+Tuple_result<Expr, Action, Data>::push(const Rule_list& rules)
+{
+    if (!rules.empty()) {
+        current_rule r;
+        r.rule = rules.begin();
+        r.end = rules.end();
+        r.ismatch = false;
+        if (num_lists == traversed.size()) {
+            traversed.push_back(r);
+        } else {
+            traversed[num_lists] = r;
+        }
+        ++num_lists;
+    }
+}
+
+/*
+ * Returns the highest priority rule that remains and matches 'data', or NULL
+ * if there is none, probing as many more tuples as that takes.
+ */
+
+template<class Expr, typename Action, typename Data>
+const Rule<Expr, Action>*
+Tuple_result<Expr, Action, Data>::next()
+{
+    const Rule<Expr, Action>* match = NULL;
+    uint32_t min_pri = 0;
+    uint32_t min_idx = 0;
+
+    /* Probing a tuple only appends lists, so each pass only needs to look at
+     * the lists pushed since the last one. */
+    for (uint32_t i = 0;;) {
+        while (i < num_lists) {
+            current_rule& current = traversed[i];
+            const Rule<Expr, Action>* rule = *current.rule;
+            if (match == NULL || rule->priority < min_pri) {
+                if (current.ismatch
+                    || matches(rule->id, rule->expr, *data)) {
+                    match = rule;
+                    min_pri = rule->priority;
+                    min_idx = i;
+                    current.ismatch = true;
+                    ++i;
+                } else if (++current.rule == current.end) {
+                    current = traversed[--num_lists];
+                }
+            } else {
+                ++i;
+            }
+        }
+
+        /* A tuple whose best rule ties with 'match' might hold another
+         * match of the same priority, which should come out first. */
+        if (space == NULL || next_tuple >= space->tuples.size()
+            || (match != NULL
+                && space->tuples[next_tuple]->best_priority > min_pri)) {
+            break;
+        }
+        space->probe(*space->tuples[next_tuple++], *data, *this);
+    }
+
+    if (match != NULL) {
+        current_rule& current = traversed[min_idx];
+        if (++current.rule == current.end) {
+            current = traversed[--num_lists];
+        } else {
+            current.ismatch = false;
+        }
+    }
+
+    return match;
+}
+
+/*
+ * Returns the Cnode::MASKS bits of the splittable fields that 'expr' does not
+ * wildcard.
+ */
+
+template<class Expr, typename Action>
+uint32_t
+Tuple_space<Expr, Action>::get_mask(const Expr& expr)
+{
+    uint32_t mask = 0;
+    for (uint32_t field = 0; field < Expr::NUM_FIELDS; field++) {
+        if (!expr.is_wildcard(field)) {
+            mask |= Cnode<Expr, Action>::MASKS[field];
+        }
+    }
+    return mask;
+}
+
+/*
+ * Returns the key of 'expr' in 'tuple', which must be 'expr''s tuple.
+ */
+
+template<class Expr, typename Action>
+uint32_t
+Tuple_space<Expr, Action>::rule_key(const Tuple& tuple, const Expr& expr)
+{
+    uint32_t hash = 0;
+    for (uint32_t i = 0; i < tuple.n_fields; i++) {
+        uint32_t value = 0;
+        expr.get_field(tuple.fields[i], value);
+        hash = hash_value(hash, value);
+    }
+    return hash;
+}
+
+/*
+ * Returns the bucket for 'key' in 'tuple', or NULL if it has none.
+ */
+
+template<class Expr, typename Action>
+const typename Tuple_space<Expr, Action>::Rule_list *
+Tuple_space<Expr, Action>::find_bucket(const Tuple& tuple, uint32_t key)
+{
+    if (tuple.slots.empty()) {
+        return NULL;
+    }
+    const Slot *slots = &tuple.slots[0];
+    uint32_t mask = tuple.slots.size() - 1;
+    for (uint32_t i = key & mask; slots[i].rules != NULL; i = (i + 1) & mask) {
+        if (slots[i].key == key) {
+            return slots[i].rules;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the bucket for 'key' in 'tuple', creating it if necessary.
+ */
+
+template<class Expr, typename Action>
+typename Tuple_space<Expr, Action>::Rule_list&
+Tuple_space<Expr, Action>::insert_bucket(Tuple& tuple, uint32_t key)
+{
+    typename Bucket_map::iterator b = tuple.buckets.find(key);
+    if (b != tuple.buckets.end()) {
+        return b->second;
+    }
+
+    if ((tuple.buckets.size() + 1) * 2 > tuple.slots.size()) {
+        resize_slots(tuple, std::max(tuple.slots.size() * 2, (size_t) 4));
+    }
+    Rule_list& rules = tuple.buckets[key];
+
+    uint32_t mask = tuple.slots.size() - 1;
+    uint32_t i = key & mask;
+    while (tuple.slots[i].rules != NULL) {
+        i = (i + 1) & mask;
+    }
+    tuple.slots[i].key = key;
+    tuple.slots[i].rules = &rules;
+    return rules;
+}
+
+/*
+ * Erases bucket 'b' from 'tuple', shifting back any index slots that its slot
+ * was keeping from their home positions.
+ */
+
+template<class Expr, typename Action>
+void
+Tuple_space<Expr, Action>::erase_bucket(Tuple& tuple,
+                                        typename Bucket_map::iterator b)
+{
+    std::vector<Slot>& slots = tuple.slots;
+    uint32_t mask = slots.size() - 1;
+    uint32_t i = b->first & mask;
+    while (slots[i].rules != &b->second) {
+        i = (i + 1) & mask;
+    }
+
+    for (uint32_t j = i;;) {
+        j = (j + 1) & mask;
+        if (slots[j].rules == NULL) {
+            break;
+        }
+        uint32_t home = slots[j].key & mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        slots[i] = slots[j];
+        i = j;
+    }
+    slots[i].rules = NULL;
+
+    tuple.buckets.erase(b);
+}
+
+template<class Expr, typename Action>
+void
+Tuple_space<Expr, Action>::resize_slots(Tuple& tuple, size_t n_slots)
+{
+    Slot empty = { 0, NULL };
+    std::vector<Slot> slots(n_slots, empty);
+    uint32_t mask = n_slots - 1;
+    for (typename Bucket_map::const_iterator b = tuple.buckets.begin();
+         b != tuple.buckets.end(); ++b)
+    {
+        uint32_t i = b->first & mask;
+        while (slots[i].rules != NULL) {
+            i = (i + 1) & mask;
+        }
+        slots[i].key = b->first;
+        slots[i].rules = &b->second;
+    }
+    tuple.slots.swap(slots);
+}
+
+template<class Expr, typename Action>
+void
+Tuple_space<Expr, Action>::add_rule(const Rule_ptr& rule)
+{
+    uint32_t mask = get_mask(rule->expr);
+    typename Tuple_map::iterator i = tuple_map.find(mask);
+    Tuple *tuple;
+    if (i != tuple_map.end()) {
+        tuple = i->second;
+    } else {
+        tuple = new Tuple;
+        tuple->mask = mask;
+        tuple->n_fields = 0;
+        for (uint32_t field = 0; field < Expr::NUM_FIELDS; field++) {
+            if (mask & Cnode<Expr, Action>::MASKS[field]) {
+                tuple->fields[tuple->n_fields++] = field;
+            }
+        }
+        tuple->n_rules = 0;
+        tuple->best_priority = rule->priority;
+        try {
+            tuples.push_back(tuple);
+            tuple_map[mask] = tuple;
+        } catch (...) {
+            if (!tuples.empty() && tuples.back() == tuple) {
+                tuples.pop_back();
+            }
+            delete tuple;
+            throw;
+        }
+    }
+
+    Rule_list& bucket = insert_bucket(*tuple, rule_key(*tuple, rule->expr));
+    typename Rule_list::iterator pos = bucket.begin();
+    while (pos != bucket.end() && (*pos)->priority < rule->priority) {
+        ++pos;
+    }
+    bucket.insert(pos, rule);
+
+    tuple->n_rules++;
+    if (rule->priority < tuple->best_priority) {
+        tuple->best_priority = rule->priority;
+        sorted = false;
+    } else if (tuple->n_rules == 1) {
+        sorted = false;
+    }
+}
+
+/*
+ * Removes 'rule', which must have its priority as of when it was added.
+ * Returns false if it was not found.
+ */
+
+template<class Expr, typename Action>
+bool
+Tuple_space<Expr, Action>::remove_rule(const Rule_ptr& rule)
+{
+    typename Tuple_map::iterator i = tuple_map.find(get_mask(rule->expr));
+    if (i == tuple_map.end()) {
+        return false;
+    }
+    Tuple *tuple = i->second;
+
+    typename Bucket_map::iterator b
+        = tuple->buckets.find(rule_key(*tuple, rule->expr));
+    if (b == tuple->buckets.end()) {
+        return false;
+    }
+    typename Rule_list::iterator pos
+        = std::find(b->second.begin(), b->second.end(), rule);
+    if (pos == b->second.end()) {
+        return false;
+    }
+    b->second.erase(pos);
+    if (b->second.empty()) {
+        erase_bucket(*tuple, b);
+    }
+
+    if (--tuple->n_rules == 0) {
+        tuple_map.erase(i);
+        tuples.erase(std::find(tuples.begin(), tuples.end(), tuple));
+        delete tuple;
+    } else if (rule->priority == tuple->best_priority) {
+        uint32_t best = ~(uint32_t) 0;
+        for (typename Bucket_map::const_iterator j = tuple->buckets.begin();
+             j != tuple->buckets.end(); ++j)
+        {
+            best = std::min(best, j->second.front()->priority);
+        }
+        if (best != tuple->best_priority) {
+            tuple->best_priority = best;
+            sorted = false;
+        }
+    }
+    return true;
+}
+
+template<class Expr, typename Action>
+void
+Tuple_space<Expr, Action>::change_rule_priority(const Rule_ptr& rule,
+                                                uint32_t priority)
+{
+    remove_rule(rule);
+    rule->priority = priority;
+    add_rule(rule);
+}
+
+/*
+ * Removes all rules, without deleting them.
+ */
+
+template<class Expr, typename Action>
+void
+Tuple_space<Expr, Action>::clear()
+{
+    for (typename std::vector<Tuple*>::iterator i = tuples.begin();
+         i != tuples.end(); ++i)
+    {
+        delete *i;
+    }
+    tuples.clear();
+    tuple_map.clear();
+    sorted = true;
+}
+
+template<class Expr, typename Action>
+void
+Tuple_space<Expr, Action>::sort()
+{
+    if (!sorted) {
+        std::stable_sort(tuples.begin(), tuples.end(), priority_less);
+        sorted = true;
+    }
+}
+
+/*
+ * Pushes onto 'result' the rules in every tuple that may match its data.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Tuple_space<Expr, Action>::get_rules(Cnode_result<Expr, Action, Data>& result)
+{
+    for (typename std::vector<Tuple*>::const_iterator i = tuples.begin();
+         i != tuples.end(); ++i)
+    {
+        probe(**i, *result.data, result);
+    }
+}
+
+/*
+ * Readies 'result' to probe tuples as its next() needs them.  'result' is
+ * only valid until the rules change.  Data with one value for each field
+ * fills in at most one list per tuple, so once 'result' has room for that
+ * many, lookups of such data do not allocate memory.
+ */
+
+template<class Expr, typename Action>
+template<typename Data>
+void
+Tuple_space<Expr, Action>::get_rules(Tuple_result<Expr, Action, Data>& result)
+{
+    sort();
+    result.traversed.reserve(tuples.size());
+    result.space = this;
+    result.next_tuple = 0;
+}
+
+/*
+ * Pushes onto 'result' the buckets in 'tuple' that may hold rules matching
+ * 'data'.
+ */
+
+template<class Expr, typename Action>
+template<typename Data, class Result>
+void
+Tuple_space<Expr, Action>::probe(const Tuple& tuple, const Data& data,
+                                 Result& result)
+{
+    /* The common case: 'data' has exactly one value for each field. */
+    uint32_t hash = 0;
+    for (uint32_t i = 0; i < tuple.n_fields; i++) {
+        uint32_t value, next_value;
+        if (!get_field<Expr, Data>(tuple.fields[i], data, 0, value)) {
+            push_all(tuple, result);
+            return;
+        } else if (get_field<Expr, Data>(tuple.fields[i], data, 1,
+                                         next_value)) {
+            for (i++; i < tuple.n_fields; i++) {
+                if (!get_field<Expr, Data>(tuple.fields[i], data, 0, value)) {
+                    push_all(tuple, result);
+                    return;
+                }
+            }
+            probed.clear();
+            probe_fields(tuple, data, 0, 0, false, result);
+            return;
+        }
+        hash = hash_value(hash, value);
+    }
+
+    const Rule_list *bucket = find_bucket(tuple, hash);
+    if (bucket != NULL) {
+        result.push(*bucket);
+    }
+}
+
+/*
+ * Pushes every bucket in 'tuple' onto 'result', for data that lacks a value
+ * for one of its fields and so might match any of them.
+ */
+
+template<class Expr, typename Action>
+template<class Result>
+void
+Tuple_space<Expr, Action>::push_all(const Tuple& tuple, Result& result)
+{
+    for (typename Bucket_map::const_iterator b = tuple.buckets.begin();
+         b != tuple.buckets.end(); ++b)
+    {
+        result.push(b->second);
+    }
+}
+
+/*
+ * Pushes onto 'result' the bucket for every combination of 'data''s values
+ * for 'tuple''s fields from the 'n'th onward, given 'hash' of the values
+ * chosen for the earlier ones.  'multiple' is true if one of the earlier
+ * fields has more than one value, in which case different combinations
+ * might land on the same bucket.
+ */
+
+template<class Expr, typename Action>
+template<typename Data, class Result>
+void
+Tuple_space<Expr, Action>::probe_fields(const Tuple& tuple, const Data& data,
+                                        uint32_t n, uint32_t hash,
+                                        bool multiple, Result& result)
+{
+    if (n == tuple.n_fields) {
+        const Rule_list *bucket = find_bucket(tuple, hash);
+        if (bucket == NULL) {
+            return;
+        }
+        if (multiple) {
+            if (std::find(probed.begin(), probed.end(), bucket)
+                != probed.end()) {
+                return;
+            }
+            probed.push_back(bucket);
+        }
+        result.push(*bucket);
+        return;
+    }
+
+    uint32_t field = tuple.fields[n];
+    uint32_t value, next_value;
+    for (uint32_t idx = 0; get_field<Expr, Data>(field, data, idx, value);
+         idx++) {
+        bool more = multiple || idx > 0
+            || get_field<Expr, Data>(field, data, 1, next_value);
+        probe_fields(tuple, data, n + 1, hash_value(hash, value), more,
+                     result);
+    }
+}
+
+} // namespace vigil
+
+#endif /* tuple-space.hh */
@@ -0,0 +1,207 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "buffer-pool.hh"
+
+#include <algorithm>
+#include <cstring>
+#include "threads/cooperative.hh"
+
+namespace vigil {
+
+namespace {
+
+/* Block size of each size class, in increasing order. */
+const size_t class_size[Buffer_pool::N_CLASSES] = {
+    128,                        /* Echo, port status, flow removed, ... */
+    256,                        /* Packet-in with default miss_send_len. */
+    2048,                       /* Packet-in carrying a full frame. */
+    65536                       /* Anything up to the OpenFlow maximum. */
+};
+
+/* Maximum number of idle blocks kept per size class. */
+const size_t class_max_free[Buffer_pool::N_CLASSES] = {
+    256, 256, 64, 4
+};
+
+} // null namespace
+
+Buffer_pool::Stats::Stats()
+    : hits(0), misses(0), oversize(0), recycled(0), discarded(0)
+{ }
+
+boost::shared_ptr<Buffer_pool>
+Buffer_pool::create()
+{
+    return boost::shared_ptr<Buffer_pool>(new Buffer_pool());
+}
+
+Buffer_pool::Buffer_pool()
+    : group(co_group_self())
+{ }
+
+Buffer_pool::~Buffer_pool()
+{
+    for (int i = 0; i < N_CLASSES; ++i) {
+        for (size_t j = 0; j < free_list[i].size(); ++j) {
+            delete[] free_list[i][j];
+        }
+    }
+}
+
+std::auto_ptr<Buffer>
+Buffer_pool::allocate(size_t size)
+{
+    return std::auto_ptr<Buffer>(new Pooled_buffer(shared_from_this(), size));
+}
+
+double
+Buffer_pool::hit_rate() const
+{
+    uint64_t total = stats.hits + stats.misses + stats.oversize;
+    return total ? double(stats.hits) / total : 0.0;
+}
+
+size_t
+Buffer_pool::n_free() const
+{
+    size_t n = 0;
+    for (int i = 0; i < N_CLASSES; ++i) {
+        n += free_list[i].size();
+    }
+    return n;
+}
+
+/* Returns the smallest size class that can hold 'size' bytes, or -1 if none
+ * can. */
+int
+Buffer_pool::size_class(size_t size)
+{
+    for (int i = 0; i < N_CLASSES; ++i) {
+        if (size <= class_size[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint8_t*
+Buffer_pool::get_block(int sc)
+{
+    std::vector<uint8_t*>& fl = free_list[sc];
+    if (!fl.empty()) {
+        uint8_t* block = fl.back();
+        fl.pop_back();
+        ++stats.hits;
+        return block;
+    }
+    ++stats.misses;
+    return new uint8_t[class_size[sc]];
+}
+
+void
+Buffer_pool::put_block(uint8_t* block, int sc)
+{
+    if (co_group_self() != group) {
+        /* An event was handed to another group and freed there. */
+        delete[] block;
+        return;
+    }
+
+    std::vector<uint8_t*>& fl = free_list[sc];
+    if (fl.size() < class_max_free[sc]) {
+        fl.push_back(block);
+        ++stats.recycled;
+    } else {
+        delete[] block;
+        ++stats.discarded;
+    }
+}
+
+Pooled_buffer::Pooled_buffer(const boost::shared_ptr<Buffer_pool>& pool_,
+                             size_t size_)
+    : pool(pool_), size_class(Buffer_pool::size_class(size_))
+{
+    if (size_class >= 0) {
+        base = pool->get_block(size_class);
+        capacity = class_size[size_class];
+    } else {
+        ++pool->stats.oversize;
+        base = new uint8_t[size_];
+        capacity = size_;
+    }
+    m_data = base;
+    m_size = size_;
+}
+
+Pooled_buffer::~Pooled_buffer()
+{
+    if (size_class >= 0) {
+        pool->put_block(base, size_class);
+    } else {
+        delete[] base;
+    }
+}
+
+/* Moves the content to a fresh heap block of 'new_capacity' bytes, leaving
+ * 'headroom' bytes in front of it, and gives the old block back. */
+void
+Pooled_buffer::reallocate(size_t new_capacity, size_t headroom)
+{
+    uint8_t* new_base = new uint8_t[new_capacity];
+    std::memcpy(new_base + headroom, data(), size());
+    if (size_class >= 0) {
+        pool->put_block(base, size_class);
+        size_class = -1;
+    } else {
+        delete[] base;
+    }
+    base = new_base;
+    capacity = new_capacity;
+    m_data = base + headroom;
+}
+
+/* Adds 'n' bytes to the front of the buffer and returns the first byte of the
+ * added storage. */
+uint8_t*
+Pooled_buffer::push(size_t n)
+{
+    size_t headroom = data() - base;
+    if (headroom < n) {
+        reallocate(capacity + n - headroom, n);
+    }
+    m_data -= n;
+    m_size += n;
+    return m_data;
+}
+
+/* Adds 'n' bytes to the end of the buffer and returns the first byte of the
+ * added storage. */
+uint8_t*
+Pooled_buffer::put(size_t n)
+{
+    size_t tailroom = (base + capacity) - (data() + size());
+    if (tailroom < n) {
+        reallocate(capacity + std::max(capacity, n - tailroom),
+                   data() - base);
+    }
+    uint8_t* p = data() + size();
+    m_size += n;
+    return p;
+}
+
+} // namespace vigil
@@ -17,13 +17,18 @@
  */
 #include "event-dispatcher.hh"
 
-#include <map>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
 #include <boost/ptr_container/ptr_list.hpp>
 
-#include "hash_map.hh"
+#include "mpsc-queue.hh"
 #include "threads/cooperative.hh"
 #include "vlog.hh"
 
@@ -31,59 +36,309 @@ namespace vigil {
 
 static Vlog_module lg("event-dispatcher");
 
-typedef std::multimap<int, Event_dispatcher::Handler> Signal;
+/* The handlers for one event type, in the order to call them. */
+struct Handler_entry
+{
+    int order;
+    Event_dispatcher::Handler handler;
+};
+typedef std::vector<Handler_entry> Signal;
+
+static bool
+operator<(int order, const Handler_entry& entry)
+{
+    return order < entry.order;
+}
 
 struct Event_dispatcher_impl
 {
-    hash_map<Event_name, Signal> table;
-    boost::ptr_list<Event> queue;
+    /* Indexed by Event_type_id.  Null if a type has no handlers.
+     *
+     * A Signal is never modified once installed here: add_handler() installs
+     * a copy instead, so that dispatch() can walk a Signal even if a handler
+     * blocks or registers handlers.  The old Signal is freed at once if no
+     * dispatch() is in progress, otherwise it waits in 'retired' until the
+     * last one finishes.  'n_dispatching' counts the dispatch() calls in
+     * progress, including those whose handlers are blocked. */
+    std::vector<const Signal*> table;
+    std::vector<const Signal*> retired;
+    unsigned int n_dispatching;
+
+    /* Events posted, from any thread, but not yet moved to 'queues'.
+     * 'n_inbound' counts them and is updated atomically. */
+    Mpsc_queue<Event*> inbound;
+    size_t n_inbound;
+
+    /* Events waiting for dispatch, by class.  Touched only by the dispatching
+     * group. */
+    struct Class_queue {
+        boost::ptr_list<Event> events;
+        unsigned int weight;
+        size_t max_queued;
+    };
+    Class_queue queues[Event_dispatcher::N_EVENT_CLASSES];
+    size_t n_queued;
     Co_cond nonempty_queue;
+
+    /* Indexed by Event_type_id.  Types beyond the end are in class CONTROL. */
+    std::vector<unsigned char> classes;
     unsigned int serial;
+
+    /* The group that polls the dispatcher, once known.  Posters in that group
+     * wake it with 'nonempty_queue'.  Others write a byte to 'wake_fds[1]'
+     * if they are the ones to set 'wake_pending', which stays set until the
+     * dispatcher reads that byte, so there is never more than one. */
+    co_group* group;
+    int wake_fds[2];
+    int wake_pending;
+
+    /* n_posted and n_remote are updated atomically. */
+    Event_dispatcher::Stats stats;
+
+    Event_dispatcher::Event_class get_class(const Event&) const;
+    void collect_inbound();
+    void free_retired();
+};
+
+/* Counts a dispatch() in progress for as long as it exists, and frees the
+ * retired Signals when the last one ends. */
+struct Dispatch_guard
+{
+    Event_dispatcher_impl* p;
+
+    Dispatch_guard(Event_dispatcher_impl* p_) : p(p_) { p->n_dispatching++; }
+    ~Dispatch_guard() { if (!--p->n_dispatching) { p->free_retired(); } }
+};
+
+/* Default weight and queue limit of each class.  No queue is bounded unless
+ * its owner asks for it with set_class_limits() or set_class_max_queued(). */
+static const struct {
+    unsigned int weight;
+    size_t max_queued;
+} class_defaults[Event_dispatcher::N_EVENT_CLASSES] = {
+    { 64, 0 },                  /* CONTROL */
+    { 32, 0 },                  /* TOPOLOGY */
+    { 16, 0 },                  /* STATS */
+    { 8, 0 },                   /* PACKET_IN */
 };
 
 Event_dispatcher::Event_dispatcher()
     : p(new Event_dispatcher_impl())
 {
+    p->n_dispatching = 0;
     p->serial = 0;
+    p->n_inbound = 0;
+    p->n_queued = 0;
+    for (int i = 0; i < N_EVENT_CLASSES; ++i) {
+        p->queues[i].weight = class_defaults[i].weight;
+        p->queues[i].max_queued = class_defaults[i].max_queued;
+    }
+    p->group = NULL;
+    p->wake_pending = 0;
+    memset(&p->stats, 0, sizeof p->stats);
+
+    if (pipe(p->wake_fds) < 0) {
+        throw std::runtime_error("Unable to create a pipe for "
+                                 "an event dispatcher.");
+    }
+    for (int i = 0; i < 2; ++i) {
+        int flags = fcntl(p->wake_fds[i], F_GETFL, 0);
+        if (fcntl(p->wake_fds[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+            throw std::runtime_error("Unable to set a pipe non-blocking.");
+        }
+    }
 }
 
 Event_dispatcher::~Event_dispatcher()
 {
+    BOOST_FOREACH (const Signal* signal, p->table) {
+        delete signal;
+    }
+    p->free_retired();
+    Event* event;
+    while (p->inbound.pop(event)) {
+        delete event;
+    }
+    /* A dispatcher destroyed at exit may have no thread, let alone a thread
+     * group, to notify.  Notify before closing, since the fd number may be
+     * reused at once. */
+    if (co_self() && co_group_self()) {
+        co_fd_closed(p->wake_fds[0]);
+    }
+    close(p->wake_fds[0]);
+    close(p->wake_fds[1]);
     delete p;
 }
 
+Event_dispatcher::Event_class
+Event_dispatcher_impl::get_class(const Event& event) const
+{
+    Event_type_id id = event.get_type_id();
+    return (id < classes.size()
+            ? Event_dispatcher::Event_class(classes[id])
+            : Event_dispatcher::CONTROL);
+}
+
+void
+Event_dispatcher_impl::free_retired()
+{
+    BOOST_FOREACH (const Signal* signal, retired) {
+        delete signal;
+    }
+    retired.clear();
+}
+
+/* Moves the events posted since the last call into their class queues, all
+ * at once, dropping those that would exceed their class's limit. */
+void
+Event_dispatcher_impl::collect_inbound()
+{
+    group = co_group_self();
+    char c;
+    if (wake_pending && read(wake_fds[0], &c, 1) == 1) {
+        __sync_lock_release(&wake_pending);
+    }
+
+    size_t n = 0;
+    Event* event;
+    while (inbound.pop(event)) {
+        ++n;
+        int cls = get_class(*event);
+        Class_queue& q = queues[cls];
+        if (q.max_queued && q.events.size() >= q.max_queued) {
+            stats.classes[cls].n_dropped++;
+            delete event;
+        } else {
+            q.events.push_back(event);
+            ++n_queued;
+        }
+    }
+    if (n) {
+        __sync_sub_and_fetch(&n_inbound, n);
+        stats.max_batch = std::max(stats.max_batch, n);
+        stats.max_depth = std::max(stats.max_depth, n_queued);
+    }
+}
+
 void
 Event_dispatcher::add_handler(const Event_name& name, 
                               const Handler& handler,
                               int order)
 {
-    p->table[name].insert(Signal::value_type(order, handler));
+    Event_type_id id = Event::get_type_id(name);
+    if (id >= p->table.size()) {
+        p->table.resize(id + 1);
+    }
+
+    /* Handlers with equal 'order' are called in the order added. */
+    const Signal* old_signal = p->table[id];
+    Signal* signal = old_signal ? new Signal(*old_signal) : new Signal;
+    Handler_entry entry;
+    entry.order = order;
+    entry.handler = handler;
+    signal->insert(std::upper_bound(signal->begin(), signal->end(), order),
+                   entry);
+
+    p->table[id] = signal;
+    if (old_signal && p->n_dispatching) {
+        p->retired.push_back(old_signal);
+    } else {
+        delete old_signal;
+    }
+}
+
+void
+Event_dispatcher::set_event_class(const Event_name& name, Event_class c)
+{
+    Event_type_id id = Event::get_type_id(name);
+    if (id >= p->classes.size()) {
+        p->classes.resize(id + 1, CONTROL);
+    }
+    p->classes[id] = c;
+}
+
+Event_dispatcher::Event_class
+Event_dispatcher::get_event_class(Event_type_id id) const
+{
+    return id < p->classes.size() ? Event_class(p->classes[id]) : CONTROL;
+}
+
+void
+Event_dispatcher::set_class_limits(Event_class c, unsigned int weight,
+                                   size_t max_queued)
+{
+    p->queues[c].weight = std::max(weight, 1u);
+    p->queues[c].max_queued = max_queued;
+}
+
+void
+Event_dispatcher::set_class_max_queued(Event_class c, size_t max_queued)
+{
+    p->queues[c].max_queued = max_queued;
+}
+
+bool
+Event_dispatcher::has_handlers(const Event_name& name) const
+{
+    return has_handlers(Event::get_type_id(name));
+}
+
+bool
+Event_dispatcher::has_handlers(Event_type_id id) const
+{
+    return id < p->table.size() && p->table[id];
 }
 
 void
 Event_dispatcher::post(Event* event)
 {
-    if (p->queue.empty()) {
-        p->nonempty_queue.broadcast();
+    p->inbound.push(event);
+    size_t n_inbound = __sync_fetch_and_add(&p->n_inbound, 1);
+    __sync_fetch_and_add(&p->stats.n_posted, 1);
+
+    co_group* group = p->group;
+    if (group && co_group_self() == group) {
+        if (!n_inbound) {
+            p->nonempty_queue.broadcast();
+        }
+    } else {
+        __sync_fetch_and_add(&p->stats.n_remote, 1);
+        if (!__sync_lock_test_and_set(&p->wake_pending, 1)) {
+            /* If the pipe is full, the dispatcher has a byte to read already.
+             * On any other error, let the next post() try again. */
+            static const char c = '\0';
+            ssize_t retval;
+            do {
+                retval = write(p->wake_fds[1], &c, 1);
+            } while (retval < 0 && errno == EINTR);
+            if (retval < 0 && errno != EAGAIN) {
+                lg.err("could not wake up event dispatcher: %s",
+                       strerror(errno));
+                __sync_lock_release(&p->wake_pending);
+            }
+        }
     }
-    p->queue.push_back(event);
 }
 
 void
 Event_dispatcher::dispatch(const Event& e)
 {
-    const Event_name& name = e.get_name();
-    if (p->table.find(name) != p->table.end()) {
-        BOOST_FOREACH (Signal::value_type& i, p->table[name]) {
-            try {
-                if (i.second(e) == STOP) {
-                    break;
-                }
-            } catch (const std::exception& e) {
-                lg.err("Event %s processing leaked an exception: %s", 
-		       name.c_str(), e.what());
+    Event_type_id id = e.get_type_id();
+    if (id >= p->table.size() || !p->table[id]) {
+        return;
+    }
+
+    Dispatch_guard guard(p);
+    const Signal& signal = *p->table[id];
+    for (Signal::const_iterator i = signal.begin(); i != signal.end(); ++i) {
+        try {
+            if (i->handler(e) == STOP) {
                 break;
             }
+        } catch (const std::exception& ex) {
+            lg.err("Event %s processing leaked an exception: %s", 
+                   e.get_name().c_str(), ex.what());
+            break;
         }
     }
 }
@@ -91,36 +346,60 @@ Event_dispatcher::dispatch(const Event& e)
 bool
 Event_dispatcher::poll()
 {
-    /* Dispatch all the events initially in the queue, but not any events
-     * queued by processing those events, to avoid starving other Pollables.
-     *
-     * XXX We need a scheme for prioritizing event dispatch above other
-     * Pollables.
-     */
-    size_t max = p->queue.size();
+    /* Dispatch up to each class's weight in events initially in its queue,
+     * but not any events queued by processing those events, to avoid starving
+     * other Pollables.  Higher-priority classes go first, so a control event
+     * waits behind at most one round of lower-priority events. */
+    p->collect_inbound();
+    size_t quota[N_EVENT_CLASSES];
+    for (int c = 0; c < N_EVENT_CLASSES; ++c) {
+        quota[c] = std::min(size_t(p->queues[c].weight),
+                            p->queues[c].events.size());
+    }
+
+    bool progress = false;
     unsigned int serial = ++p->serial;
-    for (size_t i = 0; i < max; ++i) {
-        std::auto_ptr<Event> event(p->queue.pop_front().release());
-        dispatch(*event);
-
-        if (serial != p->serial) {
-            /* dispatch(*event) blocked and Event_dispatcher::poll() was
-             * eventually re-entered in another thread.  That other call
-             * already dispatched our events, so we are done. */
-            break;
+    for (int c = 0; c < N_EVENT_CLASSES; ++c) {
+        for (size_t i = 0; i < quota[c]; ++i) {
+            std::auto_ptr<Event> event(
+                p->queues[c].events.pop_front().release());
+            p->n_queued--;
+            p->stats.n_dispatched++;
+            progress = true;
+            dispatch(*event);
+
+            if (serial != p->serial) {
+                /* dispatch(*event) blocked and Event_dispatcher::poll() was
+                 * eventually re-entered in another thread.  That other call
+                 * took over dispatching, so we are done. */
+                return true;
+            }
         }
     }
-    return max > 0;
+    return progress;
 }
 
 void
 Event_dispatcher::wait()
 {
-    if (!p->queue.empty()) {
+    p->group = co_group_self();
+    if (p->n_queued || p->n_inbound) {
         co_immediate_wake(1, NULL);
     } else {
         p->nonempty_queue.wait();
+        co_fd_read_wait(p->wake_fds[0], NULL);
+    }
+}
+
+Event_dispatcher::Stats
+Event_dispatcher::get_stats() const
+{
+    Stats stats = p->stats;
+    stats.depth = p->n_queued + p->n_inbound;
+    for (int c = 0; c < N_EVENT_CLASSES; ++c) {
+        stats.classes[c].depth = p->queues[c].events.size();
     }
+    return stats;
 }
 
 } // namespace vigil
@@ -19,6 +19,8 @@
 #include <typeinfo>
 #include <vector>
 #include <string>
+#include "hash_map.hh"
+#include "threads/native.hh"
 
 /* Following are for Event::get_name below.
  * Not portable outside GCC's C++ ABI.
@@ -28,8 +30,48 @@
 
 namespace vigil {
 
+/* Maps from event names to type ids.  Read on the construction of events
+ * whose classes do not cache their ids, but written only the first time a
+ * name is seen. */
+struct Event_type_table
+{
+    Native_rwlock rwlock;
+    hash_map<Event_name, Event_type_id> ids;
+};
+
+static Event_type_table&
+event_type_table()
+{
+    static Event_type_table* table = new Event_type_table;
+    return *table;
+}
+
+Event_type_id
+Event::get_type_id(const Event_name& name)
+{
+    Event_type_table& table = event_type_table();
+    hash_map<Event_name, Event_type_id>::const_iterator i;
+
+    table.rwlock.read_lock();
+    i = table.ids.find(name);
+    bool found = i != table.ids.end();
+    Event_type_id id = found ? i->second : 0;
+    table.rwlock.read_unlock();
+    if (found) {
+        return id;
+    }
+
+    table.rwlock.write_lock();
+    /* Another thread may have assigned an id in the meantime, in which case
+     * insert() returns it. */
+    Event_type_id next_id = table.ids.size();
+    id = table.ids.insert(std::make_pair(name, next_id)).first->second;
+    table.rwlock.write_unlock();
+    return id;
+}
+
 Event::Event(const Event_name& name_) : 
-    name(name_) { 
+    name(name_), type_id(get_type_id(name_)) { 
 
 }
 
@@ -40,6 +82,7 @@ Event::~Event() {
 void
 Event::set_name(const Event_name& name_) {
     name = name_;
+    type_id = get_type_id(name_);
 }
 
 Event_name 
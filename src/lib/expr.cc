@@ -16,6 +16,7 @@
  * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "expr.hh"
+#include <algorithm>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -90,6 +91,67 @@ get_field<Packet_expr, Packet_expr>(uint32_t field, const Packet_expr& expr,
     return expr.get_field(field, value);
 }
 
+/* The groups of a Grouped_flow that belongs to none. */
+static const uint32_t no_groups[1] = { 0 };
+
+static bool
+get_group(const std::vector<uint32_t>& groups, uint32_t idx, uint32_t& value)
+{
+    if (groups.empty()) {
+        value = no_groups[0];
+        return idx == 0;
+    } else if (idx < groups.size()) {
+        value = groups[idx];
+        return true;
+    }
+    return false;
+}
+
+template<>
+bool
+get_field<Packet_expr, Grouped_flow>(uint32_t field, const Grouped_flow& flow,
+                                     uint32_t idx, uint32_t& value)
+{
+    switch (field) {
+    case Packet_expr::GROUP_SRC:
+        return get_group(flow.src_groups, idx, value);
+    case Packet_expr::GROUP_DST:
+        return get_group(flow.dst_groups, idx, value);
+    }
+    return get_field<Packet_expr, Flow>(field, *flow.flow, idx, value);
+}
+
+static void
+get_group_set(const std::vector<uint32_t>& groups,
+              const uint32_t*& begin, const uint32_t*& end)
+{
+    if (groups.empty()) {
+        begin = no_groups;
+        end = no_groups + 1;
+    } else {
+        begin = &groups[0];
+        end = begin + groups.size();
+    }
+}
+
+template<>
+bool
+get_field_set<Packet_expr, Grouped_flow>(uint32_t field,
+                                         const Grouped_flow& flow,
+                                         const uint32_t*& begin,
+                                         const uint32_t*& end)
+{
+    switch (field) {
+    case Packet_expr::GROUP_SRC:
+        get_group_set(flow.src_groups, begin, end);
+        return true;
+    case Packet_expr::GROUP_DST:
+        get_group_set(flow.dst_groups, begin, end);
+        return true;
+    }
+    return false;
+}
+
 bool
 Packet_expr::get_field(uint32_t field, uint32_t& value) const
 {
@@ -213,14 +275,10 @@ Packet_expr::splittable(uint32_t path) const
 }
 
 
-template <>
-bool
-matches(uint32_t rule_id, const Packet_expr& expr, const Flow& flow)
+/* Returns true if 'expr' matches 'flow' on all of the fields a Flow has. */
+static bool
+matches_flow(const Packet_expr& expr, const Flow& flow)
 {
-    assert(!((~expr.wildcards) & (Cnode<Packet_expr, void*>::MASKS[Packet_expr::AP_DST]
-                             | Cnode<Packet_expr, void*>::MASKS[Packet_expr::GROUP_SRC]
-                             | Cnode<Packet_expr, void*>::MASKS[Packet_expr::GROUP_DST])));
-
     return (((expr.wildcards & Cnode<Packet_expr, void*>::MASKS[Packet_expr::AP_SRC])
              || expr.ap_src == flow.in_port)
             && ((expr.wildcards & Cnode<Packet_expr, void*>::MASKS[Packet_expr::DL_VLAN])
@@ -245,6 +303,39 @@ matches(uint32_t rule_id, const Packet_expr& expr, const Flow& flow)
                 || expr.tp_dst == flow.tp_dst));
 }
 
+template <>
+bool
+matches(uint32_t rule_id, const Packet_expr& expr, const Flow& flow)
+{
+    assert(!((~expr.wildcards) & (Cnode<Packet_expr, void*>::MASKS[Packet_expr::AP_DST]
+                             | Cnode<Packet_expr, void*>::MASKS[Packet_expr::GROUP_SRC]
+                             | Cnode<Packet_expr, void*>::MASKS[Packet_expr::GROUP_DST])));
+
+    return matches_flow(expr, flow);
+}
+
+static bool
+in_groups(const std::vector<uint32_t>& groups, uint32_t group)
+{
+    if (groups.empty()) {
+        return group == no_groups[0];
+    }
+    return std::binary_search(groups.begin(), groups.end(), group);
+}
+
+template <>
+bool
+matches(uint32_t rule_id, const Packet_expr& expr, const Grouped_flow& flow)
+{
+    assert(!((~expr.wildcards) & Cnode<Packet_expr, void*>::MASKS[Packet_expr::AP_DST]));
+
+    return (matches_flow(expr, *flow.flow)
+            && ((expr.wildcards & Cnode<Packet_expr, void*>::MASKS[Packet_expr::GROUP_SRC])
+                || in_groups(flow.src_groups, expr.group_src))
+            && ((expr.wildcards & Cnode<Packet_expr, void*>::MASKS[Packet_expr::GROUP_DST])
+                || in_groups(flow.dst_groups, expr.group_dst)));
+}
+
 template <>
 bool
 matches(uint32_t rule_id, const Packet_expr& expr, const Packet_expr& to_match)
@@ -156,15 +156,115 @@ Flow::Flow(const Flow& flow, uint64_t cookie_, bool invalid_):
 { }
 
 Flow::Flow(uint16_t in_port_, const Buffer& buffer, uint64_t cookie_)
-    : in_port(in_port_),
+    : invalid(false),
+      in_port(in_port_),
       dl_vlan(), dl_vlan_pcp(0), dl_src(), dl_dst(), dl_type(0),
       nw_src(0), nw_dst(0), nw_proto(0), nw_tos(0),
       tp_src(0), tp_dst(0), cookie(cookie_)
 {
-    invalid = false;
-    dl_vlan = htons(OFP_VLAN_NONE);
+    if (!parse_fast(buffer)) {
+        parse(buffer);
+    }
+}
 
+bool
+Flow::parse_fast(const Buffer& buffer)
+{
+    const uint8_t* p = buffer.data();
+    size_t size = buffer.size();
+    if (size < ETH_HEADER_LEN + IP_HEADER_LEN) {
+        return false;
+    }
 
+    /* Ethernet II, optionally with one VLAN tag, carrying IPv4. */
+    const eth_header* eth = reinterpret_cast<const eth_header*>(p);
+    size_t ip_ofs = ETH_HEADER_LEN;
+    uint16_t type = eth->eth_type;
+    uint16_t tci = 0;
+    bool tagged = type == htons(ETH_TYPE_VLAN);
+    if (tagged) {
+        if (size < VLAN_ETH_HEADER_LEN + IP_HEADER_LEN) {
+            return false;
+        }
+        const vlan_header* vh
+            = reinterpret_cast<const vlan_header*>(p + ETH_HEADER_LEN);
+        tci = vh->vlan_tci;
+        type = vh->vlan_next_type;
+        ip_ofs = VLAN_ETH_HEADER_LEN;
+    }
+    if (type != htons(ETH_TYPE_IP)) {
+        return false;
+    }
+
+    const ip_header* ip = reinterpret_cast<const ip_header*>(p + ip_ofs);
+    size_t ip_len = IP_IHL(ip->ip_ihl_ver) * 4;
+    if (ip_len < IP_HEADER_LEN || size < ip_ofs + ip_len) {
+        return false;
+    }
+
+    /* TCP, UDP or ICMP, unless this is a fragment. */
+    const uint8_t* l4 = p + ip_ofs + ip_len;
+    size_t l4_size = size - ip_ofs - ip_len;
+    uint16_t l4_src = 0, l4_dst = 0;
+    if (!ip_::is_fragment(ip->ip_frag_off)) {
+        if (ip->ip_proto == ip_::proto::TCP) {
+            const tcp_header* tcp = reinterpret_cast<const tcp_header*>(l4);
+            if (l4_size < TCP_HEADER_LEN
+                || TCP_OFFSET(tcp->tcp_ctl) * 4 < TCP_HEADER_LEN
+                || TCP_OFFSET(tcp->tcp_ctl) * 4 > l4_size) {
+                return false;
+            }
+            l4_src = tcp->tcp_src;
+            l4_dst = tcp->tcp_dst;
+        } else if (ip->ip_proto == ip_::proto::UDP) {
+            if (l4_size < UDP_HEADER_LEN) {
+                return false;
+            }
+            const udp_header* udp = reinterpret_cast<const udp_header*>(l4);
+            l4_src = udp->udp_src;
+            l4_dst = udp->udp_dst;
+        } else if (ip->ip_proto == ip_::proto::ICMP) {
+            if (l4_size < ICMP_HEADER_LEN) {
+                return false;
+            }
+            const icmp_header* icmp = reinterpret_cast<const icmp_header*>(l4);
+            l4_src = htons(icmp->icmp_type);
+            l4_dst = htons(icmp->icmp_code);
+        }
+    }
+
+    invalid = false;
+    memcpy(dl_src.octet, eth->eth_src, ETH_ADDR_LEN);
+    memcpy(dl_dst.octet, eth->eth_dst, ETH_ADDR_LEN);
+    dl_type = type;
+    if (tagged) {
+        dl_vlan = tci & htons(VLAN_VID);
+        dl_vlan_pcp = (ntohs(tci) & VLAN_PCP_MASK) >> VLAN_PCP_SHIFT;
+    } else {
+        dl_vlan = htons(OFP_VLAN_NONE);
+        dl_vlan_pcp = 0;
+    }
+    nw_src = ip->ip_src;
+    nw_dst = ip->ip_dst;
+    nw_proto = ip->ip_proto;
+    nw_tos = ip->ip_tos;
+    tp_src = l4_src;
+    tp_dst = l4_dst;
+    return true;
+}
+
+void
+Flow::parse(const Buffer& buffer)
+{
+    invalid = false;
+    dl_vlan = htons(OFP_VLAN_NONE);
+    dl_vlan_pcp = 0;
+    dl_src = ethernetaddr();
+    dl_dst = ethernetaddr();
+    dl_type = 0;
+    nw_src = nw_dst = 0;
+    nw_proto = nw_tos = 0;
+    tp_src = tp_dst = 0;
 
     Nonowning_buffer b(buffer);
     const eth_header* eth = pull_eth(b);
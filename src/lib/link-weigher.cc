@@ -0,0 +1,87 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "link-weigher.hh"
+
+#include <algorithm>
+#include <stddef.h>
+
+namespace vigil {
+
+Link_weigher::Link_weigher()
+    : alpha(0.5), hysteresis(0.05)
+{
+    thresholds.push_back(0.5);
+    thresholds.push_back(0.75);
+    thresholds.push_back(0.9);
+}
+
+/*
+ * Replaces the thresholds between levels by 'new_thresholds', which must be
+ * in increasing order and no more than MAX_LEVELS - 1 of them.  Returns
+ * false, leaving the thresholds alone, if they are not.
+ */
+
+bool
+Link_weigher::set_thresholds(const std::vector<double>& new_thresholds)
+{
+    if (new_thresholds.size() >= MAX_LEVELS) {
+        return false;
+    }
+    for (size_t i = 1; i < new_thresholds.size(); i++) {
+        if (new_thresholds[i] <= new_thresholds[i - 1]) {
+            return false;
+        }
+    }
+    thresholds = new_thresholds;
+    return true;
+}
+
+/*
+ * Folds the sample 'value' into 'load'.  Returns true if that moves the link
+ * to another level, and so changes its weight.  Negative samples, which mean
+ * that the load is not known, are ignored.  A load left above the top level
+ * by set_thresholds() is first moved down to it, which counts as a change.
+ */
+
+bool
+Link_weigher::sample(Load& load, double value) const
+{
+    if (value < 0) {
+        return false;
+    } else if (!load.sampled) {
+        load.value = value;
+        load.sampled = true;
+    } else {
+        load.value += alpha * (value - load.value);
+    }
+
+    unsigned int level = std::min<size_t>(load.level, thresholds.size());
+    while (level < thresholds.size() && load.value >= thresholds[level]) {
+        level++;
+    }
+    while (level > 0 && load.value < thresholds[level - 1] - hysteresis) {
+        level--;
+    }
+    if (level == load.level) {
+        return false;
+    }
+    load.level = level;
+    return true;
+}
+
+} // namespace vigil
@@ -488,7 +488,7 @@ namespace vigil {
 
 Event*
 openflow_msg_to_event(boost::shared_ptr<Openflow_connection> oconn, 
-		      std::auto_ptr<Buffer> p)
+		      boost::shared_ptr<Buffer> p)
 {
     if (p->size() < sizeof(struct ofp_header)) 
     {
@@ -29,6 +29,7 @@
 #include <netinet/in.h>
 #include "async_io.hh"
 #include "buffer.hh"
+#include "buffer-pool.hh"
 #include "datapath.hh"
 #include "errno_exception.hh"
 #include "netinet++/ipaddr.hh"
@@ -50,6 +51,10 @@ static Vlog_module log("openflow");
 
 const int Reliable_openflow_connection::backoff_limit = 60;
 const int Openflow_connection::probe_interval = 15;
+const size_t Openflow_stream_connection::rx_ring_size = 65536;
+const size_t Openflow_stream_connection::tx_flush_bytes = 32768;
+timeval Openflow_stream_connection::default_tx_flush_delay = { 0, 0 };
+size_t Openflow_stream_connection::default_tx_high_water = 1024 * 1024;
 
 Openflow_connection::Openflow_connection()
     : ext_data_xid(UINT32_MAX),
@@ -772,14 +777,27 @@ Openflow_connection::send_remote_command(const std::string& command,
 }
 
 
-/* Constructs a Openflow connection that takes over ownership of 'stream'. */
+/* Constructs a Openflow connection that takes over ownership of 'stream'.
+ * The connection must be used only from the thread group that creates it. */
 Openflow_stream_connection::Openflow_stream_connection(
     std::auto_ptr<Async_stream> stream_,Connection_type t)
-    : tx_fsm(boost::bind(&Openflow_stream_connection::tx_run, this)),
-      stream(stream_), rx_bytes(0), conn_type(t)
+    : tx_fsm(boost::bind(&Openflow_stream_connection::tx_run, this),
+             *co_group_self()),
+      stream(stream_), pool(Buffer_pool::create()),
+      rx_ring(new Array_buffer(rx_ring_size)), rx_start(0), rx_end(0),
+      tx_start(0), tx_flush_delay(default_tx_flush_delay),
+      tx_high_water(default_tx_high_water), conn_type(t)
 {
 }
 
+void
+Openflow_stream_connection::set_tx_coalescing(const timeval& flush_delay,
+                                              size_t high_water)
+{
+    default_tx_flush_delay = flush_delay;
+    default_tx_high_water = high_water;
+}
+
 /* Close the stream associated with this connection */
 int
 Openflow_stream_connection::close()
@@ -802,17 +820,37 @@ Openflow_stream_connection::do_connect_wait()
 void
 Openflow_stream_connection::tx_run()
 {
-    if (tx_buf.get() && send_tx_buf() == EAGAIN) {
-        do_send_openflow_wait();
+    if (get_tx_backlog()) {
+        if (get_tx_backlog() < tx_flush_bytes
+            && do_gettimeofday() < tx_flush_time) {
+            co_timer_wait(tx_flush_time, NULL);
+        } else if (flush_tx() == EAGAIN) {
+            do_send_openflow_wait();
+        }
     }
     co_fsm_block();
 }
 
-int Openflow_stream_connection::send_tx_buf()
+/* Writes as much of tx_queue as the stream accepts without blocking.  Returns
+ * 0 if the queue is now empty, EAGAIN if some of it remains, otherwise a
+ * positive errno value. */
+int Openflow_stream_connection::flush_tx()
 {
     ssize_t bytes_written;
-    int error = stream->write_fully(*tx_buf, &bytes_written, false);
-    tx_buf->pull(bytes_written);
+    Nonowning_buffer b(&tx_queue[tx_start], get_tx_backlog());
+    int error = stream->write_fully(b, &bytes_written, false);
+    tx_start += bytes_written;
+
+    /* Drop the written bytes once they make up at least half of the queue,
+     * so that partial writes do not let it grow without bound.  Each byte
+     * moved is paid for by at least one byte dropped. */
+    if (tx_start == tx_queue.size()) {
+        tx_queue.clear();
+        tx_start = 0;
+    } else if (tx_start >= tx_queue.size() / 2) {
+        tx_queue.erase(tx_queue.begin(), tx_queue.begin() + tx_start);
+        tx_start = 0;
+    }
 
     if (error) {
         if (error != EAGAIN) {
@@ -820,49 +858,59 @@ int Openflow_stream_connection::send_tx_buf()
         }
         return error;
     }
-
-    if (!tx_buf->size()) {
-        tx_buf.reset();
-        return 0;
-    } else {
-        return EAGAIN;
-    }
+    return get_tx_backlog() ? EAGAIN : 0;
 }
 
 int Openflow_stream_connection::do_send_openflow(const ofp_header* oh)
 {
-    if (tx_buf.get()) {
-        int error = send_tx_buf();
-        if (error) {
+    if (get_tx_backlog() >= tx_high_water) {
+        int error = flush_tx();
+        if (error && error != EAGAIN) {
             return error;
         }
+        if (get_tx_backlog() >= tx_high_water) {
+            return EAGAIN;
+        }
     }
 
-    /* FIXME: shouldn't need a copy here in most cases */
-    tx_buf.reset(new Array_buffer(ntohs(oh->length)));
-    memcpy(tx_buf->data(), oh, ntohs(oh->length));
-    int error = send_tx_buf();
-    if (error == EAGAIN) {
-        tx_fsm.wake();
-        return 0;
-    } else {
-        return error;
+    bool was_empty = !get_tx_backlog();
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(oh);
+    tx_queue.insert(tx_queue.end(), p, p + ntohs(oh->length));
+
+    if (get_tx_backlog() >= tx_flush_bytes) {
+        int error = flush_tx();
+        if (error != EAGAIN) {
+            return error;
+        }
+    } else if (was_empty) {
+        tx_flush_time = do_gettimeofday() + tx_flush_delay;
     }
+    tx_fsm.wake();
+    return 0;
 }
 
-int Openflow_stream_connection::do_read(void *p, size_t need_bytes)
+/* Reads as many bytes as 'stream' has available into the free space at the
+ * end of rx_ring, first moving any partial message to the front. */
+int Openflow_stream_connection::fill_rx_ring()
 {
-    Nonowning_buffer b(p, need_bytes);
+    if (rx_start) {
+        memmove(rx_ring->data(), rx_ring->data() + rx_start,
+                rx_end - rx_start);
+        rx_end -= rx_start;
+        rx_start = 0;
+    }
+
+    Nonowning_buffer b(rx_ring->data() + rx_end, rx_ring->size() - rx_end);
     ssize_t n = stream->read(b, false);
     if (n > 0) {
-        rx_bytes += n;
-        return n < need_bytes ? EAGAIN : 0;
+        rx_end += n;
+        return 0;
     } else if (n == -EAGAIN) {
         return EAGAIN;
     } else {
         stream->close();
         if (n == 0) {
-            if (!rx_bytes) {
+            if (rx_end == rx_start) {
                 return EOF;
             } else {
                 log.warn("%s: unexpected connection drop in middle "
@@ -875,38 +923,52 @@ int Openflow_stream_connection::do_read(void *p, size_t need_bytes)
     }
 }
 
+/* Returns the complete message at the front of rx_ring, if there is one,
+ * otherwise a null pointer. */
+const ofp_header* Openflow_stream_connection::rx_ring_message() const
+{
+    size_t avail = rx_end - rx_start;
+    if (avail < sizeof(ofp_header)) {
+        return NULL;
+    }
+    const ofp_header* oh
+        = reinterpret_cast<const ofp_header*>(rx_ring->data() + rx_start);
+    size_t length = ntohs(oh->length);
+    return length <= avail ? oh : NULL;
+}
+
 std::auto_ptr<Buffer> Openflow_stream_connection::do_recv_openflow(int& error)
 {
-    if (rx_bytes < sizeof rx_header) {
-        error = do_read((char *) &rx_header + rx_bytes,
-                        sizeof rx_header - rx_bytes);
-        if (error) {
-            return std::auto_ptr<Buffer>(0);
-        }
+    for (;;) {
+        if (rx_end - rx_start >= sizeof(ofp_header)) {
+            const ofp_header* oh = reinterpret_cast<const ofp_header*>(
+                rx_ring->data() + rx_start);
+            size_t length = ntohs(oh->length);
+            if (length < sizeof *oh) {
+                log.warn("%s: received length (%zu) claims to be shorter "
+                         "than header", to_string().c_str(), length);
+                stream->close();
+                error = EPROTO;
+                return std::auto_ptr<Buffer>(0);
+            }
 
-        size_t length = ntohs(rx_header.length);
-        if (length < sizeof rx_header) {
-            log.warn("%s: received length (%zu) claims to be shorter than "
-                     "header", to_string().c_str(), length);
-            stream->close();
-            error = EPROTO;
-            return std::auto_ptr<Buffer>(0);
+            if (rx_end - rx_start >= length) {
+                std::auto_ptr<Buffer> b(pool->allocate(length));
+                memcpy(b->data(), oh, length);
+                rx_start += length;
+                if (rx_start == rx_end) {
+                    rx_start = rx_end = 0;
+                }
+                error = 0;
+                return b;
+            }
         }
-        rx_buf.reset(new Array_buffer(length));
-        memcpy(rx_buf->data(), &rx_header, sizeof rx_header);
-    }
 
-    if (size_t need_bytes = ntohs(rx_header.length) - rx_bytes) {
-        error = do_read(rx_buf->data() + rx_bytes, need_bytes);
+        error = fill_rx_ring();
         if (error) {
             return std::auto_ptr<Buffer>(0);
         }
-    } else {
-        /* OpenFlow packet is exactly sizeof(ofp_header) bytes long. */
-        error = 0;
     }
-    rx_bytes = 0;
-    return rx_buf;
 }
 
 void
@@ -918,7 +980,12 @@ Openflow_stream_connection::do_send_openflow_wait()
 void
 Openflow_stream_connection::do_recv_openflow_wait()
 {
-    stream->read_wait();
+    if (rx_ring_message()) {
+        /* Already have a message buffered, no need to wait on the socket. */
+        co_immediate_wake(1, NULL);
+    } else {
+        stream->read_wait();
+    }
 }
 
 std::string Openflow_stream_connection::to_string()
@@ -971,7 +1038,7 @@ Reliable_openflow_connection::Reliable_openflow_connection(
       backoff(0),
       status(CONN_SLEEPING)
 {
-    fsm = co_fsm_create(&co_group_coop,
+    fsm = co_fsm_create(co_group_self(),
                   boost::bind(&Reliable_openflow_connection::run, this));
     co_fsm_run(fsm);
 }
@@ -0,0 +1,165 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "packet-in-limiter.hh"
+
+#include <algorithm>
+
+namespace vigil {
+
+Token_bucket::Token_bucket(unsigned int rate_, unsigned int burst)
+    : rate(rate_),
+      capacity(uint64_t(burst ? burst : rate_) * 1000),
+      tokens(capacity),
+      last_fill(0)
+{ }
+
+bool
+Token_bucket::consume(long long int now)
+{
+    if (!available(now)) {
+        return false;
+    }
+    take();
+    return true;
+}
+
+bool
+Token_bucket::available(long long int now)
+{
+    if (!rate) {
+        return true;
+    }
+
+    /* A token is 1000 units and 'rate' tokens accrue per second, so 'rate'
+     * units accrue per millisecond. */
+    if (now > last_fill) {
+        uint64_t elapsed = now - last_fill;
+        tokens = std::min(capacity, tokens + elapsed * rate);
+        last_fill = now;
+    }
+    return tokens >= 1000;
+}
+
+void
+Token_bucket::take()
+{
+    if (rate) {
+        tokens -= 1000;
+    }
+}
+
+Packet_in_limits::Packet_in_limits()
+    : rate(0), burst(0), port_rate(0), port_burst(0), sample(0),
+      drop_flow_secs(0)
+{ }
+
+Packet_in_stats::Packet_in_stats()
+    : admitted(0), sampled(0), dropped(0), drop_flows(0)
+{ }
+
+/* Adds 1 to counter '*counter', which other threads may be reading. */
+static inline void
+count(uint64_t* counter)
+{
+    __sync_fetch_and_add(counter, 1);
+}
+
+/* Returns the value of counter '*counter', which another thread may be
+ * updating. */
+static inline uint64_t
+read_count(const uint64_t* counter)
+{
+    return __sync_fetch_and_add(const_cast<uint64_t*>(counter), 0);
+}
+
+Packet_in_limiter::Packet_in_limiter(const Packet_in_limits& limits_)
+    : n_excess(0)
+{
+    set_limits(limits_);
+}
+
+void
+Packet_in_limiter::set_limits(const Packet_in_limits& limits_)
+{
+    limits = limits_;
+    bucket = Token_bucket(limits.rate, limits.burst);
+    ports.clear();
+}
+
+Packet_in_stats
+Packet_in_limiter::get_stats() const
+{
+    Packet_in_stats copy;
+    copy.admitted = read_count(&stats.admitted);
+    copy.sampled = read_count(&stats.sampled);
+    copy.dropped = read_count(&stats.dropped);
+    copy.drop_flows = read_count(&stats.drop_flows);
+    return copy;
+}
+
+Packet_in_limiter::Verdict
+Packet_in_limiter::admit(uint16_t in_port, long long int now)
+{
+    Port* port = NULL;
+    if (limits.port_rate) {
+        hash_map<uint16_t, Port>::iterator i = ports.find(in_port);
+        if (i == ports.end()) {
+            Port p;
+            p.bucket = Token_bucket(limits.port_rate, limits.port_burst);
+            p.drop_flow_expires = 0;
+            i = ports.insert(std::make_pair(in_port, p)).first;
+        }
+        port = &i->second;
+        if (!port->bucket.available(now)) {
+            return excess(port, now);
+        }
+    }
+    if (!bucket.available(now)) {
+        return excess(NULL, now);
+    }
+
+    /* Take tokens only once both buckets have them, so that a packet-in
+     * refused by one does not use up the other's. */
+    if (port) {
+        port->bucket.take();
+    }
+    bucket.take();
+    count(&stats.admitted);
+    return ADMIT;
+}
+
+/* Handles a packet-in over the limits, where 'port' is the port whose limit
+ * it exceeds, or null if it exceeds only the datapath's limit. */
+Packet_in_limiter::Verdict
+Packet_in_limiter::excess(Port* port, long long int now)
+{
+    if (limits.sample && ++n_excess % limits.sample == 0) {
+        count(&stats.sampled);
+        return SAMPLE;
+    }
+
+    count(&stats.dropped);
+    if (port && limits.drop_flow_secs && now >= port->drop_flow_expires) {
+        port->drop_flow_expires = now + limits.drop_flow_secs * 1000LL;
+        count(&stats.drop_flows);
+        return DROP_AND_BLOCK;
+    }
+    return DROP;
+}
+
+} // namespace vigil
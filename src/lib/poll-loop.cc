@@ -69,7 +69,7 @@ Poll_loop_impl::Poll_loop_impl(unsigned int n_threads)
         Poll_thread* pt = new Poll_thread;
         threads.push_back(pt);
         pt->thread = co_thread_create(
-            &co_group_coop,
+            co_group_self(),
             boost::bind(&Poll_loop_impl::poll_thread_main, this, pt));
         started.down();
     }
@@ -91,6 +91,16 @@ Ppoll::poll(std::vector<pollfd>& pollfds, const struct timespec *timeout)
             ? ::ppoll(&pollfds[0], pollfds.size(), timeout, &unblock_signal)
             : ::ppoll(NULL, 0, timeout, &unblock_signal));
 }
+
+#ifdef HAVE_EPOLL_CREATE
+int
+Ppoll::epoll_wait(int epfd, epoll_event* events, int max_events,
+                  const struct timespec *timeout)
+{
+    int ms = timeout ? timespec_to_ms(*timeout) : -1;
+    return ::epoll_pwait(epfd, events, max_events, ms, &unblock_signal);
+}
+#endif
 #else /* !HAVE_PPOLL */
 Ppoll::Ppoll(int)
 {
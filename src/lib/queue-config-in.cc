@@ -45,7 +45,7 @@ namespace vigil
   Queue_config_in_event::Queue_config_in_event(const datapathid& dpid, 
 					       const ofp_queue_get_config_reply *oqgcr,
 					       std::auto_ptr<Buffer> buf)
-    :Event(static_get_name()),
+    :Event(static_get_name(), this),
      Ofp_msg_event(&oqgcr->header, buf)
   {
     datapath_id = dpid;
@@ -0,0 +1,707 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "route-table.hh"
+
+#include <algorithm>
+
+namespace vigil {
+
+const uint32_t Route_table::NONE;
+const uint16_t Route_table::UNREACHABLE;
+
+bool
+Route_table::Link::operator<(const Link& that) const
+{
+    if (src != that.src) {
+        return src < that.src;
+    } else if (dst != that.dst) {
+        return dst < that.dst;
+    } else if (outport != that.outport) {
+        return outport < that.outport;
+    }
+    return inport < that.inport;
+}
+
+bool
+Route_table::Link::operator==(const Link& that) const
+{
+    return (src == that.src && dst == that.dst && outport == that.outport
+            && inport == that.inport);
+}
+
+struct Edge_dst_less {
+    template<class Edge>
+    bool operator()(const Edge& edge, uint32_t dst) const {
+        return edge.dst < dst;
+    }
+};
+
+/* Orders indexes into 'costs' by the costs there. */
+struct Cost_less {
+    const uint16_t *costs;
+
+    bool operator()(uint32_t a, uint32_t b) const {
+        return costs[a] < costs[b];
+    }
+};
+
+Route_table::Route_table()
+    : max_weight(1), capacity(0), n_searched(0)
+{ }
+
+/*
+ * Records a link from port 'outport' of 'src' to port 'inport' of 'dst', to
+ * be added by the next update().
+ */
+
+void
+Route_table::add_link(const datapathid& src, uint16_t outport,
+                      const datapathid& dst, uint16_t inport)
+{
+    Change change;
+    change.link.src = get_index(src);
+    change.link.dst = get_index(dst);
+    change.link.outport = outport;
+    change.link.inport = inport;
+    change.link.weight = 1;
+    change.type = Change::ADD;
+    changes.push_back(change);
+}
+
+/*
+ * Records that the link from port 'outport' of 'src' to port 'inport' of
+ * 'dst' is gone, to be removed by the next update().
+ */
+
+void
+Route_table::remove_link(const datapathid& src, uint16_t outport,
+                         const datapathid& dst, uint16_t inport)
+{
+    Change change;
+    change.link.src = find_index(src);
+    change.link.dst = find_index(dst);
+    if (change.link.src == NONE || change.link.dst == NONE) {
+        return;
+    }
+    change.link.outport = outport;
+    change.link.inport = inport;
+    change.type = Change::REMOVE;
+    changes.push_back(change);
+}
+
+/*
+ * Records that the link from port 'outport' of 'src' to port 'inport' of
+ * 'dst' now weighs 'weight', at least 1, to take effect on the next update().
+ * Links weigh 1 when they are added.
+ */
+
+void
+Route_table::set_weight(const datapathid& src, uint16_t outport,
+                        const datapathid& dst, uint16_t inport,
+                        uint16_t weight)
+{
+    Change change;
+    change.link.src = find_index(src);
+    change.link.dst = find_index(dst);
+    if (change.link.src == NONE || change.link.dst == NONE) {
+        return;
+    }
+    change.link.outport = outport;
+    change.link.inport = inport;
+    change.link.weight = std::max(weight, (uint16_t) 1);
+    change.type = Change::WEIGH;
+    changes.push_back(change);
+}
+
+/*
+ * Applies the link changes recorded since the last call and brings the
+ * shortest paths up to date.
+ */
+
+void
+Route_table::update()
+{
+    std::vector<uint32_t> sources;
+    prepare_update(sources);
+    for (size_t i = 0; i < sources.size(); i++) {
+        search(sources[i], queue);
+    }
+    finish_update();
+}
+
+/*
+ * Applies the link changes recorded since the last update and sets 'sources'
+ * to the switches whose shortest paths must be searched for again.
+ *
+ * A source's shortest paths stay shortest unless a link that was removed or
+ * made heavier was on one of them, with no parallel link of the same weight
+ * left to take its place, or a link that was added or made lighter leads
+ * somewhere for less than before.  Both are checked against the paths as
+ * they were, for every change, before anything is searched again: if neither
+ * holds for any of the changes, the old paths are still there at the same
+ * cost and no link makes any of them cheaper, so they are still shortest.
+ */
+
+void
+Route_table::prepare_update(std::vector<uint32_t>& sources)
+{
+    sources.clear();
+    if (changes.empty()) {
+        return;
+    }
+
+    uint32_t n = dps.size();
+    uint32_t n_old = n_searched;
+    grow(n);
+    std::vector<bool> affected(n, false);
+    for (uint32_t s = n_old; s < n; s++) {
+        affected[s] = true;
+    }
+
+    for (std::vector<Change>::const_iterator change = changes.begin();
+         change != changes.end(); ++change)
+    {
+        const Link& link = change->link;
+        std::vector<Link>::iterator pos
+            = std::lower_bound(links.begin(), links.end(), link);
+        if (change->type == Change::ADD) {
+            links.insert(pos, link);
+        } else if (pos == links.end() || !(*pos == link)) {
+            continue;
+        } else if (change->type == Change::REMOVE) {
+            links.erase(pos);
+            continue;
+        } else {
+            uint16_t old_weight = pos->weight;
+            pos->weight = link.weight;
+            if (link.weight >= old_weight) {
+                continue;
+            }
+        }
+
+        if (link.src == link.dst) {
+            continue;
+        }
+        for (uint32_t s = 0; s < n_old; s++) {
+            uint16_t via = costs[s * capacity + link.src];
+            if (via != UNREACHABLE
+                && via + link.weight < costs[s * capacity + link.dst]) {
+                affected[s] = true;
+            }
+        }
+    }
+
+    for (std::vector<Change>::const_iterator change = changes.begin();
+         change != changes.end(); ++change)
+    {
+        const Link& link = change->link;
+        if (change->type == Change::ADD) {
+            continue;
+        }
+        uint32_t weight = min_weight(link.src, link.dst);
+        for (uint32_t s = 0; s < n_old; s++) {
+            const uint16_t *row_costs = &costs[s * capacity];
+            if (preds[s * capacity + link.dst] == link.src
+                && row_costs[link.src] + weight != row_costs[link.dst]) {
+                affected[s] = true;
+            }
+        }
+    }
+    changes.clear();
+
+    build_edges();
+    for (uint32_t s = 0; s < n; s++) {
+        if (affected[s]) {
+            sources.push_back(s);
+        }
+    }
+}
+
+/*
+ * Finds the shortest paths from 'source' to every switch by breadth-first
+ * search of the adjacency array, or by search_by_weight() if any link weighs
+ * more than 1, replacing 'source''s rows.  'queue' is scratch space.
+ */
+
+void
+Route_table::search(uint32_t source, std::vector<uint32_t>& queue)
+{
+    if (max_weight > 1) {
+        search_by_weight(source, queue);
+        return;
+    }
+
+    uint32_t n = dps.size();
+    uint16_t *row_costs = &costs[source * capacity];
+    uint32_t *row_preds = &preds[source * capacity];
+    std::fill(row_costs, row_costs + n, UNREACHABLE);
+    std::fill(row_preds, row_preds + n, NONE);
+
+    queue.clear();
+    queue.reserve(n);
+    row_costs[source] = 0;
+    queue.push_back(source);
+    for (size_t i = 0; i < queue.size(); i++) {
+        uint32_t u = queue[i];
+        for (uint32_t e = offsets[u]; e < offsets[u + 1]; e++) {
+            uint32_t v = edges[e].dst;
+            if (row_costs[v] == UNREACHABLE) {
+                row_costs[v] = row_costs[u] + 1;
+                row_preds[v] = u;
+                queue.push_back(v);
+            }
+        }
+    }
+}
+
+/*
+ * Links switch 'v' in at the head of 'list', one of the lists in 'queue' of
+ * search_by_weight(), whose 'n' 'next' entries come first and 'n' 'prev'
+ * entries second.
+ */
+
+static inline void
+push_switch(uint32_t *queue, uint32_t n, uint32_t list, uint32_t v)
+{
+    uint32_t next = queue[list];
+    queue[v] = next;
+    if (next != ~(uint32_t) 0) {
+        queue[n + next] = v;
+    }
+    queue[list] = v;
+    queue[n + v] = list;
+}
+
+/*
+ * Unlinks switch 'v' from whichever list of 'queue' it is in.
+ */
+
+static inline void
+pop_switch(uint32_t *queue, uint32_t n, uint32_t v)
+{
+    uint32_t next = queue[v];
+    uint32_t prev = queue[n + v];
+    queue[prev] = next;
+    if (next != ~(uint32_t) 0) {
+        queue[n + next] = prev;
+    }
+}
+
+/*
+ * Finds the shortest paths from 'source' to every switch by Dijkstra's
+ * algorithm, replacing 'source''s rows.  'queue' is scratch space.
+ *
+ * Since no link weighs more than 'max_weight', the switches whose costs are
+ * known but not yet final all cost less than max_weight + 1 more than the
+ * cheapest of them, so they are kept in that many lists, one per cost
+ * modulo max_weight + 1, which are visited in turn.  The lists are doubly
+ * linked through 'queue', where switch v's next switch is at index v and the
+ * index of the entry that points to v, its previous switch's or its list's
+ * head, is at index n + v.  The heads come after them.
+ */
+
+void
+Route_table::search_by_weight(uint32_t source, std::vector<uint32_t>& queue)
+{
+    uint32_t n = dps.size();
+    uint16_t *row_costs = &costs[source * capacity];
+    uint32_t *row_preds = &preds[source * capacity];
+    std::fill(row_costs, row_costs + n, UNREACHABLE);
+    std::fill(row_preds, row_preds + n, NONE);
+
+    uint32_t n_lists = max_weight + 1;
+    queue.assign(2 * n + n_lists, NONE);
+    uint32_t *lists = &queue[0];
+    row_costs[source] = 0;
+    push_switch(lists, n, 2 * n, source);
+    for (uint32_t cost = 0, n_pending = 1; n_pending; cost++) {
+        uint32_t list = 2 * n + cost % n_lists;
+        while (lists[list] != NONE) {
+            uint32_t u = lists[list];
+            pop_switch(lists, n, u);
+            n_pending--;
+            for (uint32_t e = offsets[u]; e < offsets[u + 1]; e++) {
+                uint32_t v = edges[e].dst;
+                uint32_t via = cost + weights[e];
+                if (via >= row_costs[v]) {
+                    continue;
+                } else if (row_costs[v] == UNREACHABLE) {
+                    n_pending++;
+                } else {
+                    pop_switch(lists, n, v);
+                }
+                row_costs[v] = via;
+                row_preds[v] = u;
+                push_switch(lists, n, 2 * n + via % n_lists, v);
+            }
+        }
+    }
+}
+
+/*
+ * Makes the paths found since prepare_update() visible to get_route().
+ */
+
+void
+Route_table::finish_update()
+{
+    n_searched = dps.size();
+}
+
+/*
+ * Sets 'path' to the links on the shortest path from 'src' to 'dst', as of
+ * the last update().  Returns true if there is one, which is empty if 'src'
+ * and 'dst' are the same, else false.
+ */
+
+bool
+Route_table::get_route(const datapathid& src, const datapathid& dst,
+                       std::vector<Hop>& path) const
+{
+    path.clear();
+    uint32_t s = find_index(src);
+    uint32_t d = find_index(dst);
+    if (s >= n_searched || d >= n_searched) {
+        return false;
+    }
+
+    const uint32_t *row_preds = &preds[s * capacity];
+    if (costs[s * capacity + d] == UNREACHABLE) {
+        return false;
+    }
+
+    uint32_t n_hops = 0;
+    for (uint32_t v = d; v != s; v = row_preds[v]) {
+        n_hops++;
+    }
+    path.resize(n_hops);
+    for (uint32_t v = d, i = n_hops; i-- > 0; v = row_preds[v]) {
+        const Edge *edge = &edges[find_edge(row_preds[v], v)];
+        path[i].dst = dps[v];
+        path[i].outport = edge->outport;
+        path[i].inport = edge->inport;
+    }
+    return true;
+}
+
+/*
+ * Sets 'path' to one of the shortest paths from 'src' to 'dst', as of the
+ * last update(), chosen by 'hash'.  Returns true if there is one, which is
+ * empty if 'src' and 'dst' are the same, else false.
+ *
+ * At each switch on the way, the choice among the links that lead on along a
+ * shortest path is made by 'hash' mixed with the switch, so that the choices
+ * at successive switches are independent of each other.
+ */
+
+bool
+Route_table::get_route(const datapathid& src, const datapathid& dst,
+                       uint64_t hash, std::vector<Hop>& path) const
+{
+    path.clear();
+    uint32_t s = find_index(src);
+    uint32_t d = find_index(dst);
+    if (s >= n_searched || d >= n_searched
+        || costs[s * capacity + d] == UNREACHABLE) {
+        return false;
+    }
+
+    for (uint32_t u = s; u != d; ) {
+        uint32_t n_choices = 0;
+        for (uint32_t e = offsets[u]; e < offsets[u + 1]; e++) {
+            n_choices += leads_to(u, e, d);
+        }
+
+        uint64_t mixed = hash + (u + 1) * 0x9e3779b97f4a7c15ULL;
+        mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+        uint32_t choice = (mixed ^ (mixed >> 31)) % n_choices;
+        uint32_t e = offsets[u];
+        while (!leads_to(u, e, d) || choice--) {
+            e++;
+        }
+        const Edge *edge = &edges[e];
+        Hop hop;
+        hop.dst = dps[edge->dst];
+        hop.outport = edge->outport;
+        hop.inport = edge->inport;
+        path.push_back(hop);
+        u = edge->dst;
+    }
+    return true;
+}
+
+/*
+ * Sets 'dag' to all the shortest paths from 'src' to 'dst', as of the last
+ * update().  Returns true if there are any, of which there is one with no
+ * links if 'src' and 'dst' are the same, else false.
+ */
+
+bool
+Route_table::get_routes(const datapathid& src, const datapathid& dst,
+                        Dag& dag) const
+{
+    dag.dps.clear();
+    dag.offsets.clear();
+    dag.links.clear();
+    uint32_t s = find_index(src);
+    uint32_t d = find_index(dst);
+    if (s >= n_searched || d >= n_searched
+        || costs[s * capacity + d] == UNREACHABLE) {
+        return false;
+    }
+
+    /* Visiting switches breadth first puts each after all of the switches
+     * fewer hops from the source, which is their order of cost unless links
+     * weigh more than 1. */
+    std::vector<uint32_t> nodes(1, s);
+    std::vector<uint32_t> node_index(n_searched, NONE);
+    node_index[s] = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        uint32_t u = nodes[i];
+        dag.dps.push_back(dps[u]);
+        dag.offsets.push_back(dag.links.size());
+        for (uint32_t e = offsets[u]; e < offsets[u + 1]; e++) {
+            const Edge& edge = edges[e];
+            if (!leads_to(u, e, d)) {
+                continue;
+            }
+            if (node_index[edge.dst] == NONE) {
+                node_index[edge.dst] = nodes.size();
+                nodes.push_back(edge.dst);
+            }
+            Dag::Link link;
+            link.hop.dst = dps[edge.dst];
+            link.hop.outport = edge.outport;
+            link.hop.inport = edge.inport;
+            link.next = node_index[edge.dst];
+            dag.links.push_back(link);
+        }
+    }
+    dag.offsets.push_back(dag.links.size());
+    if (max_weight > 1) {
+        sort_dag(&costs[s * capacity], nodes, dag);
+    }
+    return true;
+}
+
+/*
+ * Puts the switches of 'dag', which are 'nodes', in order of the cost of the
+ * paths to them, 'costs' being the source's row.
+ */
+
+void
+Route_table::sort_dag(const uint16_t *costs,
+                      const std::vector<uint32_t>& nodes, Dag& dag)
+{
+    size_t n = nodes.size();
+    std::vector<uint32_t> order(n);
+    std::vector<uint16_t> node_costs(n);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+        node_costs[i] = costs[nodes[i]];
+    }
+    Cost_less cost_less = { &node_costs[0] };
+    std::stable_sort(order.begin(), order.end(), cost_less);
+
+    std::vector<uint32_t> rank(n);
+    for (size_t i = 0; i < n; i++) {
+        rank[order[i]] = i;
+    }
+    Dag sorted;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t old = order[i];
+        sorted.dps.push_back(dag.dps[old]);
+        sorted.offsets.push_back(sorted.links.size());
+        for (uint32_t j = dag.offsets[old]; j < dag.offsets[old + 1]; j++) {
+            Dag::Link link = dag.links[j];
+            link.next = rank[link.next];
+            sorted.links.push_back(link);
+        }
+    }
+    sorted.offsets.push_back(sorted.links.size());
+    dag.dps.swap(sorted.dps);
+    dag.offsets.swap(sorted.offsets);
+    dag.links.swap(sorted.links);
+}
+
+/*
+ * Returns the number of bytes the table occupies, not counting the hash
+ * table's per-entry allocator overhead.
+ */
+
+size_t
+Route_table::memory_usage() const
+{
+    return (sizeof *this
+            + indexes.size() * (sizeof(std::pair<datapathid, uint32_t>)
+                                + sizeof(void *))
+            + indexes.bucket_count() * sizeof(void *)
+            + dps.capacity() * sizeof(datapathid)
+            + links.capacity() * sizeof(Link)
+            + changes.capacity() * sizeof(Change)
+            + offsets.capacity() * sizeof(uint32_t)
+            + edges.capacity() * sizeof(Edge)
+            + weights.capacity() * sizeof(uint16_t)
+            + preds.capacity() * sizeof(uint32_t)
+            + costs.capacity() * sizeof(uint16_t)
+            + queue.capacity() * sizeof(uint32_t));
+}
+
+/*
+ * Returns the index of switch 'dp', numbering it if it is new.
+ */
+
+uint32_t
+Route_table::get_index(const datapathid& dp)
+{
+    hash_map<datapathid, uint32_t>::iterator i = indexes.find(dp);
+    if (i != indexes.end()) {
+        return i->second;
+    }
+    uint32_t index = dps.size();
+    dps.push_back(dp);
+    indexes[dp] = index;
+    return index;
+}
+
+/*
+ * Returns the index of switch 'dp', or NONE if it has none.
+ */
+
+uint32_t
+Route_table::find_index(const datapathid& dp) const
+{
+    hash_map<datapathid, uint32_t>::const_iterator i = indexes.find(dp);
+    return i != indexes.end() ? i->second : NONE;
+}
+
+/*
+ * Returns the index in the adjacency array of the lightest of the links from
+ * 'src' to 'dst', the first of them if they weigh the same.  There must be
+ * one.
+ */
+
+uint32_t
+Route_table::find_edge(uint32_t src, uint32_t dst) const
+{
+    const Edge *first = &edges[0];
+    uint32_t e = std::lower_bound(first + offsets[src],
+                                  first + offsets[src + 1], dst,
+                                  Edge_dst_less()) - first;
+    uint32_t lightest = e;
+    for (; e < offsets[src + 1] && edges[e].dst == dst; e++) {
+        if (weights[e] < weights[lightest]) {
+            lightest = e;
+        }
+    }
+    return lightest;
+}
+
+/*
+ * Returns true if edge 'e', from 'src', is on a shortest path from 'src' to
+ * 'dst', that is, if it leads to a switch closer to 'dst' by its weight.
+ * There must be a path from 'src' to 'dst': then one from a switch that
+ * cannot reach 'dst' costs UNREACHABLE, which no weight brings down to the
+ * cost of the path.
+ */
+
+inline bool
+Route_table::leads_to(uint32_t src, uint32_t e, uint32_t dst) const
+{
+    return (costs[edges[e].dst * capacity + dst] + weights[e]
+            == costs[src * capacity + dst]);
+}
+
+/*
+ * Returns the weight of the lightest link in 'links' from 'src' to 'dst', or
+ * UNREACHABLE if there is none.
+ */
+
+uint32_t
+Route_table::min_weight(uint32_t src, uint32_t dst) const
+{
+    Link key;
+    key.src = src;
+    key.dst = dst;
+    key.outport = key.inport = 0;
+    uint32_t weight = UNREACHABLE;
+    for (std::vector<Link>::const_iterator link
+             = std::lower_bound(links.begin(), links.end(), key);
+         link != links.end() && link->src == src && link->dst == dst;
+         ++link)
+    {
+        weight = std::min(weight, (uint32_t) link->weight);
+    }
+    return weight;
+}
+
+/*
+ * Rebuilds the adjacency array from 'links', which is sorted by source and
+ * then destination, so that each switch's edges come out sorted too.
+ */
+
+void
+Route_table::build_edges()
+{
+    uint32_t n = dps.size();
+    offsets.assign(n + 1, 0);
+    edges.resize(links.size());
+    weights.resize(links.size());
+    max_weight = 1;
+    for (size_t i = 0; i < links.size(); i++) {
+        offsets[links[i].src + 1]++;
+        edges[i].dst = links[i].dst;
+        edges[i].outport = links[i].outport;
+        edges[i].inport = links[i].inport;
+        weights[i] = links[i].weight;
+        max_weight = std::max(max_weight, links[i].weight);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+}
+
+/*
+ * Makes room for rows and columns for 'n' switches.  Rows and columns are
+ * never shrunk, since switches keep their indexes.
+ */
+
+void
+Route_table::grow(uint32_t n)
+{
+    if (n <= capacity) {
+        return;
+    }
+
+    uint32_t new_capacity = std::max(n, std::max(capacity * 2, 16u));
+    size_t size = (size_t) new_capacity * new_capacity;
+    std::vector<uint32_t> new_preds(size, NONE);
+    std::vector<uint16_t> new_costs(size, UNREACHABLE);
+    for (uint32_t s = 0; s < n_searched; s++) {
+        std::copy(&preds[s * capacity], &preds[s * capacity] + n_searched,
+                  &new_preds[s * new_capacity]);
+        std::copy(&costs[s * capacity], &costs[s * capacity] + n_searched,
+                  &new_costs[s * new_capacity]);
+    }
+    preds.swap(new_preds);
+    costs.swap(new_costs);
+    capacity = new_capacity;
+}
+
+} // namespace vigil
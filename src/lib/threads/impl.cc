@@ -43,6 +43,12 @@
 #define UNUSED __attribute__((__unused__))
 #define NOT_REACHED() abort()
 
+/* The epoll backend relies on epoll_pwait() for interruption by signal, in
+ * the same way that Ppoll relies on ppoll(). */
+#if defined(HAVE_PPOLL) && defined(HAVE_EPOLL_CREATE)
+#define CO_HAVE_EPOLL 1
+#endif
+
 namespace vigil {
 
 static Vlog_module lg("threads");
@@ -58,7 +64,16 @@ struct co_event {
 struct Co_fd_waiter {
     int pollfd_idx;
     Co_waitqueue wq[CO_N_FD_WAIT_TYPES];
-    Co_fd_waiter() : pollfd_idx(-1) { }
+
+    /* epoll backend only.  The descriptor is registered one-shot, so after it
+     * fires it stays in the epoll set, disabled, until it is re-armed. */
+    short epoll_events;         /* POLLIN and/or POLLOUT being waited for. */
+    bool epoll_added;           /* In the group's epoll set? */
+    bool epoll_armed;           /* Enabled in the epoll set? */
+
+    Co_fd_waiter()
+        : pollfd_idx(-1), epoll_events(0), epoll_added(false),
+          epoll_armed(false) { }
 };
 
 struct Co_timer {
@@ -79,6 +94,12 @@ struct co_group {
     boost::ptr_vector<Co_fd_waiter> fd_waiters;
     std::vector<pollfd> pollfds;
 
+#ifdef CO_HAVE_EPOLL
+    int epoll_fd;               /* -1 until first needed. */
+    size_t n_epoll_armed;       /* Number of armed fd_waiters. */
+    std::vector<epoll_event> epoll_events;
+#endif
+
     std::priority_queue<Co_timer> timers;
 
     bool fsm_thread;
@@ -126,6 +147,12 @@ struct co_group co_group_coop;
 /* Portable implementation of an interruptible poll operation. */
 static Ppoll* ppoll;
 
+/* Backend used by every thread group to wait on file descriptors. */
+static enum co_fd_backend fd_backend = CO_FD_BACKEND_POLL;
+
+/* Maximum number of ready descriptors collected by one epoll_wait() call. */
+static const size_t EPOLL_BATCH = 256;
+
 static void *thread_main(void *);
 static void dont_call_pthread_exit_directly(void *UNUSED);
 static void fsm_thread();
@@ -137,8 +164,17 @@ static co_event* add_event(void);
 static void schedule();
 static void reschedule_while_needed();
 static void do_schedule();
+static bool waiting_on_fds(struct co_group *);
+static int poll_fds(struct co_group *);
+static int ppoll_fds(struct co_group *, const struct timespec *timeout);
+static void process_fd_results(int n_events);
 static void process_poll_results(int n_events);
 static void remove_pollfd(Co_fd_waiter *);
+#ifdef CO_HAVE_EPOLL
+static int epoll_arm(struct co_group *, int fd, Co_fd_waiter *);
+static void epoll_remove(struct co_group *, int fd, Co_fd_waiter *);
+static void process_epoll_results(int n_events);
+#endif
 static void do_event_wake(struct co_event *, int retval);
 static void cancel_events(struct co_thread *);
 static void dequeue_event(struct co_event *);
@@ -178,6 +214,28 @@ co_init(void)
     /* Don't ignore SIGCHLD here, to allow graceful use of fork. */
 }
 
+/* Selects 'backend' for waiting on file descriptors in every thread group.
+ * Must be called before any thread waits on a file descriptor.  Returns true
+ * if successful, false if 'backend' is not supported on this system. */
+bool
+co_set_fd_backend(enum co_fd_backend backend)
+{
+#ifndef CO_HAVE_EPOLL
+    if (backend == CO_FD_BACKEND_EPOLL) {
+        return false;
+    }
+#endif
+    fd_backend = backend;
+    return true;
+}
+
+/* Returns the backend used for waiting on file descriptors. */
+enum co_fd_backend
+co_get_fd_backend(void)
+{
+    return fd_backend;
+}
+
 /* Creates a new thread to run 'start'.  Initially the thread is in thread
  * group 'group', which may be null to make it a native thread (but the new
  * thread can use co_migrate() to change thread groups).
@@ -520,9 +578,9 @@ co_poll(void)
 
     if (group) {
         wakeup_timers(&timeout, &timeoutp);
-        if (!group->pollfds.empty()) {
-            n_events = poll(&group->pollfds[0], group->pollfds.size(), 0);
-            process_poll_results(n_events);
+        if (waiting_on_fds(group)) {
+            n_events = poll_fds(group);
+            process_fd_results(n_events);
         }
     }
     do_gettimeofday(true);
@@ -702,6 +760,28 @@ co_fd_wait(int fd, enum co_fd_wait_type type, int *revents)
     }
 
     Co_fd_waiter* fdw = &group->fd_waiters[fd];
+#ifdef CO_HAVE_EPOLL
+    if (fd_backend == CO_FD_BACKEND_EPOLL) {
+        short event = type == CO_FD_WAIT_READ ? POLLIN : POLLOUT;
+        if (!fdw->epoll_armed || !(fdw->epoll_events & event)) {
+            fdw->epoll_events |= event;
+            int error = epoll_arm(group, fd, fdw);
+            if (error) {
+                /* epoll refuses regular files, which poll() always reports
+                 * ready, and invalid descriptors, which poll() reports with
+                 * POLLNVAL.  Behave the same way. */
+                fdw->epoll_events &= ~event;
+                co_immediate_wake(error == EPERM
+                                  ? event : event | POLLHUP | POLLNVAL,
+                                  revents);
+                return;
+            }
+        }
+        fdw->wq[type].wait(revents);
+        return;
+    }
+#endif
+
     struct pollfd *pfd;
     if (fdw->pollfd_idx >= 0) {
         pfd = &group->pollfds[fdw->pollfd_idx];
@@ -774,6 +854,14 @@ co_fd_closed(int fd)
     }
 
     Co_fd_waiter* fdw = &group->fd_waiters[fd];
+#ifdef CO_HAVE_EPOLL
+    if (fdw->epoll_added) {
+        fdw->wq[CO_FD_WAIT_READ].wake_all(POLLHUP | POLLNVAL | POLLIN);
+        fdw->wq[CO_FD_WAIT_WRITE].wake_all(POLLHUP | POLLNVAL | POLLOUT);
+        epoll_remove(group, fd, fdw);
+        return;
+    }
+#endif
     if (fdw->pollfd_idx < 0) {
         return;
     }
@@ -1403,6 +1491,11 @@ co_group::co_group()
     polling = NULL;
     n_threads = 0;
 
+#ifdef CO_HAVE_EPOLL
+    epoll_fd = -1;
+    n_epoll_armed = 0;
+#endif
+
     fsm_thread = false;
 }
 
@@ -1584,15 +1677,13 @@ do_schedule()
             int n_events;
 
             if (wakeup_timers(&timeout, &timeoutp)) {
-                size_t n_pollfds = group->pollfds.size();
-                pollfd* pollfds = n_pollfds ? &group->pollfds[0] : NULL;
-                n_events = poll(pollfds, n_pollfds, 0);
+                n_events = poll_fds(group);
             } else {
                 group->polling = thread;
                 pthread_mutex_unlock(&group->mutex);
 
                 /* We use a signal to wake up, thus no loop on EINTR here. */
-                n_events = ppoll->poll(group->pollfds, timeoutp);
+                n_events = ppoll_fds(group, timeoutp);
                 if (n_events == 0) {
                     wakeup_timers(&timeout, &timeoutp);
                 }
@@ -1601,7 +1692,7 @@ do_schedule()
                 pthread_mutex_lock(&group->mutex);
                 group->polling = NULL;
             }
-            process_poll_results(n_events);
+            process_fd_results(n_events);
         }
 
         /* Mark the next thread as running. */
@@ -1673,6 +1764,67 @@ run_fsm(struct co_thread *fsm)
     }
 }
 
+/* Returns true if some thread in 'group' waits on a file descriptor. */
+static bool
+waiting_on_fds(struct co_group *group)
+{
+#ifdef CO_HAVE_EPOLL
+    if (fd_backend == CO_FD_BACKEND_EPOLL) {
+        return group->n_epoll_armed > 0;
+    }
+#endif
+    return !group->pollfds.empty();
+}
+
+/* Checks, without blocking, which of the file descriptors waited on in
+ * 'group' are ready.  Returns the number of ready descriptors, for
+ * process_fd_results(). */
+static int
+poll_fds(struct co_group *group)
+{
+#ifdef CO_HAVE_EPOLL
+    if (fd_backend == CO_FD_BACKEND_EPOLL) {
+        if (!group->n_epoll_armed) {
+            return 0;
+        }
+        return epoll_wait(group->epoll_fd, &group->epoll_events[0],
+                          group->epoll_events.size(), 0);
+    }
+#endif
+    size_t n_pollfds = group->pollfds.size();
+    pollfd* pollfds = n_pollfds ? &group->pollfds[0] : NULL;
+    return poll(pollfds, n_pollfds, 0);
+}
+
+/* Waits until one of the file descriptors waited on in 'group' is ready,
+ * 'timeout' expires, or Ppoll::interrupt() is called.  Returns the number of
+ * ready descriptors, for process_fd_results(). */
+static int
+ppoll_fds(struct co_group *group, const struct timespec *timeout)
+{
+#ifdef CO_HAVE_EPOLL
+    if (fd_backend == CO_FD_BACKEND_EPOLL && group->epoll_fd >= 0) {
+        return ppoll->epoll_wait(group->epoll_fd, &group->epoll_events[0],
+                                 group->epoll_events.size(), timeout);
+    }
+#endif
+    return ppoll->poll(group->pollfds, timeout);
+}
+
+/* Wakes up the threads waiting on the 'n_events' ready file descriptors found
+ * by poll_fds() or ppoll_fds(). */
+static void
+process_fd_results(int n_events)
+{
+#ifdef CO_HAVE_EPOLL
+    if (fd_backend == CO_FD_BACKEND_EPOLL) {
+        process_epoll_results(n_events);
+        return;
+    }
+#endif
+    process_poll_results(n_events);
+}
+
 static void
 process_poll_results(int n_events)
 {
@@ -1731,6 +1883,99 @@ remove_pollfd(Co_fd_waiter *fdw)
     fdw->pollfd_idx = -1;
 }
 
+#ifdef CO_HAVE_EPOLL
+/* Enables 'fd' in the epoll set of 'group' for the events in
+ * fdw->epoll_events, creating the epoll set if necessary.  Returns 0 if
+ * successful, otherwise a positive errno value. */
+static int
+epoll_arm(struct co_group *group, int fd, Co_fd_waiter *fdw)
+{
+    if (group->epoll_fd < 0) {
+        group->epoll_fd = epoll_create(EPOLL_BATCH);
+        if (group->epoll_fd < 0) {
+            lg.emer("epoll_create failed: %s", strerror(errno));
+            NOT_REACHED();
+        }
+        group->epoll_events.resize(EPOLL_BATCH);
+    }
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = fdw->epoll_events | EPOLLONESHOT;
+    ev.data.fd = fd;
+
+    int op = fdw->epoll_added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(group->epoll_fd, op, fd, &ev) < 0) {
+        /* The kernel drops closed descriptors from epoll sets on its own, so
+         * our notion of what is registered can be stale if 'fd' was closed
+         * and reused without co_fd_closed(). */
+        op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if ((errno != ENOENT && errno != EEXIST)
+            || epoll_ctl(group->epoll_fd, op, fd, &ev) < 0) {
+            return errno;
+        }
+    }
+
+    fdw->epoll_added = true;
+    if (!fdw->epoll_armed) {
+        fdw->epoll_armed = true;
+        group->n_epoll_armed++;
+    }
+    return 0;
+}
+
+/* Removes 'fd' from the epoll set of 'group'. */
+static void
+epoll_remove(struct co_group *group, int fd, Co_fd_waiter *fdw)
+{
+    /* Fails harmlessly if 'fd' has already been closed. */
+    epoll_ctl(group->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    if (fdw->epoll_armed) {
+        group->n_epoll_armed--;
+    }
+    fdw->epoll_events = 0;
+    fdw->epoll_added = false;
+    fdw->epoll_armed = false;
+}
+
+static void
+process_epoll_results(int n_events)
+{
+    struct co_group *group = co_group_self();
+    const unsigned int err_mask = POLLERR | POLLHUP | POLLNVAL;
+    const unsigned int in_mask = POLLIN | err_mask;
+    const unsigned int out_mask = POLLOUT | err_mask;
+
+    for (int i = 0; i < n_events; i++) {
+        /* The EPOLL* bits used here have the same values as the POLL* bits
+         * that waiters expect. */
+        int fd = group->epoll_events[i].data.fd;
+        unsigned int revents = group->epoll_events[i].events;
+        Co_fd_waiter* fdw = &group->fd_waiters[fd];
+
+        /* One-shot registration: the descriptor is now disabled. */
+        fdw->epoll_armed = false;
+        group->n_epoll_armed--;
+
+        if (revents & in_mask && fdw->epoll_events & POLLIN) {
+            fdw->wq[CO_FD_WAIT_READ].wake_all(revents & in_mask);
+            fdw->epoll_events &= ~POLLIN;
+        }
+        if (revents & out_mask && fdw->epoll_events & POLLOUT) {
+            fdw->wq[CO_FD_WAIT_WRITE].wake_all(revents & out_mask);
+            fdw->epoll_events &= ~POLLOUT;
+        }
+
+        /* Keep waiting for whichever direction did not fire. */
+        if (fdw->epoll_events && epoll_arm(group, fd, fdw)) {
+            fdw->wq[CO_FD_WAIT_READ].wake_all(POLLHUP | POLLNVAL | POLLIN);
+            fdw->wq[CO_FD_WAIT_WRITE].wake_all(POLLHUP | POLLNVAL | POLLOUT);
+            fdw->epoll_events = 0;
+        }
+    }
+}
+#endif /* CO_HAVE_EPOLL */
+
 /* Wakes up all the timers that have expired and returns the number of expired
  * timers.  Stores in '*timeoutp' a timeout value to pass to ppoll(); if this
  * is non-null, then '*timeout' is used for storage. */
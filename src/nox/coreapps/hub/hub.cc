@@ -47,7 +47,7 @@ public:
     {
         const Packet_in_event& pi = assert_cast<const Packet_in_event&>(e);
         uint32_t buffer_id = pi.buffer_id;
-        Flow flow(pi.in_port, *(pi.get_buffer()));
+        const Flow& flow = pi.flow;
 
         /* drop all LLDP packets */
         if (flow.dl_type == ethernet::LLDP){
@@ -63,7 +63,7 @@ public:
         ofm->header.type = OFPT_FLOW_MOD;
         ofm->header.length = htons(size);
         ofm->match.wildcards = htonl(0);
-        ofm->match.in_port = htons(flow.in_port);
+        ofm->match.in_port = flow.in_port;
         ofm->match.dl_vlan = flow.dl_vlan;
         ofm->match.dl_vlan_pcp = flow.dl_vlan_pcp;
         memcpy(ofm->match.dl_src, flow.dl_src.octet, sizeof ofm->match.dl_src);
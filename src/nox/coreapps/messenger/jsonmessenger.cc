@@ -12,7 +12,7 @@ namespace vigil
   static const std::string app_name("jsonmessenger");
 
   JSONMsg_event::JSONMsg_event(const core_message* cmsg):
-    Event(static_get_name())
+    Event(static_get_name(), this)
   {
     set_name(static_get_name());
     sock = cmsg->sock;
@@ -53,7 +53,7 @@ namespace vigil
 
     /** For use within python.
      */
-    JSONMsg_event() : Event(static_get_name()) 
+    JSONMsg_event() : Event(static_get_name(), this) 
     { }
 
     /** Static name required in NOX.
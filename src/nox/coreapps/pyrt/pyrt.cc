@@ -327,6 +327,7 @@ static void convert_packet_in(const Event& e, PyObject* proxy) {
     pyglue_setattr_string(proxy, "datapath_id", to_python(pie.datapath_id));
     pyglue_setattr_string(proxy, "buf", to_python<boost::shared_ptr<Buffer> >
                           (pie.get_buffer()));
+    pyglue_setattr_string(proxy, "flow", to_python(pie.flow));
 
     ((Event*)SWIG_Python_GetSwigThis(proxy)->ptr)->operator=(e);
 }
@@ -59,15 +59,22 @@ public:
     Path_list get_search_paths() const;
     
 private:
+    friend class DSO_component_context;
+
     DSO_deployer(Kernel*, const Path_list& lib_search_paths);
 
     const Path_list lib_dirs;
+
+    /* The instances of shard-safe components for shards other than shard 0,
+     * deleted along with the deployer. */
+    std::vector<container::Component*> replicas;
 };
 
 class DSO_component_context 
     : public Component_context {
 public:
-    DSO_component_context(Kernel*, const std::string& component_home_path, 
+    DSO_component_context(Kernel*, DSO_deployer*,
+                          const std::string& component_home_path,
                           json_object*);
 
 private:
@@ -78,6 +85,7 @@ private:
     void instantiate();
     void configure();
     void install();
+    void install_replica();
 
     typedef container::Component_factory* component_factory_function();
     component_factory_function* find_factory_function(const char*) const;
@@ -94,6 +102,12 @@ private:
     
     /* Factory instance */
     container::Component_factory* factory; 
+
+    /* Whether the component may run one instance per shard ("shard_safe" in
+     * its description), and the deployer that keeps the instances for shards
+     * other than shard 0. */
+    bool shard_safe;
+    DSO_deployer* deployer;
 };
 
 }
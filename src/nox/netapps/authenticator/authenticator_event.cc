@@ -143,7 +143,7 @@ Authenticator::handle_packet_in(const Event& e)
 {
     const Packet_in_event& pi = assert_cast<const Packet_in_event&>(e);
 
-    Flow flow(htons(pi.in_port), *(pi.buf));
+    const Flow& flow = pi.flow;
     if (flow.dl_type == ethernet::LLDP) {
         return CONTINUE;
     }
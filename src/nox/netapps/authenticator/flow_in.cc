@@ -27,14 +27,14 @@ static Vlog_module lg("flow_in");
 Flow_in_event::Flow_in_event(const timeval& received_,
                              const Packet_in_event& pi,
                              const Flow& flow_)
-    : Event(static_get_name()), active(true), fn_applied(false),
+    : Event(static_get_name(), this), active(true), fn_applied(false),
       received(received_), datapath_id(pi.datapath_id), flow(flow_),
       buf(pi.buf), total_len(pi.total_len), buffer_id(pi.buffer_id),
       reason(pi.reason), dst_authed(false), routed_to(NOT_ROUTED)
 { }
 
 Flow_in_event::Flow_in_event()
-    : Event(static_get_name()), active(true), fn_applied(false),
+    : Event(static_get_name(), this), active(true), fn_applied(false),
       total_len(0), dst_authed(false), routed_to(NOT_ROUTED)
 { }
 
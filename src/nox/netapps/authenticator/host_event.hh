@@ -105,7 +105,7 @@ struct Host_auth_event
                     Host_event::Reason reason_);
 
     // -- only for use within python
-    Host_auth_event() : Event(static_get_name()) { }
+    Host_auth_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Host_auth_event";
@@ -158,7 +158,7 @@ struct Host_bind_event
                     Host_event::Reason reason_);
 
     // -- only for use within python
-    Host_bind_event() : Event(static_get_name()) { }
+    Host_bind_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Host_bind_event";
@@ -204,7 +204,7 @@ struct Host_join_event
                     Host_event::Reason reason_);
 
     // -- only for use within python
-    Host_join_event() : Event(static_get_name()) { }
+    Host_join_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Host_join_event";
@@ -22,7 +22,7 @@ namespace vigil {
 
 Switch_bind_event::Switch_bind_event(Action action_, const datapathid& dp,
                                      int64_t switchname_)
-    : Event(static_get_name()), action(action_), datapath_id(dp),
+    : Event(static_get_name(), this), action(action_), datapath_id(dp),
       switchname(switchname_)
 {}
 
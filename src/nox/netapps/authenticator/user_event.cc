@@ -52,21 +52,23 @@ User_event::get_reason_string(User_event::Reason reason)
 User_auth_event::User_auth_event(int64_t username_, int64_t hostname_,
                                  uint32_t idle_timeout_, uint32_t hard_timeout_,
                                  User_event::Reason reason_)
-    : Event(static_get_name()), action(AUTHENTICATE), username(username_),
+    : Event(static_get_name(), this), action(AUTHENTICATE),
+      username(username_),
       hostname(hostname_), idle_timeout(idle_timeout_),
       hard_timeout(hard_timeout_), reason(reason_), to_post(NULL)
 {}
 
 User_auth_event::User_auth_event(int64_t username_, int64_t hostname_,
                                  User_event::Reason reason_)
-    : Event(static_get_name()), action(DEAUTHENTICATE), username(username_),
+    : Event(static_get_name(), this), action(DEAUTHENTICATE),
+      username(username_),
       hostname(hostname_), idle_timeout(0), hard_timeout(0), reason(reason_),
       to_post(NULL)
 {}
 
 User_join_event::User_join_event(Action action_, int64_t username_,
                                  int64_t hostname_, User_event::Reason reason_)
-    : Event(static_get_name()), action(action_), username(username_),
+    : Event(static_get_name(), this), action(action_), username(username_),
       hostname(hostname_), reason(reason_)
 {}
 
@@ -22,7 +22,7 @@ namespace vigil {
 
 Principal_delete_event::Principal_delete_event(PrincipalType type_,
                                                int64_t id_)
-    : Event(static_get_name()), type(type_), id(id_)
+    : Event(static_get_name(), this), type(type_), id(id_)
 {}
 
 }
@@ -43,7 +43,7 @@ struct Principal_delete_event
                            int64_t id_);
 
     // -- only for use within python
-    Principal_delete_event() : Event(static_get_name()) { }
+    Principal_delete_event() : Event(static_get_name(), this) { }
 
     static const Event_name static_get_name() {
         return "Principal_delete_event";
@@ -28,12 +28,12 @@ namespace vigil {
     Link_event::Link_event(datapathid dpsrc_, datapathid dpdst_,
                uint16_t sport_, uint16_t dport_,
                Action action_)
-        : Event(static_get_name()), dpsrc(dpsrc_), dpdst(dpdst_),
+        : Event(static_get_name(), this), dpsrc(dpsrc_), dpdst(dpdst_),
           sport(sport_), dport(dport_),
           action(action_) { }
     
     // -- only for use within python
-    Link_event::Link_event() : Event(static_get_name()) { }
+    Link_event::Link_event() : Event(static_get_name(), this) { }
 
 } // namespace vigil
 
@@ -33,7 +33,7 @@ namespace vigil
   {
     const Packet_in_event& pie = assert_cast<const Packet_in_event&>(e);
  
-    Flow flow(htons(pie.in_port), *(pie.buf));
+    const Flow& flow = pie.flow;
     if (flow.dl_type == ethernet::IP &&
 	!flow.dl_src.is_multicast() && !flow.dl_src.is_broadcast() &&
 	!ipaddr(flow.nw_src).isMulticast())
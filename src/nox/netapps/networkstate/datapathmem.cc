@@ -43,6 +43,9 @@ namespace vigil
   uint32_t datapathmem::get_link_speed(datapathid dpid, uint16_t port)
   {
     hash_map<uint64_t,Datapath_join_event>::iterator i = dp_events.find(dpid.as_host());
+    if (i == dp_events.end())
+      return 0;
+
     vector<Port>::iterator j = i->second.ports.begin();
     while (j != i->second.ports.end())
     {
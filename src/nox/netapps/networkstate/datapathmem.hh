@@ -114,7 +114,7 @@ namespace vigil
      * 
      * @param dpid datapath id of switch
      * @param port port number
-     * @return speed in mbps (0 if port is not found)
+     * @return speed in mbps (0 if switch or port is not found)
      */
     uint32_t get_link_speed(datapathid dpid, uint16_t port);
     
@@ -56,12 +56,13 @@ namespace vigil
      */
     Flow_route_event(const Flow& flow_, const network::route& rte_,
 		     enum type eventType_):
-      Event(static_get_name()), rte(rte_), flow(flow_), eventType(eventType_)
+      Event(static_get_name(), this), rte(rte_), flow(flow_),
+      eventType(eventType_)
     {}
 
     /** For use within python.
      */
-    Flow_route_event() : Event(static_get_name()) 
+    Flow_route_event() : Event(static_get_name(), this) 
     { }
 
     /** Static name required in NOX.
@@ -21,13 +21,14 @@ namespace vigil
   }
 
   bool routeinstaller::get_shortest_path(std::list<network::termination> dst,
-					 network::route& route)
+					 network::route& route,
+					 const Flow* flow)
   {
     std::list<network::termination>::iterator i = dst.begin();
     if (i == dst.end())
       return false;
  
-    if (!get_shortest_path(*i, route))
+    if (!get_shortest_path(*i, route, flow))
     {
       return false;
     }
@@ -36,7 +37,7 @@ namespace vigil
     while (i != dst.end())
     {
       network::route r2(route);
-      if (!get_shortest_path(*i, r2))
+      if (!get_shortest_path(*i, r2, flow))
 	return false;
 
       merge_route(&route, &r2);
@@ -48,14 +49,16 @@ namespace vigil
 
 
   bool routeinstaller::get_shortest_path(network::termination dst,
-					 network::route& route)
+					 network::route& route,
+					 const Flow* flow)
   {
     Routing_module::RoutePtr sroute;
     Routing_module::RouteId id;
     id.src = route.in_switch_port.dpid;
     id.dst = dst.dpid;
 
-    if (!routing->get_route(id, sroute))
+    if (flow == NULL ? !routing->get_route(id, sroute)
+	             : !routing->get_route(id, *flow, sroute))
       return false;
 
     route2tree(dst, sroute, route);
@@ -63,17 +63,23 @@ namespace vigil
      * Note that a route for a list of destination is a tree.
      * @param dst list of network terminations for destinations
      * @param route route to populate with source network termination
+     * @param flow flow whose fields choose among equal-cost paths,
+     *             or NULL for the default shortest path
      * @return if route is found
      */
-    bool get_shortest_path(std::list<network::termination> dst, network::route& route);
+    bool get_shortest_path(std::list<network::termination> dst, network::route& route,
+			   const Flow* flow = NULL);
 
     /** Get shortest path route.
      * Note that a route for a list of destination is a tree.
      * @param dst destinations
      * @param route route to populate with source network termination
+     * @param flow flow whose fields choose among equal-cost paths,
+     *             or NULL for the default shortest path
      * @return if route is found
      */
-    bool get_shortest_path(network::termination dst, network::route& route);
+    bool get_shortest_path(network::termination dst, network::route& route,
+			   const Flow* flow = NULL);
 
     /** Install route, i.e., sending the route setup to a set of switches.
      * Throws Route_install_event if desired.
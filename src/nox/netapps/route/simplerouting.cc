@@ -51,7 +51,7 @@ namespace vigil
     {      
       network::route rte(pie.datapath_id, pie.in_port);
       network::termination endpt(dloc.dpid, dloc.port);
-      if (ri->get_shortest_path(endpt, rte))
+      if (ri->get_shortest_path(endpt, rte, &pie.flow))
       {
       	ri->install_route(pie.flow, rte, pie.buffer_id);
 	if (post_flow_record)
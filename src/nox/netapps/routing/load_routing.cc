@@ -0,0 +1,156 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "load_routing.hh"
+
+#include <boost/bind.hpp>
+#include <boost/tokenizer.hpp>
+#include <stdlib.h>
+
+#include "assert.hh"
+#include "discovery/link-event.hh"
+#include "networkstate/linkload.hh"
+#include "vlog.hh"
+
+namespace vigil {
+namespace applications {
+
+static Vlog_module lg("load_routing");
+
+Load_routing::Load_routing(const container::Context* c,
+                           const json_object*)
+    : container::Component(c), routing(NULL), loads(NULL), interval(0)
+{ }
+
+void
+Load_routing::getInstance(const container::Context* ctxt,
+                          Load_routing*& l)
+{
+    l = dynamic_cast<Load_routing*>
+        (ctxt->get_by_interface(container::Interface_description
+                                (typeid(Load_routing).name())));
+}
+
+void
+Load_routing::configure(const container::Configuration* c)
+{
+    const hash_map<std::string, std::string> args = c->get_arguments_list();
+    hash_map<std::string, std::string>::const_iterator arg
+        = args.find("interval");
+    if (arg != args.end()) {
+        interval = atol(arg->second.c_str());
+        if (interval <= 0) {
+            VLOG_WARN(lg, "Interval \"%s\" must be at least 1 second, "
+                      "using linkload's", arg->second.c_str());
+            interval = 0;
+        }
+    }
+    arg = args.find("alpha");
+    if (arg != args.end()) {
+        weigher.set_alpha(atoi(arg->second.c_str()) / 100.0);
+    }
+    arg = args.find("thresholds");
+    if (arg != args.end()) {
+        typedef boost::tokenizer<boost::char_separator<char> > Tokenizer;
+        Tokenizer percents(arg->second, boost::char_separator<char>(":"));
+        std::vector<double> thresholds;
+        for (Tokenizer::iterator i = percents.begin(); i != percents.end();
+             ++i) {
+            thresholds.push_back(atoi(i->c_str()) / 100.0);
+        }
+        if (!weigher.set_thresholds(thresholds)) {
+            VLOG_WARN(lg, "Thresholds \"%s\" must increase and be fewer "
+                      "than %u, using the defaults", arg->second.c_str(),
+                      Link_weigher::MAX_LEVELS);
+        }
+    }
+
+    resolve(routing);
+    resolve(loads);
+    register_handler<Link_event>
+        (boost::bind(&Load_routing::handle_link_change, this, _1));
+}
+
+void
+Load_routing::install()
+{
+    if (!interval) {
+        interval = loads->load_interval;
+    }
+    if (interval <= 0) {
+        VLOG_WARN(lg, "linkload's interval is %ld seconds, sampling every "
+                  "%d seconds instead", interval, LINKLOAD_DEFAULT_INTERVAL);
+        interval = LINKLOAD_DEFAULT_INTERVAL;
+    }
+    post(boost::bind(&Load_routing::sample_loads, this),
+         make_timeval(interval, 0));
+}
+
+// A link's weight starts over at 1 when it is added, in Routing_module as
+// here, so its load starts over too.
+
+Disposition
+Load_routing::handle_link_change(const Event& e)
+{
+    const Link_event& le = assert_cast<const Link_event&>(e);
+    network::switch_port key(le.dpsrc, le.sport);
+    if (le.action == Link_event::ADD) {
+        Weighed_link& link = links[key];
+        link.dst = le.dpdst;
+        link.inport = le.dport;
+        link.load = Link_weigher::Load();
+    } else if (le.action == Link_event::REMOVE) {
+        links.erase(key);
+    }
+    return CONTINUE;
+}
+
+// Folds the latest load on each link into its smoothed load and passes the
+// new weights of links whose loads crossed a threshold on to Routing_module.
+
+void
+Load_routing::sample_loads()
+{
+    size_t n_changed = 0;
+    for (Link_map::iterator i = links.begin(); i != links.end(); ++i) {
+        Weighed_link& link = i->second;
+        float ratio = loads->get_link_load_ratio(i->first.dpid, i->first.port);
+        if (!weigher.sample(link.load, ratio)) {
+            continue;
+        }
+        if (!routing->set_link_weight(i->first.dpid, i->first.port,
+                                      link.dst, link.inport,
+                                      weigher.weight(link.load))) {
+            VLOG_WARN(lg, "routing_module needs \"routes=compact\" to route "
+                      "by link load; no longer sampling loads");
+            return;
+        }
+        n_changed++;
+    }
+    if (n_changed) {
+        VLOG_DBG(lg, "Reweighed %zu of %zu links", n_changed, links.size());
+    }
+    post(boost::bind(&Load_routing::sample_loads, this),
+         make_timeval(interval, 0));
+}
+
+}
+}
+
+REGISTER_COMPONENT(vigil::container::Simple_component_factory
+                   <vigil::applications::Load_routing>,
+                   vigil::applications::Load_routing);
@@ -0,0 +1,91 @@
+/* Copyright 2008, 2009 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LOAD_ROUTING_HH
+#define LOAD_ROUTING_HH 1
+
+#include "component.hh"
+#include "hash_map.hh"
+#include "link-weigher.hh"
+#include "network_graph.hh"
+#include "routing.hh"
+
+/*
+ * Load-aware routing.  Samples the load on every link from linkload and gives
+ * each link a weight in Routing_module that grows with its load, so that
+ * shortest routes, and with them the routes of new flows, steer around busy
+ * links.  Flows already set up keep their routes.
+ *
+ * Loads are smoothed and turned into weights by a Link_weigher, so a link's
+ * weight changes, and routes are searched again, only when its smoothed load
+ * crosses a threshold.  Routing_module applies the changes in batches, like
+ * link changes.  It must have "routes=compact", since only then do its
+ * routes follow weights.
+ *
+ * Arguments:
+ *
+ *     interval=N        sample every N seconds, by default as often as
+ *                       linkload queries the switches, or every
+ *                       LINKLOAD_DEFAULT_INTERVAL seconds if linkload's
+ *                       interval is 0
+ *     thresholds=A:B:C  move links up a weight at A%, B% and C% of their
+ *                       capacity (the default is 50:75:90)
+ *     alpha=N           move the smoothed load N% of the way to each sample
+ *                       (the default is 50)
+ */
+
+namespace vigil {
+
+class linkload;
+
+namespace applications {
+
+class Load_routing
+    : public container::Component {
+
+public:
+    Load_routing(const container::Context*, const json_object*);
+    ~Load_routing() { }
+
+    static void getInstance(const container::Context*, Load_routing*&);
+
+    void configure(const container::Configuration*);
+    void install();
+
+private:
+    // Where a link leads, and its load, by the switch and port it leaves.
+    struct Weighed_link {
+        datapathid dst;
+        uint16_t inport;
+        Link_weigher::Load load;
+    };
+    typedef hash_map<network::switch_port, Weighed_link> Link_map;
+
+    Routing_module *routing;
+    linkload *loads;
+    Link_weigher weigher;
+    long interval;              // seconds between samples, 0 for linkload's
+    Link_map links;
+
+    Disposition handle_link_change(const Event&);
+    void sample_loads();
+};
+
+}
+}
+
+#endif
@@ -92,8 +92,10 @@ get_max_action_len() {
 
 Routing_module::Routing_module(const container::Context* c,
                                const json_object* d)
-    : container::Component(c), topology(0), nat(0), len_flow_actions(0),
-      num_actions(0), ofm(0)
+    : container::Component(c), topology(0), nat(0), compact(false),
+      table(new Route_table()), link_batch_ms(0), link_stats(),
+      updating(false), n_searching(0), len_flow_actions(0), num_actions(0),
+      ofm(0)
 {
     max_output_action_len = get_max_action_len();
 }
@@ -109,8 +111,33 @@ Routing_module::getInstance(const container::Context* ctxt,
 
 
 void
-Routing_module::configure(const container::Configuration*)
+Routing_module::configure(const container::Configuration* c)
 {
+    const hash_map<std::string, std::string> args = c->get_arguments_list();
+    hash_map<std::string, std::string>::const_iterator arg
+        = args.find("routes");
+    if (arg != args.end()) {
+        if (arg->second == "compact") {
+            compact = true;
+        } else if (arg->second != "dynamic") {
+            VLOG_WARN(lg, "Unknown route representation \"%s\", "
+                      "using \"dynamic\"", arg->second.c_str());
+        }
+    }
+    arg = args.find("link_batch_ms");
+    if (arg != args.end()) {
+        link_batch_ms = atoi(arg->second.c_str());
+    }
+    arg = args.find("route_threads");
+    if (arg != args.end() && atoi(arg->second.c_str()) > 0) {
+        compact = true;
+        workers.resize(atoi(arg->second.c_str()));
+        pool.reset(new Route_pool());
+        for (size_t i = 0; i < workers.size(); i++) {
+            pool->add_worker(&workers[i], boost::function<void()>());
+        }
+    }
+
     resolve(topology);
     resolve(nat);
     register_handler<Link_event>
@@ -125,6 +152,10 @@ Routing_module::install()
 bool
 Routing_module::get_route(const RouteId& id, RoutePtr& route) const
 {
+    if (compact) {
+        return get_compact_route(id, route);
+    }
+
     RouteMap::const_iterator rte = shortest.find(id);
     if (rte == shortest.end()) {
         if (id.src == id.dst) {
@@ -139,6 +170,91 @@ Routing_module::get_route(const RouteId& id, RoutePtr& route) const
     return true;
 }
 
+bool
+Routing_module::get_route(const RouteId& id, const Flow& flow,
+                          RoutePtr& route) const
+{
+    if (!compact) {
+        return get_route(id, route);
+    }
+
+    std::vector<Route_table::Hop> hops;
+    if (!table->get_route(id.src, id.dst, Flow_key(flow).hash(), hops)
+        && id.src != id.dst) {
+        return false;
+    }
+    make_route(id, hops, route);
+    return true;
+}
+
+// Without the compact table there is only the one shortest route, which
+// becomes a chain, as does the empty route of a switch the compact table has
+// not seen to itself.
+
+bool
+Routing_module::get_routes(const RouteId& id, Route_table::Dag& dag) const
+{
+    if (compact) {
+        if (table->get_routes(id.src, id.dst, dag)) {
+            return true;
+        } else if (id.src != id.dst) {
+            return false;
+        }
+    }
+
+    RoutePtr route;
+    if (!get_route(id, route)) {
+        return false;
+    }
+    dag.dps.assign(1, id.src);
+    dag.offsets.clear();
+    dag.links.clear();
+    for (std::list<Link>::const_iterator link = route->path.begin();
+         link != route->path.end(); ++link)
+    {
+        Route_table::Dag::Link dag_link;
+        dag_link.hop.dst = link->dst;
+        dag_link.hop.outport = link->outport;
+        dag_link.hop.inport = link->inport;
+        dag_link.next = dag.dps.size();
+        dag.offsets.push_back(dag.links.size());
+        dag.links.push_back(dag_link);
+        dag.dps.push_back(link->dst);
+    }
+    dag.offsets.push_back(dag.links.size());
+    dag.offsets.push_back(dag.links.size());
+    return true;
+}
+
+// Builds the route for 'id' from the compact table.  Switches the table has
+// not seen still have an empty route to themselves.
+
+bool
+Routing_module::get_compact_route(const RouteId& id, RoutePtr& route) const
+{
+    std::vector<Route_table::Hop> hops;
+    if (!table->get_route(id.src, id.dst, hops) && id.src != id.dst) {
+        return false;
+    }
+    make_route(id, hops, route);
+    return true;
+}
+
+void
+Routing_module::make_route(const RouteId& id,
+                           const std::vector<Route_table::Hop>& hops,
+                           RoutePtr& route)
+{
+    route.reset(new Route());
+    route->id = id;
+    for (std::vector<Route_table::Hop>::const_iterator hop = hops.begin();
+         hop != hops.end(); ++hop)
+    {
+        Link link = { hop->dst, hop->outport, hop->inport };
+        route->path.push_back(link);
+    }
+}
+
 bool
 Routing_module::check_route(const Route& route, uint16_t inport,
                             uint16_t outport) const
@@ -166,40 +282,251 @@ Routing_module::is_on_path_location(const RouteId& id, uint16_t src_port,
             && rte->path.back().inport == dst_port);
 }
 
-// Updates shortests paths on link change based on algorithm in "A New Approach
-// to Dynamic All Pairs Shortest Paths" - C. Demetrescu
+// Queues the link change for the next batch, which is processed at once if
+// there is no batching window, else when the window opened by the first
+// change of the batch closes.  Weight changes are queued the same way.
 
 Disposition
 Routing_module::handle_link_change(const Event& e)
 {
     const Link_event& le = assert_cast<const Link_event&>(e);
 
-    RouteQueue new_candidates;
-    RoutePtr route(new Route());
-    Link tmp = { le.dpdst, le.sport, le.dport };
-    route->id.src = le.dpsrc;
-    route->id.dst = le.dpdst;
-    route->path.push_back(tmp);
-    if (le.action == Link_event::REMOVE) {
-        cleanup(route, true);
-        fixup(new_candidates, true);
-    } else if (le.action == Link_event::ADD) {
-        RoutePtr left_subpath(new Route());
-        RoutePtr right_subpath(new Route());
-        left_subpath->id.src = left_subpath->id.dst = le.dpsrc;
-        right_subpath->id.src = right_subpath->id.dst = le.dpdst;
-        add(local_routes, route);
-        add(left_local, route, right_subpath);
-        add(right_local, route, left_subpath);
-        new_candidates.push(route);
-        fixup(new_candidates, false);
-    } else {
+    if (le.action != Link_event::REMOVE && le.action != Link_event::ADD) {
         VLOG_ERR(lg, "Unknown link event action %u", le.action);
+        return CONTINUE;
     }
 
+    Link_change change;
+    change.src = le.dpsrc;
+    change.link.dst = le.dpdst;
+    change.link.outport = le.sport;
+    change.link.inport = le.dport;
+    change.type = (le.action == Link_event::ADD
+                   ? Link_change::ADD : Link_change::REMOVE);
+    change.weight = 1;
+    queue_link_change(change);
     return CONTINUE;
 }
 
+bool
+Routing_module::set_link_weight(const datapathid& src, uint16_t outport,
+                                const datapathid& dst, uint16_t inport,
+                                uint16_t weight)
+{
+    if (!compact) {
+        return false;
+    }
+
+    Link_change change;
+    change.src = src;
+    change.link.dst = dst;
+    change.link.outport = outport;
+    change.link.inport = inport;
+    change.type = Link_change::WEIGH;
+    change.weight = weight;
+    queue_link_change(change);
+    return true;
+}
+
+void
+Routing_module::queue_link_change(const Link_change& change)
+{
+    link_changes.push_back(change);
+    if (!link_batch_ms) {
+        process_link_changes();
+    } else if (link_changes.size() == 1) {
+        post(boost::bind(&Routing_module::process_link_changes, this),
+             timeval_from_ms(link_batch_ms));
+    }
+}
+
+// Applies the queued link changes.  In compact mode, the table searches
+// again once for the whole batch, in the event loop or, if there is a pool,
+// in its threads.  Otherwise shortest paths are updated based on algorithm
+// in "A New Approach to Dynamic All Pairs Shortest Paths" - C. Demetrescu,
+// with each run of consecutive removals cleaned up and then fixed up once,
+// and each run of consecutive additions fixed up once.
+
+void
+Routing_module::process_link_changes()
+{
+    if (link_changes.empty() || updating) {
+        return;
+    } else if (pool) {
+        start_update();
+        return;
+    }
+
+    timeval start = do_gettimeofday(true);
+    if (compact) {
+        apply_link_changes(*table, link_changes);
+        table->update();
+    } else {
+        std::vector<Link_change>::const_iterator change
+            = link_changes.begin();
+        while (change != link_changes.end()) {
+            bool adding = change->type == Link_change::ADD;
+            RouteQueue new_candidates;
+            for (; change != link_changes.end()
+                     && (change->type == Link_change::ADD) == adding;
+                 ++change)
+            {
+                RoutePtr route(new Route());
+                route->id.src = change->src;
+                route->id.dst = change->link.dst;
+                route->path.push_back(change->link);
+                if (!adding) {
+                    cleanup(route, true);
+                    continue;
+                }
+                RoutePtr left_subpath(new Route());
+                RoutePtr right_subpath(new Route());
+                left_subpath->id.src = left_subpath->id.dst = route->id.src;
+                right_subpath->id.src = right_subpath->id.dst = route->id.dst;
+                add(local_routes, route);
+                add(left_local, route, right_subpath);
+                add(right_local, route, left_subpath);
+                new_candidates.push(route);
+            }
+            fixup(new_candidates, !adding);
+        }
+    }
+    count_batch(link_changes.size(), start);
+    link_changes.clear();
+}
+
+// Counts a batch of 'n' link changes, which started being applied at 'start'
+// and has just been finished.
+
+void
+Routing_module::count_batch(size_t n, const timeval& start)
+{
+    timeval end = do_gettimeofday(true);
+    timeval elapsed = end > start ? end - start : make_timeval(0, 0);
+    uint64_t usecs = elapsed.tv_sec * 1000000ULL + elapsed.tv_usec;
+
+    link_stats.n_batches++;
+    link_stats.n_changes += n;
+    link_stats.max_batch = std::max(link_stats.max_batch, n);
+    link_stats.total_usecs += usecs;
+    link_stats.max_usecs = std::max(link_stats.max_usecs, usecs);
+    VLOG_DBG(lg, "Recomputed routes for %zu link changes in %"PRIu64" us",
+             n, usecs);
+}
+
+void
+Routing_module::apply_link_changes(Route_table& table,
+                                   const std::vector<Link_change>& changes)
+{
+    for (std::vector<Link_change>::const_iterator change = changes.begin();
+         change != changes.end(); ++change)
+    {
+        if (change->type == Link_change::ADD) {
+            table.add_link(change->src, change->link.outport,
+                           change->link.dst, change->link.inport);
+        } else if (change->type == Link_change::REMOVE) {
+            table.remove_link(change->src, change->link.outport,
+                              change->link.dst, change->link.inport);
+        } else {
+            table.set_weight(change->src, change->link.outport,
+                             change->link.dst, change->link.inport,
+                             change->weight);
+        }
+    }
+}
+
+// Hands the queued link changes to the pool, which applies them to a copy of
+// the table.  'table' itself is left alone until the copy replaces it, so
+// the pool's threads may read it while the event loop answers get_route().
+
+void
+Routing_module::start_update()
+{
+    Link_changes_ptr changes(new std::vector<Link_change>());
+    changes->swap(link_changes);
+    boost::shared_ptr<Route_table> next(new Route_table());
+    Sources_ptr sources(new std::vector<uint32_t>());
+
+    updating = true;
+    update_start = do_gettimeofday(true);
+    pool->execute(boost::bind(&Routing_module::prepare_update,
+                              boost::shared_ptr<const Route_table>(table),
+                              changes, next, sources, _1),
+                  boost::bind(&Routing_module::start_searches, this,
+                              next, sources, changes->size()));
+}
+
+// Runs in a pool thread.  Makes 'next' a copy of 'table' with 'changes'
+// applied and sets 'sources' to the sources to search from again.
+
+int
+Routing_module::prepare_update(boost::shared_ptr<const Route_table> table,
+                               Link_changes_ptr changes,
+                               boost::shared_ptr<Route_table> next,
+                               Sources_ptr sources, Route_worker*)
+{
+    *next = *table;
+    apply_link_changes(*next, *changes);
+    next->prepare_update(*sources);
+    return 0;
+}
+
+// Splits searching from 'sources' in 'next' among the pool's threads, a few
+// tasks per thread so that they finish at about the same time.
+
+void
+Routing_module::start_searches(boost::shared_ptr<Route_table> next,
+                               Sources_ptr sources, size_t n_changes)
+{
+    size_t n = sources->size();
+    size_t n_tasks = std::min(n, workers.size() * 4);
+    if (!n_tasks) {
+        n_searching = 1;
+        finish_search(next, n_changes);
+        return;
+    }
+
+    n_searching = n_tasks;
+    for (size_t i = 0; i < n_tasks; i++) {
+        pool->execute(boost::bind(&Routing_module::search, next, sources,
+                                  n * i / n_tasks, n * (i + 1) / n_tasks,
+                                  _1),
+                      boost::bind(&Routing_module::finish_search, this,
+                                  next, n_changes));
+    }
+}
+
+// Runs in a pool thread.  Searches from sources 'begin' up to 'end' of
+// 'sources' in 'next'.
+
+int
+Routing_module::search(boost::shared_ptr<Route_table> next,
+                       Sources_ptr sources, size_t begin, size_t end,
+                       Route_worker* worker)
+{
+    for (size_t i = begin; i < end; i++) {
+        next->search((*sources)[i], worker->queue);
+    }
+    return 0;
+}
+
+// Once the last search task is done, replaces the table by 'next' and
+// starts on the link changes that have arrived in the meantime, if any.
+
+void
+Routing_module::finish_search(boost::shared_ptr<Route_table> next,
+                              size_t n_changes)
+{
+    if (--n_searching) {
+        return;
+    }
+
+    next->finish_update();
+    table = next;
+    updating = false;
+    count_batch(n_changes, update_start);
+    process_link_changes();
+}
 
 void
 Routing_module::cleanup(RoutePtr route, bool delete_route)
@@ -18,6 +18,7 @@
 #ifndef ROUTING_HH
 #define ROUTING_HH 1
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
 #include <list>
@@ -35,6 +36,8 @@
 #include "netinet++/datapathid.hh"
 #include "netinet++/ethernetaddr.hh"
 #include "openflow/openflow.h"
+#include "route-table.hh"
+#include "threads/native-pool.hh"
 #include "topology/topology.hh"
 
 
@@ -55,6 +58,36 @@ namespace applications {
  * Uses algorithm described in "A New Approach to Dynamic All Pairs Shortest
  * Paths" by C. Demetrescu to perform incremental updates when links are
  * added/removed from the network instead of recomputing all shortest paths.
+ * That keeps every shortest and locally shortest path as a separately
+ * allocated Route, which for large fabrics costs far more memory than the
+ * paths themselves need.  With the argument "routes=compact", shortest paths
+ * are instead kept in a Route_table, as predecessor arrays over an adjacency
+ * array of the links, and get_route() builds each Route on demand.
+ *
+ * With the argument "link_batch_ms=N", link changes are collected for N
+ * milliseconds after the first one and then applied as a batch, so that a
+ * burst of changes, such as a line card failing, costs one recomputation
+ * instead of one per link.  Until the batch is applied, routes reflect the
+ * links as they were.  By default each change is applied as it arrives.
+ *
+ * With the argument "route_threads=N", which implies "routes=compact",
+ * batches are applied by a pool of N native threads instead of in the event
+ * loop.  One thread applies the batch to a copy of the table, the threads
+ * then search again from the affected sources in parallel, and the copy
+ * replaces the table once they are done.  get_route() keeps answering from
+ * the old table in the meantime, and changes that arrive meanwhile wait for
+ * the next batch.
+ *
+ * Where there are several equal-cost shortest paths, get_route() given a
+ * Flow picks one of them by a hash of the flow's fields, so that flows
+ * spread over the paths while the packets of each flow stay on one, and
+ * get_routes() returns all of them.  Only "routes=compact" keeps more than
+ * one shortest path, so otherwise both fall back to the one shortest route.
+ *
+ * With "routes=compact", links may also be given weights with
+ * set_link_weight(), which are batched like link changes, and shortest routes
+ * are then those of least total weight.  The load_routing component uses this
+ * to steer new flows around busy links.
  *
  * All integer values are stored in host byte order and should be passed in as
  * such as well.
@@ -84,6 +117,15 @@ public:
     typedef boost::shared_ptr<Route> RoutePtr;
     typedef std::list<Nonowning_buffer> ActionList;
 
+    // Counters for batches of link changes.
+    struct Link_batch_stats {
+        uint64_t n_batches;    // batches applied
+        uint64_t n_changes;    // link changes applied
+        size_t max_batch;      // most link changes in a batch
+        uint64_t total_usecs;  // time spent recomputing routes
+        uint64_t max_usecs;    // longest recomputation for a batch
+    };
+
     Routing_module(const container::Context*,
                    const json_object*);
     // for python
@@ -110,6 +152,17 @@ public:
 
     bool get_route(const RouteId& id, RoutePtr& route) const;
 
+    // As above, but where there are several shortest routes, chooses one of
+    // them by a hash of the fields of 'flow', so that different flows
+    // between the same datapaths spread over the routes.
+
+    bool get_route(const RouteId& id, const Flow& flow, RoutePtr& route) const;
+
+    // Sets 'dag' to all of the shortest routes for 'id'.  Returns 'true' if
+    // a route between the two datapaths exists, else 'false'.
+
+    bool get_routes(const RouteId& id, Route_table::Dag& dag) const;
+
     // Given a route and an access point inport and outport, verifies that a
     // flow will not get route out the same port it came in on at the
     // endpoints.  Returns 'true' if this will not happen, else 'false'.
@@ -119,6 +172,19 @@ public:
     bool is_on_path_location(const RouteId& id, uint16_t src_port,
                              uint16_t dst_port);
 
+    const Link_batch_stats& get_link_batch_stats() const
+        { return link_stats; }
+
+    // Queues a change of the weight of the link from port 'outport' of 'src'
+    // to port 'inport' of 'dst' to 'weight', at least 1, to be applied with
+    // the next batch of link changes.  Links weigh 1 when they are added.
+    // Returns 'false', and does nothing, unless routes are compact, since
+    // otherwise routes are shortest by hop count.
+
+    bool set_link_weight(const datapathid& src, uint16_t outport,
+                         const datapathid& dst, uint16_t inport,
+                         uint16_t weight);
+
     // Sets up the switch entries needed to route Flow 'flow' according to
     // 'route' and the source access point 'inport' and destination access
     // point 'outport'.  Entries will time out after 'flow_timeout' seconds of
@@ -199,6 +265,42 @@ private:
     ExtensionMap right_local;
     ExtensionMap right_shortest;
 
+    // Compact alternative, used instead of the above if 'compact' is set
+
+    bool compact;
+    boost::shared_ptr<Route_table> table;
+
+    // Link changes waiting to be applied
+
+    struct Link_change {
+        enum Type { ADD, REMOVE, WEIGH };
+
+        datapathid src;
+        Link link;
+        Type type;
+        uint16_t weight;        // new weight, for WEIGH
+    };
+
+    int link_batch_ms;
+    std::vector<Link_change> link_changes;
+    Link_batch_stats link_stats;
+
+    // Threads applying batches to a copy of 'table', if any
+
+    struct Route_worker {
+        std::vector<uint32_t> queue;
+    };
+
+    typedef boost::shared_ptr<std::vector<Link_change> > Link_changes_ptr;
+    typedef boost::shared_ptr<std::vector<uint32_t> > Sources_ptr;
+    typedef Native_thread_pool<int, Route_worker> Route_pool;
+
+    std::vector<Route_worker> workers;
+    boost::scoped_ptr<Route_pool> pool;
+    bool updating;              // a batch is being applied by 'pool'
+    timeval update_start;
+    size_t n_searching;         // search tasks not yet done
+
     std::vector<const std::vector<uint64_t>*> nat_flow;
 
     uint16_t max_output_action_len;
@@ -210,6 +312,24 @@ private:
     std::ostringstream os;
 
     Disposition handle_link_change(const Event&);
+    void queue_link_change(const Link_change&);
+    void process_link_changes();
+    void count_batch(size_t, const timeval&);
+    bool get_compact_route(const RouteId&, RoutePtr&) const;
+    static void make_route(const RouteId&,
+                           const std::vector<Route_table::Hop>&, RoutePtr&);
+
+    static void apply_link_changes(Route_table&,
+                                   const std::vector<Link_change>&);
+    void start_update();
+    static int prepare_update(boost::shared_ptr<const Route_table>,
+                              Link_changes_ptr,
+                              boost::shared_ptr<Route_table>, Sources_ptr,
+                              Route_worker*);
+    void start_searches(boost::shared_ptr<Route_table>, Sources_ptr, size_t);
+    static int search(boost::shared_ptr<Route_table>, Sources_ptr,
+                      size_t, size_t, Route_worker*);
+    void finish_search(boost::shared_ptr<Route_table>, size_t);
 
     // All-pairs shortest path fns
 
@@ -333,7 +333,7 @@ SPRouting::set_route(Flow_in_event& fi,
                 route = empty;
                 check = true;
             } else {
-                check = routing->get_route(empty->id, route);
+                check = routing->get_route(empty->id, fi.flow, route);
             }
 
             if (check) {
@@ -44,6 +44,7 @@
 #include "netinet++/datapathid.hh"
 #include "netinet++/ethernetaddr.hh"
 #include "packet-classifier.hh"
+#include "packet-in-limiter.hh"
 #include "timer-dispatcher.hh"
 #include "switch_auth.hh" 
 #include "switch-mgr.hh" 
@@ -78,6 +79,21 @@ uint32_t register_handler_on_match(uint32_t priority, const Packet_expr &expr,
                                    Pexpr_action callback);
 // TODO unregister_handler_on_match
 
+/* Registers or unregisters many handlers at once, as when a policy changes.
+ * The packet classifier is rebuilt once, at the next packet-in, rather than
+ * after each.  register_handlers_on_match() appends the new rule IDs to
+ * 'rule_ids' and registers none of them if it throws;
+ * unregister_handlers() returns the number of handlers it removed. */
+void register_handlers_on_match(
+    const std::vector<Packet_classifier::Rule_spec>& rules,
+    std::vector<uint32_t>& rule_ids);
+uint32_t unregister_handlers(const std::vector<uint32_t>& rule_ids);
+
+/* Sets the number of flows whose matches the packet classifier remembers, or
+ * disables its flow cache if 'n' is 0, and returns the cache's counters. */
+void set_flow_cache_size(size_t n);
+Flow_cache_stats get_flow_cache_stats();
+
 // global hook to register a class to determine if a switch is
 // allowed to connect to NOX.  This functionality cannot be part
 // of builtin, because it likely requires access to components 
@@ -92,6 +108,44 @@ void register_switch_auth(Switch_Auth* auth);
 
 void post_event(Event*);
 
+/* Sharding.
+ *
+ * By default the whole controller runs in one cooperative thread group and
+ * thus on one core.  With set_shard_count(n), called before init(), switch
+ * connections are spread over 'n' shards.  Each shard is a thread group,
+ * running on its own native threads, with its own poll loop, event dispatcher
+ * and timers.  Shard 0 is the ordinary main loop: it hosts every component
+ * that is not shard-safe.  Components that declare "shard_safe" in their
+ * meta.json get an additional instance in each of the other shards, which
+ * sees only the events of that shard's switches.  An event produced in
+ * another shard is handled there only if no component that is not shard-safe
+ * handles events of its type.  Otherwise it goes to shard 0, where every
+ * component sees it, so a packet-in handler that is not shard-safe keeps all
+ * packet-in processing in shard 0.  The packet classifier counts as such a
+ * handler only while rules are registered with register_handler_on_match().
+ * Flow_mod_events, raised by sending flow_mods, are routed the same way.
+ *
+ * post_event(), post_timer() and register_handler() act on the calling
+ * shard.  Requests to send to a switch owned by another shard are forwarded
+ * to that shard and report success once queued.  Errors in sending them,
+ * EAGAIN included, are only logged. */
+void set_shard_count(unsigned int);
+unsigned int get_shard_count();
+unsigned int get_current_shard();
+
+/* Arranges for 'callback' to run in a cooperative thread of 'shard'.  May be
+ * called from any shard or native thread.  'callback' may block. */
+void post_to_shard(unsigned int shard, const Callback&);
+
+/* Posts 'event' to the event queue of 'shard'.  May be called from any shard
+ * or native thread. */
+void post_event(unsigned int shard, Event*);
+
+/* Runs 'callback' in 'shard' from the calling cooperative thread, which
+ * migrates there and back, and returns when 'callback' does.  Meant for
+ * setting up per-shard state. */
+void run_in_shard(unsigned int shard, const Callback&);
+
 Timer post_timer(const Callback& callback);
 Timer post_timer(const Callback& callback, const timeval& duration);
 void timer_debug();
@@ -120,6 +174,35 @@ int send_openflow_packet_out(const datapathid&,
                              uint16_t actions_len,
                              uint16_t in_port, bool block);  
 
+/* Bytes queued for switch 'datapath_id' but not yet written to it.  Senders
+ * that see this grow can back off before send_openflow_*() starts returning
+ * EAGAIN. */
+size_t get_openflow_send_backlog(const datapathid&);
+
+/* Packet-in admission control.  Before any event is built for a packet-in,
+ * it must get past a token bucket for its switch and one for the port it
+ * arrived on.  Those over the limits are dropped or sampled, and counted per
+ * switch.
+ *
+ * The first function sets the limits for switches without limits of their
+ * own, the second those for switch 'datapath_id'.  Both may be called at any
+ * time and take effect at the next packet-in. */
+void set_packet_in_limits(const Packet_in_limits&);
+void set_packet_in_limits(const datapathid&, const Packet_in_limits&);
+
+/* Packet-in queueing.  By default packet-ins wait in their own queue, behind
+ * control and topology events, so that a flood of them cannot delay echo
+ * replies or port changes.  A packet-in may therefore be handled after a
+ * port-status, flow-removed or other message that its switch sent after it.
+ * With 'queued' false, packet-ins are dispatched as they arrive instead, as
+ * they used to be.  With a nonzero 'max_queued', packet-ins that arrive
+ * while that many wait are dropped.  Must be called before init(). */
+void set_packet_in_queue(bool queued, size_t max_queued);
+
+/* Stores the packet-in counters of switch 'datapath_id' in '*stats'.  Returns
+ * false, leaving '*stats' alone, if the switch is not connected. */
+bool get_packet_in_stats(const datapathid&, Packet_in_stats* stats);
+
 int close_openflow_connection(const datapathid&);
     
 int send_add_snat(const datapathid &dpid, uint16_t port, 
@@ -18,29 +18,85 @@
 #ifndef PACKET_CLASSIFIER_HH
 #define PACKET_CLASSIFIER_HH 1
 
+#include <boost/ptr_container/ptr_vector.hpp>
 #include "classifier.hh"
+#include "compiled-classifier.hh"
 #include "event.hh"
 #include "expr.hh"
+#include "flow-cache.hh"
 
 namespace vigil {
 
 typedef boost::function<void(const Event&)> Pexpr_action;
 
+/* Dispatches packet-ins to the actions of the highest-priority rules that
+ * match them.
+ *
+ * By default, lookups use a compiled snapshot of the classifier, which is
+ * rebuilt (after building the tree) at the first packet-in following any
+ * change to the rules.  set_compiled(false) makes lookups walk the tree
+ * itself instead.  With set_backend(TUPLE_SPACE), lookups probe the tuple
+ * space only until the highest-priority matches are known.
+ *
+ * In front of all of these, a Flow_cache remembers the rules that each
+ * recently seen flow matched, until the rules change.  It has
+ * DEFAULT_FLOW_CACHE_SIZE entries unless set_flow_cache_size() says
+ * otherwise; 0 disables it.
+ *
+ * The results and traversal stacks are kept from one packet-in to the next,
+ * so that once the first packet-in after a change to the rules has sized
+ * them, classifying a packet does not allocate memory.
+ *
+ * Callers holding several flows at once can classify() them together: the
+ * flows that miss in the cache are then looked up in the compiled snapshot
+ * side by side (see Compiled_classifier::get_rules_batch()). */
 class Packet_classifier
     : public Classifier<Packet_expr, Pexpr_action>
 {
 public:
+    typedef Rule<Packet_expr, Pexpr_action> Rule_type;
+    typedef Flow_cache<Rule_type>::Value Match_set;
+
+    static const size_t DEFAULT_FLOW_CACHE_SIZE = 4096;
+
     Packet_classifier(uint32_t split_field, int n_buckets)
-        : Classifier<Packet_expr, Pexpr_action>(split_field, n_buckets), result(NULL) { }
+        : Classifier<Packet_expr, Pexpr_action>(split_field, n_buckets),
+          result(NULL), compiled_result(NULL), tuple_result(NULL),
+          use_compiled(true), flow_cache(DEFAULT_FLOW_CACHE_SIZE) { }
     Packet_classifier()
-        : Classifier<Packet_expr, Pexpr_action>(), result(NULL) { }
+        : Classifier<Packet_expr, Pexpr_action>(),
+          result(NULL), compiled_result(NULL), tuple_result(NULL),
+          use_compiled(true), flow_cache(DEFAULT_FLOW_CACHE_SIZE) { }
     ~Packet_classifier() { }
 
     void register_packet_in();
     Disposition handle_packet_in(const Event& e);
+    void classify(const Flow* const flows[], Match_set* const sets[],
+                  size_t n);
+
+    void set_compiled(bool compiled) { use_compiled = compiled; }
+    void set_flow_cache_size(size_t n) { flow_cache.resize(n); }
+    const Flow_cache_stats& get_flow_cache_stats() const
+        { return flow_cache.get_stats(); }
 
 private:
+    typedef Compiled_result<Packet_expr, Pexpr_action, Flow> Batch_result;
+
     Cnode_result<Packet_expr, Pexpr_action, Flow> result;
+    Compiled_classifier<Packet_expr, Pexpr_action> compiled;
+    Compiled_result<Packet_expr, Pexpr_action, Flow> compiled_result;
+    Tuple_result<Packet_expr, Pexpr_action, Flow> tuple_result;
+    bool use_compiled;
+    Flow_cache<Rule_type> flow_cache;
+    Match_set matches;          /* Used when 'flow_cache' is disabled. */
+
+    /* For classify(). */
+    boost::ptr_vector<Batch_result> batch_results;
+    std::vector<Batch_result*> batch_ptrs;
+    std::vector<size_t> batch_misses;
+
+    void make_current();
+    void lookup(const Flow&, Match_set&);
 
     Packet_classifier(const Packet_classifier&);
     Packet_classifier& operator=(const Packet_classifier&);
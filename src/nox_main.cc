@@ -167,7 +167,29 @@ void usage(const char* program_name)
            "  -i pcapt:FILE[:OUTFILE] same as \"pcap\", but delay packets based on pcap timestamps\n"
            "  -i pgen:                continuously generate packet-in events\n"
            "\nNetwork control options (must also specify an interface):\n"
-           "  -u, --unreliable        do not reconnect to interfaces on error\n",
+           "  -u, --unreliable        do not reconnect to interfaces on error\n"
+           "  --tx-flush-delay=MSEC   hold outgoing messages up to MSEC ms to\n"
+           "                          coalesce them (default: 0, until yield)\n"
+           "  --tx-high-water=BYTES   queued bytes per switch before sends\n"
+           "                          return EAGAIN (default: 1048576)\n"
+           "  --epoll                 wait on sockets with epoll instead of poll\n"
+           "  --shards=N              spread switches over N threads (default: 1)\n"
+           "  --packet-in-limit=RATE[:BURST]\n"
+           "                          admit at most RATE packet-ins per second\n"
+           "                          from each switch (default: no limit)\n"
+           "  --port-packet-in-limit=RATE[:BURST]\n"
+           "                          same, for each switch port\n"
+           "  --packet-in-sample=N    admit 1 of every N packet-ins over the\n"
+           "                          limits instead of dropping them all\n"
+           "  --packet-in-drop-flow=SECS\n"
+           "                          when a port goes over its limit, drop\n"
+           "                          the offending source for SECS seconds\n"
+           "  --flow-cache-size=N     remember the classifier's matches for\n"
+           "                          N flows (default: 4096, 0 disables)\n"
+           "  --packet-in-queue=N     drop packet-ins that arrive while N wait\n"
+           "                          behind other events (default: no limit)\n"
+           "  --no-packet-in-queue    handle packet-ins as they arrive instead\n"
+           "                          of behind control and topology events\n",
 	   program_name, program_name, OFP_TCP_PORT, OFP_SSL_PORT);
     leak_checker_usage();
     printf("\nOther options:\n"
@@ -239,6 +261,14 @@ int start_gui() {
 }
 
 
+/* Parses "RATE[:BURST]" in 'arg' into '*rate' and '*burst'. */
+void parse_rate(const char* arg, unsigned int* rate, unsigned int* burst)
+{
+    char* end;
+    *rate = strtoul(arg, &end, 10);
+    *burst = *end == ':' ? strtoul(end + 1, NULL, 10) : 0;
+}
+
 int verbose = 0;
 #ifndef LOG4CXX_ENABLED
 vector<string> verbosity;
@@ -337,6 +367,14 @@ int main(int argc, char *argv[])
     const char* pid_file = "/var/run/nox.pid";
     const char* info_file = "./nox.info";
     bool reliable = true;
+    unsigned long int tx_flush_delay = 0;
+    size_t tx_high_water = 1024 * 1024;
+    bool epoll_flag = false;
+    unsigned int n_shards = 1;
+    Packet_in_limits packet_in_limits;
+    size_t flow_cache_size = Packet_classifier::DEFAULT_FLOW_CACHE_SIZE;
+    bool queue_packet_ins = true;
+    size_t packet_in_queue_limit = 0;
     bool daemon_flag = false;
     bool gui_flag = false;
     vector<string> interfaces;
@@ -359,7 +397,18 @@ int main(int argc, char *argv[])
     for (;;) {
         enum {
             OPT_CHECK_LEAKS = UCHAR_MAX + 1,
-            OPT_LEAK_LIMIT
+            OPT_LEAK_LIMIT,
+            OPT_TX_FLUSH_DELAY,
+            OPT_TX_HIGH_WATER,
+            OPT_EPOLL,
+            OPT_SHARDS,
+            OPT_PACKET_IN_LIMIT,
+            OPT_PORT_PACKET_IN_LIMIT,
+            OPT_PACKET_IN_SAMPLE,
+            OPT_PACKET_IN_DROP_FLOW,
+            OPT_FLOW_CACHE_SIZE,
+            OPT_PACKET_IN_QUEUE,
+            OPT_NO_PACKET_IN_QUEUE
         };
         static struct option long_options[] = {
             {"daemon",      no_argument, 0, 'd'},
@@ -376,6 +425,25 @@ int main(int argc, char *argv[])
             {"check-leaks", required_argument, 0, OPT_CHECK_LEAKS},
             {"leak-limit",  required_argument, 0, OPT_LEAK_LIMIT},
 
+            {"tx-flush-delay", required_argument, 0, OPT_TX_FLUSH_DELAY},
+            {"tx-high-water",  required_argument, 0, OPT_TX_HIGH_WATER},
+            {"epoll",          no_argument,       0, OPT_EPOLL},
+            {"shards",         required_argument, 0, OPT_SHARDS},
+            {"packet-in-limit",      required_argument, 0,
+             OPT_PACKET_IN_LIMIT},
+            {"port-packet-in-limit", required_argument, 0,
+             OPT_PORT_PACKET_IN_LIMIT},
+            {"packet-in-sample",     required_argument, 0,
+             OPT_PACKET_IN_SAMPLE},
+            {"packet-in-drop-flow",  required_argument, 0,
+             OPT_PACKET_IN_DROP_FLOW},
+            {"flow-cache-size",      required_argument, 0,
+             OPT_FLOW_CACHE_SIZE},
+            {"packet-in-queue",      required_argument, 0,
+             OPT_PACKET_IN_QUEUE},
+            {"no-packet-in-queue",   no_argument,       0,
+             OPT_NO_PACKET_IN_QUEUE},
+
 #ifdef LOG4CXX_ENABLED
             {"verbose",     no_argument, 0, 'v'},
 #else
@@ -453,6 +521,51 @@ int main(int argc, char *argv[])
             leak_checker_set_limit(strtoll(optarg,NULL,10));
             break;
 
+        case OPT_TX_FLUSH_DELAY:
+            tx_flush_delay = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_TX_HIGH_WATER:
+            tx_high_water = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_EPOLL:
+            epoll_flag = true;
+            break;
+
+        case OPT_SHARDS:
+            n_shards = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_PACKET_IN_LIMIT:
+            parse_rate(optarg, &packet_in_limits.rate, &packet_in_limits.burst);
+            break;
+
+        case OPT_PORT_PACKET_IN_LIMIT:
+            parse_rate(optarg, &packet_in_limits.port_rate,
+                       &packet_in_limits.port_burst);
+            break;
+
+        case OPT_PACKET_IN_SAMPLE:
+            packet_in_limits.sample = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_PACKET_IN_DROP_FLOW:
+            packet_in_limits.drop_flow_secs = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_FLOW_CACHE_SIZE:
+            flow_cache_size = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_PACKET_IN_QUEUE:
+            packet_in_queue_limit = strtoul(optarg, NULL, 10);
+            break;
+
+        case OPT_NO_PACKET_IN_QUEUE:
+            queue_packet_ins = false;
+            break;
+
         case 'V':
             hello(program_name);
             exit(EXIT_SUCCESS);
@@ -465,6 +578,10 @@ int main(int argc, char *argv[])
         }
     }
 
+    Openflow_stream_connection::set_tx_coalescing(
+        make_timeval(tx_flush_delay / 1000, (tx_flush_delay % 1000) * 1000),
+        tx_high_water);
+
     /* Spawn GUI if configured */
     if (gui_flag && start_gui()) {
         exit(EXIT_FAILURE);
@@ -531,6 +648,10 @@ int main(int argc, char *argv[])
 
     init_log(platform_configuration);
 
+    if (epoll_flag && !co_set_fd_backend(CO_FD_BACKEND_EPOLL)) {
+        lg.warn("epoll is not supported on this system, using poll");
+    }
+
     lg.info("Starting %s (%s)", program_name, argv[0]);
             
     try {
@@ -549,6 +670,10 @@ int main(int argc, char *argv[])
         }
 
         /* Boot the container */
+        nox::set_shard_count(n_shards);
+        nox::set_packet_in_limits(packet_in_limits);
+        nox::set_flow_cache_size(flow_cache_size);
+        nox::set_packet_in_queue(queue_packet_ins, packet_in_queue_limit);
         nox::init();
         Kernel::init(info_file, argc, argv);
         Kernel* kernel = Kernel::get_instance();
@@ -0,0 +1,531 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Compares lookup cost in a built Classifier tree, in a compiled snapshot of
+ * it, and in a tuple space holding the same rules, and, for the first two,
+ * the cost of lookups done in batches with get_rules_batch().
+ *
+ * With files, the rules come from a test-classifier policy file, replicated
+ * with distinct ports until there are at least N_RULES of them, and the
+ * lookups use the expressions from a test-classifier packets file.  With
+ * --random, there are N_RULES random rules that each match on a random
+ * subset of the Flow fields, and the lookups are of flows that each match
+ * one of them.
+ *
+ * With --churn, times updates instead: in a built tree of N_RULES random
+ * rules, each update deletes a rule and adds a new one, and the tree is
+ * built after each update or after each batch of them.
+ *
+ * With --groups, there is a rule for each of N_GROUPS source groups, and
+ * the lookups are of flows from hosts in more and more of the groups, with
+ * each host's groups looked up as a set and, for comparison, one at a time.
+ *
+ * usage: bench-classifier POLICY PACKETS [N_RULES]
+ *        bench-classifier --random N_RULES
+ *        bench-classifier --churn N_RULES
+ *        bench-classifier --groups N_GROUPS */
+
+#include "test-classifier-rules.hh"
+#include "classifier.hh"
+#include "compiled-classifier.hh"
+#include "flow.hh"
+#include "timeval.hh"
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+using namespace vigil;
+
+typedef Classifier<Packet_expr, void*> Classifier_type;
+
+static const int N_LOOKUPS = 1000000;
+static const int N_ROUNDS = 3;
+
+static const int BATCH_SIZES[] = { 1, 8, 32, 128 };
+static const int N_BATCH_SIZES = sizeof BATCH_SIZES / sizeof *BATCH_SIZES;
+
+/* Like Packet_classifier, retrieves only the matches with the highest
+ * priority from 'result', adding their number to '*n_matches', and clears
+ * 'result'. */
+template<class Result>
+static void
+count_top_matches(Result& result, unsigned long *n_matches)
+{
+    const Rule<Packet_expr, void*> *match = result.next();
+    if (match != NULL) {
+        uint32_t top_priority = match->priority;
+        do {
+            ++*n_matches;
+            match = result.next();
+        } while (match != NULL && match->priority == top_priority);
+    }
+    result.clear();
+}
+
+/* Returns the microseconds that N_LOOKUPS lookups of 'packets' in 'c' take,
+ * using 'Result' to collect rules, and adds the number of top matches to
+ * '*n_matches'. */
+template<class Result, class Lookup, class Data>
+static double
+time_lookups(Lookup& c, const std::vector<Data>& packets,
+             unsigned long *n_matches)
+{
+    Result result(NULL);
+    timeval start = do_gettimeofday(true);
+    for (int i = 0; i < N_LOOKUPS; i++) {
+        result.set_data(&packets[i % packets.size()]);
+        c.get_rules(result);
+        count_top_matches(result, n_matches);
+    }
+    timeval elapsed = do_gettimeofday(true) - start;
+    return elapsed.tv_sec * 1000000.0 + elapsed.tv_usec;
+}
+
+/* Same as time_lookups(), but looks 'packets' up 'batch' at a time with
+ * get_rules_batch(). */
+template<class Result, class Lookup, class Data>
+static double
+time_batches(Lookup& c, const std::vector<Data>& packets, int batch,
+             unsigned long *n_matches)
+{
+    boost::ptr_vector<Result> results;
+    std::vector<Result*> result_ptrs;
+    for (int i = 0; i < batch; i++) {
+        results.push_back(new Result(NULL));
+        result_ptrs.push_back(&results.back());
+    }
+
+    timeval start = do_gettimeofday(true);
+    for (int n = 0; n < N_LOOKUPS; n += batch) {
+        int n_batch = std::min(batch, N_LOOKUPS - n);
+        for (int i = 0; i < n_batch; i++) {
+            results[i].set_data(&packets[(n + i) % packets.size()]);
+        }
+        c.get_rules_batch(&result_ptrs[0], n_batch);
+        for (int i = 0; i < n_batch; i++) {
+            count_top_matches(results[i], n_matches);
+        }
+    }
+    timeval elapsed = do_gettimeofday(true) - start;
+    return elapsed.tv_sec * 1000000.0 + elapsed.tv_usec;
+}
+
+/* Keeps in '*best' the lowest of the times passed to it. */
+static void
+keep_best(double usecs, int round, double *best)
+{
+    if (!round || usecs < *best) {
+        *best = usecs;
+    }
+}
+
+/* Times lookups of 'packets' in the rules of 'tree', which must be built,
+ * and 'tuples', which must hold the same rules, and prints the results. */
+template<class Data>
+static int
+run(Classifier_type& tree, Classifier_type& tuples,
+    const std::vector<Data>& packets, unsigned int n_rules)
+{
+    timeval start = do_gettimeofday(true);
+    Compiled_classifier<Packet_expr, void*> compiled;
+    compiled.compile(tree);
+    timeval elapsed = do_gettimeofday(true) - start;
+
+    /* Alternate between the three, keeping the best of several rounds, so
+     * that none benefits from a warmer cache. */
+    unsigned long tree_matches = 0, compiled_matches = 0, tuple_matches = 0;
+    double tree_usecs = 0, compiled_usecs = 0, tuple_usecs = 0;
+    unsigned long tree_batch_matches[N_BATCH_SIZES] = { 0 };
+    unsigned long compiled_batch_matches[N_BATCH_SIZES] = { 0 };
+    double tree_batch_usecs[N_BATCH_SIZES];
+    double compiled_batch_usecs[N_BATCH_SIZES];
+    for (int round = 0; round < N_ROUNDS; round++) {
+        for (int i = 0; i < N_BATCH_SIZES; i++) {
+            keep_best(time_batches<Cnode_result<Packet_expr, void*, Data> >(
+                          tree, packets, BATCH_SIZES[i],
+                          &tree_batch_matches[i]),
+                      round, &tree_batch_usecs[i]);
+            keep_best(time_batches<Compiled_result<Packet_expr, void*, Data> >(
+                          compiled, packets, BATCH_SIZES[i],
+                          &compiled_batch_matches[i]),
+                      round, &compiled_batch_usecs[i]);
+        }
+        keep_best(time_lookups<Cnode_result<Packet_expr, void*, Data> >(
+                      tree, packets, &tree_matches),
+                  round, &tree_usecs);
+        keep_best(time_lookups<Compiled_result<Packet_expr, void*, Data> >(
+                      compiled, packets, &compiled_matches),
+                  round, &compiled_usecs);
+        keep_best(time_lookups<Tuple_result<Packet_expr, void*, Data> >(
+                      tuples, packets, &tuple_matches),
+                  round, &tuple_usecs);
+    }
+    if (tree_matches != compiled_matches || tree_matches != tuple_matches) {
+        fprintf(stderr, "tree found %lu matches, compiled snapshot %lu, "
+                "tuple space %lu\n",
+                tree_matches, compiled_matches, tuple_matches);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < N_BATCH_SIZES; i++) {
+        if (tree_batch_matches[i] != tree_matches
+            || compiled_batch_matches[i] != tree_matches) {
+            fprintf(stderr, "batches of %d found %lu matches in the tree, "
+                    "%lu in the compiled snapshot, instead of %lu\n",
+                    BATCH_SIZES[i], tree_batch_matches[i],
+                    compiled_batch_matches[i], tree_matches);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%u rules, %zu compiled nodes, compiled in %.0f usec\n",
+           n_rules, compiled.n_nodes(),
+           elapsed.tv_sec * 1000000.0 + elapsed.tv_usec);
+    printf("%-10s %12s\n", "", "ns/lookup");
+    printf("%-10s %12.1f\n", "tree", tree_usecs * 1000.0 / N_LOOKUPS);
+    printf("%-10s %12.1f\n", "compiled", compiled_usecs * 1000.0 / N_LOOKUPS);
+    printf("%-10s %12.1f\n", "tuples", tuple_usecs * 1000.0 / N_LOOKUPS);
+
+    printf("\n%-10s %12s %12s  (ns/lookup in batches)\n",
+           "batch", "tree", "compiled");
+    for (int i = 0; i < N_BATCH_SIZES; i++) {
+        printf("%-10d %12.1f %12.1f\n", BATCH_SIZES[i],
+               tree_batch_usecs[i] * 1000.0 / N_LOOKUPS,
+               compiled_batch_usecs[i] * 1000.0 / N_LOOKUPS);
+    }
+    return 0;
+}
+
+static int
+run_files(const char *policy_file, const char *packets_file,
+          unsigned int n_rules)
+{
+    Rule_list policy, packet_rules;
+    if (!read_rules(policy_file, policy) || !read_rules(packets_file, packet_rules)
+        || policy.empty() || packet_rules.empty()) {
+        fprintf(stderr, "could not read rules\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Each copy of the policy after the first is restricted to a different
+     * input port, which packets from the packets file never arrive on. */
+    Classifier_type tree, tuples;
+    tuples.set_backend(Classifier_type::TUPLE_SPACE);
+    unsigned int n_added = 0;
+    for (uint32_t copy = 0; n_added < n_rules || !copy; copy++) {
+        for (Rule_list::iterator i = policy.begin(); i != policy.end(); ++i) {
+            Packet_expr expr = i->second.expr;
+            if (copy) {
+                uint32_t port[Packet_expr::MAX_FIELD_LEN] = { 1000 + copy, 0 };
+                expr.set_field(Packet_expr::AP_SRC, port);
+            }
+            tree.add_rule(i->second.priority, expr, NULL);
+            tuples.add_rule(i->second.priority, expr, NULL);
+            n_added++;
+        }
+    }
+    tree.build();
+
+    std::vector<Packet_expr> packets;
+    for (Rule_list::iterator i = packet_rules.begin(); i != packet_rules.end();
+         ++i) {
+        /* Real packets always arrive on some port, so give one to any that
+         * lack it: otherwise every lookup would visit every copy. */
+        Packet_expr packet = i->second.expr;
+        if (packet.is_wildcard(Packet_expr::AP_SRC)) {
+            uint32_t port[Packet_expr::MAX_FIELD_LEN] = { 10, 0 };
+            packet.set_field(Packet_expr::AP_SRC, port);
+        }
+        packets.push_back(packet);
+    }
+
+    return run(tree, tuples, packets, n_added);
+}
+
+/* Sets 'field' in 'expr', if it is in 'mask', and in 'flow' to 'value'. */
+static void
+set_random_field(Packet_expr& expr, Flow& flow, uint32_t mask,
+                 Packet_expr::Expr_field field, uint32_t value)
+{
+    uint32_t v[Packet_expr::MAX_FIELD_LEN] = { value, 0 };
+    ethernetaddr ea((uint64_t) value);
+    switch (field) {
+    case Packet_expr::AP_SRC:   flow.in_port = value; break;
+    case Packet_expr::DL_TYPE:  flow.dl_type = value; break;
+    case Packet_expr::DL_SRC:
+        flow.dl_src = ea;
+        memcpy(v, ea.octet, sizeof ea.octet);
+        break;
+    case Packet_expr::DL_DST:
+        flow.dl_dst = ea;
+        memcpy(v, ea.octet, sizeof ea.octet);
+        break;
+    case Packet_expr::NW_SRC:   flow.nw_src = value; break;
+    case Packet_expr::NW_DST:   flow.nw_dst = value; break;
+    case Packet_expr::NW_PROTO: flow.nw_proto = value; break;
+    case Packet_expr::TP_SRC:   flow.tp_src = value; break;
+    case Packet_expr::TP_DST:   flow.tp_dst = value; break;
+    default:                    abort();
+    }
+    if (mask & (1u << field)) {
+        expr.set_field(field, v);
+    }
+}
+
+/* Makes 'spec' a random rule that matches on one to three fields, and
+ * 'flow' a flow that it matches. */
+static void
+random_rule(Classifier_type::Rule_spec& spec, Flow& flow)
+{
+    static const Packet_expr::Expr_field fields[] = {
+        Packet_expr::AP_SRC, Packet_expr::DL_TYPE, Packet_expr::DL_SRC,
+        Packet_expr::DL_DST, Packet_expr::NW_SRC, Packet_expr::NW_DST,
+        Packet_expr::NW_PROTO, Packet_expr::TP_SRC, Packet_expr::TP_DST
+    };
+    static const uint32_t n_values[] = { 48, 4, 1024, 1024, 4096, 4096,
+                                         3, 64, 64 };
+    static const int n_fields = sizeof fields / sizeof *fields;
+
+    uint32_t mask = 0;
+    for (int n = 1 + rand() % 3; n > 0; n--) {
+        mask |= 1u << fields[rand() % n_fields];
+    }
+
+    spec.expr = Packet_expr();
+    flow = Flow();
+    for (int j = 0; j < n_fields; j++) {
+        set_random_field(spec.expr, flow, mask, fields[j],
+                         1 + rand() % n_values[j]);
+    }
+    spec.priority = rand() % 1000;
+}
+
+static int
+run_random(unsigned int n_rules)
+{
+    Classifier_type tree, tuples;
+    tuples.set_backend(Classifier_type::TUPLE_SPACE);
+    std::vector<Flow> packets;
+    srand(1);
+    for (unsigned int i = 0; i < n_rules; i++) {
+        Classifier_type::Rule_spec spec(0, Packet_expr(), NULL);
+        Flow flow;
+        random_rule(spec, flow);
+        tree.add_rule(spec.priority, spec.expr, NULL);
+        tuples.add_rule(spec.priority, spec.expr, NULL);
+        packets.push_back(flow);
+    }
+    tree.build();
+
+    return run(tree, tuples, packets, n_rules);
+}
+
+/* Replaces 'batch' random rules of 'tree', whose IDs are in 'ids', with new
+ * random rules, 'n_batches' times, building 'tree' after each batch.
+ * Returns the updates per second. */
+static double
+time_churn(Classifier_type& tree, std::vector<uint32_t>& ids, int batch,
+           int n_batches)
+{
+    std::vector<Classifier_type::Rule_spec> specs;
+    std::vector<uint32_t> old_ids, new_ids;
+    Flow flow;
+
+    timeval start = do_gettimeofday(true);
+    for (int i = 0; i < n_batches; i++) {
+        specs.assign(batch, Classifier_type::Rule_spec(0, Packet_expr(),
+                                                       NULL));
+        old_ids.clear();
+        new_ids.clear();
+        for (int j = 0; j < batch; j++) {
+            random_rule(specs[j], flow);
+            size_t victim = rand() % ids.size();
+            old_ids.push_back(ids[victim]);
+            ids[victim] = ids.back();
+            ids.pop_back();
+        }
+        tree.delete_rules(old_ids);
+        tree.add_rules(specs, new_ids);
+        ids.insert(ids.end(), new_ids.begin(), new_ids.end());
+        tree.build();
+    }
+    timeval elapsed = do_gettimeofday(true) - start;
+    return batch * n_batches
+        / (elapsed.tv_sec + elapsed.tv_usec / 1000000.0);
+}
+
+static int
+run_churn(unsigned int n_rules)
+{
+    Classifier_type tree;
+    std::vector<Classifier_type::Rule_spec> specs(
+        n_rules, Classifier_type::Rule_spec(0, Packet_expr(), NULL));
+    std::vector<uint32_t> ids;
+    Flow flow;
+    srand(1);
+    for (unsigned int i = 0; i < n_rules; i++) {
+        random_rule(specs[i], flow);
+    }
+
+    timeval start = do_gettimeofday(true);
+    tree.add_rules(specs, ids);
+    tree.build();
+    timeval elapsed = do_gettimeofday(true) - start;
+    printf("%u rules, built in %.0f msec\n", n_rules,
+           elapsed.tv_sec * 1000.0 + elapsed.tv_usec / 1000.0);
+
+    printf("%-10s %12s\n", "batch", "updates/s");
+    static const int batches[] = { 1, 10, 100, 1000 };
+    for (int i = 0; i < sizeof batches / sizeof *batches; i++) {
+        int n_batches = 2000 / batches[i] + 1;
+        printf("%-10d %12.0f\n", batches[i],
+               time_churn(tree, ids, batches[i], n_batches));
+        fflush(stdout);
+    }
+    return 0;
+}
+
+/* A Grouped_flow whose groups the classifier can only get one at a time,
+ * as it would without get_field_set(). */
+struct Ungrouped_flow : public Grouped_flow {
+    Ungrouped_flow(const Grouped_flow& flow) : Grouped_flow(flow) { }
+};
+
+namespace vigil {
+
+template<>
+bool
+get_field<Packet_expr, Ungrouped_flow>(uint32_t field,
+                                       const Ungrouped_flow& flow,
+                                       uint32_t idx, uint32_t& value)
+{
+    return get_field<Packet_expr, Grouped_flow>(field, flow, idx, value);
+}
+
+template<>
+bool
+matches(uint32_t rule_id, const Packet_expr& expr, const Ungrouped_flow& flow)
+{
+    return matches<Packet_expr, Grouped_flow>(rule_id, expr, flow);
+}
+
+}
+
+static int
+run_groups(unsigned int n_groups)
+{
+    Classifier_type tree;
+    srand(1);
+    for (unsigned int i = 0; i < n_groups; i++) {
+        Packet_expr expr;
+        uint32_t v[Packet_expr::MAX_FIELD_LEN] = { 1 + i, 0 };
+        expr.set_field(Packet_expr::GROUP_SRC, v);
+        if (rand() % 2) {
+            v[0] = rand() % 64;
+            expr.set_field(Packet_expr::TP_DST, v);
+        }
+        tree.add_rule(rand() % 1000, expr, NULL);
+    }
+    tree.build();
+    Compiled_classifier<Packet_expr, void*> compiled;
+    compiled.compile(tree);
+
+    std::vector<Flow> flows(1000);
+    for (size_t i = 0; i < flows.size(); i++) {
+        flows[i].tp_dst = rand() % 64;
+    }
+
+    printf("%u groups\n%-10s %12s %12s %12s %12s  (ns/lookup)\n", n_groups,
+           "groups", "tree", "tree set", "compiled", "compiled set");
+    static const unsigned int sizes[] = { 1, 10, 100, 300, 1000 };
+    for (int i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+        if (sizes[i] > n_groups) {
+            break;
+        }
+        std::vector<Grouped_flow> packets;
+        std::vector<Ungrouped_flow> ungrouped;
+        for (size_t j = 0; j < flows.size(); j++) {
+            Grouped_flow packet(&flows[j]);
+            std::vector<bool> in_group(n_groups + 1);
+            while (packet.src_groups.size() < sizes[i]) {
+                uint32_t group = 1 + rand() % n_groups;
+                if (!in_group[group]) {
+                    in_group[group] = true;
+                    packet.src_groups.push_back(group);
+                }
+            }
+            std::sort(packet.src_groups.begin(), packet.src_groups.end());
+            packets.push_back(packet);
+            ungrouped.push_back(Ungrouped_flow(packet));
+        }
+
+        unsigned long matches[4] = { 0, 0, 0, 0 };
+        double usecs[4];
+        for (int round = 0; round < N_ROUNDS; round++) {
+            keep_best(time_lookups<Cnode_result<Packet_expr, void*,
+                                                Ungrouped_flow> >(
+                          tree, ungrouped, &matches[0]),
+                      round, &usecs[0]);
+            keep_best(time_lookups<Cnode_result<Packet_expr, void*,
+                                                Grouped_flow> >(
+                          tree, packets, &matches[1]),
+                      round, &usecs[1]);
+            keep_best(time_lookups<Compiled_result<Packet_expr, void*,
+                                                   Ungrouped_flow> >(
+                          compiled, ungrouped, &matches[2]),
+                      round, &usecs[2]);
+            keep_best(time_lookups<Compiled_result<Packet_expr, void*,
+                                                   Grouped_flow> >(
+                          compiled, packets, &matches[3]),
+                      round, &usecs[3]);
+        }
+        for (int j = 1; j < 4; j++) {
+            if (matches[j] != matches[0]) {
+                fprintf(stderr, "lookups of %u groups found %lu and %lu "
+                        "matches\n", sizes[i], matches[0], matches[j]);
+                return EXIT_FAILURE;
+            }
+        }
+        printf("%-10u %12.1f %12.1f %12.1f %12.1f\n", sizes[i],
+               usecs[0] * 1000.0 / N_LOOKUPS, usecs[1] * 1000.0 / N_LOOKUPS,
+               usecs[2] * 1000.0 / N_LOOKUPS, usecs[3] * 1000.0 / N_LOOKUPS);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc == 3 && !strcmp(argv[1], "--random")) {
+        return run_random(atoi(argv[2]));
+    } else if (argc == 3 && !strcmp(argv[1], "--churn")) {
+        return run_churn(atoi(argv[2]));
+    } else if (argc == 3 && !strcmp(argv[1], "--groups")) {
+        return run_groups(atoi(argv[2]));
+    } else if (argc == 3 || argc == 4) {
+        return run_files(argv[1], argv[2], argc > 3 ? atoi(argv[3]) : 1);
+    }
+
+    fprintf(stderr, "usage: %s POLICY PACKETS [N_RULES]\n"
+            "       %s --random N_RULES\n"
+            "       %s --churn N_RULES\n"
+            "       %s --groups N_GROUPS\n", argv[0], argv[0], argv[0], argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,150 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Measures the cost of a file descriptor wakeup in the cooperative threads
+ * library as a function of the number of idle descriptors being waited on.
+ *
+ * usage: bench-co-fd-wait [poll|epoll] */
+
+#include "threads/cooperative.hh"
+#include "timeval.hh"
+#include <boost/bind.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace vigil;
+
+static const int N_ROUND_TRIPS = 20000;
+
+static int ping[2], pong[2];
+
+/* An idle descriptor's FSM: waits forever for input that never arrives. */
+static void
+idle_fsm(int fd)
+{
+    co_fd_read_wait(fd, NULL);
+    co_fsm_block();
+}
+
+/* Echoes every byte received on 'ping' back on 'pong'. */
+static void
+echo_thread()
+{
+    for (int i = 0; i < N_ROUND_TRIPS; i++) {
+        char c;
+        co_fd_read_wait(ping[0], NULL);
+        co_block();
+        if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1) {
+            perror("echo");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Adds idle descriptors until there are 'n' of them.  Returns false if the
+ * process runs out of descriptors. */
+static bool
+add_idle_fds(int n)
+{
+    static int n_idle;
+    while (n_idle < n) {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            return false;
+        }
+        co_fsm_create(&co_group_coop, boost::bind(idle_fsm, fds[0]));
+        n_idle++;
+    }
+    co_yield();
+    return true;
+}
+
+static double
+time_round_trips()
+{
+    co_thread* echo = co_thread_create(&co_group_coop, echo_thread);
+    Co_completion join;
+    co_join_completion(echo, &join);
+
+    timeval start = do_gettimeofday(true);
+    for (int i = 0; i < N_ROUND_TRIPS; i++) {
+        char c = 0;
+        if (write(ping[1], &c, 1) != 1) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        co_fd_read_wait(pong[0], NULL);
+        co_block();
+        if (read(pong[0], &c, 1) != 1) {
+            perror("read");
+            exit(EXIT_FAILURE);
+        }
+    }
+    timeval elapsed = do_gettimeofday(true) - start;
+    join.block();
+
+    /* Two wakeups per round trip. */
+    double usecs = elapsed.tv_sec * 1000000.0 + elapsed.tv_usec;
+    return usecs / (N_ROUND_TRIPS * 2);
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    const char* backend = argc > 1 ? argv[1] : "poll";
+    if (!strcmp(backend, "epoll")) {
+        if (!co_set_fd_backend(CO_FD_BACKEND_EPOLL)) {
+            fprintf(stderr, "epoll not supported\n");
+            return 77;
+        }
+    } else if (strcmp(backend, "poll")) {
+        fprintf(stderr, "usage: %s [poll|epoll]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Each idle descriptor costs two file descriptors. */
+    struct rlimit rl;
+    if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+
+    printf("%8s %12s  (%s)\n", "idle fds", "usec/wakeup", backend);
+    static const int sizes[] = { 0, 10, 100, 1000, 10000 };
+    for (int i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+        if (!add_idle_fds(sizes[i])) {
+            printf("%8d %12s\n", sizes[i], "(no fds)");
+            break;
+        }
+        printf("%8d %12.2f\n", sizes[i], time_round_trips());
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Measures the cost of Event_dispatcher::dispatch() as a function of the
+ * number of handlers registered for the event's type.
+ *
+ * usage: bench-event-dispatch [N_EVENTS] */
+
+#include "event-dispatcher.hh"
+#include "threads/cooperative.hh"
+#include "timeval.hh"
+#include <boost/bind.hpp>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace vigil;
+
+class Bench_event
+    : public Event
+{
+public:
+    Bench_event() : Event("Bench_event") { }
+};
+
+class Other_event
+    : public Event
+{
+public:
+    Other_event(int i) : Event("Other_event_" + std::string(1, 'a' + i)) { }
+};
+
+static unsigned long n_calls;
+
+static Disposition
+count_call(const Event&)
+{
+    n_calls++;
+    return CONTINUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    int n_events = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (n_events <= 0) {
+        fprintf(stderr, "usage: %s [N_EVENTS]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Register handlers for other types too, so that the table is not
+     * trivially small. */
+    Event_dispatcher dispatcher;
+    for (int i = 0; i < 16; i++) {
+        Other_event other(i);
+        dispatcher.add_handler(other.get_name(), count_call, 0);
+    }
+
+    printf("%8s %12s %12s\n", "handlers", "ns/dispatch", "ns/handler");
+    Bench_event event;
+    int n_handlers = 0;
+    static const int sizes[] = { 0, 1, 2, 4, 8, 16, 32, 64 };
+    for (int i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+        for (; n_handlers < sizes[i]; n_handlers++) {
+            dispatcher.add_handler(event.get_name(), count_call,
+                                   n_handlers % 3);
+        }
+
+        n_calls = 0;
+        timeval start = do_gettimeofday(true);
+        for (int j = 0; j < n_events; j++) {
+            dispatcher.dispatch(event);
+        }
+        timeval elapsed = do_gettimeofday(true) - start;
+        if (n_calls != (unsigned long) n_events * n_handlers) {
+            fprintf(stderr, "expected %lu handler calls, got %lu\n",
+                    (unsigned long) n_events * n_handlers, n_calls);
+            return EXIT_FAILURE;
+        }
+
+        double nsecs = (elapsed.tv_sec * 1000000.0 + elapsed.tv_usec) * 1000.0;
+        double per_dispatch = nsecs / n_events;
+        printf("%8d %12.1f", n_handlers, per_dispatch);
+        if (n_handlers) {
+            printf(" %12.1f", per_dispatch / n_handlers);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    return 0;
+}
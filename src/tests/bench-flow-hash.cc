@@ -0,0 +1,109 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Compares hash_map<Flow> insertion and lookup with Flows hashed by their
+ * MD5 hash_code() and with the default hash<Flow>, which hashes a Flow_key,
+ * and with Flow_keys themselves as the keys.
+ *
+ * usage: bench-flow-hash [N_FLOWS] */
+
+#include "flow.hh"
+#include "hash_map.hh"
+#include "timeval.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace vigil;
+
+/* hash<Flow> before Flow_key. */
+struct Md5_hash {
+    std::size_t operator()(const Flow& flow) const {
+        return flow.hash_code();
+    }
+};
+
+static double
+usecs_since(const timeval& start)
+{
+    timeval elapsed = do_gettimeofday(true) - start;
+    return elapsed.tv_sec * 1000000.0 + elapsed.tv_usec;
+}
+
+/* Inserts each of 'keys' into a fresh 'Map', then looks each of them up, and
+ * prints the nanoseconds per operation. */
+template<class Map, class Key>
+static void
+time_map(const char* name, const std::vector<Key>& keys)
+{
+    Map map;
+    timeval start = do_gettimeofday(true);
+    for (size_t i = 0; i < keys.size(); i++) {
+        map[keys[i]] = i;
+    }
+    double insert = usecs_since(start);
+
+    unsigned long found = 0;
+    start = do_gettimeofday(true);
+    for (size_t i = 0; i < keys.size(); i++) {
+        found += map.find(keys[i]) != map.end();
+    }
+    double find = usecs_since(start);
+    if (found != keys.size()) {
+        fprintf(stderr, "%s: found %lu of %zu flows\n",
+                name, found, keys.size());
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-10s %10.1f %10.1f\n", name, insert * 1000 / keys.size(),
+           find * 1000 / keys.size());
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t n_flows = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+
+    /* Flows that differ, like real traffic, mostly in their addresses and
+     * transport ports. */
+    std::vector<Flow> flows;
+    std::vector<Flow_key> keys;
+    srand(1);
+    for (size_t i = 0; i < n_flows; i++) {
+        Flow flow;
+        flow.in_port = htons(rand() % 48);
+        flow.dl_vlan = htons(OFP_VLAN_NONE);
+        flow.dl_src = ethernetaddr((uint64_t) rand() << 16 | rand() % 64);
+        flow.dl_dst = ethernetaddr((uint64_t) rand() << 16 | rand() % 64);
+        flow.dl_type = htons(0x0800);
+        flow.nw_src = rand();
+        flow.nw_dst = rand();
+        flow.nw_proto = 6;
+        flow.tp_src = rand();
+        flow.tp_dst = htons(80);
+        flows.push_back(flow);
+        keys.push_back(Flow_key(flow));
+    }
+
+    printf("%zu flows\n%-10s %10s %10s  (ns/flow)\n",
+           n_flows, "hash", "insert", "find");
+    time_map<hash_map<Flow, size_t, Md5_hash> >("md5", flows);
+    time_map<hash_map<Flow, size_t> >("Flow", flows);
+    time_map<hash_map<Flow_key, size_t> >("Flow_key", keys);
+
+    return 0;
+}
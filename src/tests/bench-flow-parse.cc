@@ -0,0 +1,137 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Compares the cost of building a Flow from each frame of a pcap file with
+ * the general parser alone and with the fast path in front of it, as
+ * Flow(in_port, Buffer) does.  The frames are loaded into memory first, so
+ * only parsing is timed.
+ *
+ * usage: bench-flow-parse FILE.pcap */
+
+#include "buffer.hh"
+#include "flow.hh"
+#include "timeval.hh"
+#include "vlog.hh"
+#include <pcap.h>
+#include <netinet/in.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace vigil;
+
+static const int N_PARSES = 3000000;
+static const int N_ROUNDS = 5;
+
+/* Returns the nanoseconds per frame that N_PARSES parses of 'frames' take,
+ * with the general parser alone if 'general' is true. */
+static double
+time_parses(const std::vector<Nonowning_buffer>& frames, bool general,
+            unsigned long *checksum)
+{
+    timeval start = do_gettimeofday(true);
+    for (int i = 0; i < N_PARSES; i++) {
+        const Buffer& frame = frames[i % frames.size()];
+        if (general) {
+            Flow flow;
+            flow.in_port = htons(1);
+            flow.parse(frame);
+            *checksum += flow.nw_src + flow.tp_dst;
+        } else {
+            Flow flow(htons(1), frame);
+            *checksum += flow.nw_src + flow.tp_dst;
+        }
+    }
+    timeval elapsed = do_gettimeofday(true) - start;
+    return (elapsed.tv_sec * 1e9 + elapsed.tv_usec * 1e3) / N_PARSES;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s FILE.pcap\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char pcerr[PCAP_ERRBUF_SIZE];
+    pcap_t* pc = pcap_open_offline(argv[1], pcerr);
+    if (!pc) {
+        fprintf(stderr, "%s: %s\n", argv[1], pcerr);
+        return EXIT_FAILURE;
+    }
+    if (pcap_datalink(pc) != DLT_EN10MB) {
+        fprintf(stderr, "%s: not an Ethernet capture\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    /* Keep all the frames in one block, so that they stay put. */
+    std::vector<uint8_t> data;
+    std::vector<std::pair<size_t, size_t> > extents;
+    struct pcap_pkthdr* hdr;
+    const u_char* pkt;
+    while (pcap_next_ex(pc, &hdr, &pkt) == 1) {
+        extents.push_back(std::make_pair(data.size(), hdr->caplen));
+        data.insert(data.end(), pkt, pkt + hdr->caplen);
+    }
+    pcap_close(pc);
+    if (extents.empty()) {
+        fprintf(stderr, "%s: no frames\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Nonowning_buffer> frames;
+    int n_fast = 0, n_differ = 0;
+    for (size_t i = 0; i < extents.size(); i++) {
+        frames.push_back(Nonowning_buffer(&data[extents[i].first],
+                                          extents[i].second));
+        Flow general, fast;
+        general.parse(frames.back());
+        if (fast.parse_fast(frames.back())) {
+            n_fast++;
+            n_differ += fast != general;
+        }
+    }
+    printf("%zu frames, %d (%.1f%%) taken by the fast path\n",
+           frames.size(), n_fast, 100.0 * n_fast / frames.size());
+    if (n_differ) {
+        printf("%d frames parsed differently!\n", n_differ);
+        return EXIT_FAILURE;
+    }
+
+    /* The general parser complains about every malformed frame. */
+    vlog().set_levels(Vlog::ANY_FACILITY, vlog().get_module_val("flow"),
+                      Vlog::LEVEL_EMER);
+
+    double general = 0, fast = 0;
+    unsigned long checksum = 0;
+    for (int round = 0; round < N_ROUNDS; round++) {
+        double t = time_parses(frames, true, &checksum);
+        if (!round || t < general) {
+            general = t;
+        }
+        t = time_parses(frames, false, &checksum);
+        if (!round || t < fast) {
+            fast = t;
+        }
+    }
+    printf("%12s %12s  (ns/frame, best of %d)\n", "general", "fast path",
+           N_ROUNDS);
+    printf("%12.1f %12.1f  (checksum %lu)\n", general, fast, checksum);
+
+    return 0;
+}
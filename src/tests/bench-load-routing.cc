@@ -0,0 +1,284 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Simulates routing flows over a k-ary fat-tree by hashing them over
+ * equal-cost paths, with and without load-aware link weights, and measures
+ * how busy the busiest links get, what share of the traffic crosses
+ * overloaded links, and what the weights cost to keep up to date.
+ *
+ * The fabric has k pods of k/2 edge and k/2 aggregation switches, with each
+ * edge switch linked to each aggregation switch in its pod, and (k/2)^2 core
+ * switches, each linked to one aggregation switch in every pod.  Every link
+ * has a capacity of 1 in each direction.
+ *
+ * Time passes in epochs, one per sample of link loads.  In each epoch, flows
+ * start between random edge switches, each with a random demand of 0.05 to
+ * 0.5 and a lifetime of 1 to 19 epochs, enough of them to load the edge
+ * switches' uplinks to the given fraction of their capacity on average.  A
+ * new flow is routed by Route_table::get_route() with a hash of its number,
+ * as Routing_module routes a Flow, and keeps its route until it ends.  At
+ * the end of each epoch, the load-aware run feeds every link's utilization
+ * to a Link_weigher and applies the weights that change, as load_routing
+ * does.
+ *
+ * With no arguments, runs k = 8, 16 and 24 at a load of 0.3.
+ *
+ * usage: bench-load-routing [K [LOAD]] */
+
+#include "link-weigher.hh"
+#include "route-table.hh"
+#include "timeval.hh"
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <list>
+#include <vector>
+
+using namespace vigil;
+
+static const int N_EPOCHS = 300;
+static const int WARMUP_EPOCHS = 30;
+static const int MAX_LIFETIME = 19;
+
+static double
+usecs_since(const timeval& start)
+{
+    timeval end = do_gettimeofday(true);
+    timeval elapsed = end > start ? end - start : make_timeval(0, 0);
+    return elapsed.tv_sec * 1000000.0 + elapsed.tv_usec;
+}
+
+static datapathid
+dp(int i)
+{
+    return datapathid::from_host(i + 1);
+}
+
+static int
+index(const datapathid& dpid)
+{
+    return dpid.as_host() - 1;
+}
+
+struct Sim_link {
+    int src, dst;
+    uint16_t outport, inport;
+    double load;
+    Link_weigher::Load weighed;
+};
+
+struct Sim_flow {
+    double demand;
+    int ends;
+    std::vector<int> links;
+};
+
+struct Fabric {
+    Route_table table;
+    int n_ports;                /* Ports per switch, plus one. */
+    std::vector<Sim_link> links;
+    std::vector<int> link_at;   /* Link leaving each switch and port. */
+    std::vector<int> edges;     /* Edge switches. */
+
+    explicit Fabric(int k);
+    void connect(int a, uint16_t port_a, int b, uint16_t port_b);
+};
+
+/* Adds links in both directions between port 'port_a' of switch 'a' and
+ * port 'port_b' of switch 'b'. */
+void
+Fabric::connect(int a, uint16_t port_a, int b, uint16_t port_b)
+{
+    for (int i = 0; i < 2; i++) {
+        Sim_link link;
+        link.src = i ? b : a;
+        link.dst = i ? a : b;
+        link.outport = i ? port_b : port_a;
+        link.inport = i ? port_a : port_b;
+        link.load = 0;
+        table.add_link(dp(link.src), link.outport, dp(link.dst), link.inport);
+        link_at[link.src * n_ports + link.outport] = links.size();
+        links.push_back(link);
+    }
+}
+
+Fabric::Fabric(int k)
+    : n_ports(k + 1)
+{
+    int half = k / 2;
+    int n_core = half * half;
+    int n_switches = n_core + k * k;
+    link_at.assign(n_switches * n_ports, -1);
+    for (int pod = 0; pod < k; pod++) {
+        int first_agg = n_core + pod * k;
+        int first_edge = first_agg + half;
+        for (int i = 0; i < half; i++) {
+            edges.push_back(first_edge + i);
+            for (int j = 0; j < half; j++) {
+                connect(first_edge + i, j + 1, first_agg + j, i + 1);
+                connect(first_agg + i, half + j + 1, i * half + j, pod + 1);
+            }
+        }
+    }
+    table.update();
+}
+
+/* Routes flows over a fabric of 'k'-port switches whose edge switches send
+ * 'load' of their uplinks' capacity, reweighing links by load if
+ * 'weighed'. */
+static void
+run(int k, double load, bool weighed)
+{
+    Fabric fabric(k);
+    Link_weigher weigher;
+    std::vector<Route_table::Hop> path;
+    std::vector<uint32_t> sources, queue;
+    std::list<Sim_flow> flows;
+    srand(1);
+
+    double mean_demand = (0.05 + 0.5) / 2;
+    double mean_lifetime = (1 + MAX_LIFETIME) / 2.0;
+    double arrivals = (fabric.edges.size() * load * (k / 2)
+                       / mean_demand / mean_lifetime);
+    double owed = 0;
+    uint64_t flow_number = 0;
+
+    double total_max = 0, total_over = 0, total_demand = 0;
+    double total_hops = 0, n_routed = 0;
+    double reweighs = 0, searched = 0, update_usecs = 0;
+    for (int epoch = 0; epoch < N_EPOCHS; epoch++) {
+        bool counting = epoch >= WARMUP_EPOCHS;
+
+        /* Flows end. */
+        for (std::list<Sim_flow>::iterator flow = flows.begin();
+             flow != flows.end(); ) {
+            if (flow->ends > epoch) {
+                ++flow;
+                continue;
+            }
+            for (size_t i = 0; i < flow->links.size(); i++) {
+                fabric.links[flow->links[i]].load -= flow->demand;
+            }
+            flow = flows.erase(flow);
+        }
+
+        /* Flows start. */
+        for (owed += arrivals; owed >= 1; owed--) {
+            int src = fabric.edges[rand() % fabric.edges.size()];
+            int dst = fabric.edges[rand() % fabric.edges.size()];
+            if (src == dst) {
+                continue;
+            }
+            Sim_flow flow;
+            flow.demand = 0.05 + 0.45 * (rand() / (RAND_MAX + 1.0));
+            flow.ends = epoch + 1 + rand() % MAX_LIFETIME;
+            uint64_t hash = ++flow_number * 0x9e3779b97f4a7c15ULL;
+            if (!fabric.table.get_route(dp(src), dp(dst), hash, path)) {
+                fprintf(stderr, "no route\n");
+                exit(EXIT_FAILURE);
+            }
+            int u = src;
+            for (size_t i = 0; i < path.size(); i++) {
+                int link = fabric.link_at[u * fabric.n_ports
+                                          + path[i].outport];
+                fabric.links[link].load += flow.demand;
+                flow.links.push_back(link);
+                u = index(path[i].dst);
+            }
+            flows.push_back(flow);
+            if (counting) {
+                total_hops += path.size();
+                n_routed++;
+            }
+        }
+
+        /* Loads are sampled. */
+        double max_load = 0;
+        for (size_t i = 0; i < fabric.links.size(); i++) {
+            max_load = std::max(max_load, fabric.links[i].load);
+        }
+        for (std::list<Sim_flow>::iterator flow = flows.begin();
+             flow != flows.end(); ++flow) {
+            bool over = false;
+            for (size_t i = 0; i < flow->links.size(); i++) {
+                over |= fabric.links[flow->links[i]].load > 1.0;
+            }
+            if (counting) {
+                total_over += over ? flow->demand : 0;
+                total_demand += flow->demand;
+            }
+        }
+        if (counting) {
+            total_max += max_load;
+        }
+        if (!weighed) {
+            continue;
+        }
+
+        int n_reweighed = 0;
+        for (size_t i = 0; i < fabric.links.size(); i++) {
+            Sim_link& link = fabric.links[i];
+            if (weigher.sample(link.weighed, link.load)) {
+                fabric.table.set_weight(dp(link.src), link.outport,
+                                        dp(link.dst), link.inport,
+                                        weigher.weight(link.weighed));
+                n_reweighed++;
+            }
+        }
+        /* Steps of Route_table::update(), to count the sources it
+         * searches. */
+        timeval start = do_gettimeofday(true);
+        fabric.table.prepare_update(sources);
+        for (size_t i = 0; i < sources.size(); i++) {
+            fabric.table.search(sources[i], queue);
+        }
+        fabric.table.finish_update();
+        if (counting) {
+            update_usecs += usecs_since(start);
+            reweighs += n_reweighed;
+            searched += sources.size();
+        }
+    }
+
+    int n_epochs = N_EPOCHS - WARMUP_EPOCHS;
+    printf("%4d %8zu %6zu %5.2f %-10s %8.2f %9.1f %6.2f %8.1f %8.1f %10.0f\n",
+           k, fabric.table.n_switches(), fabric.links.size(), load,
+           weighed ? "load-aware" : "ecmp", total_max / n_epochs,
+           total_over / total_demand * 100, total_hops / n_routed,
+           reweighs / n_epochs, searched / n_epochs,
+           update_usecs / n_epochs);
+}
+
+int
+main(int argc, char *argv[])
+{
+    printf("%4s %8s %6s %5s %-10s %8s %9s %6s %8s %8s %10s\n", "k",
+           "switches", "links", "load", "routing", "max util", "over (%)",
+           "hops", "reweighs", "searched", "update (us)");
+    if (argc > 1) {
+        int k = atoi(argv[1]);
+        double load = argc > 2 ? atof(argv[2]) : 0.3;
+        run(k, load, false);
+        run(k, load, true);
+    } else {
+        for (int k = 8; k <= 24; k += 8) {
+            run(k, 0.3, false);
+            run(k, 0.3, true);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Measures Route_table's memory use, the time to compute all of its shortest
+ * paths, the time to apply a single link change, get_route() latency with and
+ * without a hash to choose among equal-cost paths, and get_routes() latency
+ * and the number of equal-cost paths it finds, on a fat-tree-like fabric of
+ * about each of the given numbers of switches.
+ *
+ * The fabric is pods of four aggregation and four edge switches, with each
+ * edge switch linked to each aggregation switch in its pod, over a core of
+ * at least 16 switches, with each aggregation switch linked to a quarter of
+ * the core.  Every link is added in both directions.
+ *
+ * usage: bench-route-table [N_SWITCHES...] */
+
+#include "route-table.hh"
+#include "timeval.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace vigil;
+
+static const int N_LOOKUPS = 1000000;
+static const int POD_SIZE = 4;
+
+static double
+usecs_since(const timeval& start)
+{
+    timeval elapsed = do_gettimeofday(true) - start;
+    return elapsed.tv_sec * 1000000.0 + elapsed.tv_usec;
+}
+
+static datapathid
+dp(int i)
+{
+    return datapathid::from_host(i + 1);
+}
+
+/* Adds links in both directions between port 'port_a' of switch 'a' and
+ * port 'port_b' of switch 'b'. */
+static void
+connect(Route_table& table, int a, uint16_t port_a, int b, uint16_t port_b)
+{
+    table.add_link(dp(a), port_a, dp(b), port_b);
+    table.add_link(dp(b), port_b, dp(a), port_a);
+}
+
+static void
+run(int n_switches)
+{
+    Route_table table;
+    int core_share = std::max(n_switches / 200, 4);
+    int n_core = core_share * POD_SIZE;
+    int n_pods = std::max((n_switches - n_core) / (2 * POD_SIZE), 1);
+    for (int pod = 0; pod < n_pods; pod++) {
+        int first_agg = n_core + pod * 2 * POD_SIZE;
+        int first_edge = first_agg + POD_SIZE;
+        for (int i = 0; i < POD_SIZE; i++) {
+            for (int j = 0; j < POD_SIZE; j++) {
+                connect(table, first_edge + i, j + 1,
+                        first_agg + j, POD_SIZE + i + 1);
+            }
+            for (int j = 0; j < core_share; j++) {
+                connect(table, first_agg + i, j + 1,
+                        i * core_share + j, pod + 1);
+            }
+        }
+    }
+    n_switches = table.n_switches();
+
+    timeval start = do_gettimeofday(true);
+    table.update();
+    double build = usecs_since(start);
+
+    /* An aggregation switch loses a link to the core and gets it back. */
+    start = do_gettimeofday(true);
+    table.remove_link(dp(n_core), 1, dp(0), 1);
+    table.update();
+    table.add_link(dp(n_core), 1, dp(0), 1);
+    table.update();
+    double change = usecs_since(start) / 2;
+
+    std::vector<std::pair<datapathid, datapathid> > pairs;
+    srand(1);
+    for (int i = 0; i < 4096; i++) {
+        pairs.push_back(std::make_pair(dp(rand() % n_switches),
+                                       dp(rand() % n_switches)));
+    }
+    std::vector<Route_table::Hop> path;
+    unsigned long total_hops = 0;
+    start = do_gettimeofday(true);
+    for (int i = 0; i < N_LOOKUPS; i++) {
+        const std::pair<datapathid, datapathid>& pair = pairs[i % 4096];
+        if (!table.get_route(pair.first, pair.second, path)) {
+            fprintf(stderr, "no route\n");
+            exit(EXIT_FAILURE);
+        }
+        total_hops += path.size();
+    }
+    double lookup = usecs_since(start);
+
+    start = do_gettimeofday(true);
+    for (int i = 0; i < N_LOOKUPS; i++) {
+        const std::pair<datapathid, datapathid>& pair = pairs[i % 4096];
+        table.get_route(pair.first, pair.second, i * 0x9e3779b97f4a7c15ULL,
+                        path);
+    }
+    double hashed = usecs_since(start);
+
+    /* Counts each DAG's paths from the source to each switch, which comes
+     * after all the switches that lead to it. */
+    Route_table::Dag dag;
+    std::vector<double> n_paths;
+    double total_paths = 0;
+    start = do_gettimeofday(true);
+    for (int i = 0; i < 4096; i++) {
+        table.get_routes(pairs[i].first, pairs[i].second, dag);
+        n_paths.assign(dag.dps.size(), 0);
+        n_paths[0] = 1;
+        for (size_t j = 0; j < dag.dps.size(); j++) {
+            for (uint32_t k = dag.offsets[j]; k < dag.offsets[j + 1]; k++) {
+                n_paths[dag.links[k].next] += n_paths[j];
+            }
+        }
+        total_paths += n_paths.back();
+    }
+    double dags = usecs_since(start);
+
+    printf("%8d %8zu %12.1f %12.0f %12.0f %10.1f %10.1f %10.1f %6.2f %6.1f\n",
+           n_switches, table.n_links(),
+           table.memory_usage() / 1048576.0, build, change,
+           lookup * 1000 / N_LOOKUPS, hashed * 1000 / N_LOOKUPS,
+           dags / 4096, (double) total_hops / N_LOOKUPS, total_paths / 4096);
+}
+
+int
+main(int argc, char *argv[])
+{
+    printf("%8s %8s %12s %12s %12s %10s %10s %10s %6s %6s\n", "switches",
+           "links", "memory (MB)", "build (us)", "change (us)", "route (ns)",
+           "hashed (ns)", "dag (us)", "hops", "paths");
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            run(atoi(argv[i]));
+        }
+    } else {
+        run(100);
+        run(500);
+        run(2000);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "buffer-pool.hh"
+#include "threads/cooperative.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+using namespace vigil;
+
+int
+main (void)
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    boost::shared_ptr<Buffer_pool> pool(Buffer_pool::create());
+    const Buffer_pool::Stats& stats = pool->get_stats();
+
+    /* The first allocation of each class must miss, and freeing the buffer
+     * must recycle its block. */
+    {
+        std::auto_ptr<Buffer> b(pool->allocate(100));
+        MUST_SUCCEED(b->size() == 100);
+        memset(b->data(), 0xa5, b->size());
+    }
+    MUST_SUCCEED(stats.misses == 1);
+    MUST_SUCCEED(stats.recycled == 1);
+    MUST_SUCCEED(pool->n_free() == 1);
+
+    /* The next allocation of the same class must reuse that block. */
+    uint8_t* first;
+    {
+        std::auto_ptr<Buffer> b(pool->allocate(64));
+        first = b->data();
+        MUST_SUCCEED(stats.hits == 1);
+        MUST_SUCCEED(pool->n_free() == 0);
+    }
+    {
+        std::auto_ptr<Buffer> b(pool->allocate(128));
+        MUST_SUCCEED(b->data() == first);
+        MUST_SUCCEED(stats.hits == 2);
+    }
+
+    /* A different class must not be served from the small block. */
+    {
+        std::auto_ptr<Buffer> b(pool->allocate(1500));
+        MUST_SUCCEED(b->data() != first);
+        MUST_SUCCEED(stats.misses == 2);
+    }
+
+    /* Messages too large for any class still work. */
+    {
+        std::auto_ptr<Buffer> b(pool->allocate(70000));
+        MUST_SUCCEED(b->size() == 70000);
+        MUST_SUCCEED(stats.oversize == 1);
+    }
+
+    /* Extending past the block must preserve content. */
+    {
+        std::auto_ptr<Buffer> b(pool->allocate(4));
+        memcpy(b->data(), "abcd", 4);
+        b->pull(2);
+        memcpy(b->put(300), "", 1);
+        MUST_SUCCEED(b->size() == 302);
+        MUST_SUCCEED(!memcmp(b->data(), "cd", 2));
+        memcpy(b->push(10), "0123456789", 10);
+        MUST_SUCCEED(!memcmp(b->data(), "0123456789cd", 12));
+    }
+
+    /* Buffers keep the pool alive after the last other reference is gone. */
+    std::auto_ptr<Buffer> orphan(pool->allocate(10));
+    pool.reset();
+    orphan.reset();
+
+    return 0;
+}
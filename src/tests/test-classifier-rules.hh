@@ -0,0 +1,140 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TEST_CLASSIFIER_RULES_HH
+#define TEST_CLASSIFIER_RULES_HH
+
+#include <fstream>
+#include <list>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <ctype.h>
+
+#include "expr.hh"
+#include "rule.hh"
+
+/*
+ * Reads rule files for the classifier test and benchmark.
+ *
+ * Each line holds a rule ID, a priority, and a comma-separated list of
+ * FIELD=VALUE pairs, e.g. "3 1 tpsrc=423,dldst=1a:bb:cc:dd:ee:2f".
+ */
+
+typedef std::list<std::pair<uint32_t, vigil::Rule<vigil::Packet_expr, void*> > > Rule_list;
+
+inline uint8_t
+hex_to_int(char ch)
+{
+    if (isdigit(ch))
+        return ch - '0';
+    return 10 + (tolower(ch) - 'a');
+}
+
+inline bool
+set_field(vigil::Packet_expr& expr, std::string type, std::string strvalue)
+{
+    uint32_t value[2];
+
+    value[1] = 0;
+
+    if (type == "dlsrc" || type == "dldst") {
+        uint8_t *byte_ptr = (uint8_t*)value;
+        uint32_t len = strvalue.length();
+        std::string::size_type pos = 0;
+        for (uint32_t i = 0; i < 6; i++) {
+            if ((pos + 2) > len)
+                return false;
+            byte_ptr[i] = hex_to_int(strvalue.at(pos++)) << 4;
+            byte_ptr[i] += hex_to_int(strvalue.at(pos++));
+            pos++;
+        }
+        if (type == "dlsrc")
+            expr.set_field(vigil::Packet_expr::DL_SRC, value);
+        else
+            expr.set_field(vigil::Packet_expr::DL_DST, value);
+    } else {
+        std::stringstream ss(strvalue);
+        ss >> value[0];
+
+        if (type == "apsrc")
+            expr.set_field(vigil::Packet_expr::AP_SRC, value);
+        else if (type == "apdst")
+            expr.set_field(vigil::Packet_expr::AP_DST, value);
+        else if (type == "nwsrc")
+            expr.set_field(vigil::Packet_expr::NW_SRC, value);
+        else if (type == "nwdst")
+            expr.set_field(vigil::Packet_expr::NW_DST, value);
+        else if (type == "tpsrc")
+            expr.set_field(vigil::Packet_expr::TP_SRC, value);
+        else if (type == "tpdst")
+            expr.set_field(vigil::Packet_expr::TP_DST, value);
+        else if (type == "groupsrc")
+            expr.set_field(vigil::Packet_expr::GROUP_SRC, value);
+        else if (type == "groupdst")
+            expr.set_field(vigil::Packet_expr::GROUP_DST, value);
+        else if (type == "dlproto")
+            expr.set_field(vigil::Packet_expr::DL_TYPE, value);
+        else if (type == "nwproto")
+            expr.set_field(vigil::Packet_expr::NW_PROTO, value);
+        else
+            return false;
+    }
+    return true;
+}
+
+inline bool
+read_rules(const char *filename, Rule_list& rules)
+{
+    std::ifstream f(filename);
+    std::string str;
+
+    while (getline(f, str)) {
+        uint32_t len = str.length();
+
+        std::string::size_type prev = 0;
+        std::string::size_type space;
+        uint32_t ints[2];
+        for (int i = 0; i < 2; i++) {
+            space = str.find(' ', prev);
+            std::stringstream ss(str.substr(prev, space - prev));
+            ss >> ints[i];
+            prev = space + 1;
+            if (prev >= len)
+                return false;
+        }
+
+        vigil::Packet_expr expr;
+        std::string::size_type equal;
+        while ((equal = str.find('=', prev)) != std::string::npos) {
+            std::string::size_type comma = str.find(',', equal);
+            if (comma == std::string::npos)
+                comma = len;
+            if (!set_field(expr, str.substr(prev, equal - prev),
+                           str.substr(equal+1, comma - (equal+1))))
+                return false;
+            prev = comma + 1;
+            if (prev >= len)
+                break;
+        }
+        vigil::Rule<vigil::Packet_expr, void *> r(ints[0], ints[1], expr, NULL);
+        rules.push_back(std::pair<uint32_t, vigil::Rule<vigil::Packet_expr, void *> >(ints[0], r));
+    }
+    return true;
+}
+
+#endif
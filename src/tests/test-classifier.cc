@@ -24,8 +24,11 @@
 #include <sys/time.h>
 
 #include "test-classifier.hh"
+#include "test-classifier-rules.hh"
 #include "expr.hh"
+#include "flow.hh"
 
+#include <algorithm>
 #include <map>
 
 #define EXIT_ASSERT(RET) if(!RET) exit(EXIT_FAILURE)
@@ -33,13 +36,10 @@
 using namespace std;
 using namespace vigil;
 
-typedef std::list<pair<uint32_t,Rule<Packet_expr, void*> > > Rule_list;
-
 void add_rmv_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules);
 void check_lookup(Classifier_t<Packet_expr, void *>& test, Rule_list& rules);
-bool read_rules(const char *filename, Rule_list& exprs);
-bool set_field(Packet_expr& expr, std::string type, std::string strvalue);
 void timed_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules);
+void group_test();
 
 
 int
@@ -110,6 +110,25 @@ main(int argc, char *argv[])
     add_rmv_test(test, rules);
 //    test.print();
 
+//    printf("Replacing all rules in one batch and building...\n");
+    vector<uint32_t> ids;
+    vector<Classifier<Packet_expr, void *>::Rule_spec> specs;
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter) {
+        ids.push_back(iter->first);
+        specs.push_back(Classifier<Packet_expr, void *>::Rule_spec(
+                            iter->second.priority, iter->second.expr,
+                            iter->second.action));
+    }
+    EXIT_ASSERT(test.check_delete_rules(ids));
+    check_lookup(test, rules);
+    ids.clear();
+    EXIT_ASSERT(test.check_add_rules(specs, ids));
+    test.build();
+    i = 0;
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter)
+        iter->first = ids[i++];
+    add_rmv_test(test, rules);
+
     if (to_delete.size() > 0) {
 //        printf("Deleting exprs and cleaning...\n");
         for (Rule_list::iterator iter = to_delete.begin(); iter != to_delete.end(); ++iter)
@@ -122,9 +141,75 @@ main(int argc, char *argv[])
 //        test.print();
     }
 
+//    printf("Moving rules to a tuple space and back...\n");
+    test.get_classifier().set_backend(Classifier<Packet_expr, void *>::TUPLE_SPACE);
+    check_lookup(test, rules);
+    check_lookup(test, packets);
+    test.get_classifier().set_backend(Classifier<Packet_expr, void *>::CNODE_TREE);
+    test.build();
+    check_lookup(test, rules);
+    check_lookup(test, packets);
+
+//    printf("Classifying flows on their groups...\n");
+    group_test();
+
     return 0;
 }
 
+/*
+ * Checks classification of flows whose hosts belong to up to hundreds of
+ * groups, against rules on their source and destination groups.
+ */
+
+void
+group_test()
+{
+    Classifier_t<Packet_expr, void *> test;
+    srand(1);
+
+    for (int i = 0; i < 2000; i++) {
+        Packet_expr expr;
+        uint32_t value[Packet_expr::MAX_FIELD_LEN] = { 0, 0 };
+        if (rand() % 2) {
+            value[0] = rand() % 500;
+            expr.set_field(Packet_expr::GROUP_SRC, value);
+        }
+        if (rand() % 4 == 0) {
+            value[0] = rand() % 500;
+            expr.set_field(Packet_expr::GROUP_DST, value);
+        }
+        if (rand() % 4 == 0) {
+            value[0] = rand() % 4;
+            expr.set_field(Packet_expr::TP_DST, value);
+        }
+        EXIT_ASSERT(test.check_add_rule(rand() % 100, expr, NULL) != 0);
+    }
+
+    Flow flows[50];
+    boost::ptr_vector<Grouped_flow> grouped;
+    vector<const Grouped_flow *> batch;
+    for (int i = 0; i < 50; i++) {
+        flows[i].tp_dst = rand() % 4;
+        grouped.push_back(new Grouped_flow(&flows[i]));
+        int n_groups = i % 5 ? rand() % 300 : 0;
+        for (int j = 0; j < n_groups; j++) {
+            grouped[i].src_groups.push_back(rand() % 500);
+            grouped[i].dst_groups.push_back(rand() % 500);
+        }
+        sort(grouped[i].src_groups.begin(), grouped[i].src_groups.end());
+        sort(grouped[i].dst_groups.begin(), grouped[i].dst_groups.end());
+        batch.push_back(&grouped[i]);
+    }
+
+    for (int built = 0; built < 2; built++) {
+        for (int i = 0; i < 50; i++) {
+            EXIT_ASSERT(test.check_lookup(batch[i]));
+        }
+        EXIT_ASSERT(test.check_lookup_batch(&batch[0], batch.size()));
+        test.build();
+    }
+}
+
 void
 timed_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules)
 {
@@ -200,107 +285,11 @@ add_rmv_test(Classifier_t<Packet_expr, void *>& test, Rule_list& rules)
 void
 check_lookup(Classifier_t<Packet_expr, void *>& test, Rule_list& rules)
 {
-    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter)
+    vector<const Packet_expr *> batch;
+    for (Rule_list::iterator iter = rules.begin(); iter != rules.end(); ++iter) {
         EXIT_ASSERT(test.check_lookup(&iter->second.expr));
-}
-
-bool
-read_rules(const char *filename, Rule_list& rules)
-{
-    std::ifstream f(filename);
-    std::string str;
-
-    while (getline(f, str)) {
-        uint32_t len = str.length();
-
-        std::string::size_type prev = 0;
-        std::string::size_type space;
-        uint32_t ints[2];
-        for (int i = 0; i < 2; i++) {
-            space = str.find(' ', prev);
-            std::stringstream ss(str.substr(prev, space - prev));
-            ss >> ints[i];
-            prev = space + 1;
-            if (prev >= len)
-                return false;
-        }
-
-        Packet_expr expr;
-        std::string::size_type equal;
-        while ((equal = str.find('=', prev)) != std::string::npos) {
-            std::string::size_type comma = str.find(',', equal);
-            if (comma == std::string::npos)
-                comma = len;
-            if (!set_field(expr, str.substr(prev, equal - prev),
-                           str.substr(equal+1, comma - (equal+1))))
-                return false;
-            prev = comma + 1;
-            if (prev >= len)
-                break;
-        }
-        Rule<Packet_expr, void *> r(ints[0], ints[1], expr, NULL);
-        rules.push_back(pair<uint32_t,Rule<Packet_expr, void *> >(ints[0], r));
-    }
-    return true;
-}
-
-uint8_t
-hex_to_int(char ch)
-{
-    if (isdigit(ch))
-        return ch - '0';
-    return 10 + (tolower(ch) - 'a');
-}
-
-bool
-set_field(Packet_expr& expr, std::string type, std::string strvalue)
-{
-    uint32_t value[2];
-
-    value[1] = 0;
-
-    if (type == "dlsrc" || type == "dldst") {
-        uint8_t *byte_ptr = (uint8_t*)value;
-        uint32_t len = strvalue.length();
-        std::string::size_type pos = 0;
-        for (uint32_t i = 0; i < 6; i++) {
-            if ((pos + 2) > len)
-                return false;
-            byte_ptr[i] = hex_to_int(strvalue.at(pos++)) << 4;
-            byte_ptr[i] += hex_to_int(strvalue.at(pos++));
-            pos++;
-        }
-        if (type == "dlsrc")
-            expr.set_field(Packet_expr::DL_SRC, value);
-        else
-            expr.set_field(Packet_expr::DL_DST, value);
-    } else {
-        std::stringstream ss(strvalue);
-        ss >> value[0];
-
-        if (type == "apsrc")
-            expr.set_field(Packet_expr::AP_SRC, value);
-        else if (type == "apdst")
-            expr.set_field(Packet_expr::AP_DST, value);
-        else if (type == "nwsrc")
-            expr.set_field(Packet_expr::NW_SRC, value);
-        else if (type == "nwdst")
-            expr.set_field(Packet_expr::NW_DST, value);
-        else if (type == "tpsrc")
-            expr.set_field(Packet_expr::TP_SRC, value);
-        else if (type == "tpdst")
-            expr.set_field(Packet_expr::TP_DST, value);
-        else if (type == "groupsrc")
-            expr.set_field(Packet_expr::GROUP_SRC, value);
-        else if (type == "groupdst")
-            expr.set_field(Packet_expr::GROUP_DST, value);
-        else if (type == "dlproto")
-            expr.set_field(Packet_expr::DL_TYPE, value);
-        else if (type == "nwproto")
-            expr.set_field(Packet_expr::NW_PROTO, value);
-        else
-            return false;
+        batch.push_back(&iter->second.expr);
     }
-    return true;
+    if (!batch.empty())
+        EXIT_ASSERT(test.check_lookup_batch(&batch[0], batch.size()));
 }
-
@@ -18,13 +18,16 @@
 #ifndef CLASSIFIER_TEST_HH
 #define CLASSIFIER_TEST_HH
 
+#include <boost/ptr_container/ptr_vector.hpp>
 #include "classifier.hh"
+#include "compiled-classifier.hh"
 
 /*
  * Classifier test class.
  *
- * Compares Classifier results to a linear
- * list classifier's results.
+ * Compares Classifier results, from the tree, from a compiled snapshot of
+ * it, and from a second classifier holding the same rules in a tuple space,
+ * to a linear list classifier's results.
  */
 
 template<class Expr, typename Action>
@@ -33,14 +36,22 @@ class Classifier_t {
 public:
     typedef std::list<vigil::Rule<Expr, Action> > Rule_list;
 
+    Classifier_t() { tuples.set_backend(vigil::Classifier<Expr, Action>::TUPLE_SPACE); }
+
     uint32_t check_add_rule(uint32_t, const Expr&, Action);
     bool check_delete_rule(uint32_t);
 
     template<class Data>
     bool check_delete_rules(const Data *data);
+    bool check_add_rules(
+        const std::vector<typename vigil::Classifier<Expr, Action>::Rule_spec>&,
+        std::vector<uint32_t>&);
+    bool check_delete_rules(const std::vector<uint32_t>&);
 
     template<class Data>
     bool check_lookup(const Data *);
+    template<class Data>
+    bool check_lookup_batch(const Data * const[], size_t);
 
     void build() { classifier.build(); }
     void unbuild() { classifier.unbuild(); }
@@ -52,12 +63,17 @@ public:
 
 private:
     vigil::Classifier<Expr, Action> classifier;
+    vigil::Compiled_classifier<Expr, Action> compiled;
+    vigil::Classifier<Expr, Action> tuples;
     std::list<vigil::Rule<Expr, Action> > linear;
 
-    template<class Data>
+    template<class Data, class Result>
+    bool check_result(const Data *, Result&) const;
+
+    template<class Data, class Result>
     bool resolve_priority(typename Rule_list::const_iterator&,
                           const Data *, const vigil::Rule<Expr, Action>*,
-                          vigil::Cnode_result<Expr, Action, Data>&) const;
+                          Result&) const;
 };
 
 
@@ -73,7 +89,7 @@ Classifier_t<Expr, Action>::check_add_rule(uint32_t priority, const Expr& expr,
                                            Action action)
 {
     uint32_t id = classifier.add_rule(priority, expr, action);
-    if (id == 0) {
+    if (id == 0 || tuples.add_rule(priority, expr, action) != id) {
         return 0;
     }
 
@@ -109,6 +125,9 @@ bool
 Classifier_t<Expr, Action>::check_delete_rule(uint32_t id)
 {
     bool success = classifier.delete_rule(id);
+    if (tuples.delete_rule(id) != success) {
+        return false;
+    }
 
     for (typename Rule_list::iterator iter = linear.begin();
          iter != linear.end(); ++iter)
@@ -134,6 +153,9 @@ bool
 Classifier_t<Expr, Action>::check_delete_rules(const Data *data)
 {
     uint32_t c_del = classifier.delete_rules(data);
+    if (tuples.delete_rules(data) != c_del) {
+        return false;
+    }
 
     typename Rule_list::iterator iter = linear.begin();
 
@@ -151,6 +173,71 @@ Classifier_t<Expr, Action>::check_delete_rules(const Data *data)
 }
 
 
+/*
+ * Adds a batch of rules to both classifiers, appending their IDs to 'ids'.
+ * Returns true if both assigned the same IDs, else false.
+ */
+
+template<class Expr, typename Action>
+bool
+Classifier_t<Expr, Action>::check_add_rules(
+    const std::vector<typename vigil::Classifier<Expr, Action>::Rule_spec>& specs,
+    std::vector<uint32_t>& ids)
+{
+    std::vector<uint32_t> tuple_ids(ids);
+    size_t n_ids = ids.size();
+    classifier.add_rules(specs, ids);
+    tuples.add_rules(specs, tuple_ids);
+    if (ids != tuple_ids || ids.size() != n_ids + specs.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < specs.size(); i++) {
+        typename Rule_list::iterator iter = linear.begin();
+        while (iter != linear.end() && iter->priority < specs[i].priority) {
+            ++iter;
+        }
+        linear.insert(iter, vigil::Rule<Expr, Action>(ids[n_ids + i],
+                                                      specs[i].priority,
+                                                      specs[i].expr,
+                                                      specs[i].action));
+    }
+    return true;
+}
+
+
+/*
+ * Deletes a batch of rules by ID from both classifiers.  Returns true if
+ * outcomes are equivalent, else false.
+ */
+
+template<class Expr, typename Action>
+bool
+Classifier_t<Expr, Action>::check_delete_rules(const std::vector<uint32_t>& ids)
+{
+    uint32_t c_del = classifier.delete_rules(ids);
+    if (tuples.delete_rules(ids) != c_del) {
+        return false;
+    }
+
+    uint32_t l_del = 0;
+    for (std::vector<uint32_t>::const_iterator id = ids.begin();
+         id != ids.end(); ++id)
+    {
+        for (typename Rule_list::iterator iter = linear.begin();
+             iter != linear.end(); ++iter)
+        {
+            if (iter->id == *id) {
+                linear.erase(iter);
+                l_del++;
+                break;
+            }
+        }
+    }
+    return c_del == l_del;
+}
+
+
 /*
  * Checks that lookup of 'data' in the two classifiers returns equivalent rule
  * sets.  Returns true if the results are identical, else false.
@@ -162,9 +249,85 @@ bool
 Classifier_t<Expr, Action>::check_lookup(const Data *data)
 {
     vigil::Cnode_result<Expr, Action, Data> result(data);
-
     classifier.get_rules(result);
+    if (!check_result(data, result)) {
+        return false;
+    }
+
+    if (classifier.get_backend() == vigil::Classifier<Expr, Action>::CNODE_TREE) {
+        if (!compiled.is_current(classifier)) {
+            compiled.compile(classifier);
+        }
+        vigil::Compiled_result<Expr, Action, Data> compiled_result(data);
+        compiled.get_rules(compiled_result);
+        if (!check_result(data, compiled_result)) {
+            return false;
+        }
+    }
 
+    vigil::Cnode_result<Expr, Action, Data> tuples_result(data);
+    tuples.get_rules(tuples_result);
+    if (!check_result(data, tuples_result)) {
+        return false;
+    }
+
+    vigil::Tuple_result<Expr, Action, Data> tuple_result(data);
+    tuples.get_rules(tuple_result);
+    return check_result(data, tuple_result);
+}
+
+/*
+ * Checks that looking up all of 'data' in one batch, in the tree and in its
+ * compiled snapshot, finds the same rules as the linear classifier.
+ */
+
+template<class Expr, typename Action>
+template<class Data>
+bool
+Classifier_t<Expr, Action>::check_lookup_batch(const Data * const data[],
+                                               size_t n)
+{
+    if (classifier.get_backend() != vigil::Classifier<Expr, Action>::CNODE_TREE) {
+        return true;
+    }
+
+    boost::ptr_vector<vigil::Cnode_result<Expr, Action, Data> > results;
+    std::vector<vigil::Cnode_result<Expr, Action, Data>*> result_ptrs;
+    boost::ptr_vector<vigil::Compiled_result<Expr, Action, Data> > compiled_results;
+    std::vector<vigil::Compiled_result<Expr, Action, Data>*> compiled_ptrs;
+    for (size_t i = 0; i < n; i++) {
+        results.push_back(new vigil::Cnode_result<Expr, Action, Data>(data[i]));
+        result_ptrs.push_back(&results.back());
+        compiled_results.push_back(
+            new vigil::Compiled_result<Expr, Action, Data>(data[i]));
+        compiled_ptrs.push_back(&compiled_results.back());
+    }
+
+    if (!compiled.is_current(classifier)) {
+        compiled.compile(classifier);
+    }
+    classifier.get_rules_batch(&result_ptrs[0], n);
+    compiled.get_rules_batch(&compiled_ptrs[0], n);
+    for (size_t i = 0; i < n; i++) {
+        if (!check_result(data[i], results[i])
+            || !check_result(data[i], compiled_results[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Checks that the rules in 'result' are those that the linear classifier
+ * matches against 'data'.
+ */
+
+template<class Expr, typename Action>
+template<class Data, class Result>
+bool
+Classifier_t<Expr, Action>::check_result(const Data *data,
+                                         Result& result) const
+{
     typename Rule_list::const_iterator iter = linear.begin();
 
     while (true) {
@@ -200,12 +363,12 @@ Classifier_t<Expr, Action>::check_lookup(const Data *data)
  */
 
 template<class Expr, typename Action>
-template<class Data>
+template<class Data, class Result>
 bool
 Classifier_t<Expr, Action>::resolve_priority(typename Rule_list::const_iterator& liter,
                                              const Data *data,
                                              const vigil::Rule<Expr, Action> *match,
-                                             vigil::Cnode_result<Expr, Action, Data>& result) const
+                                             Result& result) const
 {
     std::list<vigil::Rule<Expr, Action> > ms;
 
@@ -0,0 +1,106 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests that native threads can post events to an Event_dispatcher polled by
+ * a cooperative thread, and that none are lost or reordered. */
+
+#include "event-dispatcher.hh"
+#include <boost/bind.hpp>
+#include "assert.hh"
+#include "threads/cooperative.hh"
+#include "threads/native.hh"
+#include <cstdio>
+#include <unistd.h>
+
+using namespace vigil;
+
+static const int N_THREADS = 4;
+static const int N_EVENTS = 20000;
+
+class My_event
+    : public Event
+{
+public:
+    My_event(int thread_, int seq_)
+        : Event("My_event"), thread(thread_), seq(seq_) { }
+
+    static const Event_name static_get_name() {
+        return "My_event";
+    }
+
+    int thread;
+    int seq;
+};
+
+static int next_seq[N_THREADS];
+static int n_received;
+
+static Disposition
+handle_my_event(const Event& e_, Event_dispatcher& event_dispatcher)
+{
+    const My_event& e = assert_cast<const My_event&>(e_);
+    if (e.seq != next_seq[e.thread]++) {
+        printf("thread %d: got event %d, expected %d\n",
+               e.thread, e.seq, next_seq[e.thread] - 1);
+        exit(1);
+    }
+    if (++n_received == N_THREADS * N_EVENTS) {
+        Event_dispatcher::Stats stats = event_dispatcher.get_stats();
+        printf("received %d events\n", n_received);
+        printf("posted=%llu remote=%llu dispatched=%llu depth=%zu\n",
+               (unsigned long long int) stats.n_posted,
+               (unsigned long long int) stats.n_remote,
+               (unsigned long long int) stats.n_dispatched,
+               stats.depth);
+        exit(0);
+    }
+    return CONTINUE;
+}
+
+static void
+poster(Event_dispatcher* event_dispatcher, int thread)
+{
+    for (int i = 0; i < N_EVENTS; ++i) {
+        event_dispatcher->post(new My_event(thread, i));
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    /* This test tends to hang if something goes wrong. */
+    alarm(10);
+
+    Poll_loop loop(1);
+
+    Event_dispatcher event_dispatcher;
+    loop.add_pollable(&event_dispatcher);
+    event_dispatcher.add_handler(My_event::static_get_name(),
+                                 boost::bind(handle_my_event, _1,
+                                             boost::ref(event_dispatcher)), 0);
+
+    for (int i = 0; i < N_THREADS; ++i) {
+        Native_thread thread;
+        thread.start(boost::bind(poster, &event_dispatcher, i));
+    }
+
+    loop.run();
+}
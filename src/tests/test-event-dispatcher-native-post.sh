@@ -0,0 +1,7 @@
+#! /bin/sh -e
+trap 'rm -f tmp$$' 0
+$SUPERVISOR ./test-event-dispatcher-native-post > tmp$$
+diff -u - tmp$$ <<EOF
+received 80000 events
+posted=80000 remote=80000 dispatched=80000 depth=0
+EOF
@@ -0,0 +1,75 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests that the event dispatcher drains its event classes in priority order,
+ * no more than each class's weight per poll, and drops events beyond a
+ * class's queue limit. */
+
+#include "event-dispatcher.hh"
+#include "assert.hh"
+#include "threads/cooperative.hh"
+#include <cstdio>
+
+using namespace vigil;
+
+class My_event
+    : public Event
+{
+public:
+    My_event(const Event_name& name, int seq_) : Event(name), seq(seq_) { }
+    int seq;
+};
+
+static Disposition
+handle_my_event(const Event& e_)
+{
+    const My_event& e = assert_cast<const My_event&>(e_);
+    printf("%s %d\n", e.get_name().c_str(), e.seq);
+    return CONTINUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    Event_dispatcher dispatcher;
+    dispatcher.add_handler("Control", handle_my_event, 0);
+    dispatcher.add_handler("Packet", handle_my_event, 0);
+    dispatcher.set_event_class("Packet", Event_dispatcher::PACKET_IN);
+    dispatcher.set_class_limits(Event_dispatcher::CONTROL, 2, 0);
+    dispatcher.set_class_limits(Event_dispatcher::PACKET_IN, 4, 10);
+
+    for (int i = 0; i < 12; i++) {
+        dispatcher.post(new My_event("Packet", i));
+        if (i % 4 == 3) {
+            dispatcher.post(new My_event("Control", i / 4));
+        }
+    }
+    while (dispatcher.poll()) {
+        printf("--\n");
+    }
+
+    Event_dispatcher::Stats stats = dispatcher.get_stats();
+    printf("dispatched=%d dropped=%d depth=%d\n",
+           int(stats.n_dispatched),
+           int(stats.classes[Event_dispatcher::PACKET_IN].n_dropped),
+           int(stats.depth));
+    return 0;
+}
@@ -0,0 +1,22 @@
+#! /bin/sh -e
+trap 'rm -f tmp$$' 0
+$SUPERVISOR ./test-event-dispatcher-priority > tmp$$
+diff -u - tmp$$ <<EOF
+Control 0
+Control 1
+Packet 0
+Packet 1
+Packet 2
+Packet 3
+--
+Control 2
+Packet 4
+Packet 5
+Packet 6
+Packet 7
+--
+Packet 8
+Packet 9
+--
+dispatched=13 dropped=2 depth=0
+EOF
@@ -0,0 +1,85 @@
+/* Copyright 2008 (C) Nicira, Inc..
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Tests that handlers registered while an event is being dispatched are called
+ * for later events but not for that one, and that events whose classes cache
+ * their type ids get the same ids as a lookup by name. */
+
+#include "event-dispatcher.hh"
+#include "assert.hh"
+#include "threads/cooperative.hh"
+#include <cstdio>
+
+using namespace vigil;
+
+class My_event
+    : public Event
+{
+public:
+    My_event(int seq_) : Event(static_get_name(), this), seq(seq_) { }
+    static const Event_name static_get_name() { return "My_event"; }
+    int seq;
+};
+
+static Event_dispatcher* dispatcher;
+
+static Disposition
+handle_later(const Event& e_)
+{
+    const My_event& e = assert_cast<const My_event&>(e_);
+    printf("later %d\n", e.seq);
+    return CONTINUE;
+}
+
+static Disposition
+handle_first(const Event& e_)
+{
+    const My_event& e = assert_cast<const My_event&>(e_);
+    printf("first %d\n", e.seq);
+    dispatcher->add_handler(My_event::static_get_name(), handle_later, 1);
+    return CONTINUE;
+}
+
+static Disposition
+handle_last(const Event& e_)
+{
+    const My_event& e = assert_cast<const My_event&>(e_);
+    printf("last %d\n", e.seq);
+    return CONTINUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    co_init();
+    co_thread_assimilate();
+    co_migrate(&co_group_coop);
+
+    Event_dispatcher my_dispatcher;
+    dispatcher = &my_dispatcher;
+    dispatcher->add_handler(My_event::static_get_name(), handle_first, 0);
+    dispatcher->add_handler(My_event::static_get_name(), handle_last, 2);
+    for (int i = 0; i < 3; i++) {
+        dispatcher->dispatch(My_event(i));
+    }
+
+    My_event e(3);
+    printf("ids %s\n",
+           (e.get_type_id() == Event::get_type_id(My_event::static_get_name())
+            ? "match" : "differ"));
+    return 0;
+}
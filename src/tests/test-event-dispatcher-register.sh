@@ -0,0 +1,15 @@
+#! /bin/sh -e
+trap 'rm -f tmp$$' 0
+$SUPERVISOR ./test-event-dispatcher-register > tmp$$
+diff -u - tmp$$ <<EOF
+first 0
+last 0
+first 1
+later 1
+last 1
+first 2
+later 2
+later 2
+last 2
+ids match
+EOF
@@ -0,0 +1,202 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Checks that Flow's fast-path parser takes the frames it should and agrees
+ * with the general parser on every frame, including mangled ones, and that
+ * Flow_key tells Flows apart. */
+
+#include "flow.hh"
+#include "buffer.hh"
+#include "netinet++/ip.hh"
+#include "packets.h"
+#include "vlog.hh"
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+using namespace vigil;
+
+/* Builds a frame: Ethernet, a VLAN tag if 'vlan_tci' is nonzero, and an
+ * IPv4 header of 'ihl' words for 'proto' followed by 20 bytes of L4 header
+ * with ports 1234 -> 80.  Returns its length. */
+static size_t
+make_frame(uint8_t* frame, uint16_t vlan_tci, int ihl, uint8_t proto,
+           uint16_t frag_off)
+{
+    size_t n = 0;
+    memcpy(frame, "\x00\x11\x22\x33\x44\x55\x00\x66\x77\x88\x99\xaa", 12);
+    n = 12;
+    if (vlan_tci) {
+        uint16_t vlan[2] = { htons(ETH_TYPE_VLAN), htons(vlan_tci) };
+        memcpy(frame + n, vlan, sizeof vlan);
+        n += sizeof vlan;
+    }
+    uint16_t type = htons(ETH_TYPE_IP);
+    memcpy(frame + n, &type, 2);
+    n += 2;
+
+    ip_header ip;
+    memset(&ip, 0, sizeof ip);
+    ip.ip_ihl_ver = IP_IHL_VER(ihl, 4);
+    ip.ip_tos = 0x10;
+    ip.ip_frag_off = htons(frag_off);
+    ip.ip_proto = proto;
+    ip.ip_src = htonl(0x0a000001);
+    ip.ip_dst = htonl(0x0a000002);
+    memcpy(frame + n, &ip, sizeof ip);
+    n += ihl * 4;
+
+    uint8_t l4[20];
+    memset(l4, 0, sizeof l4);
+    l4[0] = 1234 >> 8;
+    l4[1] = 1234 & 0xff;
+    l4[3] = 80;
+    l4[12] = 5 << 4;            /* TCP data offset. */
+    memcpy(frame + n, l4, sizeof l4);
+    return n + sizeof l4;
+}
+
+/* Parses the first 'size' bytes of 'frame' with the general parser and with
+ * the constructor and checks that they agree.  Returns whether the fast path
+ * took it. */
+static bool
+check_frame(const uint8_t* frame, size_t size)
+{
+    Nonowning_buffer buffer(frame, size);
+
+    Flow general;
+    general.in_port = htons(3);
+    general.parse(buffer);
+
+    Flow fast;
+    fast.in_port = htons(3);
+    bool took = fast.parse_fast(buffer);
+
+    Flow flow(htons(3), buffer);
+    MUST_SUCCEED(flow == general);
+    MUST_SUCCEED(flow.invalid == general.invalid);
+    if (took) {
+        MUST_SUCCEED(fast == general);
+        MUST_SUCCEED(!general.invalid);
+    }
+    return took;
+}
+
+int
+main(void)
+{
+    uint8_t frame[128];
+    size_t n;
+
+    /* Keep the general parser's complaints about mangled frames quiet. */
+    vlog().set_levels(Vlog::ANY_FACILITY, vlog().get_module_val("flow"),
+                      Vlog::LEVEL_EMER);
+
+    /* Plain and VLAN-tagged TCP, UDP and ICMP go the fast way. */
+    n = make_frame(frame, 0, 5, ip_::proto::TCP, 0);
+    MUST_SUCCEED(check_frame(frame, n));
+    Flow tcp(htons(3), Nonowning_buffer(frame, n));
+    MUST_SUCCEED(tcp.dl_vlan == htons(OFP_VLAN_NONE));
+    MUST_SUCCEED(tcp.nw_src == htonl(0x0a000001));
+    MUST_SUCCEED(tcp.nw_tos == 0x10);
+    MUST_SUCCEED(tcp.tp_src == htons(1234) && tcp.tp_dst == htons(80));
+
+    n = make_frame(frame, 0x6123, 5, ip_::proto::UDP, 0);
+    MUST_SUCCEED(check_frame(frame, n));
+    Flow udp(htons(3), Nonowning_buffer(frame, n));
+    MUST_SUCCEED(udp.dl_vlan == htons(0x123) && udp.dl_vlan_pcp == 3);
+    MUST_SUCCEED(udp.tp_dst == htons(80));
+
+    n = make_frame(frame, 0, 5, ip_::proto::ICMP, 0);
+    MUST_SUCCEED(check_frame(frame, n));
+
+    /* So do IP options, fragments and other protocols. */
+    n = make_frame(frame, 0, 7, ip_::proto::TCP, 0);
+    MUST_SUCCEED(check_frame(frame, n));
+    n = make_frame(frame, 0, 5, ip_::proto::TCP, 100);
+    MUST_SUCCEED(check_frame(frame, n));
+    n = make_frame(frame, 0, 5, 47, 0);
+    MUST_SUCCEED(check_frame(frame, n));
+
+    /* Truncated headers, ARP and 802.2 are left to the general parser. */
+    n = make_frame(frame, 0, 5, ip_::proto::TCP, 0);
+    MUST_SUCCEED(!check_frame(frame, n - 1));
+    frame[ETH_HEADER_LEN + IP_HEADER_LEN + 12] = 6 << 4;
+    MUST_SUCCEED(!check_frame(frame, n));
+    n = make_frame(frame, 0, 4, ip_::proto::UDP, 0);
+    MUST_SUCCEED(!check_frame(frame, n));
+    n = make_frame(frame, 0, 5, ip_::proto::UDP, 0);
+    frame[12] = ETH_TYPE_ARP >> 8;
+    frame[13] = ETH_TYPE_ARP & 0xff;
+    MUST_SUCCEED(!check_frame(frame, n));
+    frame[12] = 0;
+    frame[13] = 64;
+    MUST_SUCCEED(!check_frame(frame, n));
+    MUST_SUCCEED(!check_frame(frame, 10));
+
+    /* Flows have equal keys exactly when they are equal. */
+    {
+        n = make_frame(frame, 0x6123, 5, ip_::proto::UDP, 0);
+        const Flow flow(htons(3), Nonowning_buffer(frame, n));
+        MUST_SUCCEED(Flow_key(flow) == Flow_key(Flow(flow)));
+        MUST_SUCCEED(Flow_key(flow).hash() == Flow_key(Flow(flow)).hash());
+        MUST_SUCCEED(Flow_key(Flow()) == Flow_key());
+
+        Flow other[12];
+        for (int i = 0; i < 12; i++) {
+            other[i] = flow;
+        }
+        other[0].in_port++;
+        other[1].dl_vlan++;
+        other[2].dl_vlan_pcp++;
+        other[3].dl_src.octet[5]++;
+        other[4].dl_dst.octet[0]++;
+        other[5].dl_type++;
+        other[6].nw_src++;
+        other[7].nw_dst++;
+        other[8].nw_proto++;
+        other[9].nw_tos++;
+        other[10].tp_src++;
+        other[11].tp_dst++;
+        for (int i = 0; i < 12; i++) {
+            MUST_SUCCEED(other[i] != flow);
+            MUST_SUCCEED(Flow_key(other[i]) != Flow_key(flow));
+            MUST_SUCCEED(Flow_key(other[i]).hash() != Flow_key(flow).hash());
+        }
+    }
+
+    /* Both parsers agree on randomly mangled and truncated frames. */
+    srand(1);
+    for (int i = 0; i < 100000; i++) {
+        n = make_frame(frame, rand() % 2 ? rand() & 0xffff : 0,
+                       5 + rand() % 3, rand() % 2 ? 6 : 17, 0);
+        for (int j = rand() % 4; j > 0; j--) {
+            frame[rand() % n] = rand();
+        }
+        check_frame(frame, rand() % (n + 1));
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Checks that Link_weigher smooths loads, changes weights only when the
+ * smoothed load crosses a threshold, and waits for it to drop well below a
+ * threshold before lowering a weight again, even after the thresholds
+ * change. */
+
+#include "link-weigher.hh"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+using namespace vigil;
+
+int
+main(void)
+{
+    Link_weigher weigher;
+    Link_weigher::Load load;
+    MUST_SUCCEED(weigher.weight(load) == 1);
+
+    /* Unknown loads are ignored, and the first sample is taken as is. */
+    MUST_SUCCEED(!weigher.sample(load, -1));
+    MUST_SUCCEED(!load.sampled);
+    MUST_SUCCEED(!weigher.sample(load, 0.4));
+    MUST_SUCCEED(load.value == 0.4 && weigher.weight(load) == 1);
+
+    /* Smoothing halves the distance to each sample, so a burst takes two
+     * samples to cross 0.5. */
+    MUST_SUCCEED(!weigher.sample(load, 0.58));
+    MUST_SUCCEED(load.value > 0.48 && load.value < 0.5);
+    MUST_SUCCEED(weigher.sample(load, 0.58));
+    MUST_SUCCEED(weigher.weight(load) == 2);
+
+    /* A load hovering just under the threshold keeps the weight... */
+    MUST_SUCCEED(!weigher.sample(load, 0.47));
+    MUST_SUCCEED(!weigher.sample(load, 0.47));
+    MUST_SUCCEED(weigher.weight(load) == 2);
+
+    /* ...until it is 'hysteresis' below it. */
+    MUST_SUCCEED(!weigher.sample(load, 0.45));
+    MUST_SUCCEED(weigher.sample(load, 0.2));
+    MUST_SUCCEED(weigher.weight(load) == 1);
+
+    /* A saturated link jumps straight to the top level, and an idle one all
+     * the way back. */
+    Link_weigher::Load busy;
+    MUST_SUCCEED(weigher.sample(busy, 1.0));
+    MUST_SUCCEED(weigher.weight(busy) == 8);
+    Link_weigher fast;
+    fast.set_alpha(1.0);
+    MUST_SUCCEED(fast.sample(busy, 0.0));
+    MUST_SUCCEED(fast.weight(busy) == 1);
+
+    /* Thresholds must increase, and not give more than MAX_LEVELS levels. */
+    std::vector<double> thresholds;
+    thresholds.push_back(0.3);
+    thresholds.push_back(0.2);
+    MUST_SUCCEED(!fast.set_thresholds(thresholds));
+    thresholds.assign(Link_weigher::MAX_LEVELS, 0);
+    for (size_t i = 0; i < thresholds.size(); i++) {
+        thresholds[i] = (i + 1) * 0.1;
+    }
+    MUST_SUCCEED(!fast.set_thresholds(thresholds));
+    thresholds.pop_back();
+    MUST_SUCCEED(fast.set_thresholds(thresholds));
+    MUST_SUCCEED(fast.sample(busy, 0.75));
+    MUST_SUCCEED(fast.weight(busy) == 1 << 7);
+
+    /* With fewer thresholds, the next sample moves a load above the new top
+     * level down to it. */
+    thresholds.resize(2);
+    MUST_SUCCEED(fast.set_thresholds(thresholds));
+    MUST_SUCCEED(fast.sample(busy, 0.75));
+    MUST_SUCCEED(fast.weight(busy) == 4);
+    MUST_SUCCEED(!fast.sample(busy, 0.75));
+    return 0;
+}
@@ -0,0 +1,302 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Checks that Packet_classifier dispatches packet-ins to the actions of the
+ * highest-priority matching rules, and that it does so without allocating
+ * memory once it has classified a packet, with each way of looking them up
+ * and with its flow cache.  Checks that the flow cache notices changes to
+ * the rules and evicts old flows when it fills up, that actions may classify
+ * other packet-ins, and that classifying flows in a batch finds the same
+ * rules. */
+
+#include "packet-classifier.hh"
+#include "packet-in.hh"
+#include <boost/bind.hpp>
+#include <cstdlib>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+using namespace vigil;
+
+static unsigned long n_allocs;
+
+/* The replacements below count every allocation, whichever form of new makes
+ * it.  They get and release memory only through these two helpers, which are
+ * kept out of line so that the compiler does not see free() called on memory
+ * from operator new and warn about it. */
+
+static void* __attribute__ ((__noinline__))
+raw_alloc(size_t size)
+{
+    n_allocs++;
+    return std::malloc(size ? size : 1);
+}
+
+static void __attribute__ ((__noinline__))
+raw_free(void *p)
+{
+    std::free(p);
+}
+
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#else
+#define THROWS_BAD_ALLOC throw (std::bad_alloc)
+#define THROWS_NOTHING throw ()
+#endif
+
+void*
+operator new(size_t size) THROWS_BAD_ALLOC
+{
+    void *p = raw_alloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void*
+operator new[](size_t size) THROWS_BAD_ALLOC
+{
+    return operator new(size);
+}
+
+void*
+operator new(size_t size, const std::nothrow_t&) THROWS_NOTHING
+{
+    return raw_alloc(size);
+}
+
+void*
+operator new[](size_t size, const std::nothrow_t&) THROWS_NOTHING
+{
+    return raw_alloc(size);
+}
+
+void
+operator delete(void *p) THROWS_NOTHING
+{
+    raw_free(p);
+}
+
+void
+operator delete[](void *p) THROWS_NOTHING
+{
+    raw_free(p);
+}
+
+void
+operator delete(void *p, const std::nothrow_t&) THROWS_NOTHING
+{
+    raw_free(p);
+}
+
+void
+operator delete[](void *p, const std::nothrow_t&) THROWS_NOTHING
+{
+    raw_free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void
+operator delete(void *p, size_t) THROWS_NOTHING
+{
+    raw_free(p);
+}
+
+void
+operator delete[](void *p, size_t) THROWS_NOTHING
+{
+    raw_free(p);
+}
+#endif
+
+/* An Ethernet frame holding a TCP SYN from 10.0.0.1:1024 to 10.0.0.2:80. */
+static const uint8_t tcp_frame[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x08, 0x00,
+    0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+    0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+    0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x50, 0x02, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00
+};
+
+static const int TP_DST_OFFSET = 36;
+
+static Packet_in_event*
+make_packet_in(uint16_t tp_dst)
+{
+    boost::shared_ptr<Buffer> buf(new Array_buffer(sizeof tcp_frame));
+    memcpy(buf->data(), tcp_frame, sizeof tcp_frame);
+    buf->data()[TP_DST_OFFSET] = tp_dst >> 8;
+    buf->data()[TP_DST_OFFSET + 1] = tp_dst;
+    return new Packet_in_event(datapathid::from_host(1), 1, buf,
+                               sizeof tcp_frame, 0, OFPR_NO_MATCH);
+}
+
+static void
+count(int *counter, const Event&)
+{
+    ++*counter;
+}
+
+/* Counts the packet-in, then classifies 'other' while the caller is still
+ * running the actions for the packet-in. */
+static void
+count_and_reenter(int *counter, Packet_classifier* classifier,
+                  const Packet_in_event* other, const Event&)
+{
+    ++*counter;
+    classifier->handle_packet_in(*other);
+}
+
+int
+main(void)
+{
+    Packet_classifier classifier;
+    int n_http = 0, n_ip = 0, n_arp = 0, n_ssh = 0, n_port = 0;
+
+    uint32_t value[Packet_expr::MAX_FIELD_LEN] = { 0, 0 };
+    Packet_expr http, ip, arp;
+    value[0] = htons(80);
+    http.set_field(Packet_expr::TP_DST, value);
+    value[0] = htons(0x0800);
+    ip.set_field(Packet_expr::DL_TYPE, value);
+    value[0] = htons(0x0806);
+    arp.set_field(Packet_expr::DL_TYPE, value);
+    uint32_t http_id = classifier.add_rule(5, http,
+                                           boost::bind(count, &n_http, _1));
+    uint32_t ip_id = classifier.add_rule(10, ip,
+                                         boost::bind(count, &n_ip, _1));
+    classifier.add_rule(1, arp, boost::bind(count, &n_arp, _1));
+
+    std::auto_ptr<Packet_in_event> web(make_packet_in(80));
+    std::auto_ptr<Packet_in_event> ssh(make_packet_in(22));
+
+    classifier.set_flow_cache_size(0);
+    for (int mode = 0; mode < 4; mode++) {
+        if (mode == 1) {
+            classifier.set_compiled(false);
+        } else if (mode == 2) {
+            classifier.set_backend(Packet_classifier::TUPLE_SPACE);
+        } else if (mode == 3) {
+            classifier.set_flow_cache_size(16);
+        }
+
+        /* The first lookups build whatever the classifier needs. */
+        classifier.handle_packet_in(*web);
+        classifier.handle_packet_in(*ssh);
+
+        n_http = n_ip = 0;
+        unsigned long before = n_allocs;
+        for (int i = 0; i < 1000; i++) {
+            classifier.handle_packet_in(*web);
+            classifier.handle_packet_in(*ssh);
+        }
+        MUST_SUCCEED(n_allocs == before);
+        MUST_SUCCEED(n_http == 1000);
+        MUST_SUCCEED(n_ip == 1000);
+        MUST_SUCCEED(n_arp == 0);
+    }
+
+    const Flow_cache_stats& stats = classifier.get_flow_cache_stats();
+    MUST_SUCCEED(stats.hits == 2000);
+    MUST_SUCCEED(stats.misses == 2);
+
+    /* A new rule takes effect even for flows in the cache. */
+    value[0] = htons(22);
+    Packet_expr ssh_rule;
+    ssh_rule.set_field(Packet_expr::TP_DST, value);
+    uint32_t ssh_id = classifier.add_rule(2, ssh_rule,
+                                          boost::bind(count, &n_ssh, _1));
+    n_ip = 0;
+    classifier.handle_packet_in(*ssh);
+    MUST_SUCCEED(n_ssh == 1 && n_ip == 0);
+    MUST_SUCCEED(stats.stale == 1);
+
+    /* With room for one flow, each flow evicts the other. */
+    classifier.set_flow_cache_size(1);
+    n_http = n_ssh = 0;
+    uint64_t evictions = stats.evictions;
+    for (int i = 0; i < 10; i++) {
+        classifier.handle_packet_in(*web);
+        classifier.handle_packet_in(*ssh);
+    }
+    MUST_SUCCEED(n_http == 10 && n_ssh == 10);
+    MUST_SUCCEED(stats.evictions == evictions + 19);
+
+    /* Rules on the arrival port match it in network byte order, as the
+     * Python API sets it. */
+    value[0] = htons(1);
+    Packet_expr port_rule;
+    port_rule.set_field(Packet_expr::AP_SRC, value);
+    uint32_t port_id = classifier.add_rule(0, port_rule,
+                                           boost::bind(count, &n_port, _1));
+    classifier.handle_packet_in(*web);
+    MUST_SUCCEED(n_port == 1);
+    classifier.delete_rule(port_id);
+
+    /* Actions that classify other packet-ins, evicting the flow whose actions
+     * are running from the cache, do not disturb the rest of them. */
+    int n_reentered = 0;
+    uint32_t reenter_ids[2];
+    for (int i = 0; i < 2; i++) {
+        reenter_ids[i] = classifier.add_rule(
+            5, http, boost::bind(count_and_reenter, &n_reentered, &classifier,
+                                 ssh.get(), _1));
+    }
+    n_http = n_ssh = 0;
+    classifier.handle_packet_in(*web);
+    MUST_SUCCEED(n_http == 1 && n_reentered == 2 && n_ssh == 2);
+    for (int i = 0; i < 2; i++) {
+        classifier.delete_rule(reenter_ids[i]);
+    }
+
+    /* A batch finds each flow's rules, whether it is in the cache or not,
+     * and whether it appears in the batch once or more. */
+    std::auto_ptr<Packet_in_event> https(make_packet_in(443));
+    const Flow* flows[] = { &web->flow, &ssh->flow, &https->flow, &web->flow };
+    const uint32_t expected[] = { http_id, ssh_id, ip_id, http_id };
+    Packet_classifier::Match_set sets[4];
+    Packet_classifier::Match_set* set_ptrs[] = {
+        &sets[0], &sets[1], &sets[2], &sets[3]
+    };
+    classifier.set_backend(Packet_classifier::CNODE_TREE);
+    classifier.set_compiled(true);
+    classifier.set_flow_cache_size(2);
+    for (int round = 0; round < 3; round++) {
+        unsigned long before = n_allocs;
+        classifier.classify(flows, set_ptrs, 4);
+        MUST_SUCCEED(round == 0 || n_allocs == before);
+        for (int i = 0; i < 4; i++) {
+            MUST_SUCCEED(sets[i].size() == 1);
+            MUST_SUCCEED(sets[i][0]->id == expected[i]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* Copyright 2010 (C) Stanford University.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "packet-in-limiter.hh"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+using namespace vigil;
+
+int
+main (void)
+{
+    /* A bucket admits its burst at once, then refills at its rate. */
+    {
+        Token_bucket bucket(10, 5);
+        long long int now = 1000;
+        for (int i = 0; i < 5; i++) {
+            MUST_SUCCEED(bucket.consume(now));
+        }
+        MUST_SUCCEED(!bucket.consume(now));
+        MUST_SUCCEED(!bucket.consume(now + 99));
+        MUST_SUCCEED(bucket.consume(now + 100));
+        MUST_SUCCEED(!bucket.consume(now + 100));
+
+        /* It never holds more than its burst. */
+        now += 60000;
+        for (int i = 0; i < 5; i++) {
+            MUST_SUCCEED(bucket.consume(now));
+        }
+        MUST_SUCCEED(!bucket.consume(now));
+    }
+
+    /* Without limits, everything is admitted. */
+    {
+        Packet_in_limiter limiter((Packet_in_limits()));
+        for (int i = 0; i < 1000; i++) {
+            MUST_SUCCEED(limiter.admit(1, 0) == Packet_in_limiter::ADMIT);
+        }
+        MUST_SUCCEED(limiter.get_stats().admitted == 1000);
+    }
+
+    /* A port over its limit does not use up the datapath's budget, and
+     * triggers one drop flow per drop_flow_secs. */
+    {
+        Packet_in_limits limits;
+        limits.rate = 100;
+        limits.port_rate = 10;
+        limits.drop_flow_secs = 5;
+        Packet_in_limiter limiter(limits);
+
+        int verdicts[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 50; i++) {
+            verdicts[limiter.admit(1, 0)]++;
+        }
+        MUST_SUCCEED(verdicts[Packet_in_limiter::ADMIT] == 10);
+        MUST_SUCCEED(verdicts[Packet_in_limiter::DROP_AND_BLOCK] == 1);
+        MUST_SUCCEED(verdicts[Packet_in_limiter::DROP] == 39);
+        for (int i = 0; i < 10; i++) {
+            MUST_SUCCEED(limiter.admit(2, 0) == Packet_in_limiter::ADMIT);
+        }
+
+        /* No new drop flow until the first one expires. */
+        Packet_in_limiter::Verdict v;
+        while ((v = limiter.admit(1, 4000)) == Packet_in_limiter::ADMIT) {
+            continue;
+        }
+        MUST_SUCCEED(v == Packet_in_limiter::DROP);
+        while ((v = limiter.admit(1, 5000)) == Packet_in_limiter::ADMIT) {
+            continue;
+        }
+        MUST_SUCCEED(v == Packet_in_limiter::DROP_AND_BLOCK);
+        MUST_SUCCEED(limiter.get_stats().drop_flows == 2);
+    }
+
+    /* A packet-in over the datapath's limit does not use up its port's
+     * budget either. */
+    {
+        Packet_in_limits limits;
+        limits.rate = 1;
+        limits.burst = 1;
+        limits.port_rate = 1;
+        limits.port_burst = 1;
+        limits.drop_flow_secs = 5;
+        Packet_in_limiter limiter(limits);
+
+        MUST_SUCCEED(limiter.admit(1, 0) == Packet_in_limiter::ADMIT);
+        for (int i = 0; i < 5; i++) {
+            MUST_SUCCEED(limiter.admit(2, 0) == Packet_in_limiter::DROP);
+        }
+        MUST_SUCCEED(limiter.get_stats().drop_flows == 0);
+    }
+
+    /* Sampling admits 1 of every N excess packet-ins. */
+    {
+        Packet_in_limits limits;
+        limits.rate = 1;
+        limits.sample = 4;
+        Packet_in_limiter limiter(limits);
+        for (int i = 0; i < 41; i++) {
+            limiter.admit(1, 0);
+        }
+        const Packet_in_stats& stats = limiter.get_stats();
+        MUST_SUCCEED(stats.admitted == 1);
+        MUST_SUCCEED(stats.sampled == 10);
+        MUST_SUCCEED(stats.dropped == 30);
+        MUST_SUCCEED(stats.drop_flows == 0);
+    }
+
+    return 0;
+}
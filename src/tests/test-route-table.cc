@@ -0,0 +1,384 @@
+/* Copyright 2008 (C) Nicira, Inc.
+ *
+ * This file is part of NOX.
+ *
+ * NOX is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * NOX is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with NOX.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Checks Route_table's paths against a brute-force search of the same
+ * links, on random topologies changed a link at a time and in batches, with
+ * and without link weights, and checks that updating in steps gives the same
+ * paths and leaves copies alone. */
+
+#include "route-table.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#define MUST_SUCCEED(EXPRESSION)                    \
+    if (!(EXPRESSION)) {                            \
+        fprintf(stderr, "%s:%d: %s failed\n",       \
+                __FILE__, __LINE__, #EXPRESSION);   \
+        exit(EXIT_FAILURE);                         \
+    }
+
+using namespace vigil;
+
+struct Test_link {
+    int src, dst;
+    uint16_t outport, inport;
+    int weight;
+};
+
+static const int MAX_SWITCHES = 40;
+
+static datapathid
+dp(int i)
+{
+    return datapathid::from_host(0x1000 + i);
+}
+
+/* Orders links by the cost of the paths to their sources in 'costs'. */
+struct Source_cost_less {
+    const std::vector<Test_link>& links;
+    const std::vector<int>& costs;
+
+    bool operator()(int a, int b) const {
+        return costs[links[a].src] < costs[links[b].src];
+    }
+};
+
+/* Sets 'costs[i]' to the cost of the shortest path from 'src' to switch i
+ * over 'links', or -1 if there is no path, and 'n_paths[i]' to the number of
+ * shortest paths. */
+static void
+distances(const std::vector<Test_link>& links, int src,
+          std::vector<int>& costs, std::vector<double>& n_paths)
+{
+    costs.assign(MAX_SWITCHES, -1);
+    costs[src] = 0;
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (size_t i = 0; i < links.size(); i++) {
+            const Test_link& link = links[i];
+            int via = costs[link.src] + link.weight;
+            if (costs[link.src] >= 0
+                && (costs[link.dst] < 0 || via < costs[link.dst])) {
+                costs[link.dst] = via;
+                changed = true;
+            }
+        }
+    }
+
+    /* A switch's paths are all counted once the links from every switch
+     * that costs less to reach have been. */
+    std::vector<int> order;
+    for (size_t i = 0; i < links.size(); i++) {
+        if (costs[links[i].src] >= 0) {
+            order.push_back(i);
+        }
+    }
+    Source_cost_less less = { links, costs };
+    std::sort(order.begin(), order.end(), less);
+    n_paths.assign(MAX_SWITCHES, 0);
+    n_paths[src] = 1;
+    for (size_t i = 0; i < order.size(); i++) {
+        const Test_link& link = links[order[i]];
+        if (costs[link.src] + link.weight == costs[link.dst]) {
+            n_paths[link.dst] += n_paths[link.src];
+        }
+    }
+}
+
+/* Links by source switch. */
+typedef std::vector<std::vector<Test_link> > Out_links;
+
+/* Returns the weight of the lightest of 'out[src]' that 'hop' from 'src'
+ * could be, or -1 if there is none. */
+static int
+link_weight(const Out_links& out, int src, const Route_table::Hop& hop)
+{
+    const std::vector<Test_link>& links = out[src];
+    int weight = -1;
+    for (size_t i = 0; i < links.size(); i++) {
+        if (dp(links[i].dst) == hop.dst
+            && links[i].outport == hop.outport
+            && links[i].inport == hop.inport
+            && (weight < 0 || links[i].weight < weight)) {
+            weight = links[i].weight;
+        }
+    }
+    return weight;
+}
+
+static int
+index(const datapathid& dpid)
+{
+    return dpid.as_host() - 0x1000;
+}
+
+/* Checks that 'path' is made of the links in 'out' and leads from 's' to 'd'
+ * at a cost of 'cost'. */
+static void
+check_path(const std::vector<Route_table::Hop>& path, const Out_links& out,
+           int s, int d, int cost)
+{
+    int u = s;
+    for (size_t i = 0; i < path.size(); i++) {
+        int weight = link_weight(out, u, path[i]);
+        MUST_SUCCEED(weight > 0);
+        cost -= weight;
+        u = index(path[i].dst);
+    }
+    MUST_SUCCEED(u == d && cost == 0);
+}
+
+/* Checks that 'dag' holds 'n_paths' paths made of the links in 'out' from
+ * 's' to 'd', each costing 'cost'. */
+static void
+check_dag(const Route_table::Dag& dag, const Out_links& out, int s, int d,
+          int cost, double n_paths)
+{
+    size_t n = dag.dps.size();
+    MUST_SUCCEED(n > 0 && dag.offsets.size() == n + 1);
+    MUST_SUCCEED(index(dag.dps[0]) == s && index(dag.dps[n - 1]) == d);
+    MUST_SUCCEED(dag.offsets[n] == dag.links.size());
+
+    /* Counts the paths from the source to each switch, which come after
+     * all the switches that lead to them. */
+    std::vector<double> n_dag_paths(n, 0);
+    std::vector<int> costs(n, -1);
+    n_dag_paths[0] = 1;
+    costs[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (uint32_t j = dag.offsets[i]; j < dag.offsets[i + 1]; j++) {
+            const Route_table::Dag::Link& link = dag.links[j];
+            MUST_SUCCEED(link.next > i && link.next < n);
+            MUST_SUCCEED(link.hop.dst == dag.dps[link.next]);
+            int weight = link_weight(out, index(dag.dps[i]), link.hop);
+            MUST_SUCCEED(weight > 0);
+            MUST_SUCCEED(costs[link.next] < 0
+                         || costs[link.next] == costs[i] + weight);
+            costs[link.next] = costs[i] + weight;
+            n_dag_paths[link.next] += n_dag_paths[i];
+        }
+    }
+    MUST_SUCCEED(costs[n - 1] == cost);
+    MUST_SUCCEED(n_dag_paths[n - 1] == n_paths);
+}
+
+/* Checks that 'table' has the shortest paths made of 'links' between every
+ * pair of the first 'n' switches. */
+static void
+check_routes(const Route_table& table, const std::vector<Test_link>& links,
+             int n)
+{
+    std::vector<Route_table::Hop> path;
+    Route_table::Dag dag;
+    std::vector<int> costs;
+    std::vector<double> n_paths;
+    Out_links out(MAX_SWITCHES);
+    for (size_t i = 0; i < links.size(); i++) {
+        out[links[i].src].push_back(links[i]);
+    }
+    for (int s = 0; s < n; s++) {
+        distances(links, s, costs, n_paths);
+        for (int d = 0; d < n; d++) {
+            int cost = costs[d];
+            bool found = table.get_route(dp(s), dp(d), path);
+            MUST_SUCCEED(found == (cost >= 0));
+            MUST_SUCCEED(table.get_routes(dp(s), dp(d), dag) == found);
+            if (!found) {
+                continue;
+            }
+            check_path(path, out, s, d, cost);
+            check_dag(dag, out, s, d, cost, n_paths[d]);
+            MUST_SUCCEED(table.get_route(dp(s), dp(d), s * 12345 + d, path));
+            check_path(path, out, s, d, cost);
+        }
+    }
+}
+
+/* Updates 'table' in steps, searching the sources in reverse order with a
+ * queue each, as threads would. */
+static void
+update_in_steps(Route_table& table)
+{
+    std::vector<uint32_t> sources;
+    table.prepare_update(sources);
+    std::vector<std::vector<uint32_t> > queues(sources.size());
+    for (size_t i = sources.size(); i-- > 0; ) {
+        table.search(sources[i], queues[i]);
+    }
+    table.finish_update();
+}
+
+/* Returns the index in 'links' of the link with the same ports and switches
+ * as 'link', or -1 if there is none. */
+static int
+find_link(const std::vector<Test_link>& links, const Test_link& link)
+{
+    for (size_t i = 0; i < links.size(); i++) {
+        if (links[i].src == link.src && links[i].dst == link.dst
+            && links[i].outport == link.outport
+            && links[i].inport == link.inport) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Adds or removes random links, and if 'weighted' reweighs them, 'batch'
+ * changes per update(), checking the routes after each update(), in one go
+ * and in steps.
+ *
+ * Route_table tells links apart only by switches and ports, so with weights
+ * there is never more than one link with the same ones. */
+static void
+random_test(int batch, bool weighted)
+{
+    Route_table table, stepped;
+    std::vector<Test_link> links;
+    int n = 0;
+
+    for (int round = 0; round < 300; round++) {
+        std::vector<Test_link> old_links = links;
+        int old_n = n;
+        for (int i = 0; i < batch; i++) {
+            if (weighted && !links.empty() && !(rand() % 3)) {
+                Test_link& link = links[rand() % links.size()];
+                link.weight = 1 + rand() % 5;
+                table.set_weight(dp(link.src), link.outport,
+                                 dp(link.dst), link.inport, link.weight);
+                stepped.set_weight(dp(link.src), link.outport,
+                                   dp(link.dst), link.inport, link.weight);
+            } else if (links.empty() || rand() % 3) {
+                /* Mostly between switches seen so far, so that there are
+                 * parallel links and cycles, sometimes to a new one. */
+                Test_link link;
+                link.src = rand() % (n + 1);
+                link.dst = rand() % (n + 1);
+                link.outport = rand() % 4;
+                link.inport = rand() % 4;
+                link.weight = 1;
+                if (weighted && find_link(links, link) >= 0) {
+                    continue;
+                }
+                if (link.src == n || link.dst == n) {
+                    if (n == MAX_SWITCHES) {
+                        continue;
+                    }
+                    n++;
+                }
+                links.push_back(link);
+                table.add_link(dp(link.src), link.outport,
+                               dp(link.dst), link.inport);
+                stepped.add_link(dp(link.src), link.outport,
+                                 dp(link.dst), link.inport);
+            } else {
+                size_t j = rand() % links.size();
+                Test_link link = links[j];
+                links.erase(links.begin() + j);
+                table.remove_link(dp(link.src), link.outport,
+                                  dp(link.dst), link.inport);
+                stepped.remove_link(dp(link.src), link.outport,
+                                    dp(link.dst), link.inport);
+            }
+        }
+        table.update();
+        MUST_SUCCEED(!table.is_pending());
+        MUST_SUCCEED(table.n_links() == links.size());
+        check_routes(table, links, n);
+
+        Route_table copy(stepped);
+        update_in_steps(stepped);
+        check_routes(stepped, links, n);
+        check_routes(copy, old_links, old_n);
+    }
+}
+
+int
+main(void)
+{
+    Route_table table;
+    std::vector<Route_table::Hop> path;
+
+    /* Nothing is known before the first update(). */
+    MUST_SUCCEED(!table.get_route(dp(0), dp(0), path));
+    table.add_link(dp(0), 1, dp(1), 2);
+    MUST_SUCCEED(!table.get_route(dp(0), dp(1), path));
+    table.update();
+    MUST_SUCCEED(table.get_route(dp(0), dp(1), path));
+    MUST_SUCCEED(path.size() == 1 && path[0].dst == dp(1));
+    MUST_SUCCEED(path[0].outport == 1 && path[0].inport == 2);
+    MUST_SUCCEED(table.get_route(dp(1), dp(1), path) && path.empty());
+    MUST_SUCCEED(!table.get_route(dp(1), dp(0), path));
+    MUST_SUCCEED(!table.get_route(dp(0), dp(2), path));
+
+    /* Removing an unknown link or switch changes nothing. */
+    table.remove_link(dp(0), 3, dp(1), 2);
+    table.remove_link(dp(5), 1, dp(1), 2);
+    table.update();
+    MUST_SUCCEED(table.get_route(dp(0), dp(1), path) && path.size() == 1);
+
+    /* Hashes spread over both sides of a diamond, and over parallel links. */
+    {
+        Route_table diamond;
+        diamond.add_link(dp(0), 1, dp(1), 1);
+        diamond.add_link(dp(0), 2, dp(2), 1);
+        diamond.add_link(dp(1), 2, dp(3), 1);
+        diamond.add_link(dp(2), 2, dp(3), 2);
+        diamond.add_link(dp(2), 3, dp(3), 3);
+        diamond.update();
+        int n_used[3] = { 0, 0, 0 };
+        for (uint64_t hash = 0; hash < 300; hash++) {
+            MUST_SUCCEED(diamond.get_route(dp(0), dp(3),
+                                           hash * 0x123456789ULL, path));
+            MUST_SUCCEED(path.size() == 2);
+            n_used[path[1].inport - 1]++;
+        }
+        MUST_SUCCEED(n_used[0] > 100 && n_used[1] > 30 && n_used[2] > 30);
+    }
+
+    /* A heavy link is avoided until it gets lighter again. */
+    {
+        Route_table triangle;
+        triangle.add_link(dp(0), 1, dp(1), 1);
+        triangle.add_link(dp(0), 2, dp(2), 1);
+        triangle.add_link(dp(2), 2, dp(1), 2);
+        triangle.update();
+        MUST_SUCCEED(triangle.get_route(dp(0), dp(1), path)
+                     && path.size() == 1);
+        triangle.set_weight(dp(0), 1, dp(1), 1, 3);
+        triangle.update();
+        MUST_SUCCEED(triangle.get_route(dp(0), dp(1), path)
+                     && path.size() == 2 && path[0].dst == dp(2));
+        triangle.set_weight(dp(0), 1, dp(1), 1, 2);
+        triangle.update();
+        Route_table::Dag dag;
+        MUST_SUCCEED(triangle.get_routes(dp(0), dp(1), dag)
+                     && dag.links.size() == 3);
+        triangle.set_weight(dp(0), 1, dp(1), 1, 1);
+        triangle.update();
+        MUST_SUCCEED(triangle.get_route(dp(0), dp(1), path)
+                     && path.size() == 1);
+    }
+
+    srand(1);
+    random_test(1, false);
+    random_test(8, false);
+    random_test(1, true);
+    random_test(8, true);
+    return 0;
+}